@@ -0,0 +1,176 @@
+#pragma once
+
+#include "3rd/json.hpp"
+#include "common/rtsp_ctx.h"
+#include "core/buffer_pool.h"
+#include "core/multicast_hub.h"
+#include "protocol/hls_segmenter.h"
+#include "protocol/pipeline_profile.h"
+#include "protocol/rtp_pipeline.h"
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <netinet/in.h>
+
+class EpollLoop;
+class SocketCtx;
+class RtspUpstream;
+
+/**
+ * HlsOutput serves channels as HLS (and LL-HLS with hls_part_ms set) from
+ * memory, so browsers and mobile players can watch them and HTTP caches can
+ * share the load.
+ *
+ * A channel is set up by the first request for it: one RtspUpstream (or a
+ * MulticastHub subscription for a multicast path) feeds its RtpPipeline and
+ * an HlsSegmenter, and every viewer is served from that one set of
+ * segments. A lost or stalled upstream is reconnected with backoff and the
+ * next segment is marked as a discontinuity. A channel nobody has asked
+ * for in CHANNEL_IDLE is closed.
+ *
+ * Each channel keeps a segmenter per format that has been asked for: TS
+ * (index.m3u8) and CMAF fMP4 (cmaf.m3u8), the latter also served as one
+ * progressive fMP4 response (live.mp4) for MSE players, which gets every
+ * fragment as soon as it is complete.
+ *
+ * Answers that cannot go out right away are held here: the first playlist
+ * request of a new channel waits for its first segment, LL-HLS blocking
+ * playlist reloads (_HLS_msn/_HLS_part) and preload hints wait for their
+ * part, and bodies that do not fit into the socket buffer are sent as it
+ * drains. A keep-alive connection then goes back to MasterHandle.
+ */
+class HlsOutput
+{
+public:
+    struct Source
+    {
+        std::string key;        // channel path, e.g. /rtp/10.0.0.1:554/cctv1 or /udp/239.1.1.1:5000
+        bool multicast{false};
+        MulticastHub::Group group;
+        rtspCtx ctx;
+        PipelineProfile profile;
+    };
+
+    struct Request
+    {
+        enum class Kind
+        {
+            PLAYLIST,
+            SEGMENT,
+            PART,
+            INIT,  // FMP4 init segment, seq is its id
+            STREAM // progressive FMP4
+        };
+
+        Kind kind{Kind::PLAYLIST};
+        HlsSegmenter::Format format{HlsSegmenter::Format::TS};
+        uint64_t seq{0};
+        int part{-1};          // PART: part index; PLAYLIST: _HLS_part, -1 if none; STREAM: next to send
+        bool block{false};     // PLAYLIST: _HLS_msn given, wait for seq/part
+        std::string query;     // appended to the URIs of a playlist
+    };
+
+    static HlsOutput &getInstance();
+
+    void attach(EpollLoop *loop, BufferPool *pool);
+
+    // Answers a request for 'source', setting the channel up if needed.
+    // Returns true if the connection was taken over; otherwise the answer
+    // has been sent and keep_alive says whether the connection can be reused.
+    bool serve(int fd, const sockaddr_in &addr, const Source &source, const Request &req, bool &keep_alive);
+
+    nlohmann::json get_info() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr int TICK_INTERVAL_MS = 250;
+    static constexpr int RETRY_BACKOFF_MS = 1000;
+    static constexpr int RETRY_BACKOFF_MAX_MS = 30000;
+    static constexpr int DEFAULT_STALL_MS = 5000;
+    static constexpr std::chrono::seconds CHANNEL_IDLE{30};
+    static constexpr std::chrono::seconds START_TIMEOUT{15}; // first playlist of a new channel
+    static constexpr std::chrono::seconds SEND_TIMEOUT{30};
+    static constexpr std::chrono::seconds STREAM_WAIT{30};   // a progressive response without new fragments ends
+    static constexpr size_t MAX_IOV = 64;
+
+    struct Channel
+    {
+        Source source;
+        std::unique_ptr<HlsSegmenter> segmenters[2]; // by Format, created when first asked for
+        std::unique_ptr<RtpPipeline> pipeline;
+        std::unique_ptr<RtspUpstream> upstream;
+        uint64_t subscription{0};
+        bool played{false};   // the upstream has been playing before
+        bool wake_pending{false};
+        int retries{0};
+        Clock::time_point started{};
+        Clock::time_point retry_at{}; // pending reconnect, valid while upstream is null
+        Clock::time_point last_request{};
+        uint64_t reconnects{0};
+        uint64_t requests{0};
+        uint64_t bytes_in{0};
+        uint64_t bytes_out{0};
+
+        explicit Channel(const Source &src);
+        ~Channel();
+
+        HlsSegmenter *segmenter(HlsSegmenter::Format format) { return segmenters[static_cast<size_t>(format)].get(); }
+    };
+
+    // A connection whose answer is pending or still being sent.
+    struct Held
+    {
+        sockaddr_in addr{};
+        bool keep_alive{false};
+        std::string channel;
+        Request req;
+        bool waiting{false};
+        Clock::time_point deadline{};
+        std::string head;
+        std::vector<HlsSegmenter::Piece> body;
+        size_t sent{0};
+        bool streaming{false}; // a progressive response is under way
+        uint64_t init_sent{0};
+    };
+
+    HlsOutput() = default;
+    ~HlsOutput() = default;
+    HlsOutput(const HlsOutput &) = delete;
+    HlsOutput &operator=(const HlsOutput &) = delete;
+
+    static HlsSegmenter::Options segmenter_options(HlsSegmenter::Format format);
+    Channel *open_channel(const Source &source);
+    void close_channel(const std::string &key);
+    void start_upstream(Channel &ch);
+    void retire_upstream(Channel &ch);
+    void on_failed(Channel &ch);
+    void on_rtp(Channel &ch, Packet &&pkt);
+    void schedule_wake(Channel &ch);
+    void wake(const std::string &key);
+
+    // Fills head and body; false if the answer has to wait (and may, unless timed_out).
+    bool prepare(Channel *ch, Held &h, bool timed_out);
+    bool prepare_stream(const HlsSegmenter &seg, Held &h, bool timed_out);
+    void set_response(Held &h, const char *status, const char *type, const std::string &cache,
+                      std::vector<HlsSegmenter::Piece> body);
+    // 1: all sent, 0: the socket is full, -1: failed.
+    int send_some(int fd, Held &h);
+    void start_send(int fd);
+    void on_sent(int fd);
+    void watch(int fd, uint32_t events);
+    void handle_held(int fd, uint32_t event);
+    void finish(int fd);
+    void drop(int fd);
+    void handle_tick(uint32_t event);
+
+    EpollLoop *loop_{nullptr};
+    BufferPool *pool_{nullptr};
+    int timer_fd_{-1};
+    std::unique_ptr<SocketCtx> timer_ctx_;
+    std::map<std::string, std::unique_ptr<Channel>> channels_;
+    std::unordered_map<int, Held> held_;
+};
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "3rd/json.hpp"
+#include "common/rtsp_ctx.h"
+#include "core/buffer_pool.h"
+#include "core/udp_batch_sender.h"
+#include "protocol/rtp_pipeline.h"
+#include <chrono>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <string>
+#include <netinet/in.h>
+
+class EpollLoop;
+class SocketCtx;
+class RtspUpstream;
+
+/**
+ * MulticastPublisher puts RTSP channels on a LAN multicast group, so a
+ * channel with hundreds of viewers on the LAN costs one stream instead of
+ * one HTTP stream per viewer.
+ *
+ * Each output pulls its channel with one RtspUpstream (on http_interface),
+ * runs it through the channel's RtpPipeline and sends it on
+ * listen_interface either as RTP, or as raw TS in datagrams of 7 x 188
+ * bytes (udpxy's /udp/). Datagrams produced in one wakeup leave in one
+ * UdpBatchSender flush. A lost or stalled upstream is reconnected with
+ * backoff for as long as the output is on air.
+ *
+ * Outputs come from "multicast_outputs" in the config file or from the
+ * /api/publish endpoints and may carry a start and stop time (Unix time).
+ */
+class MulticastPublisher
+{
+public:
+    struct Spec
+    {
+        std::string name;
+        std::string url;       // rtsp://... or a proxy path (/rtp/..., /tv/...)
+        sockaddr_in group{};
+        int ttl{1};
+        bool rtp{true};        // RTP, or raw TS
+        std::time_t start{0};  // 0: right away
+        std::time_t stop{0};   // 0: until stopped
+    };
+
+    static MulticastPublisher &getInstance();
+
+    // Reads a "multicast_outputs" array (config file); outputs start once attached.
+    void load(const nlohmann::json &outputs);
+    void attach(EpollLoop *loop, BufferPool *pool);
+
+    // Fills spec from a JSON object with name, url, group ("239.1.1.1:5000"),
+    // ttl, format ("rtp" or "udp"), start and stop.
+    static bool parse_spec(const nlohmann::json &j, Spec &spec, std::string &error);
+
+    // Adds an output, replacing one of the same name.
+    bool publish(const Spec &spec, std::string &error);
+    // Takes an output off the air at 'at' (now if 0) and removes it.
+    bool stop(const std::string &name, std::time_t at, std::string &error);
+
+    nlohmann::json get_info() const;
+
+private:
+    static constexpr int TICK_INTERVAL_MS = 1000;
+    static constexpr int RETRY_BACKOFF_MS = 1000;
+    static constexpr int RETRY_BACKOFF_MAX_MS = 30000;
+    static constexpr int DEFAULT_STALL_MS = 5000;
+    static constexpr size_t TS_PACKET = 188;
+    static constexpr size_t TS_DATAGRAM = 7 * TS_PACKET;
+
+    struct Output
+    {
+        Spec spec;
+        rtspCtx ctx;
+        std::unique_ptr<RtpPipeline> pipeline;
+        std::unique_ptr<RtspUpstream> upstream;
+        int fd{-1};
+        std::unique_ptr<UdpBatchSender> batch;
+        std::unique_ptr<uint8_t[]> chunk; // raw TS being filled up to TS_DATAGRAM
+        size_t chunk_len{0};
+        bool on_air{false};
+        bool flush_pending{false};
+        int retries{0};
+        std::chrono::steady_clock::time_point started{};
+        std::chrono::steady_clock::time_point retry_at{}; // pending reconnect, valid while upstream is null
+        uint64_t reconnects{0};
+        uint64_t packets{0};
+        uint64_t bytes{0};
+    };
+
+    MulticastPublisher() = default;
+    ~MulticastPublisher() = default;
+    MulticastPublisher(const MulticastPublisher &) = delete;
+    MulticastPublisher &operator=(const MulticastPublisher &) = delete;
+
+    bool go_on_air(Output &out);
+    void take_off_air(Output &out);
+    void start_upstream(Output &out);
+    void retire_upstream(Output &out);
+    void on_failed(Output &out);
+    void on_rtp(Output &out, Packet &&pkt);
+    void send_ts(Output &out, Packet &&pkt); // pkt.offset is where the TS payload starts
+    void flush(const std::string &name);
+    void handle_tick(uint32_t event);
+
+    EpollLoop *loop_{nullptr};
+    BufferPool *pool_{nullptr};
+    int timer_fd_{-1};
+    std::unique_ptr<SocketCtx> timer_ctx_;
+    std::map<std::string, Output> outputs_;
+    std::map<std::string, Spec> pending_; // loaded before attach()
+};
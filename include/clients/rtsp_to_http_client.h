@@ -1,13 +1,21 @@
 #pragma once
 
 #include "core/iclient.h"
-#include "protocol/rtsp_parser.h"
 #include "common/rtsp_ctx.h"
+#include "clients/rtsp_upstream.h"
 #include "protocol/rtp_pipeline.h"
+#include "protocol/rtp_reorder_buffer.h"
+#include "protocol/rtp_leg_monitor.h"
+#include "protocol/ts_resync.h"
+#include "protocol/pcr_pacer.h"
+#include "protocol/ts_coalescer.h"
+#include "protocol/websocket.h"
 #include "core/buffer_pool.h"
+#include "core/downstream_queue.h"
+#include "core/multicast_hub.h"
 #include <string>
 #include <memory>
-#include <queue>
+#include <vector>
 #include <deque>
 #include <chrono>
 #include <netinet/in.h>
@@ -15,22 +23,37 @@
 class EpollLoop;
 class SocketCtx;
 
-enum class RtspMethod
+/**
+ * Session setup for RTSPToHttpClient. With 'redundant' set a second upstream
+ * leg pulls the same stream from redundant_ctx (another host, or the same one
+ * over redundant_iface) and both legs are merged by RTP sequence number,
+ * SMPTE 2022-7 style: the first copy of every packet is forwarded. Legs
+ * that turn out to carry different RTP streams (SSRC or sequence numbers)
+ * are not merged; one is forwarded and the other takes over if it stalls.
+ * 'mirrors' are tried in turn when the primary leg has to reconnect.
+ * With 'multicast' set there is no RTSP upstream: the session watches
+ * 'group' through MulticastHub instead. A non-empty 'websocket_accept'
+ * answers a WebSocket upgrade and sends the TS as binary frames.
+ */
+struct RtspHttpConfig
 {
-    OPTIONS,
-    DESCRIBE,
-    SETUP,
-    PLAY,
-    PAUSE,
-    TEARDOWN,
-    GET_PARAMETER,
-    SET_PARAMETER
+    rtspCtx ctx;
+    PipelineProfile profile;
+    bool redundant{false};
+    rtspCtx redundant_ctx;
+    std::string redundant_iface;
+    std::vector<rtspCtx> mirrors;
+    bool multicast{false};
+    MulticastHub::Group group;
+    std::string websocket_accept;
+    std::string uri; // as requested, without proxy-local parameters; for the dashboard
 };
 
 class RTSPToHttpClient : public IClient
 {
 public:
-    RTSPToHttpClient(EpollLoop *loop, BufferPool &pool, const sockaddr_in &client_addr, int client_fd, const rtspCtx &ctx);
+    RTSPToHttpClient(EpollLoop *loop, BufferPool &pool, const sockaddr_in &client_addr, int client_fd,
+                     const RtspHttpConfig &config);
     ~RTSPToHttpClient() override;
 
     void set_on_closed_callback(ClosedCallback cb) override;
@@ -38,23 +61,6 @@ public:
     bool is_closed() const override { return is_closed_; }
 
 private:
-    enum class RtspState
-    {
-        INIT,
-        CONNECTING,
-        CONNECTED,
-        STREAMING
-    };
-
-    struct RtspRequest
-    {
-        RtspMethod method;
-        std::string uri;
-        std::string headers;
-        std::string body;
-        int cseq;
-    };
-
     class FdGuard
     {
     public:
@@ -74,39 +80,98 @@ private:
         EpollLoop *loop_{nullptr};
     };
 
+    /**
+     * One upstream position of the session. The RtspUpstream behind it is
+     * replaced on failure or stall, rotating through 'sources', while the
+     * downstream HTTP connection stays open. With upstream_race set the next
+     * source is connected in parallel and the first one to reach PLAY wins.
+     */
+    struct LegSlot
+    {
+        RtspUpstream::Options opts;
+        std::vector<rtspCtx> sources; // configured upstream first, then mirrors
+        size_t source{0};
+        std::unique_ptr<RtspUpstream> upstream;
+        std::unique_ptr<RtspUpstream> racer; // second source raced against upstream until one plays
+        size_t racer_source{0};
+        std::chrono::steady_clock::time_point started{};
+        std::chrono::steady_clock::time_point retry_at{}; // pending reconnect, valid while upstream is null
+        int retries{0};                                   // consecutive attempts without reaching PLAY
+        uint64_t reconnects{0};
+    };
+
+    // Latency budget used for redundant sessions when reorder_latency_ms is 0,
+    // so a packet lost on one leg can still be filled in order from the other.
+    static constexpr uint32_t REDUNDANT_LATENCY_MS = 50;
+
+    // How redundant legs are combined. They are merged by sequence number only
+    // when they carry the same RTP stream; otherwise one leg is forwarded and
+    // the other waits on standby. PENDING until every leg has delivered.
+    enum class Redundancy
+    {
+        PENDING,
+        MERGE,
+        STANDBY
+    };
+    // Outside MERGE, the standby leg takes over once the active one is silent this long.
+    static constexpr int STANDBY_SWITCH_MS = 500;
+
+    // Watchdog tick for stall detection and scheduled reconnects.
+    static constexpr int WATCHDOG_INTERVAL_MS = 250;
+    static constexpr int RETRY_BACKOFF_MS = 250;
+    static constexpr int RETRY_BACKOFF_MAX_MS = 4000;
+
+    // Kernel pacing rate (SO_MAX_PACING_RATE) as a multiple of the PCR rate:
+    // smooths the bursts between PCRs but still lets a backlog drain.
+    static constexpr uint64_t KERNEL_PACING_HEADROOM = 2;
+
+    // WebSocket viewers always get batched frames: this is the coalesce
+    // latency when coalesce_ms is 0.
+    static constexpr uint32_t WEBSOCKET_BATCH_MS = 40;
+    // Viewers only send control frames; anything longer closes the session.
+    static constexpr size_t MAX_WEBSOCKET_INPUT = 1024;
+
 private:
-    void connect_server();
-    void handle_rtsp(uint32_t event);
-    void handle_rtp(uint32_t event);
-    void handle_rtcp(uint32_t event);
+    void add_leg(std::vector<rtspCtx> sources, const RtspUpstream::Options &opts);
+    void start_leg(size_t leg);
+    void bind_upstream(size_t leg);
+    void retire_upstream(std::unique_ptr<RtspUpstream> &upstream);
+    void promote_racer(size_t leg);
+    void on_racer_playing(size_t leg);
+    void on_racer_failed(size_t leg);
+    void on_leg_rtp(size_t leg, Packet &&pkt);
+    bool select_leg(size_t leg);
+    void on_leg_playing(size_t leg);
+    void on_leg_failed(size_t leg);
+    bool other_leg_streaming(size_t leg) const;
+    void on_multicast_rtp(Packet &&pkt);
+
     void handle_client(uint32_t event);
-    void handle_timer(uint32_t event);
-
-    void on_rtsp_writable();
-    void on_rtsp_readable();
-    void on_rtp_writable();
-    void on_rtp_readable();
-    void on_rtcp_writable();
-    void on_rtcp_readable();
+    void handle_reorder_timer(uint32_t event);
+    void handle_watchdog(uint32_t event);
+    void handle_pace_timer(uint32_t event);
+    void handle_coalesce_timer(uint32_t event);
+
     void on_client_writable();
     void on_client_readable();
     void on_client_closed();
 
-    void push_request_into_queue(RtspMethod method, const std::string &uri, const std::string &extra_headers = "", const std::string &body = "");
-    void build_and_send_request();
-    void init_rtp_rtcp_sockets();
-    void init_rtp_rtcp_server_addr();
-    void send_rtp_trigger();
-    void send_zte_heartbeat();
-    void init_timer_fd();
-    void send_http_response();
-    void send_rtsp_option();
-    void send_rtsp_describe();
-    void send_rtsp_setup(const std::string &sdp_data = "");
-    void send_rtsp_play();
-    void handle_interleaved_packet(uint8_t channel, const uint8_t *data, size_t len);
-
-    static std::string RtspMethodToString(RtspMethod method);
+    void send_http_response(const std::string &websocket_accept);
+    bool frame_websocket(Packet &pkt, size_t &header);
+    void send_websocket_control(ws::Opcode opcode, const uint8_t *payload, size_t len);
+    void on_websocket_input();
+    void forward_rtp_packet(Packet &&pkt);
+    void queue_payload(Packet &&pkt); // pkt.offset is where the TS payload starts
+    void init_reorder_timer();
+    void init_watchdog();
+    void init_pace_timer();
+    void arm_pace_timer(PcrPacer::Clock::time_point due);
+    void apply_pacing_rate();
+    void init_coalesce_timer();
+    void arm_coalesce_timer();
+    void arm_reorder_timer();
+    void want_client_writable();
+    void set_upstream_paused(bool paused);
 
 private:
     EpollLoop *loop_;
@@ -114,48 +179,44 @@ private:
     ClosedCallback on_closed_callback_;
     std::chrono::steady_clock::time_point start_time_;
     sockaddr_in client_addr_;
+    std::string uri_;
     FdGuard client_fd_;
-    rtspCtx ctx;
     std::unique_ptr<RtpPipeline> rtp_pipeline_;
+    std::unique_ptr<RtpReorderBuffer> reorder_;
+    std::unique_ptr<RtpLegMonitor> leg_monitor_;
+    Redundancy redundancy_{Redundancy::PENDING};
+    size_t active_leg_{0};  // the leg forwarded outside MERGE
+    uint64_t leg_switches_{0};
+    std::unique_ptr<PcrPacer> pacer_; // only with pace_output
+    std::unique_ptr<TsCoalescer> coalescer_; // only with coalesce_ms
+    std::vector<LegSlot> legs_; // empty for multicast input
+    MulticastHub::Group multicast_group_;
+    uint64_t multicast_id_{0};
+    TsResync resync_;
 
     std::unique_ptr<SocketCtx> client_ctx_;
-    std::unique_ptr<SocketCtx> rtsp_ctx_;
-    std::unique_ptr<SocketCtx> rtp_ctx_;
-    std::unique_ptr<SocketCtx> rtcp_ctx_;
-    std::unique_ptr<SocketCtx> timer_ctx_;
-
-    FdGuard rtsp_fd_;
-    FdGuard rtp_fd_;
-    FdGuard rtcp_fd_;
-    FdGuard timer_fd_;
-
-    RtspState state_{RtspState::INIT};
-    int cseq_{1};
-    std::string req_buf_;
-    std::string resp_buf_;
-    size_t tcp_send_offset_{0};
-    char rtsp_buf[4096];
-
-    std::queue<RtspRequest> request_queue_;
-    RtspRequest current_request_;
-
-    uint16_t rtp_port_{0};
-    sockaddr_in server_rtp_addr_{};
-    sockaddr_in server_rtcp_addr_{};
+    std::unique_ptr<SocketCtx> reorder_timer_ctx_;
+    std::unique_ptr<SocketCtx> watchdog_ctx_;
+    std::unique_ptr<SocketCtx> pace_timer_ctx_;
+    std::unique_ptr<SocketCtx> coalesce_timer_ctx_;
+
+    FdGuard reorder_timer_fd_;
+    bool reorder_timer_armed_{false};
+    FdGuard watchdog_fd_;
+    FdGuard pace_timer_fd_;
+    PcrPacer::Clock::time_point pace_timer_due_{}; // armed deadline, {} while idle
+    uint64_t pacing_rate_{0};                      // last SO_MAX_PACING_RATE applied
+    FdGuard coalesce_timer_fd_;
+    bool coalesce_timer_armed_{false};
 
     bool is_closed_{false};
-    bool is_init_ok{false};
-    bool is_tcp_mode_{false};
-    uint8_t interleaved_rtp_channel_{0};
-    uint8_t interleaved_rtcp_channel_{1};
-    bool setup_retry_with_tcp_{false};
-
-    std::string local_ip_;
-    uint16_t local_tcp_port_{0};
-    std::string nat_wan_ip;
-    uint16_t nat_wan_port{0};
-
-    std::deque<Packet> send_queue_;
-    mutable BandwidthEstimator upstream_est_;
+    bool websocket_{false};
+    bool websocket_closing_{false}; // close frame queued, no more media
+    std::string websocket_in_;      // partial frame from the viewer
+    bool is_streaming_{false};
+    bool upstream_paused_{false}; // TCP legs stopped reading while the viewer catches up
+    std::chrono::steady_clock::time_point paused_since_{};
+
+    DownstreamQueue send_queue_;
     mutable BandwidthEstimator downstream_est_;
 };
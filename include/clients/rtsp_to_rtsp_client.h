@@ -13,9 +13,15 @@
 #include <memory>
 #include <chrono>
 #include "protocol/rtp_pipeline.h"
+#include "protocol/rtp_fec.h"
+#include "protocol/rtsp_demuxer.h"
+#include "protocol/rtsp_rewriter.h"
 
 class EpollLoop;
+struct RequestInfo;
 #include "core/buffer_pool.h"
+#include "core/downstream_queue.h"
+#include "core/udp_batch_sender.h"
 class SocketCtx;
 
 /**
@@ -32,6 +38,7 @@ struct RtspMitmConfig
     rtspCtx ctx;
     std::string proxy_uri_prefix;
     std::string upstream_uri_base;
+    PipelineProfile profile;
 };
 
 class RTSPToRtspClient : public IClient
@@ -42,7 +49,7 @@ public:
                             const RtspMitmConfig &config,
                             const std::string &first_request);
 
-    static RtspMitmConfig resolve_upstream(const std::string &first_request);
+    static RtspMitmConfig resolve_upstream(const RequestInfo &info);
     ~RTSPToRtspClient() override;
 
     void set_on_closed_callback(ClosedCallback cb) override;
@@ -50,6 +57,12 @@ public:
     bool is_closed() const override { return closed_; }
 
 private:
+    // Bytes kept free in front of relayed RTP/RTCP for the downstream '$' header.
+    static constexpr size_t INTERLEAVED_HEADROOM = 4;
+
+    // Datagrams taken from the upstream RTP socket per recvmmsg().
+    static constexpr unsigned int RELAY_BATCH = 32;
+
     /* ------------------------------------------------------------------ */
     /* State machine                                                        */
     /* ------------------------------------------------------------------ */
@@ -98,12 +111,28 @@ private:
     std::string patch_transport_for_client(const std::string &resp);
 
     // Extract client_port from Transport header in a SETUP request.
-    bool extract_client_port(const std::string &req,
+    bool extract_client_port(std::string_view req,
                              uint16_t &rtp_port, uint16_t &rtcp_port);
 
     // Allocate local UDP sockets for RTP and RTCP relay.
     bool init_relay_sockets();
 
+    // Bind the upstream-facing FEC column/row sockets (RTP port +2/+4).
+    void init_fec_sockets();
+
+    // Run an upstream RTP packet (at buf + off) through the pipeline and send
+    // it downstream. Takes ownership of 'buf'.
+    void relay_rtp_downstream(std::unique_ptr<uint8_t[]> buf, size_t off, size_t len);
+
+    // Send an upstream RTCP packet (at buf + off) to the client. Takes ownership of 'buf'.
+    void relay_rtcp_downstream(std::unique_ptr<uint8_t[]> buf, size_t off, size_t len);
+
+    // Route upstream media of this session from the SharedRtpSocket port.
+    void subscribe_shared_rtp(std::string_view transport);
+
+    // Send a datagram to the server's RTP (or RTCP) port from our upstream-facing port.
+    ssize_t send_to_upstream(bool rtcp, const void *data, size_t len);
+
     void init_timer_fd();
 
     // Rewrite the RTSP request URI from the proxy-format URL
@@ -111,22 +140,26 @@ private:
     // (rtsp://real-host:port/path) before forwarding to the server.
     std::string rewrite_request_for_upstream(const std::string &req);
 
-    // Patch any response from upstream before sending to client.
-    // Handles Transport, Content-Base, RTP-Info and SDP.
-    std::string patch_response_for_client(const std::string &resp);
+    // Appends the upstream response, patched for the client, to out.
+    // Handles Transport, Content-Base, Location, RTP-Info and SDP.
+    void patch_response_for_client(const RtspMessage &resp, std::string &out);
 
     // Extract interleaved channels from Transport header.
-    bool extract_interleaved_channels(const std::string &req,
+    bool extract_interleaved_channels(std::string_view req,
                                       uint8_t &rtp_chan, uint8_t &rtcp_chan);
 
     // Send an interleaved RTP/RTCP packet to the downstream client.
     void send_interleaved_downstream(uint8_t channel, const uint8_t *data, size_t len);
 
+    // Queue the packet at buf + off (off >= INTERLEAVED_HEADROOM) to the downstream
+    // client, writing the '$' header in front of it. Takes ownership of 'buf'.
+    void queue_interleaved_downstream(uint8_t channel, std::unique_ptr<uint8_t[]> buf, size_t off, size_t len);
+
     // Handle an interleaved packet received from the downstream client.
     void handle_interleaved_from_client(uint8_t channel, const uint8_t *data, size_t len);
 
     // Handle an interleaved packet received from the upstream server.
-    void handle_interleaved_from_upstream(uint8_t channel, const uint8_t *data, size_t len);
+    void handle_interleaved_from_upstream(RtspDemuxer::Item &item);
 
     // Patch the SETUP request for TCP interleaved mode.
     std::string patch_transport_for_upstream_tcp(const std::string &req);
@@ -141,6 +174,7 @@ private:
     void handle_upstream(uint32_t events);
     void handle_rtp_from_upstream(uint32_t events);
     void handle_rtcp_from_upstream(uint32_t events);
+    void handle_fec_from_upstream(int fd, uint32_t events);
     void handle_rtp_from_client(uint32_t events);
     void handle_rtcp_from_client(uint32_t events);
     void handle_timer(uint32_t events);
@@ -150,7 +184,10 @@ private:
     void on_downstream_closed();
     void on_upstream_readable();
     void on_upstream_writable();
+    uint32_t upstream_events() const;
+    void set_upstream_paused(bool paused);
     void send_rtp_trigger();
+    void connect_relay_downstream();
     void send_zte_heartbeat();
     void process_pending_setup();
 
@@ -161,6 +198,8 @@ private:
     BufferPool &pool_;
     ClosedCallback on_closed_;
     std::chrono::steady_clock::time_point start_time_ = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point connect_start_{};
+    bool pooled_{false}; // upstream connection came from UpstreamConnPool
 
     /* downstream (the RTSP client that connected to us) */
     FdGuard downstream_fd_;
@@ -184,6 +223,18 @@ private:
     std::unique_ptr<SocketCtx> timer_ctx_;
     FdGuard timer_fd_;
 
+    /* SMPTE 2022-1 FEC from upstream (optional) */
+    FdGuard fec_col_fd_;
+    FdGuard fec_row_fd_;
+    std::unique_ptr<SocketCtx> fec_col_ctx_;
+    std::unique_ptr<SocketCtx> fec_row_ctx_;
+    std::unique_ptr<RtpFecDecoder> fec_;
+    int us_port_pairs_{1};
+
+    /* Upstream-facing media on the SharedRtpSocket port instead of rtp_us_fd_/rtcp_us_fd_ */
+    bool shared_rtp_{false};
+    uint64_t shared_rtp_id_{0};
+
     /* Local port numbers for the relay sockets */
     uint16_t local_rtp_us_port_{0};   // our RTP port (facing upstream)
     uint16_t local_rtcp_us_port_{0};  // our RTCP port (facing upstream)
@@ -193,6 +244,7 @@ private:
     /* The actual client RTP/RTCP endpoints (where we forward RTP to) */
     sockaddr_in client_rtp_addr_{};
     sockaddr_in client_rtcp_addr_{};
+    bool client_rtp_learned_{false}; // client_rtp_addr_ confirmed by a packet from the client
 
     /* The upstream server RTP/RTCP endpoints */
     sockaddr_in server_rtp_addr_{};
@@ -213,12 +265,22 @@ private:
     rtspCtx ctx_; // parsed URL info for upstream
 
     // Per-request buffers
-    std::string downstream_recv_buf_; // accumulate full RTSP request from client
-    std::string upstream_recv_buf_;   // accumulate full RTSP response from server
+    std::string first_request_;       // request received by the handler, sent once connected
+    RtspDemuxer downstream_demux_;    // RTSP requests and $ frames from the client
+    RtspDemuxer upstream_demux_;      // RTSP responses and $ frames from the server
+    RtspRewriter rewriter_;
+    std::string ctrl_out_;            // patched response being queued to the client
 
-    // Send queues (raw RTSP text)
+    // Send queues (raw RTSP text upstream; responses and media downstream)
     std::deque<std::string> to_upstream_q_;
-    std::deque<Packet> to_downstream_q_;
+    DownstreamQueue to_downstream_q_;
+    bool upstream_paused_{false}; // interleaved upstream not read while the client catches up
+    std::chrono::steady_clock::time_point paused_since_{};
+
+    // UDP relay toward the client: connected once media flows, sent per wakeup with sendmmsg.
+    UdpBatchSender ds_rtp_batch_;
+    bool relay_batching_{false}; // inside a recvmmsg batch; flushed at its end
+    bool us_peer_checked_{false};
 
     // TCP send progress for simple head-of-queue item
     size_t upstream_send_offset_{0};
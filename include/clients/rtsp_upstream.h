@@ -0,0 +1,219 @@
+#pragma once
+
+#include "common/rtsp_ctx.h"
+#include "core/buffer_pool.h"
+#include "core/iclient.h"
+#include "protocol/rtp_fec.h"
+#include "protocol/rtsp_demuxer.h"
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <netinet/in.h>
+
+class EpollLoop;
+class SocketCtx;
+
+enum class RtspMethod
+{
+    OPTIONS,
+    DESCRIBE,
+    SETUP,
+    PLAY,
+    PAUSE,
+    TEARDOWN,
+    GET_PARAMETER,
+    SET_PARAMETER
+};
+
+/**
+ * RtspUpstream is one upstream leg of an RTSP-to-HTTP session.
+ *
+ * It owns the RTSP control connection and the local RTP/RTCP (and optional
+ * FEC) sockets, runs the OPTIONS/DESCRIBE/SETUP/PLAY handshake including the
+ * STUN/ZTE NAT helpers and the 461 fallback to TCP interleaved, keeps the
+ * session alive and hands every received RTP packet to the owner through
+ * the RTP callback. Errors are reported once through the failed callback;
+ * the owner decides whether to close the session or retry.
+ */
+class RtspUpstream
+{
+public:
+    using RtpCallback = std::function<void(Packet &&)>;
+    using EventCallback = std::function<void()>;
+
+    struct Options
+    {
+        std::string name;   // label used in logs and /api/status
+        std::string iface;  // upstream interface to bind, empty for default route
+        bool fec{false};
+    };
+
+    RtspUpstream(EpollLoop *loop, BufferPool &pool, const rtspCtx &ctx, const Options &opts);
+    ~RtspUpstream();
+
+    RtspUpstream(const RtspUpstream &) = delete;
+    RtspUpstream &operator=(const RtspUpstream &) = delete;
+
+    void set_on_rtp(RtpCallback cb) { on_rtp_ = std::move(cb); }
+    void set_on_playing(EventCallback cb) { on_playing_ = std::move(cb); }
+    void set_on_failed(EventCallback cb) { on_failed_ = std::move(cb); }
+
+    // Binds the local sockets and starts the handshake (after STUN if enabled).
+    void start();
+
+    bool is_streaming() const { return state_ == State::STREAMING; }
+    bool is_failed() const { return failed_; }
+    bool is_tcp() const { return is_tcp_mode_; }
+    const rtspCtx &ctx() const { return ctx_; }
+    const Options &options() const { return opts_; }
+    std::chrono::steady_clock::time_point last_rtp_time() const { return last_rtp_time_; }
+
+    // TCP connect time and connect-to-PLAY time of the control connection, -1 until known.
+    double connect_ms() const { return connect_ms_; }
+    double handshake_ms() const { return handshake_ms_; }
+
+    // Stops or resumes reading an interleaved (TCP) stream so that TCP flow
+    // control slows the server down while the viewer is behind. The handshake
+    // is never paused and a UDP stream is not affected.
+    void set_paused(bool paused);
+    bool is_paused() const { return paused_; }
+
+    double bandwidth() const { return est_.getBandwidth(); }
+    json get_info() const;
+
+private:
+    enum class State
+    {
+        INIT,
+        CONNECTING,
+        CONNECTED,
+        STREAMING
+    };
+
+    struct RtspRequest
+    {
+        RtspMethod method;
+        std::string uri;
+        std::string headers;
+        std::string body;
+        int cseq;
+    };
+
+    class FdGuard
+    {
+    public:
+        FdGuard();
+        FdGuard(int fd, EpollLoop *loop = nullptr);
+        ~FdGuard();
+        FdGuard(const FdGuard &) = delete;
+        FdGuard &operator=(const FdGuard &) = delete;
+        FdGuard(FdGuard &&other) noexcept;
+        FdGuard &operator=(FdGuard &&other) noexcept;
+        int &get_ref();
+        int get() const;
+        operator int() const;
+
+    private:
+        int fd_{-1};
+        EpollLoop *loop_{nullptr};
+    };
+
+    static double elapsed_ms(std::chrono::steady_clock::time_point since);
+    void fail(const std::string &reason);
+    void deliver(Packet &&pkt);
+
+    void connect_server();
+    void handle_rtsp(uint32_t event);
+    void handle_rtp(uint32_t event);
+    void handle_fec(int fd, uint32_t event);
+    void handle_timer(uint32_t event);
+
+    void on_rtsp_writable();
+    void on_rtsp_readable();
+    void on_rtp_readable();
+
+    void push_request_into_queue(RtspMethod method, const std::string &uri, const std::string &extra_headers = "", const std::string &body = "");
+    void build_and_send_request();
+    bool init_rtp_rtcp_sockets();
+    void init_fec_sockets();
+    void init_rtp_rtcp_server_addr();
+    void subscribe_shared_rtp(std::string_view transport);
+    ssize_t send_rtp_datagram(const void *data, size_t len);
+    void send_rtp_trigger();
+    void send_zte_heartbeat();
+    void init_timer_fd();
+    void send_rtsp_option();
+    void send_rtsp_describe();
+    void send_rtsp_setup(const std::string &sdp_data = "");
+    void send_rtsp_play();
+    void handle_interleaved_packet(RtspDemuxer::Item &item);
+    uint32_t rtsp_read_events() const;
+
+    static std::string RtspMethodToString(RtspMethod method);
+
+    EpollLoop *loop_;
+    BufferPool &pool_;
+    rtspCtx ctx_;
+    Options opts_;
+
+    RtpCallback on_rtp_;
+    EventCallback on_playing_;
+    EventCallback on_failed_;
+
+    std::unique_ptr<SocketCtx> rtsp_ctx_;
+    std::unique_ptr<SocketCtx> rtp_ctx_;
+    std::unique_ptr<SocketCtx> rtcp_ctx_;
+    std::unique_ptr<SocketCtx> timer_ctx_;
+    std::unique_ptr<SocketCtx> fec_col_ctx_;
+    std::unique_ptr<SocketCtx> fec_row_ctx_;
+
+    FdGuard rtsp_fd_;
+    FdGuard rtp_fd_;
+    FdGuard rtcp_fd_;
+    FdGuard timer_fd_;
+    FdGuard fec_col_fd_;
+    FdGuard fec_row_fd_;
+
+    std::unique_ptr<RtpFecDecoder> fec_;
+
+    State state_{State::INIT};
+    bool failed_{false};
+    bool paused_{false};
+    int cseq_{1};
+    std::string req_buf_;
+    size_t tcp_send_offset_{0};
+    RtspDemuxer demux_;
+
+    std::queue<RtspRequest> request_queue_;
+    RtspRequest current_request_;
+
+    uint16_t rtp_port_{0};
+    int rtp_port_pairs_{1};
+    bool shared_rtp_{false};      // media arrives on the SharedRtpSocket port
+    uint64_t shared_rtp_id_{0};
+    sockaddr_in server_rtp_addr_{};
+    sockaddr_in server_rtcp_addr_{};
+
+    bool is_init_ok_{false};
+    bool is_tcp_mode_{false};
+    uint8_t interleaved_rtp_channel_{0};
+    uint8_t interleaved_rtcp_channel_{1};
+    bool setup_retry_with_tcp_{false};
+
+    std::string local_ip_;
+    uint16_t local_tcp_port_{0};
+    std::string nat_wan_ip_;
+    uint16_t nat_wan_port_{0};
+
+    std::chrono::steady_clock::time_point connect_start_{};
+    bool pooled_{false}; // control connection came from UpstreamConnPool
+    double connect_ms_{-1};
+    double handshake_ms_{-1};
+
+    uint64_t rtp_packets_{0};
+    std::chrono::steady_clock::time_point last_rtp_time_{};
+    mutable BandwidthEstimator est_;
+};
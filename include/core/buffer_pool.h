@@ -1,54 +1,80 @@
 #pragma once
 
-#include <vector>
-#include <memory>
+#include <cstddef>
+#include <cstdint>
 #include <cstring>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
+/**
+ * BufferPool hands out fixed-size blocks from a few size classes.
+ *
+ * The base class has the configured block size and backs acquire(); RTP
+ * datagrams land there. acquire(min_size) picks the smallest class that
+ * fits, so short RTCP and control messages take SMALL_BLOCK_SIZE blocks and
+ * interleaved frames up to 64 KB stay whole in LARGE/JUMBO blocks without
+ * raising the base block size. Every class keeps its own free list,
+ * statistics and cap on idle blocks; a block released beyond the cap is
+ * freed. release() finds the class of a block by itself.
+ */
 class BufferPool
 {
 
 public:
-    BufferPool(size_t buf_size, size_t pool_size)
-        : buf_size_(buf_size), total_allocated_(pool_size)
-    {
-        for (size_t i = 0; i < pool_size; ++i)
-        {
-            pool_.push_back(std::make_unique<uint8_t[]>(buf_size_));
-        }
-    }
+    static constexpr size_t SMALL_BLOCK_SIZE = 256;
+    static constexpr size_t LARGE_BLOCK_SIZE = 16 * 1024;
+    static constexpr size_t JUMBO_BLOCK_SIZE = 64 * 1024 + 64; // largest '$' frame plus header room
 
-    std::unique_ptr<uint8_t[]> acquire()
+    struct ClassStats
     {
-        if (pool_.empty()) {
-            total_allocated_++;
-            size_t used = total_allocated_;
-            if (used > peak_used_) peak_used_ = used;
-            return std::make_unique<uint8_t[]>(buf_size_);
-        }
-        auto buf = std::move(pool_.back());
-        pool_.pop_back();
-        
-        size_t used = total_allocated_ - pool_.size();
-        if (used > peak_used_) peak_used_ = used;
-        
-        return buf;
-    }
+        size_t block_size;
+        size_t available;
+        size_t allocated;
+        size_t peak_used;
+        size_t max_idle; // 0 = unlimited
+        uint64_t freed;  // released beyond max_idle
+    };
 
-    void release(std::unique_ptr<uint8_t[]> buf)
-    {
-        pool_.push_back(std::move(buf));
-    }
+    BufferPool(size_t buf_size, size_t pool_size);
 
-    size_t get_available_count() const { return pool_.size(); }
-    size_t get_total_allocated() const { return total_allocated_; }
-    size_t get_buffer_size() const { return buf_size_; }
-    size_t get_peak_used() const { return peak_used_; }
+    // A block of get_buffer_size() bytes.
+    std::unique_ptr<uint8_t[]> acquire();
+
+    // A block of at least min_size bytes; nullptr above get_max_buffer_size().
+    std::unique_ptr<uint8_t[]> acquire(size_t min_size);
+
+    void release(std::unique_ptr<uint8_t[]> buf);
+
+    // Base class statistics.
+    size_t get_available_count() const { return classes_[base_].free.size(); }
+    size_t get_total_allocated() const { return classes_[base_].allocated; }
+    size_t get_buffer_size() const { return classes_[base_].size; }
+    size_t get_peak_used() const { return classes_[base_].peak_used; }
+
+    size_t get_max_buffer_size() const { return classes_.back().size; }
+    size_t get_total_bytes() const;
+    std::vector<ClassStats> get_class_stats() const;
 
 private:
-    size_t buf_size_;
-    size_t total_allocated_;
-    size_t peak_used_ = 0;
-    std::vector<std::unique_ptr<uint8_t[]>> pool_;
+    struct SizeClass
+    {
+        SizeClass(size_t size, size_t max_idle) : size(size), max_idle(max_idle) {}
+
+        size_t size;
+        size_t max_idle;
+        size_t allocated{0};
+        size_t peak_used{0};
+        uint64_t freed{0};
+        std::vector<std::unique_ptr<uint8_t[]>> free;
+    };
+
+    std::unique_ptr<uint8_t[]> take(uint8_t index);
+
+    std::vector<SizeClass> classes_; // ascending block size
+    uint8_t base_{0};
+    // Class of every live block outside the base class; empty in the common case.
+    std::unordered_map<const uint8_t *, uint8_t> owner_;
 };
 
 struct Packet
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "core/buffer_pool.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+struct DownstreamQueueStats
+{
+    uint64_t drops{0};   // media packets skipped while the viewer was over budget
+    uint64_t resyncs{0}; // times the queue resumed on a sync point after skipping
+    size_t high_water{0}; // most bytes ever queued
+};
+
+/**
+ * DownstreamQueue is the send queue of one viewer, with a per-session byte
+ * budget (client_buffer_kb) and a share of the worker-wide one
+ * (total_buffer_mb).
+ *
+ * A media packet that would take the viewer over budget is not queued, and
+ * neither is anything after it: the queue lets the viewer drain to half its
+ * budget and then resumes on the next packet the caller marks as a sync
+ * point (PAT or keyframe), so the picture picks up at a GOP boundary instead
+ * of missing random packets mid-GOP. Packets already queued are never
+ * dropped. A viewer that stays in this state for slow_client_timeout_ms is
+ * reported as too slow so the caller can disconnect it.
+ *
+ * Control packets (HTTP headers, RTSP responses) bypass the budget. Budgets
+ * count the bytes to send, [offset, length), not the headroom before them.
+ */
+class DownstreamQueue
+{
+public:
+    enum class Verdict
+    {
+        QUEUED,
+        RESUMED,  // queued; first packet after skipping to a sync point
+        RESYNC,   // dropped; the viewer just went over budget
+        DROPPED,  // dropped while skipping to a sync point
+        TOO_SLOW  // dropped; over budget for longer than slow_client_timeout_ms
+    };
+
+    explicit DownstreamQueue(BufferPool &pool);
+    ~DownstreamQueue();
+
+    DownstreamQueue(const DownstreamQueue &) = delete;
+    DownstreamQueue &operator=(const DownstreamQueue &) = delete;
+
+    // True while media is skipped; only then does push_media() look at sync_point.
+    bool resyncing() const { return state_ != State::FLOWING; }
+
+    // Takes ownership of pkt.data whatever the verdict.
+    Verdict push_media(Packet &&pkt, bool sync_point);
+    void push_control(Packet &&pkt);
+
+    bool empty() const { return queue_.empty(); }
+    size_t size() const { return queue_.size(); }
+    size_t bytes() const { return bytes_; }
+    Packet &front() { return queue_.front().pkt; }
+    Packet &back() { return queue_.back().pkt; }
+    void pop_front(); // releases the front packet
+    void clear();
+
+    // Watermarks for callers that can slow their source down instead of
+    // dropping: stop reading above half the budget, resume below a quarter.
+    bool congested() const { return bytes_ >= budget_ / 2; }
+    bool drained() const { return bytes_ <= budget_ / 4; }
+
+    const DownstreamQueueStats &stats() const { return stats_; }
+
+    // Bytes queued across every viewer of this worker.
+    static size_t total_bytes() { return total_bytes_; }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // A viewer holding less than this is never cut because of the worker-wide budget.
+    static constexpr size_t FAIR_SHARE = 256 * 1024;
+
+    enum class State
+    {
+        FLOWING,
+        DRAINING,  // over budget, waiting for the viewer to drain to half
+        WAIT_SYNC  // drained, waiting for a sync point
+    };
+
+    struct Entry
+    {
+        Packet pkt;
+        size_t bytes; // counted against the budgets when queued; offset moves as it is sent
+    };
+
+    void enqueue(Packet &&pkt);
+    bool over_budget(size_t len) const;
+
+    BufferPool &pool_;
+    std::deque<Entry> queue_;
+    size_t bytes_{0};
+    size_t budget_;
+    State state_{State::FLOWING};
+    Clock::time_point skipping_since_{};
+    DownstreamQueueStats stats_;
+
+    static size_t total_bytes_;
+};
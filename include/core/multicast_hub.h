@@ -0,0 +1,101 @@
+#pragma once
+
+#include "3rd/json.hpp"
+#include "core/buffer_pool.h"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <netinet/in.h>
+
+class EpollLoop;
+class SocketCtx;
+
+/**
+ * MulticastHub joins IPTV multicast groups for HTTP viewers. Each group is
+ * joined once, on http_interface, however many viewers watch it; every
+ * datagram is handed to all of its viewers and the membership is dropped
+ * with the last one.
+ *
+ * Viewers always get RTP: raw TS datagrams (udpxy's /udp/) are received
+ * behind room for a 12-byte header and given one with a per-group sequence
+ * number, so both kinds run through the same RtpPipeline and reorder
+ * buffer. The URL only tells which kind to expect; a group that turns out
+ * to carry the other one is detected per datagram.
+ */
+class MulticastHub
+{
+public:
+    // Gets the RTP packet at data[0, length).
+    using Receiver = std::function<void(Packet &&)>;
+
+    struct Group
+    {
+        in_addr_t addr{0};   // network order
+        in_addr_t source{0}; // source-specific multicast, 0 for any source
+        uint16_t port{0};    // host order
+        bool rtp{false};     // expected payload: RTP, or raw TS
+
+        bool operator==(const Group &o) const { return addr == o.addr && source == o.source && port == o.port; }
+        std::string to_string() const;
+    };
+
+    static MulticastHub &getInstance();
+
+    void attach(EpollLoop *loop, BufferPool *pool);
+
+    // Delivers the group's datagrams to on_rtp until unsubscribe().
+    // Returns 0 if the group cannot be joined.
+    uint64_t subscribe(const Group &group, Receiver on_rtp);
+    void unsubscribe(uint64_t id);
+
+    nlohmann::json get_info() const;
+
+private:
+    static constexpr unsigned int RECV_BATCH = 32;
+    static constexpr size_t RTP_HEADER = 12;
+    static constexpr uint8_t RTP_PT_MP2T = 33;
+
+    struct Channel
+    {
+        Group group;
+        int fd{-1};
+        std::unique_ptr<SocketCtx> ctx;
+        std::vector<uint64_t> viewers;
+        bool rtp{false};   // what the last datagram carried
+        uint16_t seq{0};   // for raw TS
+        uint32_t ssrc{0};
+        uint64_t packets{0};
+        uint64_t bytes{0};
+        uint64_t dropped{0}; // neither RTP nor TS
+    };
+
+    struct Subscription
+    {
+        Channel *channel;
+        Receiver on_rtp;
+        bool dead{false};
+    };
+
+    MulticastHub() = default;
+    ~MulticastHub();
+    MulticastHub(const MulticastHub &) = delete;
+    MulticastHub &operator=(const MulticastHub &) = delete;
+
+    Channel *join(const Group &group);
+    void leave(Channel *channel);
+    void handle_channel(Channel *channel, uint32_t event);
+    bool frame(Channel &channel, uint8_t *buf, size_t off, size_t n, size_t &len);
+    void remove(uint64_t id);
+    void reap();
+
+    EpollLoop *loop_{nullptr};
+    BufferPool *pool_{nullptr};
+    std::vector<std::unique_ptr<Channel>> channels_;
+    std::unordered_map<uint64_t, Subscription> subs_;
+    uint64_t next_id_{1};
+    bool dispatching_{false};
+    std::vector<uint64_t> dead_;
+};
@@ -1,12 +1,21 @@
 #pragma once
 
+#include "3rd/json.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <stdint.h>
-#include <mutex>
-#include <set>
 
 /**
  * PortPool manages a range of UDP ports to ensure that RTP/RTCP
  * port pairs (even, odd) are allocated without internal collisions.
+ *
+ * Pairs are tracked in a bitmap of atomic words, one bit per pair, and
+ * claimed with compare-and-swap, so allocation needs no lock and costs a
+ * few word operations. A rotating cursor spreads allocations over the range
+ * so a just-released pair is not handed out again while stale packets may
+ * still arrive on it. Ports found occupied by another process are
+ * quarantined for OCCUPIED_HOLD and then returned to the range.
  */
 class PortPool
 {
@@ -15,32 +24,49 @@ public:
 
     /**
      * Acquire a pair of consecutive ports (even, even+1).
+     * With pairs > 1 the following pairs are reserved as well, e.g. 3 for
+     * RTP/RTCP plus the SMPTE 2022-1 FEC ports at +2 and +4.
      * Returns the even port, or 0 if no ports are available.
      */
-    uint16_t acquire_pair();
+    uint16_t acquire_pair(int pairs = 1);
 
     /**
-     * Release a pair of ports starting with 'port'.
+     * Release 'pairs' pairs of ports starting with 'port'.
      */
-    void release_pair(uint16_t port);
+    void release_pair(uint16_t port, int pairs = 1);
 
     /**
      * Mark a port as externally occupied (failed to bind).
-     * This port will be skipped for a while.
+     * Its pair is skipped for OCCUPIED_HOLD, even if it is released.
      */
     void mark_occupied(uint16_t port);
 
+    nlohmann::json get_info() const;
+
 private:
+    static constexpr uint16_t START_PORT = 20000;
+    static constexpr uint16_t END_PORT = 40000;
+    static constexpr size_t PAIRS = (END_PORT - START_PORT) / 2;
+    static constexpr size_t WORDS = (PAIRS + 63) / 64;
+    static constexpr int MAX_PAIRS_PER_ACQUIRE = 8;
+    static constexpr std::chrono::seconds OCCUPIED_HOLD{60};
+
     PortPool();
     ~PortPool() = default;
 
     PortPool(const PortPool&) = delete;
     PortPool& operator=(const PortPool&) = delete;
 
-    std::mutex mutex_;
-    uint16_t start_port_{20000};
-    uint16_t end_port_{40000};
-    uint16_t next_port_{20000};
-    
-    std::set<uint16_t> used_ports_;
+    static uint32_t now_sec();
+    void expire(size_t word, uint32_t now);
+
+    std::array<std::atomic<uint64_t>, WORDS> used_{};        // allocated or quarantined
+    std::array<std::atomic<uint64_t>, WORDS> quarantined_{};
+    std::array<std::atomic<uint32_t>, PAIRS> hold_until_{}; // now_sec() when a quarantine ends
+    std::atomic<size_t> cursor_{0};
+
+    std::atomic<uint64_t> acquired_{0};
+    std::atomic<uint64_t> exhausted_{0};
+    std::atomic<uint64_t> collisions_{0};
+    std::atomic<uint64_t> expired_{0};
 };
@@ -23,7 +23,7 @@ private:
     int start_worker();
     int start_watchdog();
     
-    void setup_accept_handler(int listen_fd, EpollLoop &loop, BufferPool &pool);
+    void setup_accept_handler(int listen_fd, EpollLoop &loop);
 
 private:
     bool running_{true};
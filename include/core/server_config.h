@@ -20,12 +20,29 @@ public:
     static void setToken(std::string token);
     static void setHttpUpstreamInterface(std::string iface);
     static void setMitmUpstreamInterface(std::string iface);
+    static void setRedundantInterface(std::string iface);
     static void setListenInterface(std::string iface);
     static void setLogFile(std::string path);
     static void setLogLines(size_t lines);
     static void setBlacklist(const std::vector<std::string> &list);
     static void setStripPadding(bool enable);
     static void setWaitKeyframe(bool enable);
+    static void setReorderLatencyMs(int ms);
+    static void setFecEnabled(bool enable);
+    static void setStallTimeoutMs(int ms);
+    static void setUpstreamRetries(int retries);
+    static void setUpstreamRaceEnabled(bool enable);
+    static void setUpstreamPoolSize(int size);
+    static void setClientBufferKb(int kb);
+    static void setTotalBufferMb(int mb);
+    static void setSlowClientTimeoutMs(int ms);
+    static void setPaceOutputEnabled(bool enable);
+    static void setPaceBurstMs(int ms);
+    static void setCoalesceMs(int ms);
+    static void setSharedRtpPort(int port);
+    static void setHlsSegmentMs(int ms);
+    static void setHlsPartMs(int ms);
+    static void setHlsWindow(int segments);
     static void setWatchdogEnabled(bool enable);
     static void setDaemonEnabled(bool enable);
     static void setAuthToken(std::string token) { setToken(token); }
@@ -42,11 +59,28 @@ public:
     static std::string getToken();
     static std::string getHttpUpstreamInterface();
     static std::string getMitmUpstreamInterface();
+    static std::string getRedundantInterface();
     static std::string getListenInterface();
     static std::string getLogFile();
     static size_t getLogLines();
     static bool isStripPadding();
     static bool isWaitKeyframe();
+    static int getReorderLatencyMs();
+    static bool isFecEnabled();
+    static int getStallTimeoutMs();
+    static int getUpstreamRetries();
+    static bool isUpstreamRaceEnabled();
+    static int getUpstreamPoolSize();
+    static int getClientBufferKb();
+    static int getTotalBufferMb();
+    static int getSlowClientTimeoutMs();
+    static bool isPaceOutputEnabled();
+    static int getPaceBurstMs();
+    static int getCoalesceMs();
+    static int getSharedRtpPort();
+    static int getHlsSegmentMs();
+    static int getHlsPartMs();
+    static int getHlsWindow();
     static bool isWatchdogEnabled();
     static bool isDaemonEnabled();
     static const std::vector<std::string>& getBlacklist();
@@ -67,11 +101,28 @@ private:
     static std::string auth_token;
     static std::string http_upstream_interface;
     static std::string mitm_upstream_interface;
+    static std::string redundant_interface;
     static std::string listen_interface;
     static std::string log_file_path;
     static size_t log_file_lines;
     static bool strip_padding;
     static bool wait_keyframe;
+    static int reorder_latency_ms;
+    static bool fec_enabled;
+    static int stall_timeout_ms;
+    static int upstream_retries;
+    static bool upstream_race;
+    static int upstream_pool_size;
+    static int client_buffer_kb;
+    static int total_buffer_mb;
+    static int slow_client_timeout_ms;
+    static bool pace_output;
+    static int pace_burst_ms;
+    static int coalesce_ms;
+    static int shared_rtp_port;
+    static int hls_segment_ms;
+    static int hls_part_ms;
+    static int hls_window;
     static bool watchdog_enabled;
     static bool daemon_enabled;
     static std::vector<std::string> blacklist;
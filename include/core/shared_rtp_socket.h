@@ -0,0 +1,136 @@
+#pragma once
+
+#include "3rd/json.hpp"
+#include "core/buffer_pool.h"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <netinet/in.h>
+
+class EpollLoop;
+class SocketCtx;
+
+/**
+ * SharedRtpSocket receives the upstream UDP RTP/RTCP of every session on
+ * one fixed port pair per upstream interface, instead of a pooled pair per
+ * session, so fds, epoll registrations and wakeups no longer grow with the
+ * number of sessions.
+ *
+ * Sessions announce the shared port in SETUP and subscribe with the
+ * server's address once the server_port is known. Incoming RTP is routed by
+ * (source address, source port, SSRC). A subscription that knows its SSRC
+ * (ssrc= in the SETUP reply) claims exactly that stream. Otherwise the first
+ * packet of a new source is claimed by the subscription waiting for that
+ * server address, preferring one whose server_port matches the source port;
+ * when several are waiting there is no telling whose channel it is, so the
+ * packet stays unrouted rather than being guessed. A source that changes its
+ * SSRC is re-claimed by the only subscription it could belong to. RTCP is
+ * routed by (source address, sender SSRC) of a claimed stream.
+ *
+ * The pair for the default route is bound at shared_rtp_port; every further
+ * interface takes the next pair. Sockets are opened with SO_REUSEPORT so a
+ * restarted worker can bind them again right away.
+ */
+class SharedRtpSocket
+{
+public:
+    // Gets the datagram at data[0, length).
+    using Receiver = std::function<void(Packet &&)>;
+
+    static SharedRtpSocket &getInstance();
+
+    // Binds the shared sockets to the worker's event loop; they are opened on first use.
+    void attach(EpollLoop *loop, BufferPool *pool);
+
+    // True if shared_rtp_port is configured.
+    bool enabled() const { return loop_ != nullptr; }
+
+    // RTP port of the pair for iface, opening it if needed; 0 if it cannot be bound.
+    uint16_t port(const std::string &iface);
+
+    // Routes RTP (and RTCP, if on_rtcp is set) from server to the receivers until
+    // unsubscribe(). Returns 0 if the pair for iface is not open.
+    uint64_t subscribe(const std::string &iface, const sockaddr_in &server, Receiver on_rtp, Receiver on_rtcp = nullptr);
+    void unsubscribe(uint64_t id);
+
+    // Restricts a waiting subscription to RTP with this SSRC, e.g. the one announced in the SETUP reply.
+    void expect_ssrc(uint64_t id, uint32_t ssrc);
+
+    // Sends a datagram from the shared RTP (or RTCP) port, e.g. a NAT trigger.
+    bool send_to(const std::string &iface, bool rtcp, const sockaddr_in &to, const void *data, size_t len);
+
+    nlohmann::json get_info() const;
+
+private:
+    static constexpr unsigned int RECV_BATCH = 32;
+
+    struct Route
+    {
+        uint32_t addr;
+        uint16_t port; // 0 in RTCP routes
+        uint32_t ssrc;
+        bool operator==(const Route &o) const { return addr == o.addr && port == o.port && ssrc == o.ssrc; }
+    };
+
+    struct RouteHash
+    {
+        size_t operator()(const Route &r) const
+        {
+            uint64_t k = (static_cast<uint64_t>(r.addr) << 32 | r.ssrc) ^ (static_cast<uint64_t>(r.port) << 17);
+            return std::hash<uint64_t>()(k * 0x9E3779B97F4A7C15ULL);
+        }
+    };
+
+    struct Endpoint
+    {
+        std::string iface;
+        uint16_t port{0};
+        int rtp_fd{-1};
+        int rtcp_fd{-1};
+        std::unique_ptr<SocketCtx> rtp_ctx;
+        std::unique_ptr<SocketCtx> rtcp_ctx;
+        std::vector<uint64_t> waiting; // subscriptions without a source yet, oldest first
+        uint64_t packets{0};
+        uint64_t unrouted{0};
+        uint64_t ambiguous{0}; // new sources with more than one subscription to go to
+    };
+
+    struct Subscription
+    {
+        size_t endpoint;
+        sockaddr_in server;
+        Receiver on_rtp;
+        Receiver on_rtcp;
+        bool has_ssrc{false};
+        uint32_t ssrc{0}; // network order, like Route::ssrc
+        bool routed{false};
+        Route route{};
+        bool dead{false};
+    };
+
+    SharedRtpSocket() = default;
+    ~SharedRtpSocket();
+    SharedRtpSocket(const SharedRtpSocket &) = delete;
+    SharedRtpSocket &operator=(const SharedRtpSocket &) = delete;
+
+    Endpoint *endpoint(const std::string &iface);
+    void handle_rtp(size_t ep, uint32_t event);
+    void handle_rtcp(size_t ep, uint32_t event);
+    Subscription *claim(size_t ep, const Route &route);
+    void bind_route(uint64_t id, Subscription &sub, const Route &route);
+    void unroute(uint64_t id, Subscription &sub);
+    void reap();
+
+    EpollLoop *loop_{nullptr};
+    BufferPool *pool_{nullptr};
+    std::vector<std::unique_ptr<Endpoint>> endpoints_;
+    std::unordered_map<uint64_t, Subscription> subs_;
+    std::unordered_map<Route, uint64_t, RouteHash> routes_;
+    std::unordered_map<Route, uint64_t, RouteHash> rtcp_routes_;
+    uint64_t next_id_{1};
+    bool dispatching_{false};
+    std::vector<uint64_t> dead_;
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "core/buffer_pool.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+/**
+ * UdpBatchSender collects the datagrams a relay produces during one wakeup
+ * and sends them to one peer with a single sendmmsg().
+ *
+ * Runs of equal-sized datagrams (the usual case for RTP carrying 7 TS
+ * packets) are merged into one UDP GSO send (UDP_SEGMENT), so the stack
+ * builds and routes one super-packet and only splits it at the device. GSO
+ * is probed per socket and given up after the first failure. The socket is
+ * expected to be connect()ed; otherwise set_peer() supplies the address.
+ * Datagrams the socket cannot take right now are dropped, as a full UDP
+ * send buffer would drop them anyway.
+ */
+class UdpBatchSender
+{
+public:
+    static constexpr size_t MAX_BATCH = 64;
+
+    explicit UdpBatchSender(BufferPool &pool);
+    ~UdpBatchSender();
+
+    UdpBatchSender(const UdpBatchSender &) = delete;
+    UdpBatchSender &operator=(const UdpBatchSender &) = delete;
+
+    // peer may be null for a connected socket.
+    void set_peer(int fd, const sockaddr_in *peer);
+    bool ready() const { return fd_ >= 0; }
+
+    // Takes the block; the datagram is buf[off, off + len). Flushes when the batch is full.
+    void add(std::unique_ptr<uint8_t[]> buf, size_t off, size_t len);
+
+    // Sends everything collected; returns the bytes the socket accepted.
+    size_t flush();
+
+    uint64_t syscalls() const { return syscalls_; }
+    uint64_t datagrams() const { return datagrams_; }
+    uint64_t gso_sends() const { return gso_sends_; }
+
+private:
+    // One GSO send carries at most this many segments and bytes.
+    static constexpr size_t GSO_MAX_SEGMENTS = 64;
+    static constexpr size_t GSO_MAX_BYTES = 63 * 1024;
+
+    struct Item
+    {
+        std::unique_ptr<uint8_t[]> buf;
+        size_t off{0};
+        size_t len{0};
+    };
+
+    size_t send_items(bool use_gso);
+    void clear();
+
+    BufferPool &pool_;
+    int fd_{-1};
+    sockaddr_in peer_{};
+    bool has_peer_{false};
+    bool gso_{false};
+
+    Item items_[MAX_BATCH];
+    size_t count_{0};
+
+    uint64_t syscalls_{0};
+    uint64_t datagrams_{0};
+    uint64_t gso_sends_{0};
+};
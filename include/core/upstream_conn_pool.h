@@ -0,0 +1,119 @@
+#pragma once
+
+#include "3rd/json.hpp"
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+class EpollLoop;
+class SocketCtx;
+
+/**
+ * UpstreamConnPool keeps pre-established TCP control connections to the
+ * upstream RTSP servers that sessions recently used, so a new session can
+ * send OPTIONS right away instead of paying a TCP handshake first.
+ *
+ * For every upstream (ip:port and interface) that was asked for within the
+ * last KEEP_WARM, the pool connects in the background until
+ * upstream_pool_size idle connections are available. Connections that idle
+ * longer than IDLE_TIMEOUT are replaced, and connections the server closes
+ * are dropped as soon as epoll reports it.
+ *
+ * A UDP-mode session that ends cleanly hands its control connection back
+ * through recycle(). The TEARDOWN is sent, and if the server answers 200 and
+ * keeps the connection open, the connection is reused for the next session.
+ * A server that closes it after TEARDOWN simply does not support multiple
+ * sessions per connection.
+ */
+class UpstreamConnPool
+{
+public:
+    struct Lease
+    {
+        int fd{-1};
+        int cseq{1};        // next CSeq to use on this connection
+        bool reused{false}; // carried an earlier RTSP session
+    };
+
+    static UpstreamConnPool &getInstance();
+
+    // Binds the pool to the worker's event loop and starts the refill timer.
+    void attach(EpollLoop *loop);
+
+    /**
+     * Takes an idle (or still connecting) connection to the upstream, or returns
+     * fd -1 if none is available. With allow_reused false only connections that
+     * never carried a session are handed out, e.g. for the MITM relay which
+     * forwards the client's own CSeq numbers.
+     */
+    Lease acquire(const std::string &ip, uint16_t port, const std::string &iface, bool allow_reused = true);
+
+    /**
+     * Sends 'teardown' on fd and keeps the connection for reuse if the server
+     * answers 200. Takes ownership of fd on success and returns false otherwise.
+     */
+    bool recycle(int fd, const std::string &ip, uint16_t port, const std::string &iface,
+                 const std::string &teardown, int next_cseq);
+
+    nlohmann::json get_info() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr std::chrono::seconds KEEP_WARM{300};
+    static constexpr std::chrono::seconds IDLE_TIMEOUT{25};
+    static constexpr std::chrono::seconds DRAIN_TIMEOUT{2};
+    static constexpr std::chrono::seconds CONNECT_BACKOFF{5};
+    static constexpr int REFILL_INTERVAL_MS = 1000;
+
+    enum class State
+    {
+        CONNECTING,
+        IDLE,
+        DRAINING // waiting for the TEARDOWN reply
+    };
+
+    struct Conn
+    {
+        std::string key;
+        State state{State::CONNECTING};
+        std::unique_ptr<SocketCtx> ctx;
+        Clock::time_point since;
+        int cseq{1};
+        bool reused{false};
+        std::string buf;
+    };
+
+    struct Upstream
+    {
+        std::string ip;
+        uint16_t port{0};
+        std::string iface;
+        Clock::time_point last_used;
+        Clock::time_point retry_after{};
+        uint64_t hits{0};
+        uint64_t misses{0};
+        uint64_t reuses{0};
+    };
+
+    UpstreamConnPool() = default;
+    UpstreamConnPool(const UpstreamConnPool &) = delete;
+    UpstreamConnPool &operator=(const UpstreamConnPool &) = delete;
+
+    static std::string key(const std::string &ip, uint16_t port, const std::string &iface);
+
+    void handle_conn(int fd, uint32_t event);
+    void handle_timer(uint32_t event);
+    void refill(const std::string &key, Upstream &upstream);
+    void open_conn(const std::string &key, Upstream &upstream);
+    void drop(int fd);
+    size_t pooled(const std::string &key) const;
+
+    EpollLoop *loop_{nullptr};
+    int timer_fd_{-1};
+    std::unique_ptr<SocketCtx> timer_ctx_;
+    std::map<std::string, Upstream> upstreams_;
+    std::map<int, Conn> conns_;
+};
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "common/rtsp_ctx.h"
+#include "3rd/json.hpp"
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * UpstreamSelector ranks equivalent RTSP edge servers listed in the
+ * "upstream_groups" section of config.json.
+ *
+ * For every host it keeps a moving average of the TCP connect RTT, the
+ * connect-to-PLAY handshake time and the failure rate. A new session whose
+ * upstream belongs to a group is sent to the fastest healthy host; the
+ * remaining hosts are returned behind it as fallbacks for reconnects.
+ * Hosts that failed several times in a row sit out for a cooldown period,
+ * and hosts without samples yet are tried first so every member gets measured.
+ */
+class UpstreamSelector
+{
+public:
+    static UpstreamSelector &getInstance();
+
+    /**
+     * Loads groups of the form [{"name": "edge", "hosts": ["10.0.0.1:554", "10.0.0.2"]}].
+     * The port defaults to 554; entries that do not parse are skipped with a warning.
+     */
+    void load(const nlohmann::json &groups);
+
+    /**
+     * Returns the upstreams to use for 'ctx', best first, all with ctx's path.
+     * If ctx is not part of a group the result is just ctx.
+     */
+    std::vector<rtspCtx> candidates(const rtspCtx &ctx);
+
+    void report_success(const rtspCtx &ctx, double connect_ms, double handshake_ms);
+    void report_failure(const rtspCtx &ctx);
+
+    nlohmann::json get_info();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr double EWMA_ALPHA = 0.25;
+    static constexpr int UNHEALTHY_FAILURES = 3;
+    static constexpr std::chrono::seconds COOLDOWN{30};
+
+    struct HostStats
+    {
+        uint64_t successes{0};
+        uint64_t failures{0};
+        double connect_ms{0};
+        double handshake_ms{0};
+        double failure_rate{0};
+        int consecutive_failures{0};
+        Clock::time_point last_failure{};
+    };
+
+    struct Host
+    {
+        std::string key; // "ip:port"
+        std::string ip;
+        uint16_t port{0};
+    };
+
+    struct Group
+    {
+        std::string name;
+        std::vector<Host> hosts;
+    };
+
+    UpstreamSelector() = default;
+    UpstreamSelector(const UpstreamSelector &) = delete;
+    UpstreamSelector &operator=(const UpstreamSelector &) = delete;
+
+    static std::string key(const rtspCtx &ctx);
+    static bool parse_host(const std::string &entry, Host &host);
+    bool is_healthy(const HostStats &stats, Clock::time_point now) const;
+    double score(const HostStats &stats) const;
+
+    std::mutex mutex_;
+    std::vector<Group> groups_;
+    std::map<std::string, size_t> group_of_;
+    std::map<std::string, HostStats> hosts_;
+};
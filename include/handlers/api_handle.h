@@ -14,13 +14,18 @@ public:
      * - /admin/*
      * - /favicon.ico
      * Also handles unauthorized access for these paths.
+     * The connection is left open; keep_alive says on entry whether the
+     * client asked to reuse it and on return whether that is still possible.
      * @return true if handled, false if it's a streaming request.
      */
-    static bool dispatch(int client_fd, const RequestInfo &info, EpollLoop *loop, BufferPool &pool);
+    static bool dispatch(int client_fd, const RequestInfo &info, EpollLoop *loop, BufferPool &pool, bool &keep_alive);
 
 private:
-    static void serve_admin_file(int client_fd, const RequestInfo &info);
-    static void send_json_response(int client_fd, const nlohmann::json &j);
+    static void serve_admin_file(int client_fd, const RequestInfo &info, bool &keep_alive);
+    static void handle_publish(int client_fd, const RequestInfo &info, bool &keep_alive);
+    static void send_json_response(int client_fd, const nlohmann::json &j, bool &keep_alive);
+    static void send_response(int client_fd, const char *status, const std::string &headers,
+                              const std::string &body, bool &keep_alive);
     static void send_unauthorized(int client_fd);
     static std::string get_mime_type(const std::string &path);
 };
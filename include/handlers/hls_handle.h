@@ -0,0 +1,24 @@
+#pragma once
+
+#include "protocol/request_parser.h"
+#include <netinet/in.h>
+
+class HlsHandle
+{
+public:
+    /**
+     * Handles HLS requests for a streaming path: /hls/<path>/index.m3u8,
+     * /hls/<path>/<seq>.ts and /hls/<path>/<seq>.<part>.ts, their CMAF
+     * counterparts cmaf.m3u8, init-<id>.mp4 and <seq>[.<part>].m4s, and the
+     * progressive fMP4 stream /hls/<path>/live.mp4, where <path> is what an
+     * HTTP-TS viewer would ask for (/rtp/..., /tv/..., /udp/...).
+     * taken is set if HlsOutput took the connection over; otherwise the
+     * answer has been sent and keep_alive says whether to reuse it.
+     * @return true if handled, false if it's not an HLS request.
+     */
+    static bool dispatch(int client_fd, const sockaddr_in &client_addr, const RequestInfo &info,
+                         bool &keep_alive, bool &taken);
+
+private:
+    static void send_error(int client_fd, const char *status, bool &keep_alive);
+};
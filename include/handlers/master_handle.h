@@ -1,16 +1,73 @@
 #pragma once
 
+#include "protocol/rtsp_message.h"
+#include <chrono>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
 #include <netinet/in.h>
 
 class EpollLoop;
 class BufferPool;
+class SocketCtx;
 
+/**
+ * MasterHandle is the front door of the server.
+ *
+ * Every accepted connection stays here until a complete request (start
+ * line, headers and any Content-Length body) has arrived, however it was
+ * split into TCP segments. The request is then dispatched to ApiHandle,
+ * HlsHandle, RtspToHttpHandle or RtspToRtspHandle; a WebSocket upgrade
+ * of a stream URL goes to RtspToHttpHandle with RequestInfo::websocket_key
+ * set. API, admin and HLS connections that ask for keep-alive come back
+ * for their next request (HLS answers that had to wait through accept()).
+ * A connection that does not complete a request within REQUEST_TIMEOUT,
+ * or whose request exceeds MAX_REQUEST_BYTES, is closed.
+ */
 class MasterHandle
 {
 public:
-    /**
-     * Entry point for every new connection.
-     * Identifies the protocol and dispatches to HTTPHandle or RTSPHandle.
-     */
-    static void handle(int client_fd, sockaddr_in client_addr, EpollLoop *loop, BufferPool &pool);
+    static MasterHandle &getInstance();
+
+    // Binds the front door to the worker's event loop and starts the timeout sweep.
+    void attach(EpollLoop *loop, BufferPool *pool);
+
+    // Takes a freshly accepted (non-blocking) connection, or one handed back after its answer.
+    void accept(int client_fd, const sockaddr_in &client_addr);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t MAX_REQUEST_BYTES = 16 * 1024;
+    static constexpr std::chrono::seconds REQUEST_TIMEOUT{10}; // also the keep-alive idle limit
+    static constexpr int SWEEP_INTERVAL_MS = 1000;
+
+    struct Conn
+    {
+        sockaddr_in addr{};
+        std::string buf; // partial request, empty while nothing is pending
+        RtspMessage msg;
+        Clock::time_point deadline;
+    };
+
+    MasterHandle() = default;
+    MasterHandle(const MasterHandle &) = delete;
+    MasterHandle &operator=(const MasterHandle &) = delete;
+
+    void handle_conn(int fd, uint32_t event);
+    void handle_timer(uint32_t event);
+
+    // Returns true if the connection stays here for another request.
+    bool dispatch(int fd, Conn &conn, std::string_view request, std::string_view pending);
+    void reject(int fd, const Conn &conn, const char *http_status);
+    void close_conn(int fd);
+
+    static std::string host_of(const sockaddr_in &addr);
+
+    EpollLoop *loop_{nullptr};
+    BufferPool *pool_{nullptr};
+    int timer_fd_{-1};
+    std::unique_ptr<SocketCtx> timer_ctx_;
+    std::unordered_map<int, Conn> conns_;
 };
@@ -9,7 +9,8 @@ class RtspToHttpHandle
 {
 public:
     /**
-     * Handles RTSP-over-HTTP streaming requests.
+     * Handles RTSP-over-HTTP streaming requests and udpxy-style multicast URLs,
+     * answered as plain HTTP or, for a WebSocket upgrade, in binary frames.
      * @return true if handled, false otherwise.
      */
     static bool dispatch(int client_fd, const sockaddr_in &client_addr, const RequestInfo &info, EpollLoop *loop, BufferPool &pool);
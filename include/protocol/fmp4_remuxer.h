@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Fmp4Remuxer turns a TS program into fragmented MP4 (CMAF): an init
+ * segment (ftyp + moov) and moof + mdat fragments.
+ *
+ * The first H.264/H.265 stream and the first ADTS AAC stream of the PMT
+ * become track 1 and 2; other streams are left out. Access units are
+ * rewritten from Annex B to length-prefixed NAL units with the parameter
+ * sets moved into the sample entry, and AAC frames lose their ADTS
+ * header. Samples wait in per-track buffers that keep their capacity
+ * until flush() writes them out as one fragment, so nothing is allocated
+ * per frame once the buffers have grown to a fragment's size.
+ *
+ * All tracks share one continuous timeline, which carries on across
+ * timestamp jumps and reset(). New parameter sets or a new audio format
+ * are held back at a boundary (config_pending()) until apply_config(), so
+ * that the caller can start a segment with the new init segment there.
+ */
+class Fmp4Remuxer
+{
+public:
+    Fmp4Remuxer();
+
+    // Takes one TS packet.
+    void push(const uint8_t *ts);
+
+    // The input restarted: partial frames are dropped and the program is
+    // learnt again; the timeline carries on.
+    void reset();
+
+    // Configured: init_segment() is valid and samples are queued.
+    bool ready() const { return ready_; }
+    // Changes whenever init_segment() does.
+    uint32_t version() const { return version_; }
+    const std::string &init_segment() const { return init_; }
+
+    // Samples with a new codec configuration are waiting; flush() stops
+    // before them until apply_config().
+    bool config_pending() const { return pending_; }
+    void apply_config();
+
+    bool has_samples() const { return !video_.samples.empty() || !audio_.samples.empty(); }
+    size_t queued_bytes() const { return video_.data.size() + audio_.data.size(); }
+
+    // Appends one moof + mdat with the queued samples to 'out'; false if
+    // there are none. 'independent' is set if it starts with a video sync
+    // sample (or there is no video).
+    bool flush(std::string &out, bool &independent);
+
+private:
+    static constexpr uint16_t NO_PID = 0x1FFF;
+    static constexpr uint32_t HZ = 90000;
+    static constexpr int64_t MAX_STEP = 10 * HZ;      // larger timestamp steps are jumps
+    static constexpr size_t MAX_PES_BYTES = 4 * 1024 * 1024;
+    static constexpr uint32_t DEFAULT_DURATION = 3600; // 25 fps until a frame rate is seen
+
+    struct Sample
+    {
+        uint32_t size;
+        uint32_t duration;
+        int32_t offset; // composition time offset
+        bool sync;
+    };
+
+    struct Config
+    {
+        // Video: NAL units without start code.
+        std::string vps, sps, pps;
+        uint16_t width{0};
+        uint16_t height{0};
+        uint8_t chroma_format{1};
+        uint8_t bit_depth_luma{8};
+        uint8_t bit_depth_chroma{8};
+        uint8_t sub_layers{1};
+        bool temporal_nesting{false};
+        uint8_t profile_tier_level[12]{}; // H.265 general profile, for hvcC
+        // Audio: from the ADTS header.
+        uint8_t profile{0};
+        uint8_t sample_rate_index{0xF};
+        uint8_t channels{0};
+    };
+
+    struct Track
+    {
+        uint16_t pid{NO_PID};
+        uint8_t stream_type{0};
+        uint32_t id{0};
+        uint32_t timescale{HZ};
+        Config cur;
+        Config next; // while config_pending()
+
+        // PES being assembled
+        std::string pes;
+        size_t pes_read{0}; // audio: bytes already taken as frames
+        bool in_pes{false};
+        bool random_access{false};
+        uint64_t pts{0};
+        uint64_t dts{0};
+        bool pts_valid{false}; // audio: pts is the time of the next frame
+
+        // Queued samples
+        std::vector<Sample> samples;
+        std::string data;
+        size_t boundary{0};    // samples before the pending configuration
+        uint64_t queue_time{0}; // decode time of samples[0]
+        uint64_t next_time{0};  // decode time of the next sample
+        bool timed{false};
+        uint32_t last_duration{DEFAULT_DURATION};
+    };
+
+    void on_pmt(const uint8_t *ts);
+    void drop_tracks();
+    void complete_video(uint64_t next_dts);
+    void extract_audio();
+    void on_audio_frame(const uint8_t *frame, size_t header, size_t length);
+    void update_video_config(const uint8_t *vps, size_t vps_len, const uint8_t *sps, size_t sps_len,
+                             const uint8_t *pps, size_t pps_len);
+    void begin_change();
+    bool try_ready(uint64_t origin);
+    void build_init(std::string &out) const;
+    void write_video_entry(std::string &out) const;
+    void write_audio_entry(std::string &out) const;
+    void queue(Track &t, const Sample &sample);
+    int64_t map(uint64_t ts) const;
+
+    uint16_t pmt_pid_{NO_PID};
+    Track video_;
+    Track audio_;
+    bool ready_{false};
+    bool pending_{false};
+    uint32_t version_{0};
+    uint32_t fragments_{0};
+    std::string init_;
+    std::string scratch_;
+
+    // Input time origin_in_ (90 kHz, 33 bits) is origin_out_ on the timeline.
+    uint64_t origin_in_{0};
+    int64_t origin_out_{0};
+};
@@ -0,0 +1,186 @@
+#pragma once
+
+#include "protocol/fmp4_remuxer.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * HlsSegmenter cuts a channel's TS into HLS media segments kept in memory.
+ *
+ * A segment is closed on the first keyframe (random access indicator, or an
+ * IDR/SPS packet on the video PID of the PMT) after it has reached
+ * segment_ms, and every segment starts with a copy of the last PAT and PMT,
+ * so each one decodes on its own. Durations are stream time from the PCR
+ * of the first PCR PID, or arrival time while there is none. With part_ms
+ * set, segments are also split into LL-HLS partial segments of at most
+ * about that length, a new one starting on every keyframe; without it the
+ * same pieces are only a storage unit of up to PIECE_BYTES.
+ *
+ * In FMP4 format the packets go through an Fmp4Remuxer instead and every
+ * piece is one CMAF fragment: LL-HLS parts, or fragments of up to
+ * FRAGMENT_MS without them. Segments refer to the init segment that was
+ * current when they started; a codec change starts a segment with a new one.
+ *
+ * Pieces are immutable once sealed and handed out as shared pointers, so a
+ * response can keep sending a segment that has since left the ring. The
+ * last 'window' segments are listed in the playlist, EXTRA_SEGMENTS more
+ * are kept for players still fetching them, and the buffers of evicted
+ * pieces nobody holds are reused.
+ */
+class HlsSegmenter
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    using Piece = std::shared_ptr<const std::string>;
+
+    enum class Format
+    {
+        TS,
+        FMP4
+    };
+
+    struct Options
+    {
+        int segment_ms{2000};
+        int part_ms{0}; // 0: no partial segments
+        size_t window{6};
+        Format format{Format::TS};
+    };
+
+    explicit HlsSegmenter(const Options &opts);
+
+    // Takes consecutive TS packets; returns true if a part or segment was completed.
+    bool push(const uint8_t *ts, size_t len, Clock::time_point now);
+
+    // The input restarted: closes the open segment and starts the next one,
+    // marked as a discontinuity, on the next keyframe. Returns true if a
+    // segment was completed.
+    bool discontinuity();
+
+    // Whether part 'part' of segment 'seq' (the whole segment if part < 0) is complete.
+    bool has(uint64_t seq, int part) const;
+    // True once a segment can be listed.
+    bool ready() const { return !segments_.empty(); }
+
+    // Segment being filled, and its number of complete parts.
+    uint64_t next_seq() const { return next_seq_; }
+    size_t next_part() const { return open_ ? open_seg_.parts.size() : 0; }
+
+    // Body of a complete segment or part; false if it is not (or no longer) held.
+    bool segment(uint64_t seq, std::vector<Piece> &pieces) const;
+    bool part(uint64_t seq, size_t index, Piece &piece) const;
+    // FMP4: the init segment a segment refers to (0 if unknown), and its body.
+    uint64_t init_of(uint64_t seq) const;
+    bool init(uint64_t id, Piece &piece) const;
+    // Newest part a viewer can start decoding from; false if there is none.
+    bool live_start(uint64_t &seq, size_t &part) const;
+    uint64_t first_seq() const { return segments_.empty() ? next_seq_ : segments_.front().seq; }
+
+    // Media playlist; 'query' is appended to every URI (e.g. "?token=...").
+    std::string playlist(const std::string &query) const;
+
+    int target_duration() const { return target_duration_; } // seconds
+    bool low_latency() const { return part_ticks_ > 0; }
+    Format format() const { return opts_.format; }
+
+    size_t held_bytes() const;
+    size_t segment_count() const { return segments_.size(); }
+    uint64_t discontinuities() const { return discontinuities_; }
+    uint64_t forced_cuts() const { return forced_cuts_; }
+
+private:
+    static constexpr uint64_t HZ = 90000;                 // stream time unit (PCR base)
+    static constexpr uint64_t PCR_WRAP = 1ULL << 33;
+    static constexpr uint64_t MAX_PCR_STEP = HZ;          // larger PCR jumps are discontinuities
+    static constexpr std::chrono::milliseconds PCR_LOST{1000}; // then arrival time takes over
+    static constexpr uint64_t MAX_SEGMENT_FACTOR = 3;     // cut without keyframe past this many targets
+    static constexpr size_t PIECE_BYTES = 256 * 1024;
+    static constexpr int FRAGMENT_MS = 500;               // FMP4 fragments without parts
+    static constexpr size_t EXTRA_SEGMENTS = 3;
+    static constexpr size_t MAX_SPARE_PIECES = 16;
+    static constexpr size_t PART_SEGMENTS = 4;            // complete segments whose parts are listed
+    static constexpr uint16_t NO_PID = 0x1FFF;
+
+    struct Part
+    {
+        Piece data;
+        uint64_t duration{0};
+        bool independent{false};
+    };
+
+    struct Segment
+    {
+        uint64_t seq{0};
+        uint64_t duration{0};
+        std::vector<Part> parts;
+        bool discontinuity{false};
+        uint64_t init{0};
+        std::chrono::system_clock::time_point start_time{};
+    };
+
+    void advance_clock(Clock::time_point now);
+    void on_pcr(uint64_t pcr, Clock::time_point now);
+    void on_psi(const uint8_t *ts, uint16_t pid);
+    bool is_keyframe(const uint8_t *ts, uint16_t pid) const;
+    bool change_init();
+
+    void start_segment(bool independent);
+    bool close_segment();
+    bool seal_part();
+    void start_piece(bool independent);
+    void recycle(Segment &segment);
+    const Segment *find(uint64_t seq) const;
+
+    Options opts_;
+    uint64_t target_ticks_;
+    uint64_t part_ticks_;
+    uint64_t piece_ticks_; // pieces are cut by time (parts, fragments), or by size if 0
+    int target_duration_;
+
+    // Program structure
+    uint16_t pmt_pid_{NO_PID};
+    uint16_t video_pid_{NO_PID};
+    uint8_t video_type_{0};
+    uint16_t pcr_pid_{NO_PID};
+    std::string pat_;
+    std::string pmt_;
+
+    // Stream clock in HZ ticks
+    uint64_t clock_{0};
+    uint64_t last_step_{0};
+    bool clock_started_{false};
+    bool pcr_locked_{false};
+    uint64_t last_pcr_{0};
+    Clock::time_point last_pcr_wall_{};
+    Clock::time_point last_wall_{};
+    uint64_t wait_start_{0}; // clock when the wait for a keyframe began
+
+    // Ring
+    std::deque<Segment> segments_;
+    Segment open_seg_;
+    bool open_{false};
+    bool pending_discontinuity_{false};
+    uint64_t next_seq_;
+    uint64_t discontinuity_seq_{0};
+    uint64_t seg_start_{0};
+
+    // Piece being filled
+    std::shared_ptr<std::string> piece_;
+    bool piece_independent_{false};
+    uint64_t piece_start_{0};
+    std::vector<std::shared_ptr<std::string>> spare_;
+
+    // FMP4
+    std::unique_ptr<Fmp4Remuxer> remux_;
+    uint32_t remux_version_{0};
+    uint64_t init_id_{0};
+    std::deque<std::pair<uint64_t, Piece>> inits_;
+
+    uint64_t discontinuities_{0};
+    uint64_t forced_cuts_{0};
+};
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+/**
+ * PcrPacer decides how much of a viewer's send queue may go out now so that
+ * TS leaves at the stream's own rate instead of in upstream bursts.
+ *
+ * It follows the queue as a byte stream: every queued TS packet carrying a
+ * PCR on the PCR PID (the first PID seen with one, normally video) becomes
+ * a checkpoint due at the wall time that PCR maps to, and the bytes up to
+ * and including it are released when it is due. Output runs burst_ms of
+ * stream time ahead of real time, so a new viewer gets that much at once
+ * and its player buffer fills quickly. A PCR jump (upstream restart,
+ * splice) or falling more than MAX_LATE behind rebases the clock instead
+ * of bursting to catch up. Bytes queued while no PCR is known are released
+ * at once.
+ */
+class PcrPacer
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit PcrPacer(std::chrono::milliseconds burst);
+
+    // Accounts for a queued packet of queued_len bytes ending with the TS payload ts/ts_len.
+    void on_queued(const uint8_t *ts, size_t ts_len, size_t queued_len, Clock::time_point now);
+
+    // Accounts for bytes that are not paced (HTTP headers, WebSocket control
+    // frames). They still leave in queue order, so they are released together
+    // with the media queued ahead of them.
+    void on_control(size_t len);
+
+    // Releases every checkpoint that is due; returns the next due time, or {} if none is pending.
+    Clock::time_point release(Clock::time_point now);
+
+    size_t allowance() const { return released_ - sent_; }
+    void on_sent(size_t n) { sent_ += n; }
+
+    // True once the initial burst is over and checkpoints have had to wait.
+    bool pacing() const { return pacing_; }
+
+    // Stream rate measured from PCR, 0 until known.
+    uint64_t rate_bytes_per_sec() const { return rate_; }
+
+    size_t held_bytes() const { return queued_ - released_; }
+    uint64_t rebases() const { return rebases_; }
+
+private:
+    static constexpr uint64_t PCR_HZ = 27000000;
+    static constexpr uint64_t PCR_WRAP = (1ULL << 33) * 300;
+    static constexpr uint64_t MAX_PCR_STEP = PCR_HZ;               // larger forward jumps are discontinuities
+    static constexpr std::chrono::milliseconds MAX_LATE{1000};
+    static constexpr uint64_t PCR_LOST_PACKETS = 8192;              // TS packets without PCR before unlocking
+    static constexpr uint64_t RATE_WINDOW = PCR_HZ;                 // stream time per rate sample
+
+    struct Checkpoint
+    {
+        size_t end;          // queue position just past the PCR packet
+        Clock::time_point due;
+    };
+
+    void on_pcr(uint64_t pcr, size_t end, Clock::time_point now);
+    void rebase(uint64_t pcr, size_t end, Clock::time_point origin);
+
+    std::chrono::milliseconds burst_;
+    std::deque<Checkpoint> checkpoints_;
+
+    size_t queued_{0};
+    size_t released_{0};
+    size_t sent_{0};
+
+    bool locked_{false};
+    uint16_t pcr_pid_{0};
+    uint64_t packets_since_pcr_{0};
+    uint64_t last_pcr_{0};
+    uint64_t stream_ticks_{0};   // 27 MHz ticks since the clock was based
+    Clock::time_point origin_{}; // wall time of stream tick 0
+
+    uint64_t window_ticks_{0};
+    size_t window_start_{0};     // queue position where the rate window began
+    uint64_t rate_{0};
+
+    bool pacing_{false};
+    uint64_t rebases_{0};
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include "3rd/json.hpp"
+
+/**
+ * PipelineProfile describes which RtpPipeline stages a session runs.
+ * The profile is resolved once per session; RtpPipeline::create() turns it
+ * into a compile-time specialized stage chain, so the per-packet path never
+ * consults these flags.
+ */
+struct PipelineProfile
+{
+    enum Stage : unsigned
+    {
+        KEYFRAME_GATE = 1u << 0,
+        PADDING_STRIP = 1u << 1,
+        NULL_STRIP = 1u << 2,
+        PID_FILTER = 1u << 3,
+        STATS = 1u << 4,
+        STAGE_COUNT = 5
+    };
+
+    std::string name{"default"};
+    bool wait_keyframe{false};
+    bool strip_padding{false};
+    bool strip_null{false};
+    bool stats{false};
+    std::vector<uint16_t> drop_pids;
+
+    unsigned stage_mask() const;
+};
+
+class PipelineProfiles
+{
+public:
+    /**
+     * Loads "pipeline_profiles" (name -> stage options) and "pipeline_rules"
+     * (URI substring -> profile name) from config.json.
+     */
+    static void load(const nlohmann::json &profiles, const nlohmann::json &rules);
+
+    /**
+     * Picks the profile for a session. An explicit ?profile= URL parameter wins,
+     * then the first matching rule, then the global --strip-padding/--wait-keyframe defaults.
+     */
+    static PipelineProfile resolve(const std::string &uri, const std::string &requested = "");
+
+private:
+    struct Rule
+    {
+        std::string match;
+        std::string profile;
+    };
+
+    static PipelineProfile default_profile();
+    static PipelineProfile from_json(const std::string &name, const nlohmann::json &j);
+
+    static std::map<std::string, PipelineProfile> profiles_;
+    static std::vector<Rule> rules_;
+};
@@ -1,19 +1,50 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
-#include <map>
-#include <vector>
+#include <string_view>
 
 struct RequestInfo
 {
+    static constexpr size_t MAX_PARAMS = 16; // further query parameters are ignored
+
     std::string method;
     std::string raw_uri;
     std::string version;
-    std::string clean_uri; // URI without token parameter
+    std::string clean_uri; // URI without proxy-local parameters (token, profile)
     std::string upstream_url; // Resolved upstream RTSP URL
-    std::map<std::string, std::string> params;
     bool is_authorized = false;
     bool is_http = true;
+
+    // udpxy-style multicast input, /udp/<group>:<port> or /rtp/[<source>@]<group>:<port>
+    // (/udp/ carries raw TS, /rtp/ RTP); multicast_port is 0 for any other request.
+    uint32_t multicast_group = 0;  // network order
+    uint32_t multicast_source = 0; // source-specific multicast, 0 for any source
+    uint16_t multicast_port = 0;
+    bool multicast_rtp = false;
+
+    // Sec-WebSocket-Key of a WebSocket upgrade request, empty for any other
+    // request; set by MasterHandle from the headers.
+    std::string websocket_key;
+
+    // Value of the first query parameter named key (as a view into raw_uri).
+    std::string_view param(std::string_view key) const;
+    bool has_param(std::string_view key) const;
+
+private:
+    friend class RequestParser;
+
+    // Offsets into raw_uri, so copies of the struct stay valid.
+    struct Param
+    {
+        uint16_t key_off;
+        uint16_t key_len;
+        uint16_t value_off;
+        uint16_t value_len;
+    };
+
+    Param params_[MAX_PARAMS]{};
+    size_t param_count_ = 0;
 };
 
 class RequestParser
@@ -22,8 +53,14 @@ public:
     /**
      * Parses the first line of an HTTP or RTSP request and extracts metadata.
      */
-    static RequestInfo parse(const std::string &request_data);
+    static RequestInfo parse(std::string_view request_data);
+
+    /**
+     * Removes proxy-local query parameters (token, profile) from a URI.
+     */
+    static std::string strip_local_params(const std::string &uri);
 
 private:
-    static std::vector<std::string> split(const std::string &str, char delimiter);
+    static bool is_local_param(std::string_view key);
+    static bool parse_multicast(std::string_view path, RequestInfo &info);
 };
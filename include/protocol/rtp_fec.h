@@ -0,0 +1,97 @@
+#pragma once
+
+#include "core/buffer_pool.h"
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <vector>
+
+struct RtpFecStats
+{
+    uint64_t fec_packets{0};
+    uint64_t recovered{0};
+    uint64_t unrecoverable{0}; // FEC groups discarded with two or more packets missing
+};
+
+/**
+ * RtpFecDecoder implements SMPTE 2022-1 (1D/2D parity) FEC reception.
+ *
+ * Media packets are recorded as they arrive; column (port+2) and row (port+4)
+ * FEC packets describe a group of media sequence numbers whose payloads,
+ * lengths, payload types and timestamps they XOR-protect. A group with exactly
+ * one missing packet is repaired and the rebuilt RTP packet is handed to the
+ * recover callback. Groups with more losses are kept pending so that a repair
+ * from the other dimension, or a late media packet, can make them recoverable.
+ */
+class RtpFecDecoder
+{
+public:
+    using RecoverFn = std::function<void(Packet &&)>;
+
+    RtpFecDecoder(BufferPool &pool, RecoverFn on_recovered);
+
+    RtpFecDecoder(const RtpFecDecoder &) = delete;
+    RtpFecDecoder &operator=(const RtpFecDecoder &) = delete;
+
+    // Records a media RTP packet received from the upstream.
+    void on_media(const uint8_t *buf, size_t len);
+
+    // Handles a column or row FEC packet.
+    void on_fec(const uint8_t *buf, size_t len);
+
+    void reset();
+    const RtpFecStats &stats() const { return stats_; }
+
+private:
+    static constexpr size_t HISTORY = 256;     // media packets kept; 2022-1 limits L*D to 100
+    static constexpr size_t MAX_PENDING = 64;  // FEC packets waiting for a second repair
+    static constexpr size_t FEC_HEADER_SIZE = 16;
+
+    struct MediaSlot
+    {
+        uint32_t ts{0};
+        uint16_t seq{0};
+        uint16_t len{0}; // payload length
+        uint8_t pt{0};
+        bool valid{false};
+    };
+
+    struct FecEntry
+    {
+        uint16_t base;
+        uint8_t offset;
+        uint8_t na;
+        uint16_t length_recovery;
+        uint8_t pt_recovery;
+        uint32_t ts_recovery;
+        std::vector<uint8_t> payload;
+    };
+
+    enum class Result
+    {
+        COMPLETE,  // nothing missing, entry is done
+        RECOVERED, // the single missing packet was rebuilt
+        PENDING,   // two or more missing
+        EXPIRED    // protected packets left the history window
+    };
+
+    bool has_media(uint16_t seq) const;
+    bool is_expired(const FecEntry &fec) const;
+    static bool covers(const FecEntry &fec, uint16_t seq);
+    void store_media(uint16_t seq, uint8_t pt, uint32_t ts, const uint8_t *payload, size_t len);
+    Result try_recover(const FecEntry &fec);
+    void retry_pending();
+
+    BufferPool &pool_;
+    RecoverFn on_recovered_;
+    size_t max_payload_;
+
+    std::vector<MediaSlot> slots_;
+    std::vector<uint8_t> payloads_; // HISTORY * max_payload_ bytes
+    uint16_t highest_seq_{0};
+    uint32_t ssrc_{0};
+    bool started_{false};
+
+    std::deque<FecEntry> pending_;
+    RtpFecStats stats_;
+};
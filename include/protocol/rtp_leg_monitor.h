@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct RtpLegStats
+{
+    uint64_t received{0};
+    uint64_t lost{0};        // gaps in this leg's own sequence numbers
+    uint64_t first{0};       // packets this leg delivered before any other leg
+    uint64_t lag_samples{0};
+    uint64_t lag_total_us{0};
+
+    double avg_lag_ms() const { return lag_samples ? lag_total_us / 1000.0 / lag_samples : 0.0; }
+};
+
+/**
+ * RtpLegMonitor observes the RTP legs of a redundant session before they are
+ * merged. For each leg it tracks loss from the leg's own sequence numbers and,
+ * for packets another leg delivered first, how far behind that copy arrived.
+ * It also tells whether the legs carry the same stream at all.
+ */
+class RtpLegMonitor
+{
+public:
+    explicit RtpLegMonitor(size_t legs);
+
+    void on_packet(size_t leg, const uint8_t *buf, size_t len);
+
+    // Restarts sequence tracking for a leg (e.g. after it reconnected); counters are kept.
+    void restart(size_t leg);
+
+    size_t legs() const { return legs_.size(); }
+    const RtpLegStats &stats(size_t leg) const { return legs_[leg].stats; }
+
+    // True once the leg has delivered a packet since it (re)started.
+    bool started(size_t leg) const { return legs_[leg].started; }
+
+    // True when two started legs carry one RTP stream: the same SSRC and
+    // sequence numbers within SEQ_WINDOW of each other. Only then can they be
+    // merged by sequence number.
+    bool same_stream(size_t a, size_t b) const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+    static constexpr size_t HISTORY = 1024;
+    static constexpr int SEQ_WINDOW = HISTORY / 2;
+
+    struct LegState
+    {
+        RtpLegStats stats;
+        bool started{false};
+        uint32_t ssrc{0};
+        uint16_t max_seq{0};
+        uint32_t cycles{0};
+        uint32_t base_seq{0};
+        uint64_t received_base{0}; // counters carried over from before restart()
+        uint64_t lost_base{0};
+    };
+
+    struct Arrival
+    {
+        Clock::time_point time;
+        uint16_t seq{0};
+        uint8_t leg{0};
+        bool valid{false};
+    };
+
+    std::vector<LegState> legs_;
+    std::vector<Arrival> arrivals_;
+};
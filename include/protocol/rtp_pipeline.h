@@ -1,26 +1,43 @@
 #pragma once
 #include <cstdint>
 #include <cstddef>
+#include <memory>
+#include "protocol/pipeline_profile.h"
 
+struct RtpPipelineStats
+{
+    uint64_t packets{0};
+    uint64_t dropped{0};
+    uint64_t ts_packets{0};
+    uint64_t cc_errors{0};
+};
+
+/**
+ * RtpPipeline is the per-session packet processing chain.
+ * Concrete pipelines are RtpStageChain<...> specializations (see rtp_stages.h)
+ * selected by create() from the session's PipelineProfile.
+ */
 class RtpPipeline {
 public:
-    RtpPipeline();
-    ~RtpPipeline();
+    virtual ~RtpPipeline() = default;
+
+    // Builds the stage chain matching the profile.
+    static std::unique_ptr<RtpPipeline> create(const PipelineProfile &profile);
 
     // Processes an RTP packet.
     // Returns true if the packet should be forwarded, false if it should be dropped.
     // 'len' may be modified if padding or null packets are stripped.
-    bool process(uint8_t *buf, size_t &len);
-
-    // Helper to get the offset of the payload (skips RTP header and extensions)
-    static bool get_payload_offset(const uint8_t *buf, size_t len, size_t &offset);
+    virtual bool process(uint8_t *buf, size_t &len) = 0;
 
     // Reset the pipeline state (e.g. for a new stream/play)
-    void reset();
+    virtual void reset() = 0;
+
+    virtual const PipelineProfile &profile() const = 0;
+    virtual RtpPipelineStats stats() const = 0;
 
-private:
-    void strip_rtp_padding_and_ts_null(uint8_t *buf, size_t &len);
-    bool check_keyframe(const uint8_t *buf, size_t len);
+    // Helper to get the offset of the payload (skips RTP header and extensions)
+    static bool get_payload_offset(const uint8_t *buf, size_t len, size_t &offset);
 
-    bool wait_for_keyframe_;
+    // Returns true if the RTP packet carries a TS sync point (PAT, RAI or key NAL units).
+    static bool check_keyframe(const uint8_t *buf, size_t len);
 };
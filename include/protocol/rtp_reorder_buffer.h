@@ -0,0 +1,101 @@
+#pragma once
+
+#include "core/buffer_pool.h"
+#include <bitset>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+struct RtpSequenceStats
+{
+    uint64_t received{0};
+    uint64_t lost{0};
+    uint64_t reordered{0};
+    uint64_t duplicates{0};
+    uint64_t late{0};
+};
+
+/**
+ * RtpReorderBuffer restores RTP sequence order for UDP upstreams.
+ *
+ * Packets are keyed on the RTP sequence number in a small window. In-order
+ * packets pass straight through; a gap holds later packets until the missing
+ * one arrives or the oldest held packet exceeds the latency budget, at which
+ * point the gap is counted as lost and skipped. Duplicates are always dropped.
+ *
+ * With a latency budget of 0 nothing is held: packets are emitted in arrival
+ * order and only duplicate suppression and the counters remain active.
+ */
+class RtpReorderBuffer
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    using EmitFn = std::function<void(Packet &&)>;
+
+    RtpReorderBuffer(BufferPool &pool, uint32_t latency_ms, EmitFn emit);
+    ~RtpReorderBuffer();
+
+    RtpReorderBuffer(const RtpReorderBuffer &) = delete;
+    RtpReorderBuffer &operator=(const RtpReorderBuffer &) = delete;
+
+    /**
+     * Feeds one received RTP packet (Packet::offset is ignored).
+     * Packets that are not valid RTP are passed through untouched.
+     */
+    void push(Packet &&pkt);
+
+    /**
+     * Skips gaps whose oldest held packet has exceeded the latency budget.
+     */
+    void flush_expired();
+
+    /**
+     * Milliseconds until flush_expired() has work to do, or -1 if nothing is held.
+     */
+    int next_deadline_ms() const;
+
+    // Emits everything still held, in order, counting remaining gaps as lost.
+    void flush_all();
+    void reset();
+
+    bool is_holding() const { return held_ > 0; }
+    const RtpSequenceStats &stats() const { return stats_; }
+
+private:
+    static constexpr size_t WINDOW = 128;        // held slots, must be a power of two
+    static constexpr int MAX_DROPOUT = 3000;     // larger forward jumps are a stream restart
+    static constexpr int MAX_MISORDER = 100;     // larger backward jumps are a restart candidate
+    static constexpr size_t HISTORY = 1024;      // emitted sequence numbers remembered for dedup
+
+    struct Slot
+    {
+        Packet pkt{std::unique_ptr<uint8_t[]>(), 0, 0};
+        Clock::time_point arrival;
+        uint16_t seq{0};
+        bool used{false};
+    };
+
+    static int16_t seq_diff(uint16_t a, uint16_t b) { return static_cast<int16_t>(a - b); }
+
+    void emit(Packet &&pkt, uint16_t seq);
+    void emit_ready();
+    void skip_to_next_held();
+    void restart(uint16_t seq);
+
+    BufferPool &pool_;
+    std::chrono::milliseconds latency_;
+    EmitFn emit_;
+
+    std::vector<Slot> slots_;
+    size_t held_{0};
+
+    bool started_{false};
+    uint16_t next_seq_{0};       // next sequence number to emit
+    uint16_t highest_seq_{0};    // highest sequence number received
+    uint16_t bad_seq_{0};        // candidate restart sequence (RFC 3550 A.1)
+    bool bad_seq_valid_{false};
+    std::bitset<HISTORY> seen_;
+
+    RtpSequenceStats stats_;
+};
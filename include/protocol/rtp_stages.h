@@ -0,0 +1,238 @@
+#pragma once
+
+#include "protocol/rtp_pipeline.h"
+#include "protocol/ts_utils.h"
+#include "core/logger.h"
+#include "utils/utils.h"
+#include <bitset>
+#include <tuple>
+#include <cstring>
+
+/**
+ * Building blocks for RtpStageChain.
+ * Each stage is a plain struct with:
+ *   bool operator()(RtpPacketView &pkt)   - return false to drop the packet
+ *   void reset(const PipelineProfile &)   - restart per-stream state
+ *   void collect(RtpPipelineStats &) const
+ * The chain is assembled as a template, so disabled stages are replaced by
+ * Passthrough and compile away instead of being skipped at runtime.
+ */
+struct RtpPacketView
+{
+    uint8_t *buf;
+    size_t len;
+    size_t payload_off;
+};
+
+namespace rtp_stage
+{
+    struct Passthrough
+    {
+        explicit Passthrough(const PipelineProfile &) {}
+        bool operator()(RtpPacketView &) { return true; }
+        void reset(const PipelineProfile &) {}
+        void collect(RtpPipelineStats &) const {}
+    };
+
+    // Drops everything until the first TS sync point after reset().
+    struct KeyframeGate
+    {
+        bool waiting{true};
+
+        explicit KeyframeGate(const PipelineProfile &) {}
+
+        bool operator()(RtpPacketView &pkt)
+        {
+            if (likely(!waiting)) return true;
+            if (ts::find_sync_point(pkt.buf + pkt.payload_off, pkt.len - pkt.payload_off))
+            {
+                Logger::debug("[Pipeline] Keyframe/PAT found, start forwarding");
+                waiting = false;
+                return true;
+            }
+            return false; // Drop until keyframe
+        }
+        void reset(const PipelineProfile &) { waiting = true; }
+        void collect(RtpPipelineStats &) const {}
+    };
+
+    // Removes RTP padding and clears the P bit.
+    struct PaddingStrip
+    {
+        explicit PaddingStrip(const PipelineProfile &) {}
+
+        bool operator()(RtpPacketView &pkt)
+        {
+            if (unlikely(pkt.buf[0] & 0x20))
+            {
+                uint8_t padding_len = pkt.buf[pkt.len - 1];
+                if (likely(padding_len > 0 && padding_len <= (pkt.len - pkt.payload_off)))
+                {
+                    pkt.len -= padding_len;
+                }
+                pkt.buf[0] &= ~0x20; // Clear padding bit
+            }
+            // A header-only packet is still forwarded; only TS stages drop emptied payloads.
+            return true;
+        }
+        void reset(const PipelineProfile &) {}
+        void collect(RtpPipelineStats &) const {}
+    };
+
+    // Compacts the TS payload in place, keeping only packets accepted by 'keep'.
+    template <typename Pred>
+    inline bool compact_ts(RtpPacketView &pkt, Pred keep)
+    {
+        uint8_t *payload = pkt.buf + pkt.payload_off;
+        size_t payload_len = pkt.len - pkt.payload_off;
+        // Check if it's MPEG-TS (starts with 0x47)
+        if (unlikely(payload_len < ts::PACKET_SIZE || payload[0] != 0x47)) return true;
+
+        size_t new_payload_len = 0;
+        for (size_t i = 0; i + ts::PACKET_SIZE <= payload_len; i += ts::PACKET_SIZE)
+        {
+            if (likely(keep(payload + i)))
+            {
+                if (unlikely(new_payload_len != i))
+                {
+                    memmove(payload + new_payload_len, payload + i, ts::PACKET_SIZE);
+                }
+                new_payload_len += ts::PACKET_SIZE;
+            }
+        }
+        pkt.len = pkt.payload_off + new_payload_len;
+        pkt.buf[0] &= ~0x20; // Ensure padding bit is clear if we modified the packet
+        return new_payload_len > 0;
+    }
+
+    // Strips TS null packets (PID 0x1FFF).
+    struct NullStrip
+    {
+        explicit NullStrip(const PipelineProfile &) {}
+
+        bool operator()(RtpPacketView &pkt)
+        {
+            return compact_ts(pkt, [](const uint8_t *ts) { return ts::pid(ts) != ts::NULL_PID; });
+        }
+        void reset(const PipelineProfile &) {}
+        void collect(RtpPipelineStats &) const {}
+    };
+
+    // Strips the PIDs listed in the profile's drop_pids.
+    struct PidFilter
+    {
+        std::bitset<8192> drop;
+
+        explicit PidFilter(const PipelineProfile &profile)
+        {
+            for (uint16_t pid : profile.drop_pids) drop.set(pid);
+        }
+
+        bool operator()(RtpPacketView &pkt)
+        {
+            return compact_ts(pkt, [this](const uint8_t *ts) { return !drop.test(ts::pid(ts)); });
+        }
+        void reset(const PipelineProfile &) {}
+        void collect(RtpPipelineStats &) const {}
+    };
+
+    // Counts forwarded TS packets and continuity counter errors per PID.
+    struct Stats
+    {
+        uint8_t last_cc[8192];
+        uint64_t ts_packets{0};
+        uint64_t cc_errors{0};
+
+        explicit Stats(const PipelineProfile &) { memset(last_cc, 0xFF, sizeof(last_cc)); }
+
+        bool operator()(RtpPacketView &pkt)
+        {
+            const uint8_t *payload = pkt.buf + pkt.payload_off;
+            size_t payload_len = pkt.len - pkt.payload_off;
+            if (unlikely(payload_len < ts::PACKET_SIZE || payload[0] != 0x47)) return true;
+
+            for (size_t i = 0; i + ts::PACKET_SIZE <= payload_len; i += ts::PACKET_SIZE)
+            {
+                const uint8_t *p = payload + i;
+                uint16_t pid = ts::pid(p);
+                ++ts_packets;
+                if (pid == ts::NULL_PID || !ts::has_payload(p)) continue;
+
+                uint8_t cc = ts::cc(p);
+                uint8_t last = last_cc[pid];
+                bool discontinuity = ts::has_adaptation(p) && (p[5] & 0x80);
+                if (last != 0xFF && !discontinuity && cc != last && cc != ((last + 1) & 0x0F))
+                {
+                    ++cc_errors;
+                }
+                last_cc[pid] = cc;
+            }
+            return true;
+        }
+        void reset(const PipelineProfile &) { memset(last_cc, 0xFF, sizeof(last_cc)); }
+        void collect(RtpPipelineStats &s) const
+        {
+            s.ts_packets = ts_packets;
+            s.cc_errors = cc_errors;
+        }
+    };
+
+    template <bool Enabled, typename Stage>
+    using StageIf = std::conditional_t<Enabled, Stage, Passthrough>;
+}
+
+template <typename... Stages>
+class RtpStageChain final : public RtpPipeline
+{
+public:
+    explicit RtpStageChain(const PipelineProfile &profile)
+        : profile_(profile), stages_(Stages(profile)...) {}
+
+    bool process(uint8_t *buf, size_t &len) override
+    {
+        ++stats_.packets;
+        RtpPacketView pkt{buf, len, 0};
+        if (unlikely(!get_payload_offset(buf, len, pkt.payload_off)))
+        {
+            ++stats_.dropped;
+            return false;
+        }
+
+        bool keep = std::apply([&pkt](auto &...stage) { return (stage(pkt) && ...); }, stages_);
+        len = pkt.len;
+        if (unlikely(!keep || len == 0))
+        {
+            ++stats_.dropped;
+            return false;
+        }
+        return true;
+    }
+
+    void reset() override
+    {
+        std::apply([this](auto &...stage) { (stage.reset(profile_), ...); }, stages_);
+    }
+
+    const PipelineProfile &profile() const override { return profile_; }
+
+    RtpPipelineStats stats() const override
+    {
+        RtpPipelineStats s = stats_;
+        std::apply([&s](const auto &...stage) { (stage.collect(s), ...); }, stages_);
+        return s;
+    }
+
+private:
+    PipelineProfile profile_;
+    std::tuple<Stages...> stages_;
+    RtpPipelineStats stats_;
+};
+
+// The chain type for a PipelineProfile::stage_mask() value, in fixed stage order.
+template <unsigned Mask>
+using RtpStageChainFor = RtpStageChain<
+    rtp_stage::StageIf<(Mask & PipelineProfile::KEYFRAME_GATE) != 0, rtp_stage::KeyframeGate>,
+    rtp_stage::StageIf<(Mask & PipelineProfile::PADDING_STRIP) != 0, rtp_stage::PaddingStrip>,
+    rtp_stage::StageIf<(Mask & PipelineProfile::NULL_STRIP) != 0, rtp_stage::NullStrip>,
+    rtp_stage::StageIf<(Mask & PipelineProfile::PID_FILTER) != 0, rtp_stage::PidFilter>,
+    rtp_stage::StageIf<(Mask & PipelineProfile::STATS) != 0, rtp_stage::Stats>>;
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "protocol/rtsp_message.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <sys/types.h>
+
+class BufferPool;
+
+/**
+ * RtspDemuxer splits an RTSP control connection into messages and
+ * '$'-framed interleaved packets.
+ *
+ * Bytes are received straight into a fixed-capacity buffer with large
+ * reads. Consumed items only advance the read offset; the unconsumed tail
+ * (at most one partial item) is moved to the front when the free space at
+ * the end runs low, so every returned item is one contiguous span and the
+ * per-packet cost does not grow with the amount of buffered data.
+ *
+ * Messages are tokenized incrementally by RtspMessage as bytes arrive, so
+ * a response split over many reads is not rescanned from the start.
+ *
+ * With a frame pool set, interleaved payloads are copied once into pool
+ * blocks instead of being returned as spans, leaving room in front of the
+ * payload for a header the caller wants to prepend. The rest of a frame
+ * that is split across reads is received straight into its block.
+ *
+ * Spans returned by next() stay valid until the next read_from() or feed();
+ * the message index until the next call to next().
+ */
+class RtspDemuxer
+{
+public:
+    enum class Type
+    {
+        NONE,    // need more data
+        FRAME,   // interleaved packet: channel, data/len = payload
+        MESSAGE, // RTSP request or response: data/len = headers + body, message = index
+        ERROR    // malformed message or item larger than the buffer
+    };
+
+    struct Item
+    {
+        Type type{Type::NONE};
+        uint8_t channel{0};
+        const uint8_t *data{nullptr};
+        size_t len{0};
+        const RtspMessage *message{nullptr};
+        std::unique_ptr<uint8_t[]> block; // FRAME in a pool block (data = block + headroom); caller releases it
+    };
+
+    // Must hold the largest interleaved frame (4 + 65535) plus one read.
+    static constexpr size_t DEFAULT_CAPACITY = 128 * 1024;
+
+    explicit RtspDemuxer(size_t capacity = DEFAULT_CAPACITY);
+    ~RtspDemuxer();
+
+    RtspDemuxer(const RtspDemuxer &) = delete;
+    RtspDemuxer &operator=(const RtspDemuxer &) = delete;
+
+    // recv() into the free space. Same return convention as recv(); fails
+    // with ENOBUFS if the buffer is full of an unparseable item.
+    ssize_t read_from(int fd);
+
+    // Appends already received bytes. Returns false if they do not fit.
+    bool feed(const void *data, size_t len);
+
+    Item next();
+
+    // Returns frames in the smallest block from 'pool' that holds 'headroom' + payload.
+    void set_frame_pool(BufferPool *pool, size_t headroom);
+
+    size_t buffered() const { return tail_ - head_ + (fill_ ? 4 + fill_got_ : 0); }
+    void clear();
+
+private:
+    void compact();
+    Item take_fill();
+
+    std::unique_ptr<uint8_t[]> buf_;
+    size_t capacity_;
+    size_t head_{0};
+    size_t tail_{0};
+    bool message_pending_{false}; // msg_ holds a completed item to be reset
+    RtspMessage msg_;
+
+    BufferPool *pool_{nullptr};
+    size_t headroom_{0};
+    std::unique_ptr<uint8_t[]> fill_; // block of a frame still being received
+    uint8_t fill_channel_{0};
+    size_t fill_len_{0};
+    size_t fill_got_{0};
+};
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+/**
+ * RtspMessage tokenizes an RTSP/1.0 request or response in one pass.
+ *
+ * The start line and every header line are indexed as offsets into the
+ * caller's buffer, so lookups are case-insensitive comparisons over a small
+ * array instead of rescans and lowercased copies of the message. parse()
+ * can be called again with a longer prefix of the same stream after a
+ * partial read and resumes at the first incomplete line; the buffer may
+ * move between calls. Views returned by the accessors point into the
+ * buffer passed to the most recent parse().
+ */
+class RtspMessage
+{
+public:
+    enum class Result
+    {
+        INCOMPLETE,
+        COMPLETE, // start line, headers and the Content-Length body are in
+        ERROR
+    };
+
+    static constexpr size_t MAX_HEADERS = 32; // further headers are skipped
+    static constexpr size_t MAX_HEADER_BYTES = 16 * 1024;
+    static constexpr size_t MAX_BODY = 64 * 1024;
+
+    void reset();
+    Result parse(std::string_view data);
+
+    bool headers_done() const { return headers_done_; }
+    bool is_response() const { return response_; }
+
+    // Request line: METHOD URI VERSION; response line: VERSION CODE REASON.
+    std::string_view method() const { return response_ ? std::string_view() : view(start_[0]); }
+    std::string_view uri() const { return response_ ? std::string_view() : view(start_[1]); }
+    std::string_view version() const { return view(start_[response_ ? 0 : 2]); }
+    std::string_view reason() const { return response_ ? view(start_[2]) : std::string_view(); }
+    int status_code() const { return status_; }
+
+    // Value of the first header with this name (trimmed), empty if absent.
+    std::string_view header(std::string_view name) const;
+    bool has_header(std::string_view name) const;
+    size_t header_count() const { return count_; }
+    std::string_view header_name(size_t i) const { return view(fields_[i].name); }
+    std::string_view header_value(size_t i) const { return view(fields_[i].value); }
+
+    // Raw header lines past MAX_HEADERS, including their line ends; usually empty.
+    std::string_view unindexed_headers() const
+    {
+        return overflow_off_ ? std::string_view(base_ + overflow_off_, blank_off_ - overflow_off_) : std::string_view();
+    }
+
+    // Session id without the ";timeout=" parameter.
+    std::string_view session_id() const;
+
+    size_t header_length() const { return header_len_; }
+    size_t content_length() const { return content_length_; }
+    size_t length() const { return header_len_ + content_length_; }
+    std::string_view head() const { return std::string_view(base_, header_len_); }
+    std::string_view body() const { return std::string_view(base_ + header_len_, content_length_); }
+
+    static bool iequals(std::string_view a, std::string_view b);
+
+private:
+    struct Span
+    {
+        uint32_t off{0};
+        uint32_t len{0};
+    };
+
+    struct Field
+    {
+        Span name;
+        Span value;
+    };
+
+    std::string_view view(Span s) const { return std::string_view(base_ + s.off, s.len); }
+    bool parse_start_line(size_t off, size_t len);
+    bool parse_header_line(size_t off, size_t len);
+
+    const char *base_{nullptr};
+    size_t pos_{0}; // first byte of the next unparsed line
+    bool start_done_{false};
+    bool headers_done_{false};
+    bool response_{false};
+    int status_{-1};
+    Span start_[3];
+    Field fields_[MAX_HEADERS];
+    size_t count_{0};
+    size_t overflow_off_{0}; // first header line not indexed, 0 if none
+    size_t blank_off_{0};    // start of the blank line ending the headers
+    size_t header_len_{0};
+    size_t content_length_{0};
+};
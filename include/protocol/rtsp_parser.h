@@ -1,11 +1,14 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <map>
 #include <vector>
 
 struct rtspCtx;
 struct Media;
+class RtspMessage;
 
 class rtspParser
 {
@@ -34,5 +37,19 @@ public:
     static int get_content_length(const std::string &resp);
     static std::string extract_header_value(const std::string &msg, const std::string &header_name);
 
+    // Same lookups on an already tokenized message, without rescanning it.
+    static int parse_server_ports(const RtspMessage &msg, rtspCtx &ctx);
+    static int parse_session_id(const RtspMessage &msg, rtspCtx &ctx);
+
+    // Reads "<key><a>-<b>" from a Transport value, e.g. key "client_port=".
+    static bool parse_transport_pair(std::string_view transport, std::string_view key, uint16_t &first, uint16_t &second);
+
+    // Reads the hexadecimal "ssrc=" parameter of a Transport value.
+    static bool parse_transport_ssrc(std::string_view transport, uint32_t &ssrc);
+
+    // Case-insensitive header lookup over the raw text, stopping at the blank line.
+    static std::string_view find_header(std::string_view msg, std::string_view header_name);
+
 private:
+    static int parse_transport_ports(std::string_view transport, rtspCtx &ctx);
 };
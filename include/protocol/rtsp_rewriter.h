@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+class RtspMessage;
+
+/**
+ * RtspRewriter turns an upstream RTSP response into the one the MITM
+ * client should see, in a single pass over the parsed header index.
+ *
+ * Transport is rebuilt parameter by parameter for the downstream leg;
+ * absolute URIs in Content-Base, Content-Location, Location and RTP-Info
+ * and in SDP a=control lines are moved under the proxy path; SDP c=/o=
+ * addresses become the proxy address and Content-Length follows the new
+ * body. Everything else is copied through unchanged. No regex and no
+ * per-call allocation once the output and scratch buffers have grown.
+ */
+class RtspRewriter
+{
+public:
+    struct Rules
+    {
+        std::string_view upstream_host; // host whose URIs are rewritten
+        std::string_view proxy_ip;      // address the client connected to
+        uint16_t proxy_port{0};
+
+        std::string_view transport_protocol; // replaces MP2T/RTP/UDP when set
+        bool interleaved{false};             // client uses TCP interleaved
+        uint8_t rtp_channel{0};
+        uint8_t rtcp_channel{1};
+        uint16_t client_rtp_port{0};
+        uint16_t client_rtcp_port{0};
+        uint16_t server_rtp_port{0}; // relay ports facing the client
+        uint16_t server_rtcp_port{0};
+    };
+
+    // Appends the rewritten message to out.
+    void rewrite_response(const RtspMessage &msg, const Rules &rules, std::string &out);
+
+    // Appends value with every rtsp://<upstream_host>[:port]/ prefix moved under the proxy path.
+    static void rewrite_uris(std::string_view value, const Rules &rules, std::string &out);
+
+private:
+    static void rewrite_transport(std::string_view value, const Rules &rules, std::string &out);
+    void rewrite_sdp(std::string_view sdp, const Rules &rules);
+
+    std::string body_;
+};
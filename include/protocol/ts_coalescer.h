@@ -0,0 +1,65 @@
+#pragma once
+
+#include "core/buffer_pool.h"
+#include "protocol/ts_utils.h"
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+/**
+ * TsCoalescer gathers consecutive TS payloads into larger chunks so that a
+ * viewer gets one write of up to CHUNK_BYTES instead of one per RTP packet.
+ *
+ * A chunk is emitted when the next payload would not fit, when its oldest
+ * byte has waited for the latency budget, or before a payload that starts
+ * a new GOP (PAT or random access indicator), so chunks begin on the points
+ * a falling-behind viewer resumes from. Payloads are whole TS packets, so
+ * chunks stay 188-byte aligned. A payload too large to share a chunk is
+ * passed through as is. Chunks start HEADROOM bytes into their block, so a
+ * framing header (WebSocket) can be put in front of them without a copy.
+ */
+class TsCoalescer
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    using EmitFn = std::function<void(Packet &&)>;
+
+    // A whole number of TS packets that still fits the pool's jumbo class.
+    static constexpr size_t CHUNK_BYTES = 348 * ts::PACKET_SIZE;
+    static constexpr size_t HEADROOM = 16;
+
+    TsCoalescer(BufferPool &pool, uint32_t latency_ms, EmitFn emit);
+    ~TsCoalescer();
+
+    TsCoalescer(const TsCoalescer &) = delete;
+    TsCoalescer &operator=(const TsCoalescer &) = delete;
+
+    // Takes a packet whose TS payload runs from pkt.offset to pkt.length.
+    void push(Packet &&pkt);
+
+    // Emits the chunk if it has waited for the latency budget.
+    void flush_expired();
+
+    // Milliseconds until flush_expired() has work to do, or -1 if nothing is held.
+    int next_deadline_ms() const;
+
+    void flush();
+
+    bool is_holding() const { return chunk_len_ > 0; }
+    uint64_t chunks() const { return chunks_; }
+    uint64_t payloads() const { return payloads_; }
+
+private:
+    static bool starts_gop(const uint8_t *ts, size_t len);
+
+    BufferPool &pool_;
+    std::chrono::milliseconds latency_;
+    EmitFn emit_;
+
+    std::unique_ptr<uint8_t[]> chunk_;
+    size_t chunk_len_{0};
+    Clock::time_point started_{};
+
+    uint64_t chunks_{0};
+    uint64_t payloads_{0};
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * TsResync splices a restarted upstream into a running TS output.
+ *
+ * After arm() the payloads of incoming RTP packets are dropped until the
+ * first TS sync point, so the viewer resumes on a keyframe instead of a
+ * half GOP. From there on the first packet of every PID, and the first one
+ * carrying a PCR, get the discontinuity_indicator set so players accept the
+ * continuity counter and timebase jump. Packets without an adaptation field
+ * cannot be flagged in place and pass unchanged.
+ */
+class TsResync
+{
+public:
+    void arm();
+
+    // Starts flagging right away, for a caller that skipped to a sync point itself.
+    void mark();
+
+    // Returns false if the RTP packet should be dropped.
+    bool process(uint8_t *payload, size_t len);
+
+    bool active() const { return waiting_ || marking_ > 0; }
+    uint64_t resumes() const { return resumes_; }
+
+private:
+    // TS packets after the sync point in which PIDs are still flagged (~100 ms at 15 Mbit/s).
+    static constexpr uint32_t MARK_WINDOW = 1024;
+
+    bool waiting_{false};
+    uint32_t marking_{0};
+    uint64_t resumes_{0};
+    std::bitset<8192> seen_;
+    std::bitset<8192> pcr_seen_;
+};
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+/**
+ * Small inline helpers for inspecting MPEG-TS packets in place.
+ * All functions expect 'ts' to point at a 188-byte packet starting with 0x47.
+ */
+namespace ts
+{
+    constexpr size_t PACKET_SIZE = 188;
+    constexpr uint16_t NULL_PID = 0x1FFF;
+
+    inline uint16_t pid(const uint8_t *ts) { return ((ts[1] & 0x1F) << 8) | ts[2]; }
+    inline bool pusi(const uint8_t *ts) { return ts[1] & 0x40; }
+    inline uint8_t afc(const uint8_t *ts) { return (ts[3] & 0x30) >> 4; }
+    inline uint8_t cc(const uint8_t *ts) { return ts[3] & 0x0F; }
+    inline bool has_payload(const uint8_t *ts) { return afc(ts) & 0x01; }
+    inline bool has_adaptation(const uint8_t *ts) { return (afc(ts) & 0x02) && ts[4] > 0; }
+
+    // Offset of the TS payload inside the packet (188 if there is none).
+    inline size_t payload_offset(const uint8_t *ts)
+    {
+        size_t off = 4;
+        if (afc(ts) & 0x02) off += 1 + ts[4];
+        return off > PACKET_SIZE ? PACKET_SIZE : off;
+    }
+
+    // Sets the discontinuity_indicator; only possible if an adaptation field is present.
+    inline bool set_discontinuity(uint8_t *ts)
+    {
+        if (!has_adaptation(ts)) return false;
+        ts[5] |= 0x80;
+        return true;
+    }
+
+    // Extracts the 27 MHz PCR if the packet carries one.
+    inline bool read_pcr(const uint8_t *ts, uint64_t &pcr)
+    {
+        if (!has_adaptation(ts) || ts[4] < 7 || !(ts[5] & 0x10)) return false;
+        const uint8_t *p = ts + 6;
+        uint64_t base = (static_cast<uint64_t>(p[0]) << 25) | (static_cast<uint64_t>(p[1]) << 17) |
+                        (static_cast<uint64_t>(p[2]) << 9) | (static_cast<uint64_t>(p[3]) << 1) | (p[4] >> 7);
+        uint64_t ext = (static_cast<uint64_t>(p[4] & 0x01) << 8) | p[5];
+        pcr = base * 300 + ext;
+        return true;
+    }
+
+    /**
+     * Returns true if the packet is a good point to start decoding from:
+     * a PAT, a packet with the random access indicator, or a PES payload
+     * that carries H.264 SPS/PPS/IDR or H.265 VPS/SPS/PPS/IDR NAL units.
+     */
+    inline bool is_sync_point(const uint8_t *ts)
+    {
+        uint16_t p = pid(ts);
+
+        // 1. PAT is a good sync point as headers usually follow
+        if (p == 0) return true;
+
+        // 2. Check for Random Access Indicator in Adaptation Field
+        uint8_t a = afc(ts);
+        if (a >= 2 && ts[4] > 0 && (ts[5] & 0x40)) return true;
+
+        // 3. Deep scan for H.264 NAL units (SPS=7, PPS=8, IDR=5)
+        // This handles cases where RAI bit is not set but headers are present.
+        size_t off = 4;
+        if (a == 2 || a == 3) off += 1 + ts[4];
+        if (off >= PACKET_SIZE) return false;
+
+        const uint8_t *data = ts + off;
+        size_t data_len = PACKET_SIZE - off;
+        for (size_t j = 0; j + 4 < data_len; ++j)
+        {
+            if (data[j] == 0x00 && data[j + 1] == 0x00 && data[j + 2] == 0x01)
+            {
+                // H.264 NAL type is in bits 0-4 of the first byte
+                uint8_t nal_type_h264 = data[j + 3] & 0x1F;
+                if (nal_type_h264 == 7 || nal_type_h264 == 8 || nal_type_h264 == 5) return true;
+
+                // H.265 NAL type is in bits 1-6 of the first byte
+                uint8_t nal_type_h265 = (data[j + 3] >> 1) & 0x3F;
+                if (nal_type_h265 >= 32 && nal_type_h265 <= 34) return true; // VPS, SPS, PPS
+                if (nal_type_h265 == 19 || nal_type_h265 == 20) return true; // IDR
+            }
+        }
+        return false;
+    }
+
+    // Start of the PSI section in a packet with payload_unit_start_indicator
+    // set, with len the bytes of it that are in this packet; nullptr if none.
+    inline const uint8_t *psi_section(const uint8_t *ts, size_t &len)
+    {
+        if (!pusi(ts) || !has_payload(ts)) return nullptr;
+        size_t off = payload_offset(ts);
+        if (off >= PACKET_SIZE) return nullptr;
+        off += 1 + ts[off]; // pointer_field
+        if (off + 3 > PACKET_SIZE) return nullptr;
+        len = PACKET_SIZE - off;
+        return ts + off;
+    }
+
+    // PMT PID of the first program listed in a PAT packet, NULL_PID if there is none.
+    inline uint16_t pat_pmt_pid(const uint8_t *ts)
+    {
+        size_t len = 0;
+        const uint8_t *s = psi_section(ts, len);
+        if (!s || s[0] != 0x00) return NULL_PID;
+        size_t section_len = ((s[1] & 0x0F) << 8) | s[2];
+        size_t end = std::min(3 + section_len, len);
+        if (end < 4) return NULL_PID;
+        end -= 4; // CRC_32
+        for (size_t i = 8; i + 4 <= end; i += 4)
+        {
+            uint16_t program = (s[i] << 8) | s[i + 1];
+            if (program != 0) return ((s[i + 2] & 0x1F) << 8) | s[i + 3];
+        }
+        return NULL_PID;
+    }
+
+    /**
+     * Calls fn(stream_type, pid) for every elementary stream listed in a PMT
+     * packet. Returns false if it is not a PMT or its stream loop does not
+     * fit in the packet (only the streams in this packet are reported).
+     */
+    template <typename Fn>
+    inline bool pmt_streams(const uint8_t *ts, Fn fn)
+    {
+        size_t len = 0;
+        const uint8_t *s = psi_section(ts, len);
+        if (!s || s[0] != 0x02 || len < 12) return false;
+        size_t section_len = ((s[1] & 0x0F) << 8) | s[2];
+        if (3 + section_len > len || section_len < 13) return false;
+        size_t end = 3 + section_len - 4; // CRC_32
+        size_t i = 12 + (((s[10] & 0x0F) << 8) | s[11]);
+        while (i + 5 <= end)
+        {
+            fn(s[i], static_cast<uint16_t>(((s[i + 1] & 0x1F) << 8) | s[i + 2]));
+            i += 5 + (((s[i + 3] & 0x0F) << 8) | s[i + 4]);
+        }
+        return true;
+    }
+
+    // MPEG-2, MPEG-4 part 2, H.264 or H.265 video.
+    inline bool is_video_stream(uint8_t stream_type)
+    {
+        return stream_type == 0x01 || stream_type == 0x02 || stream_type == 0x10 ||
+               stream_type == 0x1B || stream_type == 0x24;
+    }
+
+    /**
+     * Like is_sync_point, but for a packet of a video stream whose PMT
+     * stream_type is known, so the start codes are read for that codec only
+     * (an H.264 P slice, 0x41, would pass for an H.265 VPS otherwise).
+     */
+    inline bool is_keyframe(const uint8_t *ts, uint8_t stream_type)
+    {
+        uint8_t a = afc(ts);
+        if (a >= 2 && ts[4] > 0 && (ts[5] & 0x40)) return true;
+        if (!has_payload(ts)) return false;
+
+        size_t off = payload_offset(ts);
+        if (pusi(ts) && off + 9 <= PACKET_SIZE && ts[off] == 0 && ts[off + 1] == 0 && ts[off + 2] == 1)
+            off += 9 + ts[off + 8]; // PES header
+        for (size_t j = off; j + 4 <= PACKET_SIZE; ++j)
+        {
+            if (ts[j] != 0x00 || ts[j + 1] != 0x00 || ts[j + 2] != 0x01) continue;
+            uint8_t b = ts[j + 3];
+            switch (stream_type)
+            {
+            case 0x1B: // H.264: IDR, SPS, PPS
+                if ((b & 0x1F) == 5 || (b & 0x1F) == 7 || (b & 0x1F) == 8) return true;
+                break;
+            case 0x24: // H.265: IRAP, VPS, SPS, PPS
+                if (((b >> 1) & 0x3F) >= 16 && ((b >> 1) & 0x3F) <= 21) return true;
+                if (((b >> 1) & 0x3F) >= 32 && ((b >> 1) & 0x3F) <= 34) return true;
+                break;
+            case 0x01:
+            case 0x02: // MPEG-1/2: sequence header
+                if (b == 0xB3) return true;
+                break;
+            case 0x10: // MPEG-4 part 2: visual object sequence, GOV
+                if (b == 0xB0 || b == 0xB3) return true;
+                break;
+            default:
+                return is_sync_point(ts);
+            }
+        }
+        return false;
+    }
+
+    // Scans a buffer of consecutive TS packets for a sync point.
+    inline bool find_sync_point(const uint8_t *data, size_t len)
+    {
+        if (len < PACKET_SIZE || data[0] != 0x47) return false;
+        for (size_t i = 0; i + PACKET_SIZE <= len; i += PACKET_SIZE)
+        {
+            if (is_sync_point(data + i)) return true;
+        }
+        return false;
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/**
+ * The parts of WebSocket (RFC 6455) a streaming server needs: the opening
+ * handshake, headers of unmasked server frames, and parsing of the masked
+ * frames a browser sends back (close, ping).
+ */
+namespace ws
+{
+    enum Opcode : uint8_t
+    {
+        CONTINUATION = 0x0,
+        TEXT = 0x1,
+        BINARY = 0x2,
+        CLOSE = 0x8,
+        PING = 0x9,
+        PONG = 0xA
+    };
+
+    constexpr size_t MAX_HEADER = 10;
+    constexpr size_t MAX_CONTROL_PAYLOAD = 125;
+
+    // Sec-WebSocket-Accept for a Sec-WebSocket-Key.
+    std::string accept_key(std::string_view key);
+
+    // Size of the header of a server frame with 'len' payload bytes.
+    inline size_t header_size(size_t len) { return len < 126 ? 2 : (len <= 0xFFFF ? 4 : 10); }
+
+    // Writes the header of a final, unmasked frame; returns header_size(len).
+    size_t write_header(uint8_t *out, Opcode opcode, size_t len);
+
+    struct Frame
+    {
+        Opcode opcode;
+        bool fin;
+        bool masked;
+        size_t size; // header and payload
+        const uint8_t *payload;
+        size_t length;
+    };
+
+    enum class Result
+    {
+        INCOMPLETE,
+        COMPLETE,
+        ERROR // longer than max_payload
+    };
+
+    // Parses the frame at the start of 'data' and unmasks its payload in place.
+    Result read_frame(uint8_t *data, size_t len, size_t max_payload, Frame &frame);
+}
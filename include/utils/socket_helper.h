@@ -1,10 +1,15 @@
 #pragma once
 #include <string>
 #include <stdint.h>
+#include <netinet/in.h>
 
 int create_listen_socket(int port, const std::string &iface = "");
 int create_nonblocking_tcp(const std::string &ip, uint16_t port, const std::string &iface = "");
 int bind_udp_socket_with_retry(int &fd, uint16_t &port, int max_attempts, const std::string &iface = "");
 int bind_udp_socket(int &fd, const uint16_t &port, const std::string &iface = "");
-int bind_udp_pair_from_pool(int &rtp_fd, int &rtcp_fd, uint16_t &rtp_port, const std::string &iface = "");
+int bind_udp_shared_socket(int &fd, uint16_t port, const std::string &iface = "");
+int join_multicast_socket(int &fd, uint32_t group, uint32_t source, uint16_t port, const std::string &iface = "");
+int open_multicast_sender(int &fd, const sockaddr_in &group, int ttl, const std::string &iface = "");
+int bind_udp_pair_from_pool(int &rtp_fd, int &rtcp_fd, uint16_t &rtp_port, const std::string &iface = "", int reserve_pairs = 1);
+int bind_udp_fec_sockets(int &col_fd, int &row_fd, uint16_t rtp_port, const std::string &iface = "");
 void set_tcp_nodelay(int fd);
\ No newline at end of file
@@ -0,0 +1,680 @@
+#include "clients/hls_output.h"
+#include "clients/rtsp_upstream.h"
+#include "handlers/master_handle.h"
+#include "core/epoll_loop.h"
+#include "core/logger.h"
+#include "core/server_config.h"
+#include "core/statistics.h"
+#include "common/socket_ctx.h"
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <set>
+
+HlsOutput::Channel::Channel(const Source &src)
+    : source(src)
+{
+}
+
+HlsOutput::Channel::~Channel() = default;
+
+HlsOutput &HlsOutput::getInstance()
+{
+    static HlsOutput instance;
+    return instance;
+}
+
+void HlsOutput::attach(EpollLoop *loop, BufferPool *pool)
+{
+    loop_ = loop;
+    pool_ = pool;
+
+    timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd_ < 0)
+    {
+        Logger::warn("[HLS] Failed to create timer, HLS output is disabled");
+        return;
+    }
+
+    itimerspec its{};
+    its.it_value.tv_nsec = TICK_INTERVAL_MS * 1000000L;
+    its.it_interval.tv_nsec = TICK_INTERVAL_MS * 1000000L;
+    timerfd_settime(timer_fd_, 0, &its, nullptr);
+
+    timer_ctx_ = std::make_unique<SocketCtx>(timer_fd_, [this](uint32_t event)
+                                             { handle_tick(event); });
+    loop_->set(timer_ctx_.get(), timer_fd_, EPOLLIN);
+}
+
+bool HlsOutput::serve(int fd, const sockaddr_in &addr, const Source &source, const Request &req, bool &keep_alive)
+{
+    auto now = Clock::now();
+    auto it = channels_.find(source.key);
+    Channel *ch = it != channels_.end() ? it->second.get() : open_channel(source);
+    if (ch)
+    {
+        ch->last_request = now;
+        ++ch->requests;
+        auto &seg = ch->segmenters[static_cast<size_t>(req.format)];
+        if (!seg)
+            seg = std::make_unique<HlsSegmenter>(segmenter_options(req.format));
+    }
+
+    Held h;
+    h.addr = addr;
+    h.keep_alive = keep_alive;
+    h.channel = source.key;
+    h.req = req;
+    if (!prepare(ch, h, false))
+    {
+        h.waiting = true;
+        const HlsSegmenter *seg = ch->segmenter(req.format);
+        h.deadline = now + (seg->ready() ? std::chrono::seconds(3 * seg->target_duration())
+                                         : std::chrono::seconds(START_TIMEOUT));
+        held_[fd] = std::move(h);
+        watch(fd, EPOLLRDHUP);
+        return true;
+    }
+
+    int result = send_some(fd, h);
+    if (result < 0 || (result > 0 && !h.streaming))
+    {
+        keep_alive = result > 0 && h.keep_alive;
+        return false;
+    }
+    h.deadline = now + SEND_TIMEOUT;
+    held_[fd] = std::move(h);
+    if (result > 0)
+        on_sent(fd);
+    else
+        watch(fd, EPOLLOUT);
+    return true;
+}
+
+HlsSegmenter::Options HlsOutput::segmenter_options(HlsSegmenter::Format format)
+{
+    HlsSegmenter::Options opts;
+    opts.segment_ms = ServerConfig::getHlsSegmentMs();
+    opts.part_ms = ServerConfig::getHlsPartMs();
+    opts.window = static_cast<size_t>(ServerConfig::getHlsWindow());
+    opts.format = format;
+    return opts;
+}
+
+HlsOutput::Channel *HlsOutput::open_channel(const Source &source)
+{
+    if (timer_fd_ < 0)
+        return nullptr;
+
+    auto ch = std::make_unique<Channel>(source);
+    ch->pipeline = RtpPipeline::create(source.profile);
+    ch->last_request = Clock::now();
+    Channel *raw = ch.get();
+
+    if (source.multicast)
+    {
+        raw->subscription = MulticastHub::getInstance().subscribe(source.group, [this, raw](Packet &&pkt)
+                                                                  { on_rtp(*raw, std::move(pkt)); });
+        if (raw->subscription == 0)
+        {
+            Logger::error("[HLS] Failed to join " + source.group.to_string() + " for " + source.key);
+            return nullptr;
+        }
+    }
+
+    channels_[source.key] = std::move(ch);
+    Logger::info("[HLS] Channel " + source.key + " set up from " +
+                 (source.multicast ? source.group.to_string()
+                                   : source.ctx.server_ip + ":" + std::to_string(source.ctx.server_rtsp_port)));
+    if (!source.multicast)
+        start_upstream(*raw);
+    return raw;
+}
+
+void HlsOutput::close_channel(const std::string &key)
+{
+    auto it = channels_.find(key);
+    if (it == channels_.end())
+        return;
+
+    Channel &ch = *it->second;
+    retire_upstream(ch);
+    if (ch.subscription != 0)
+        MulticastHub::getInstance().unsubscribe(ch.subscription);
+    Logger::info("[HLS] Channel " + key + " closed after " + std::to_string(ch.requests) + " request(s)");
+    channels_.erase(it);
+}
+
+void HlsOutput::start_upstream(Channel &ch)
+{
+    if (ch.started != Clock::time_point{})
+        ++ch.reconnects;
+    ch.started = Clock::now();
+    ch.retry_at = {};
+
+    ch.upstream = std::make_unique<RtspUpstream>(loop_, *pool_, ch.source.ctx,
+                                                 RtspUpstream::Options{"HLS " + ch.source.key, ServerConfig::getHttpUpstreamInterface(), false});
+    Channel *target = &ch;
+    ch.upstream->set_on_rtp([this, target](Packet &&pkt)
+                            { on_rtp(*target, std::move(pkt)); });
+    ch.upstream->set_on_playing([this, target]()
+                                {
+                                    target->retries = 0;
+                                    target->pipeline->reset();
+                                    // Whatever the new stream is, players have to reset their decoders for it.
+                                    bool completed = false;
+                                    for (auto &seg : target->segmenters)
+                                    {
+                                        if (target->played && seg && seg->discontinuity())
+                                            completed = true;
+                                    }
+                                    if (completed)
+                                        schedule_wake(*target);
+                                    target->played = true;
+                                    Logger::info("[HLS] " + target->source.key + " receiving from " + target->source.ctx.server_ip); });
+    ch.upstream->set_on_failed([this, target]()
+                               { on_failed(*target); });
+    ch.upstream->start();
+}
+
+void HlsOutput::retire_upstream(Channel &ch)
+{
+    if (!ch.upstream)
+        return;
+
+    // It may be inside one of its own handlers.
+    ch.upstream->set_on_rtp(nullptr);
+    ch.upstream->set_on_playing(nullptr);
+    ch.upstream->set_on_failed(nullptr);
+    std::shared_ptr<RtspUpstream> retired(std::move(ch.upstream));
+    loop_->add_task([retired]() {});
+}
+
+void HlsOutput::on_failed(Channel &ch)
+{
+    retire_upstream(ch);
+
+    // The channel lives as long as it is asked for, so there is no retry limit.
+    int delay = std::min(RETRY_BACKOFF_MS << std::min(ch.retries, 5), RETRY_BACKOFF_MAX_MS);
+    ++ch.retries;
+    ch.retry_at = Clock::now() + std::chrono::milliseconds(delay);
+    Logger::warn("[HLS] " + ch.source.key + " lost " + ch.source.ctx.server_ip + ", reconnecting in " +
+                 std::to_string(delay) + " ms");
+}
+
+void HlsOutput::on_rtp(Channel &ch, Packet &&pkt)
+{
+    size_t len = pkt.length;
+    size_t payload_off = 0;
+    if (ch.pipeline->process(pkt.data.get(), len) &&
+        RtpPipeline::get_payload_offset(pkt.data.get(), len, payload_off) && len > payload_off)
+    {
+        ch.bytes_in += len - payload_off;
+        auto now = Clock::now();
+        bool completed = false;
+        for (auto &seg : ch.segmenters)
+        {
+            if (seg && seg->push(pkt.data.get() + payload_off, len - payload_off, now))
+                completed = true;
+        }
+        if (completed)
+            schedule_wake(ch);
+    }
+    pool_->release(std::move(pkt.data));
+}
+
+void HlsOutput::schedule_wake(Channel &ch)
+{
+    // Waiting viewers are answered once per wakeup, after everything received in it.
+    if (ch.wake_pending)
+        return;
+    ch.wake_pending = true;
+    std::string key = ch.source.key;
+    loop_->add_task([this, key]()
+                    { wake(key); });
+}
+
+void HlsOutput::wake(const std::string &key)
+{
+    auto it = channels_.find(key);
+    if (it == channels_.end())
+        return;
+    Channel *ch = it->second.get();
+    ch->wake_pending = false;
+
+    std::vector<int> ready;
+    for (auto &[fd, h] : held_)
+    {
+        if (h.waiting && h.channel == key && prepare(ch, h, false))
+            ready.push_back(fd);
+    }
+    for (int fd : ready)
+        start_send(fd);
+}
+
+bool HlsOutput::prepare(Channel *ch, Held &h, bool timed_out)
+{
+    const Request &req = h.req;
+    if (!ch)
+    {
+        set_response(h, "503 Service Unavailable", nullptr, "", {});
+        return true;
+    }
+
+    const HlsSegmenter &seg = *ch->segmenter(req.format);
+    const char *media_type = req.format == HlsSegmenter::Format::FMP4 ? "video/mp4" : "video/mp2t";
+    // Segment and part URIs name immutable objects for as long as they are held.
+    std::string immutable = "public, max-age=" + std::to_string(seg.target_duration() * 2 * ServerConfig::getHlsWindow());
+
+    switch (req.kind)
+    {
+    case Request::Kind::PLAYLIST:
+        // A blocking reload may ask for at most two segments ahead.
+        if (req.block && req.seq > seg.next_seq() + 2)
+        {
+            set_response(h, "400 Bad Request", nullptr, "", {});
+            return true;
+        }
+        if (!seg.ready() || (req.block && !seg.has(req.seq, req.part)))
+        {
+            if (!timed_out)
+                return false;
+            set_response(h, "503 Service Unavailable", nullptr, "", {});
+            return true;
+        }
+        set_response(h, "200 OK", "application/vnd.apple.mpegurl", req.block ? immutable : "max-age=1",
+                     {std::make_shared<const std::string>(seg.playlist(req.query))});
+        return true;
+
+    case Request::Kind::SEGMENT:
+    {
+        std::vector<HlsSegmenter::Piece> pieces;
+        if (seg.segment(req.seq, pieces))
+            set_response(h, "200 OK", media_type, immutable, std::move(pieces));
+        else
+            set_response(h, "404 Not Found", nullptr, "", {});
+        return true;
+    }
+
+    case Request::Kind::PART:
+    {
+        HlsSegmenter::Piece piece;
+        if (seg.part(req.seq, static_cast<size_t>(req.part), piece))
+        {
+            set_response(h, "200 OK", media_type, immutable, {std::move(piece)});
+            return true;
+        }
+        // A preload hint names the part after the last one listed.
+        bool upcoming = !seg.has(req.seq, req.part) && req.seq >= seg.next_seq() && req.seq <= seg.next_seq() + 1;
+        if (upcoming && !timed_out)
+            return false;
+        set_response(h, upcoming ? "503 Service Unavailable" : "404 Not Found", nullptr, "", {});
+        return true;
+    }
+
+    case Request::Kind::INIT:
+    {
+        HlsSegmenter::Piece piece;
+        if (seg.init(req.seq, piece))
+            set_response(h, "200 OK", "video/mp4", immutable, {std::move(piece)});
+        else
+            set_response(h, "404 Not Found", nullptr, "", {});
+        return true;
+    }
+
+    case Request::Kind::STREAM:
+        return prepare_stream(seg, h, timed_out);
+    }
+    return true;
+}
+
+bool HlsOutput::prepare_stream(const HlsSegmenter &seg, Held &h, bool timed_out)
+{
+    Request &req = h.req;
+    if (!h.streaming || req.seq < seg.first_seq())
+    {
+        // Start, or start over after falling out of the ring, where a decoder can.
+        size_t part = 0;
+        if (seg.live_start(req.seq, part))
+            req.part = static_cast<int>(part);
+        else if (!h.streaming)
+        {
+            if (!timed_out)
+                return false;
+            set_response(h, "503 Service Unavailable", nullptr, "", {});
+            return true;
+        }
+    }
+
+    // Every fragment completed since the last round, with the init segment wherever it changes.
+    std::vector<HlsSegmenter::Piece> body;
+    HlsSegmenter::Piece piece;
+    while (body.size() + 1 < MAX_IOV)
+    {
+        if (seg.part(req.seq, static_cast<size_t>(req.part), piece))
+        {
+            uint64_t init = seg.init_of(req.seq);
+            HlsSegmenter::Piece init_piece;
+            if (init != h.init_sent && seg.init(init, init_piece))
+            {
+                body.push_back(std::move(init_piece));
+                h.init_sent = init;
+            }
+            body.push_back(std::move(piece));
+            ++req.part;
+        }
+        else if (req.seq < seg.next_seq())
+        {
+            ++req.seq;
+            req.part = 0;
+        }
+        else
+            break;
+    }
+
+    if (body.empty())
+    {
+        if (!timed_out)
+            return false;
+        // Nothing new for too long: the response ends here.
+        h.streaming = false;
+        h.keep_alive = false;
+        h.head.clear();
+        h.body.clear();
+        h.sent = 0;
+        return true;
+    }
+
+    if (!h.streaming)
+    {
+        // Open-ended, so the connection ends with it.
+        h.streaming = true;
+        h.keep_alive = false;
+        h.head = "HTTP/1.1 200 OK\r\n"
+                 "Content-Type: video/mp4\r\n"
+                 "Cache-Control: no-cache\r\n"
+                 "Access-Control-Allow-Origin: *\r\n"
+                 "Connection: close\r\n"
+                 "\r\n";
+    }
+    else
+        h.head.clear();
+    h.body = std::move(body);
+    h.sent = 0;
+    return true;
+}
+
+void HlsOutput::set_response(Held &h, const char *status, const char *type, const std::string &cache,
+                             std::vector<HlsSegmenter::Piece> body)
+{
+    size_t length = 0;
+    for (const auto &piece : body)
+        length += piece->size();
+
+    // Players on web pages fetch across origins.
+    h.head = std::string("HTTP/1.1 ") + status + "\r\n" +
+             (type ? std::string("Content-Type: ") + type + "\r\n" : std::string()) +
+             (cache.empty() ? std::string("Cache-Control: no-cache\r\n") : "Cache-Control: " + cache + "\r\n") +
+             "Access-Control-Allow-Origin: *\r\n"
+             "Content-Length: " + std::to_string(length) + "\r\n" +
+             (h.keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n") +
+             "\r\n";
+    h.body = std::move(body);
+    h.sent = 0;
+}
+
+int HlsOutput::send_some(int fd, Held &h)
+{
+    size_t total = h.head.size();
+    for (const auto &piece : h.body)
+        total += piece->size();
+
+    size_t sent = 0;
+    while (h.sent < total)
+    {
+        // Head and pieces from where the last call stopped, straight from the ring.
+        iovec iov[MAX_IOV];
+        size_t count = 0;
+        size_t skip = h.sent;
+        if (skip < h.head.size())
+            iov[count++] = iovec{const_cast<char *>(h.head.data()) + skip, h.head.size() - skip};
+        skip = skip > h.head.size() ? skip - h.head.size() : 0;
+        for (const auto &piece : h.body)
+        {
+            if (count == MAX_IOV)
+                break;
+            if (skip >= piece->size())
+            {
+                skip -= piece->size();
+                continue;
+            }
+            iov[count++] = iovec{const_cast<char *>(piece->data()) + skip, piece->size() - skip};
+            skip = 0;
+        }
+
+        msghdr msg{};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return -1;
+        }
+        h.sent += n;
+        sent += n;
+    }
+
+    Statistics::getInstance().addDownstreamBytes(sent);
+    auto it = channels_.find(h.channel);
+    if (it != channels_.end())
+        it->second->bytes_out += sent;
+    return h.sent == total ? 1 : 0;
+}
+
+void HlsOutput::start_send(int fd)
+{
+    Held &h = held_[fd];
+    h.waiting = false;
+    int result = send_some(fd, h);
+    if (result > 0)
+        on_sent(fd);
+    else if (result < 0)
+        drop(fd);
+    else
+    {
+        h.deadline = Clock::now() + SEND_TIMEOUT;
+        watch(fd, EPOLLOUT);
+    }
+}
+
+void HlsOutput::on_sent(int fd)
+{
+    Held &h = held_[fd];
+    if (!h.streaming)
+    {
+        finish(fd);
+        return;
+    }
+
+    // A progressive response goes on with the next fragments.
+    auto it = channels_.find(h.channel);
+    if (it == channels_.end())
+    {
+        drop(fd);
+        return;
+    }
+    h.waiting = true;
+    h.deadline = Clock::now() + STREAM_WAIT;
+    if (prepare(it->second.get(), h, false))
+        start_send(fd);
+    else
+        watch(fd, EPOLLRDHUP);
+}
+
+void HlsOutput::watch(int fd, uint32_t events)
+{
+    loop_->set(std::make_unique<SocketCtx>(fd, [this, fd](uint32_t event)
+                                           { handle_held(fd, event); }),
+               fd, events);
+}
+
+void HlsOutput::handle_held(int fd, uint32_t event)
+{
+    auto it = held_.find(fd);
+    if (it == held_.end())
+        return;
+    Held &h = it->second;
+
+    // A viewer that hangs up while waiting is gone; one that only shut down
+    // its sending side still gets its answer.
+    if ((event & (EPOLLHUP | EPOLLERR)) || (h.waiting && (event & EPOLLRDHUP)))
+    {
+        drop(fd);
+        return;
+    }
+    if (!h.waiting && (event & EPOLLOUT))
+    {
+        int result = send_some(fd, h);
+        if (result > 0)
+            on_sent(fd);
+        else if (result < 0)
+            drop(fd);
+    }
+}
+
+void HlsOutput::finish(int fd)
+{
+    auto it = held_.find(fd);
+    sockaddr_in addr = it->second.addr;
+    bool keep_alive = it->second.keep_alive;
+    held_.erase(it);
+
+    if (keep_alive)
+    {
+        MasterHandle::getInstance().accept(fd, addr);
+        return;
+    }
+    loop_->remove(fd);
+    close(fd);
+}
+
+void HlsOutput::drop(int fd)
+{
+    held_.erase(fd);
+    loop_->remove(fd);
+    close(fd);
+}
+
+void HlsOutput::handle_tick(uint32_t event)
+{
+    if (!(event & EPOLLIN))
+        return;
+
+    uint64_t expirations;
+    read(timer_fd_, &expirations, sizeof(expirations));
+
+    auto now = Clock::now();
+    std::vector<int> due;
+    std::set<std::string> waited_on;
+    for (const auto &[fd, h] : held_)
+    {
+        if (now >= h.deadline)
+            due.push_back(fd);
+        else if (h.waiting || h.streaming)
+            waited_on.insert(h.channel);
+    }
+    for (int fd : due)
+    {
+        Held &h = held_[fd];
+        if (!h.waiting)
+        {
+            Logger::debug("[HLS] Dropping a viewer that stopped reading " + h.channel);
+            drop(fd);
+            continue;
+        }
+        auto it = channels_.find(h.channel);
+        prepare(it != channels_.end() ? it->second.get() : nullptr, h, true);
+        start_send(fd);
+    }
+
+    int stall_ms = ServerConfig::getStallTimeoutMs() > 0 ? ServerConfig::getStallTimeoutMs() : DEFAULT_STALL_MS;
+    std::vector<std::string> idle;
+    for (auto &[key, ptr] : channels_)
+    {
+        Channel &ch = *ptr;
+        if (now - ch.last_request >= CHANNEL_IDLE && !waited_on.count(key))
+        {
+            idle.push_back(key);
+            continue;
+        }
+        if (ch.source.multicast)
+            continue;
+
+        if (!ch.upstream)
+        {
+            if (now >= ch.retry_at)
+                start_upstream(ch);
+        }
+        else if (now - std::max(ch.started, ch.upstream->last_rtp_time()) >= std::chrono::milliseconds(stall_ms))
+        {
+            Logger::warn("[HLS] No RTP for " + key + " in " + std::to_string(stall_ms) + " ms");
+            on_failed(ch);
+        }
+    }
+    for (const auto &key : idle)
+        close_channel(key);
+}
+
+nlohmann::json HlsOutput::get_info() const
+{
+    nlohmann::json list = nlohmann::json::array();
+    for (const auto &[key, ptr] : channels_)
+    {
+        const Channel &ch = *ptr;
+        bool ready = false;
+        for (const auto &seg : ch.segmenters)
+            ready = ready || (seg && seg->ready());
+        nlohmann::json c;
+        c["channel"] = key;
+        if (ch.source.multicast)
+        {
+            c["source"] = ch.source.group.to_string();
+            c["state"] = ready ? "live" : "starting";
+        }
+        else
+        {
+            c["source"] = ch.source.ctx.server_ip + ":" + std::to_string(ch.source.ctx.server_rtsp_port);
+            c["state"] = !ch.upstream ? "reconnecting" : !ch.upstream->is_streaming() ? "connecting" : ready ? "live" : "starting";
+            c["reconnects"] = ch.reconnects;
+            if (ch.upstream)
+                c["bandwidth"] = static_cast<uint64_t>(ch.upstream->bandwidth());
+        }
+        for (const auto &seg : ch.segmenters)
+        {
+            if (!seg)
+                continue;
+            nlohmann::json f;
+            f["low_latency"] = seg->low_latency();
+            f["segments"] = seg->segment_count();
+            f["next_seq"] = seg->next_seq();
+            f["target_duration"] = seg->target_duration();
+            f["held_bytes"] = seg->held_bytes();
+            f["discontinuities"] = seg->discontinuities();
+            f["forced_cuts"] = seg->forced_cuts();
+            c[seg->format() == HlsSegmenter::Format::FMP4 ? "fmp4" : "ts"] = std::move(f);
+        }
+        c["requests"] = ch.requests;
+        c["bytes_in"] = ch.bytes_in;
+        c["bytes_out"] = ch.bytes_out;
+        list.push_back(std::move(c));
+    }
+
+    nlohmann::json info;
+    info["channels"] = std::move(list);
+    info["pending"] = held_.size();
+    return info;
+}
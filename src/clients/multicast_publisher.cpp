@@ -0,0 +1,467 @@
+#include "clients/multicast_publisher.h"
+#include "clients/rtsp_upstream.h"
+#include "core/epoll_loop.h"
+#include "core/logger.h"
+#include "core/server_config.h"
+#include "core/statistics.h"
+#include "common/socket_ctx.h"
+#include "protocol/pipeline_profile.h"
+#include "protocol/rtsp_parser.h"
+#include "utils/blacklist_checker.h"
+#include "utils/socket_helper.h"
+#include "utils/url_rewriter.h"
+#include "utils/utils.h"
+#include <sys/timerfd.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    // Accepts a JSON number or a decimal string (API query parameters).
+    bool to_int(const nlohmann::json &j, long long &value)
+    {
+        if (j.is_number_integer())
+        {
+            value = j.get<long long>();
+            return true;
+        }
+        if (!j.is_string())
+            return false;
+        const std::string &s = j.get_ref<const std::string &>();
+        if (s.empty() || s.size() > 18 || !std::all_of(s.begin(), s.end(), ::isdigit))
+            return false;
+        value = std::stoll(s);
+        return true;
+    }
+
+    std::string host_of(const sockaddr_in &addr)
+    {
+        char buf[INET_ADDRSTRLEN] = {0};
+        inet_ntop(AF_INET, &addr.sin_addr, buf, sizeof(buf));
+        return std::string(buf) + ":" + std::to_string(ntohs(addr.sin_port));
+    }
+}
+
+MulticastPublisher &MulticastPublisher::getInstance()
+{
+    static MulticastPublisher instance;
+    return instance;
+}
+
+bool MulticastPublisher::parse_spec(const nlohmann::json &j, Spec &spec, std::string &error)
+{
+    if (!j.is_object() || !j.contains("name") || !j["name"].is_string() || j["name"].get<std::string>().empty())
+    {
+        error = "missing name";
+        return false;
+    }
+    spec.name = j["name"].get<std::string>();
+
+    if (!j.contains("url") || !j["url"].is_string())
+    {
+        error = "missing url";
+        return false;
+    }
+    spec.url = j["url"].get<std::string>();
+
+    std::string group = j.contains("group") && j["group"].is_string() ? j["group"].get<std::string>() : "";
+    size_t colon = group.rfind(':');
+    long long port = 0;
+    spec.group = sockaddr_in{};
+    spec.group.sin_family = AF_INET;
+    if (colon == std::string::npos || inet_pton(AF_INET, group.substr(0, colon).c_str(), &spec.group.sin_addr) != 1 ||
+        !IN_MULTICAST(ntohl(spec.group.sin_addr.s_addr)) || !to_int(nlohmann::json(group.substr(colon + 1)), port) ||
+        port <= 0 || port > 65535)
+    {
+        error = "group must be <multicast address>:<port>";
+        return false;
+    }
+    spec.group.sin_port = htons(static_cast<uint16_t>(port));
+
+    long long value = 1;
+    if (j.contains("ttl") && (!to_int(j["ttl"], value) || value < 1 || value > 255))
+    {
+        error = "ttl must be 1-255";
+        return false;
+    }
+    spec.ttl = static_cast<int>(value);
+
+    std::string format = j.contains("format") && j["format"].is_string() ? j["format"].get<std::string>() : "rtp";
+    if (format != "rtp" && format != "udp")
+    {
+        error = "format must be rtp or udp";
+        return false;
+    }
+    spec.rtp = format == "rtp";
+
+    value = 0;
+    if (j.contains("start") && !to_int(j["start"], value))
+    {
+        error = "start must be a Unix time";
+        return false;
+    }
+    spec.start = static_cast<std::time_t>(value);
+    value = 0;
+    if (j.contains("stop") && !to_int(j["stop"], value))
+    {
+        error = "stop must be a Unix time";
+        return false;
+    }
+    spec.stop = static_cast<std::time_t>(value);
+    return true;
+}
+
+void MulticastPublisher::load(const nlohmann::json &outputs)
+{
+    if (!outputs.is_array())
+        return;
+    for (const auto &j : outputs)
+    {
+        Spec spec;
+        std::string error;
+        if (!parse_spec(j, spec, error))
+        {
+            Logger::error("[PUBLISH] Ignoring multicast output: " + error);
+            continue;
+        }
+        pending_[spec.name] = spec;
+    }
+}
+
+void MulticastPublisher::attach(EpollLoop *loop, BufferPool *pool)
+{
+    loop_ = loop;
+    pool_ = pool;
+
+    timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd_ < 0)
+    {
+        Logger::warn("[PUBLISH] Failed to create schedule timer, multicast outputs are disabled");
+        return;
+    }
+
+    itimerspec its{};
+    its.it_value.tv_sec = TICK_INTERVAL_MS / 1000;
+    its.it_interval.tv_sec = TICK_INTERVAL_MS / 1000;
+    timerfd_settime(timer_fd_, 0, &its, nullptr);
+
+    timer_ctx_ = std::make_unique<SocketCtx>(timer_fd_, [this](uint32_t event)
+                                             { handle_tick(event); });
+    loop_->set(timer_ctx_.get(), timer_fd_, EPOLLIN);
+
+    std::string error;
+    for (const auto &entry : pending_)
+    {
+        if (!publish(entry.second, error))
+            Logger::error("[PUBLISH] Multicast output " + entry.first + ": " + error);
+    }
+    pending_.clear();
+}
+
+bool MulticastPublisher::publish(const Spec &spec, std::string &error)
+{
+    if (timer_fd_ < 0)
+    {
+        error = "multicast outputs are disabled";
+        return false;
+    }
+
+    // A proxy path resolves the same way as for an HTTP viewer.
+    std::string rtsp_url = spec.url;
+    if (spec.url.compare(0, 7, "rtsp://") != 0 && !URLRewriter::rewrite_path(spec.url, rtsp_url))
+    {
+        error = "url must be rtsp://... or /rtp/..., /tv/...";
+        return false;
+    }
+
+    rtspCtx ctx;
+    if (rtspParser::parse_url(rtsp_url, ctx) != 0)
+    {
+        error = "failed to parse " + rtsp_url;
+        return false;
+    }
+    if (BlacklistChecker::is_blacklisted(ctx.server_ip))
+    {
+        error = "upstream " + ctx.server_ip + " is blacklisted";
+        return false;
+    }
+
+    auto it = outputs_.find(spec.name);
+    if (it != outputs_.end())
+    {
+        take_off_air(it->second);
+        outputs_.erase(it);
+    }
+
+    Output &out = outputs_[spec.name];
+    out.spec = spec;
+    out.ctx = ctx;
+    out.pipeline = RtpPipeline::create(PipelineProfiles::resolve(spec.url));
+
+    Logger::info("[PUBLISH] " + spec.name + ": " + rtsp_url + " -> " + host_of(spec.group) + " (" +
+                 (spec.rtp ? "RTP" : "UDP TS") + ", TTL " + std::to_string(spec.ttl) + ")" +
+                 (spec.start > std::time(nullptr) ? ", starting at " + std::to_string(spec.start) : ""));
+
+    if (spec.start <= std::time(nullptr) && !go_on_air(out))
+    {
+        error = "failed to open multicast socket for " + host_of(spec.group);
+        outputs_.erase(spec.name);
+        return false;
+    }
+    return true;
+}
+
+bool MulticastPublisher::stop(const std::string &name, std::time_t at, std::string &error)
+{
+    auto it = outputs_.find(name);
+    if (it == outputs_.end())
+    {
+        error = "no multicast output " + name;
+        return false;
+    }
+
+    if (at > std::time(nullptr))
+    {
+        it->second.spec.stop = at;
+        Logger::info("[PUBLISH] " + name + " stops at " + std::to_string(at));
+        return true;
+    }
+
+    take_off_air(it->second);
+    outputs_.erase(it);
+    Logger::info("[PUBLISH] " + name + " removed");
+    return true;
+}
+
+bool MulticastPublisher::go_on_air(Output &out)
+{
+    const std::string &iface = ServerConfig::getListenInterface();
+    if (open_multicast_sender(out.fd, out.spec.group, out.spec.ttl, iface) < 0)
+    {
+        Logger::error("[PUBLISH] Failed to open " + host_of(out.spec.group) +
+                      (iface.empty() ? "" : " on " + iface) + ": " + strerror(errno));
+        return false;
+    }
+
+    out.batch = std::make_unique<UdpBatchSender>(*pool_);
+    out.batch->set_peer(out.fd, nullptr);
+    out.on_air = true;
+    Logger::info("[PUBLISH] " + out.spec.name + " on air at " + host_of(out.spec.group) + (iface.empty() ? "" : " on " + iface));
+    start_upstream(out);
+    return true;
+}
+
+void MulticastPublisher::take_off_air(Output &out)
+{
+    if (!out.on_air)
+        return;
+
+    retire_upstream(out);
+    if (out.batch)
+    {
+        out.batch->flush();
+        out.batch.reset();
+    }
+    if (out.chunk)
+        pool_->release(std::move(out.chunk));
+    out.chunk_len = 0;
+    close(out.fd);
+    out.fd = -1;
+    out.on_air = false;
+    Logger::info("[PUBLISH] " + out.spec.name + " off air");
+}
+
+void MulticastPublisher::start_upstream(Output &out)
+{
+    if (out.started != std::chrono::steady_clock::time_point{})
+        ++out.reconnects;
+    out.started = std::chrono::steady_clock::now();
+    out.retry_at = {};
+
+    out.upstream = std::make_unique<RtspUpstream>(loop_, *pool_, out.ctx,
+                                                  RtspUpstream::Options{out.spec.name, ServerConfig::getHttpUpstreamInterface(), false});
+    Output *target = &out;
+    out.upstream->set_on_rtp([this, target](Packet &&pkt)
+                             { on_rtp(*target, std::move(pkt)); });
+    out.upstream->set_on_playing([this, target]()
+                                 {
+                                     target->retries = 0;
+                                     target->pipeline->reset();
+                                     Logger::info("[PUBLISH] " + target->spec.name + " receiving from " + target->ctx.server_ip); });
+    out.upstream->set_on_failed([this, target]()
+                                { on_failed(*target); });
+    out.upstream->start();
+}
+
+void MulticastPublisher::retire_upstream(Output &out)
+{
+    if (!out.upstream)
+        return;
+
+    // Same as for HTTP sessions: it may be inside one of its own handlers.
+    out.upstream->set_on_rtp(nullptr);
+    out.upstream->set_on_playing(nullptr);
+    out.upstream->set_on_failed(nullptr);
+    std::shared_ptr<RtspUpstream> retired(std::move(out.upstream));
+    loop_->add_task([retired]() {});
+}
+
+void MulticastPublisher::on_failed(Output &out)
+{
+    retire_upstream(out);
+
+    // An output stays on air until it is stopped, so there is no retry limit.
+    int delay = std::min(RETRY_BACKOFF_MS << std::min(out.retries, 5), RETRY_BACKOFF_MAX_MS);
+    ++out.retries;
+    out.retry_at = std::chrono::steady_clock::now() + std::chrono::milliseconds(delay);
+    Logger::warn("[PUBLISH] " + out.spec.name + " lost " + out.ctx.server_ip + ", reconnecting in " +
+                 std::to_string(delay) + " ms");
+}
+
+void MulticastPublisher::on_rtp(Output &out, Packet &&pkt)
+{
+    size_t len = pkt.length;
+    size_t payload_off = 0;
+    if (!out.pipeline->process(pkt.data.get(), len) ||
+        (!out.spec.rtp && !RtpPipeline::get_payload_offset(pkt.data.get(), len, payload_off)))
+    {
+        pool_->release(std::move(pkt.data));
+        return;
+    }
+
+    ++out.packets;
+    if (out.spec.rtp)
+        out.batch->add(std::move(pkt.data), 0, len);
+    else
+        send_ts(out, Packet{std::move(pkt.data), len, payload_off});
+
+    // Everything received in this wakeup leaves in one batch afterwards.
+    if (!out.flush_pending)
+    {
+        out.flush_pending = true;
+        std::string name = out.spec.name;
+        loop_->add_task([this, name]()
+                        { flush(name); });
+    }
+}
+
+void MulticastPublisher::send_ts(Output &out, Packet &&pkt)
+{
+    const uint8_t *ts = pkt.data.get() + pkt.offset;
+    size_t remaining = pkt.length - pkt.offset;
+
+    // The usual 7 x 188 payload goes out in place.
+    if (out.chunk_len == 0 && remaining == TS_DATAGRAM)
+    {
+        out.batch->add(std::move(pkt.data), pkt.offset, remaining);
+        return;
+    }
+
+    while (remaining > 0)
+    {
+        if (!out.chunk)
+            out.chunk = pool_->acquire();
+        size_t n = std::min(remaining, TS_DATAGRAM - out.chunk_len);
+        memcpy(out.chunk.get() + out.chunk_len, ts, n);
+        out.chunk_len += n;
+        ts += n;
+        remaining -= n;
+        if (out.chunk_len == TS_DATAGRAM)
+        {
+            out.batch->add(std::move(out.chunk), 0, TS_DATAGRAM);
+            out.chunk_len = 0;
+        }
+    }
+    pool_->release(std::move(pkt.data));
+}
+
+void MulticastPublisher::flush(const std::string &name)
+{
+    auto it = outputs_.find(name);
+    if (it == outputs_.end() || !it->second.batch)
+        return;
+
+    Output &out = it->second;
+    out.flush_pending = false;
+    size_t sent = out.batch->flush();
+    out.bytes += sent;
+    Statistics::getInstance().addDownstreamBytes(sent);
+}
+
+void MulticastPublisher::handle_tick(uint32_t event)
+{
+    if (!(event & EPOLLIN))
+        return;
+
+    uint64_t expirations;
+    read(timer_fd_, &expirations, sizeof(expirations));
+
+    std::time_t wall = std::time(nullptr);
+    auto now = std::chrono::steady_clock::now();
+    int stall_ms = ServerConfig::getStallTimeoutMs() > 0 ? ServerConfig::getStallTimeoutMs() : DEFAULT_STALL_MS;
+
+    for (auto it = outputs_.begin(); it != outputs_.end();)
+    {
+        Output &out = it->second;
+        if (out.spec.stop != 0 && wall >= out.spec.stop)
+        {
+            Logger::info("[PUBLISH] " + out.spec.name + " reached its stop time");
+            take_off_air(out);
+            it = outputs_.erase(it);
+            continue;
+        }
+        ++it;
+
+        if (!out.on_air)
+        {
+            // A socket that cannot be opened is retried on the next tick.
+            if (wall >= out.spec.start)
+                go_on_air(out);
+            continue;
+        }
+
+        if (!out.upstream)
+        {
+            if (now >= out.retry_at)
+                start_upstream(out);
+        }
+        else if (now - std::max(out.started, out.upstream->last_rtp_time()) >= std::chrono::milliseconds(stall_ms))
+        {
+            Logger::warn("[PUBLISH] No RTP for " + out.spec.name + " in " + std::to_string(stall_ms) + " ms");
+            on_failed(out);
+        }
+    }
+}
+
+nlohmann::json MulticastPublisher::get_info() const
+{
+    nlohmann::json list = nlohmann::json::array();
+    for (const auto &[name, out] : outputs_)
+    {
+        nlohmann::json o;
+        o["name"] = name;
+        o["url"] = out.spec.url;
+        o["group"] = host_of(out.spec.group);
+        o["ttl"] = out.spec.ttl;
+        o["format"] = out.spec.rtp ? "rtp" : "udp";
+        if (out.spec.start != 0) o["start"] = static_cast<int64_t>(out.spec.start);
+        if (out.spec.stop != 0) o["stop"] = static_cast<int64_t>(out.spec.stop);
+        o["state"] = !out.on_air ? "scheduled" : !out.upstream ? "reconnecting" : out.upstream->is_streaming() ? "playing" : "connecting";
+        o["upstream"] = out.ctx.server_ip + ":" + std::to_string(out.ctx.server_rtsp_port);
+        o["reconnects"] = out.reconnects;
+        o["packets"] = out.packets;
+        o["bytes"] = out.bytes;
+        if (out.batch)
+        {
+            o["datagrams"] = out.batch->datagrams();
+            o["syscalls"] = out.batch->syscalls();
+            o["gso_sends"] = out.batch->gso_sends();
+        }
+        if (out.upstream)
+            o["bandwidth"] = static_cast<uint64_t>(out.upstream->bandwidth());
+        list.push_back(std::move(o));
+    }
+    return list;
+}
@@ -3,14 +3,12 @@
 #include "core/epoll_loop.h"
 #include "core/logger.h"
 #include "core/server_config.h"
+#include "core/upstream_selector.h"
 #include "core/buffer_pool.h"
 #include "common/socket_ctx.h"
 #include "common/rtsp_ctx.h"
-#include "utils/stun_client.h"
+#include "protocol/ts_utils.h"
 #include "utils/utils.h"
-#include "protocol/rtsp_parser.h"
-#include "utils/socket_helper.h"
-#include "core/port_pool.h"
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <unistd.h>
@@ -18,108 +16,399 @@
 #include <cstring>
 #include <sys/timerfd.h>
 
-RTSPToHttpClient::RTSPToHttpClient(EpollLoop *loop, BufferPool &pool, const sockaddr_in &client_addr, int client_fd, const rtspCtx &ctx)
+RTSPToHttpClient::RTSPToHttpClient(EpollLoop *loop, BufferPool &pool, const sockaddr_in &client_addr, int client_fd,
+                                   const RtspHttpConfig &config)
     : loop_(loop),
       buffer_pool_(pool),
       start_time_(std::chrono::steady_clock::now()),
       client_addr_(client_addr),
+      uri_(config.uri),
       client_fd_(client_fd, loop_),
-      ctx(ctx),
-      rtp_pipeline_(std::make_unique<RtpPipeline>()),
+      rtp_pipeline_(RtpPipeline::create(config.profile)),
       client_ctx_(std::make_unique<SocketCtx>(client_fd, [this](uint32_t event)
                                               { handle_client(event); })),
-      timer_fd_(-1, loop_)
+      reorder_timer_fd_(-1, loop_),
+      watchdog_fd_(-1, loop_),
+      pace_timer_fd_(-1, loop_),
+      coalesce_timer_fd_(-1, loop_),
+      send_queue_(pool)
 {
+    uint32_t latency = ServerConfig::getReorderLatencyMs();
+    if (config.redundant && latency == 0)
+    {
+        latency = REDUNDANT_LATENCY_MS;
+    }
+    reorder_ = std::make_unique<RtpReorderBuffer>(buffer_pool_, latency,
+                                                  [this](Packet &&pkt)
+                                                  { forward_rtp_packet(std::move(pkt)); });
     loop_->remove(client_fd);
 
-    loop_->set(client_ctx_.get(), client_fd, EPOLLRDHUP | EPOLLHUP | EPOLLERR);
+    // WebSocket viewers are read from for close and ping frames.
+    websocket_ = !config.websocket_accept.empty();
+    uint32_t events = EPOLLRDHUP | EPOLLHUP | EPOLLERR;
+    if (websocket_)
+        events |= EPOLLIN;
+    loop_->set(client_ctx_.get(), client_fd, events);
 
-    send_http_response();
-    init_rtp_rtcp_sockets();
-    if (ServerConfig::isNatEnabled() && ServerConfig::getNatMethod() == "stun")
+    if (ServerConfig::isPaceOutputEnabled())
     {
-        StunClient::send_stun_mapping_request(rtp_fd_);
+        pacer_ = std::make_unique<PcrPacer>(std::chrono::milliseconds(ServerConfig::getPaceBurstMs()));
+        init_pace_timer();
     }
-    else
+
+    uint32_t coalesce_ms = ServerConfig::getCoalesceMs();
+    if (websocket_ && coalesce_ms == 0)
+        coalesce_ms = WEBSOCKET_BATCH_MS;
+    if (coalesce_ms > 0)
+    {
+        coalescer_ = std::make_unique<TsCoalescer>(buffer_pool_, coalesce_ms,
+                                                   [this](Packet &&pkt)
+                                                   { queue_payload(std::move(pkt)); });
+        init_coalesce_timer();
+    }
+
+    send_http_response(config.websocket_accept);
+    if (latency > 0)
+    {
+        init_reorder_timer();
+    }
+
+    if (config.multicast)
+    {
+        // The group is shared with every other viewer; there is nothing to reconnect or pause.
+        multicast_group_ = config.group;
+        multicast_id_ = MulticastHub::getInstance().subscribe(config.group, [this](Packet &&pkt)
+                                                               { on_multicast_rtp(std::move(pkt)); });
+        if (multicast_id_ == 0)
+        {
+            on_client_closed();
+            return;
+        }
+        is_streaming_ = true;
+        return;
+    }
+
+    std::vector<rtspCtx> sources{config.ctx};
+    sources.insert(sources.end(), config.mirrors.begin(), config.mirrors.end());
+    add_leg(std::move(sources), {config.redundant ? "primary" : "", ServerConfig::getHttpUpstreamInterface(), ServerConfig::isFecEnabled()});
+    if (config.redundant)
+    {
+        std::string iface = config.redundant_iface.empty() ? ServerConfig::getHttpUpstreamInterface() : config.redundant_iface;
+        add_leg({config.redundant_ctx}, {"redundant", iface, ServerConfig::isFecEnabled()});
+        leg_monitor_ = std::make_unique<RtpLegMonitor>(legs_.size());
+        Logger::info("[RTSP] Redundant session: " + config.ctx.server_ip + " + " + config.redundant_ctx.server_ip +
+                     (iface.empty() ? "" : " via " + iface));
+    }
+
+    if (ServerConfig::getStallTimeoutMs() > 0 || ServerConfig::getUpstreamRetries() > 0 ||
+        ServerConfig::getSlowClientTimeoutMs() > 0)
+    {
+        init_watchdog();
+    }
+
+    for (size_t i = 0; i < legs_.size() && !is_closed_; ++i)
     {
-        is_init_ok = true;
-        send_rtsp_option();
+        start_leg(i);
     }
 }
 
 void RTSPToHttpClient::set_on_closed_callback(ClosedCallback cb)
 {
     on_closed_callback_ = std::move(cb);
+    // A leg may already have failed while the session was being constructed.
+    if (is_closed_ && on_closed_callback_)
+        on_closed_callback_();
 }
 
 RTSPToHttpClient::~RTSPToHttpClient()
 {
-    for (auto &packet : send_queue_)
+    MulticastHub::getInstance().unsubscribe(multicast_id_);
+    reorder_.reset();
+    coalescer_.reset();
+}
+
+void RTSPToHttpClient::add_leg(std::vector<rtspCtx> sources, const RtspUpstream::Options &opts)
+{
+    LegSlot slot;
+    slot.opts = opts;
+    slot.sources = std::move(sources);
+    legs_.push_back(std::move(slot));
+}
+
+void RTSPToHttpClient::start_leg(size_t leg)
+{
+    LegSlot &slot = legs_[leg];
+    if (slot.started != std::chrono::steady_clock::time_point{})
     {
-        buffer_pool_.release(std::move(packet.data));
+        ++slot.reconnects;
     }
-    send_queue_.clear();
+    slot.started = std::chrono::steady_clock::now();
+    slot.retry_at = {};
 
-    if (rtp_port_ != 0) {
-        PortPool::getInstance().release_pair(rtp_port_);
+    slot.upstream = std::make_unique<RtspUpstream>(loop_, buffer_pool_, slot.sources[slot.source], slot.opts);
+    slot.upstream->set_paused(upstream_paused_);
+    bind_upstream(leg);
+    if (leg_monitor_)
+    {
+        leg_monitor_->restart(leg);
+        // The new source may carry another stream: decide again once it delivers.
+        if (redundancy_ == Redundancy::MERGE && leg == active_leg_)
+            active_leg_ = (leg + 1) % legs_.size();
+        redundancy_ = Redundancy::PENDING;
     }
+
+    // Race the next source as well; whichever reaches PLAY first is kept.
+    if (ServerConfig::isUpstreamRaceEnabled() && slot.sources.size() > 1)
+    {
+        slot.racer_source = (slot.source + 1) % slot.sources.size();
+        slot.racer = std::make_unique<RtspUpstream>(loop_, buffer_pool_, slot.sources[slot.racer_source], slot.opts);
+        slot.racer->set_paused(upstream_paused_);
+        slot.racer->set_on_playing([this, leg]()
+                                   { on_racer_playing(leg); });
+        slot.racer->set_on_failed([this, leg]()
+                                  { on_racer_failed(leg); });
+    }
+
+    // Either may fail synchronously. The racer goes first so that a failing
+    // primary can hand over to an already started racer.
+    if (slot.racer)
+    {
+        slot.racer->start();
+    }
+    slot.upstream->start();
 }
 
-void RTSPToHttpClient::connect_server()
+void RTSPToHttpClient::bind_upstream(size_t leg)
 {
-    rtsp_fd_ = create_nonblocking_tcp(ctx.server_ip, ctx.server_rtsp_port, ServerConfig::getHttpUpstreamInterface());
+    RtspUpstream &upstream = *legs_[leg].upstream;
+    upstream.set_on_rtp([this, leg](Packet &&pkt)
+                        { on_leg_rtp(leg, std::move(pkt)); });
+    upstream.set_on_playing([this, leg]()
+                            { on_leg_playing(leg); });
+    upstream.set_on_failed([this, leg]()
+                           { on_leg_failed(leg); });
+}
 
-    if (rtsp_fd_ < 0)
-    {
-        Logger::error("[RTSP] Connect to upstream failed.");
-        if (on_closed_callback_) on_closed_callback_();
+void RTSPToHttpClient::retire_upstream(std::unique_ptr<RtspUpstream> &upstream)
+{
+    if (!upstream)
         return;
+
+    // The upstream may be running one of its own handlers right now and its
+    // sockets may still have events in this batch: mute it and destroy it
+    // once the batch is done.
+    upstream->set_on_rtp(nullptr);
+    upstream->set_on_playing(nullptr);
+    upstream->set_on_failed(nullptr);
+    std::shared_ptr<RtspUpstream> retired(std::move(upstream));
+    loop_->add_task([retired]() {});
+}
+
+void RTSPToHttpClient::promote_racer(size_t leg)
+{
+    LegSlot &slot = legs_[leg];
+    retire_upstream(slot.upstream);
+    slot.upstream = std::move(slot.racer);
+    slot.source = slot.racer_source;
+    bind_upstream(leg);
+}
+
+void RTSPToHttpClient::on_racer_playing(size_t leg)
+{
+    LegSlot &slot = legs_[leg];
+    Logger::info("[RTSP] " + slot.racer->ctx().server_ip + " won the connect race");
+    promote_racer(leg);
+    on_leg_playing(leg);
+}
+
+void RTSPToHttpClient::on_racer_failed(size_t leg)
+{
+    LegSlot &slot = legs_[leg];
+    UpstreamSelector::getInstance().report_failure(slot.racer->ctx());
+    retire_upstream(slot.racer);
+}
+
+bool RTSPToHttpClient::other_leg_streaming(size_t leg) const
+{
+    for (size_t i = 0; i < legs_.size(); ++i)
+    {
+        if (i != leg && legs_[i].upstream && legs_[i].upstream->is_streaming())
+            return true;
     }
+    return false;
+}
 
-    rtsp_ctx_ = std::make_unique<SocketCtx>(
-        rtsp_fd_,
-        [this](uint32_t event)
-        { handle_rtsp(event); });
+void RTSPToHttpClient::on_leg_rtp(size_t leg, Packet &&pkt)
+{
+    // Data flowing again is what ends a reconnect streak, not just a PLAY reply.
+    legs_[leg].retries = 0;
 
-    loop_->set(rtsp_ctx_.get(), rtsp_fd_, EPOLLOUT);
+    if (leg_monitor_)
+    {
+        leg_monitor_->on_packet(leg, pkt.data.get(), pkt.length);
+        if (!select_leg(leg))
+        {
+            buffer_pool_.release(std::move(pkt.data));
+            return;
+        }
+    }
 
-    state_ = RtspState::CONNECTING;
+    if (legs_.size() == 1 && legs_[leg].upstream->is_tcp())
+    {
+        // TCP delivers in order, so the reorder buffer is bypassed here.
+        forward_rtp_packet(std::move(pkt));
+    }
+    else
+    {
+        reorder_->push(std::move(pkt));
+        arm_reorder_timer();
+    }
+
+    // A TCP upstream can be held back instead of dropping for a slow viewer.
+    if (!upstream_paused_ && !is_closed_ && send_queue_.congested() && legs_[leg].upstream &&
+        legs_[leg].upstream->is_tcp())
+    {
+        set_upstream_paused(true);
+    }
+
+    want_client_writable();
 }
 
-void RTSPToHttpClient::handle_rtsp(uint32_t event)
+bool RTSPToHttpClient::select_leg(size_t leg)
 {
-    if (event & EPOLLIN)
+    if (redundancy_ == Redundancy::PENDING)
     {
-        on_rtsp_readable();
+        bool all_started = true, same = true;
+        for (size_t i = 0; i < legs_.size(); ++i)
+        {
+            all_started = all_started && leg_monitor_->started(i);
+            same = same && leg_monitor_->same_stream(0, i);
+        }
+        if (all_started)
+        {
+            redundancy_ = same ? Redundancy::MERGE : Redundancy::STANDBY;
+            if (same)
+                Logger::info("[RTSP] Redundant legs carry the same RTP stream, merging by sequence number");
+            else
+                Logger::warn("[RTSP] Redundant legs carry different RTP streams (SSRC or sequence numbers differ), " +
+                             legs_[active_leg_].opts.name + " leg active, the other on standby");
+        }
     }
-    if (event & EPOLLOUT)
+    if (redundancy_ == Redundancy::MERGE || leg == active_leg_)
+        return true;
+
+    // Standby: take over only when the active leg has gone quiet.
+    const LegSlot &active = legs_[active_leg_];
+    if (active.upstream && leg_monitor_->started(active_leg_) &&
+        std::chrono::steady_clock::now() - active.upstream->last_rtp_time() < std::chrono::milliseconds(STANDBY_SWITCH_MS))
+        return false;
+
+    // Before anything was forwarded there is no stream to splice into.
+    bool forwarded = leg_monitor_->stats(active_leg_).received > 0;
+    active_leg_ = leg;
+    if (forwarded)
     {
-        on_rtsp_writable();
+        Logger::warn("[RTSP] " + active.opts.name + " leg stalled, switching to " + legs_[leg].opts.name +
+                     " leg on next keyframe");
+        ++leg_switches_;
+        rtp_pipeline_->reset();
+        reorder_->reset();
+        resync_.arm();
     }
+    return true;
 }
 
-void RTSPToHttpClient::handle_rtp(uint32_t event)
+void RTSPToHttpClient::on_multicast_rtp(Packet &&pkt)
 {
-    if (event & EPOLLIN)
+    // Multicast is UDP: it goes through the reorder buffer like any UDP leg.
+    reorder_->push(std::move(pkt));
+    arm_reorder_timer();
+    want_client_writable();
+}
+
+void RTSPToHttpClient::set_upstream_paused(bool paused)
+{
+    upstream_paused_ = paused;
+    if (paused)
+        paused_since_ = std::chrono::steady_clock::now();
+    Logger::debug(std::string("[RTSP] ") + (paused ? "Pausing" : "Resuming") + " upstream for viewer " +
+                  inet_ntoa(client_addr_.sin_addr));
+    for (LegSlot &slot : legs_)
     {
-        on_rtp_readable();
+        if (slot.upstream)
+            slot.upstream->set_paused(paused);
+        if (slot.racer)
+            slot.racer->set_paused(paused);
     }
-    if (event & EPOLLOUT)
+}
+
+void RTSPToHttpClient::on_leg_playing(size_t leg)
+{
+    LegSlot &slot = legs_[leg];
+    UpstreamSelector::getInstance().report_success(slot.upstream->ctx(), slot.upstream->connect_ms(), slot.upstream->handshake_ms());
+    retire_upstream(slot.racer);
+
+    // Only the first leg to start resets the chain; later legs join the running stream.
+    if (!is_streaming_)
+    {
+        rtp_pipeline_->reset();
+        reorder_->reset();
+        is_streaming_ = true;
+    }
+    else if (!other_leg_streaming(leg))
     {
-        on_rtp_writable();
+        // The output went dark while this leg reconnected: splice the new stream in on a keyframe.
+        Logger::info("[RTSP] Upstream reconnected to " + slot.upstream->ctx().server_ip + ", resuming on next keyframe");
+        rtp_pipeline_->reset();
+        reorder_->reset();
+        resync_.arm();
+    }
+    else
+    {
+        Logger::info("[RTSP] " + slot.opts.name + " leg joined the session");
     }
 }
 
-void RTSPToHttpClient::handle_rtcp(uint32_t event)
+void RTSPToHttpClient::on_leg_failed(size_t leg)
 {
-    if (event & EPOLLIN)
+    if (is_closed_)
+        return;
+
+    LegSlot &slot = legs_[leg];
+    if (slot.upstream)
     {
-        on_rtcp_readable();
+        UpstreamSelector::getInstance().report_failure(slot.upstream->ctx());
     }
-    if (event & EPOLLOUT)
+
+    if (slot.racer)
+    {
+        // The race is still on: the other source simply takes over.
+        Logger::warn("[RTSP] Upstream lost, continuing with " + slot.racer->ctx().server_ip);
+        promote_racer(leg);
+        return;
+    }
+    retire_upstream(slot.upstream);
+
+    if (slot.retries < ServerConfig::getUpstreamRetries())
+    {
+        int delay = std::min(RETRY_BACKOFF_MS << slot.retries, RETRY_BACKOFF_MAX_MS);
+        ++slot.retries;
+        slot.source = (slot.source + 1) % slot.sources.size();
+        slot.retry_at = std::chrono::steady_clock::now() + std::chrono::milliseconds(delay);
+        const rtspCtx &next = slot.sources[slot.source];
+        Logger::warn("[RTSP] Upstream lost, reconnecting to " + next.server_ip + ":" + std::to_string(next.server_rtsp_port) +
+                     " in " + std::to_string(delay) + " ms (attempt " + std::to_string(slot.retries) + ")");
+        return;
+    }
+
+    bool any_alive = std::any_of(legs_.begin(), legs_.end(), [](const LegSlot &l)
+                                 { return l.upstream || l.retry_at != std::chrono::steady_clock::time_point{}; });
+    if (any_alive)
     {
-        on_rtcp_writable();
+        Logger::warn("[RTSP] " + slot.opts.name + " leg lost, continuing on the remaining leg");
+        return;
     }
+    on_client_closed();
 }
 
 void RTSPToHttpClient::handle_client(uint32_t event)
@@ -139,307 +428,207 @@ void RTSPToHttpClient::handle_client(uint32_t event)
     }
 }
 
-void RTSPToHttpClient::handle_timer(uint32_t event)
+void RTSPToHttpClient::handle_reorder_timer(uint32_t event)
 {
     if (event & EPOLLIN)
     {
         uint64_t expirations;
-        read(timer_fd_, &expirations, sizeof(expirations));
-        push_request_into_queue(RtspMethod::GET_PARAMETER, "rtsp://" + ctx.server_ip + ":" + std::to_string(ctx.server_rtsp_port) + ctx.path);
-        build_and_send_request();
-
-        // if (ServerConfig::isNatEnabled() && ServerConfig::getNatMethod() == "zte")
-        // {
-        //     send_zte_heartbeat();
-        // }
+        read(reorder_timer_fd_, &expirations, sizeof(expirations));
+        reorder_timer_armed_ = false;
+        reorder_->flush_expired();
+        arm_reorder_timer();
+        want_client_writable();
     }
 }
 
-void RTSPToHttpClient::on_rtsp_writable()
+void RTSPToHttpClient::handle_watchdog(uint32_t event)
 {
-    if (state_ == RtspState::CONNECTING)
+    if (!(event & EPOLLIN))
+        return;
+
+    uint64_t expirations;
+    read(watchdog_fd_, &expirations, sizeof(expirations));
+
+    auto now = std::chrono::steady_clock::now();
+    auto stall_timeout = std::chrono::milliseconds(ServerConfig::getStallTimeoutMs());
+
+    // A paused upstream sends nothing by design; the viewer has to catch up in time instead.
+    if (upstream_paused_)
     {
-        int err = 0;
-        socklen_t len = sizeof(err);
-        if (getsockopt(rtsp_fd_, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0)
+        auto slow_timeout = std::chrono::milliseconds(ServerConfig::getSlowClientTimeoutMs());
+        if (slow_timeout.count() > 0 && now - paused_since_ >= slow_timeout)
         {
-            Logger::error("[RTSP] Connect to upstream failed.");
-            on_closed_callback_();
+            Logger::warn(std::string("[RTSP] Disconnecting viewer ") + inet_ntoa(client_addr_.sin_addr) +
+                         ", too slow for " + std::to_string(slow_timeout.count()) + " ms");
+            on_client_closed();
             return;
         }
-        Logger::debug("[RTSP] Connection to upstream established.");
-        state_ = RtspState::CONNECTED;
-
-        struct sockaddr_in local_addr;
-        socklen_t addr_len = sizeof(local_addr);
-        if (getsockname(rtsp_fd_, (struct sockaddr *)&local_addr, &addr_len) == 0) {
-            local_ip_ = inet_ntoa(local_addr.sin_addr);
-            local_tcp_port_ = ntohs(local_addr.sin_port);
-            Logger::debug("[RTSP] Local IP: " + local_ip_ + ", Local TCP Port: " + std::to_string(local_tcp_port_));
-        }
     }
 
-    ssize_t n = send(rtsp_fd_, req_buf_.data() + tcp_send_offset_,
-                     req_buf_.size() - tcp_send_offset_, 0);
-    if (n > 0)
+    for (size_t i = 0; i < legs_.size() && !is_closed_; ++i)
     {
-        tcp_send_offset_ += n;
-        if (tcp_send_offset_ == req_buf_.size())
+        LegSlot &slot = legs_[i];
+        if (!slot.upstream)
         {
-            loop_->set(rtsp_ctx_.get(), rtsp_fd_, EPOLLIN);
-            tcp_send_offset_ = 0;
+            if (slot.retry_at != std::chrono::steady_clock::time_point{} && now >= slot.retry_at)
+                start_leg(i);
+            continue;
         }
-    }
-    else
-    {
-        Logger::error("[RTSP] RTSP control message send failed.");
 
-        on_closed_callback_();
-        return;
+        // Covers both a handshake that never completes and RTP that stops arriving.
+        if (stall_timeout.count() > 0 && !upstream_paused_ && now - std::max(slot.started, slot.upstream->last_rtp_time()) >= stall_timeout)
+        {
+            Logger::warn("[RTSP] No RTP from upstream " + slot.upstream->ctx().server_ip + " for " +
+                         std::to_string(stall_timeout.count()) + " ms");
+            on_leg_failed(i);
+        }
     }
 }
 
-void RTSPToHttpClient::on_rtsp_readable()
+void RTSPToHttpClient::handle_coalesce_timer(uint32_t event)
 {
-    while (true)
+    if (event & EPOLLIN)
     {
-        ssize_t n = recv(rtsp_fd_, rtsp_buf, sizeof(rtsp_buf), 0);
-        if (n > 0)
-        {
-            resp_buf_.append(rtsp_buf, n);
-            while (!resp_buf_.empty())
-            {
-                if (resp_buf_[0] == '$')
-                {
-                    if (resp_buf_.size() < 4)
-                        break;
-                    uint16_t len = ntohs(*reinterpret_cast<const uint16_t *>(resp_buf_.data() + 2));
-                    if (resp_buf_.size() < static_cast<size_t>(len) + 4)
-                        break;
-
-                    uint8_t channel = static_cast<uint8_t>(resp_buf_[1]);
-                    upstream_est_.addBytes(len + 4);
-                    Statistics::getInstance().addUpstreamBytes(len + 4);
-                    handle_interleaved_packet(channel, reinterpret_cast<const uint8_t *>(resp_buf_.data() + 4), len);
-                    resp_buf_.erase(0, 4 + len);
-                    continue;
-                }
-
-                size_t end = resp_buf_.find("\r\n\r\n");
-                if (end == std::string::npos)
-                    break;
-
-                std::string header = resp_buf_.substr(0, end + 4);
-                int content_length = rtspParser::get_content_length(header);
-                if (resp_buf_.size() < end + 4 + content_length)
-                    break;
-
-                std::string body = resp_buf_.substr(end + 4, content_length);
-                resp_buf_.erase(0, end + 4 + content_length);
-
-                rtspParser::parse_session_id(header, ctx);
-                int status = rtspParser::parse_status_code(header);
-
-                if (status == -1)
-                {
-                    std::string cseq = rtspParser::extract_header_value(header, "CSeq");
-                    if (!cseq.empty())
-                    {
-                        Logger::debug("[RTSP] Received request from server, responding with 200 OK (CSeq: " + cseq + ")");
-                        std::string resp = "RTSP/1.0 200 OK\r\nCSeq: " + cseq + "\r\n\r\n";
-                        send(rtsp_fd_, resp.data(), resp.size(), 0);
-                        continue;
-                    }
-                }
-
-                if (status == 461 && current_request_.method == RtspMethod::SETUP && !setup_retry_with_tcp_)
-                {
-                    Logger::warn("[RTSP] Upstream rejected UDP SETUP (461). Retrying with TCP Interleaved...");
-                    setup_retry_with_tcp_ = true;
-                    send_rtsp_setup();
-                    continue;
-                }
-
-                if (status != 200)
-                {
-                    Logger::error("[RTSP] Connection to upstream refused. Status: " + std::to_string(status) + ", Header: " + header);
-                    on_closed_callback_();
-                    return;
-                }
-
-                if (current_request_.method == RtspMethod::OPTIONS)
-                {
-                    send_rtsp_describe();
-                }
-                else if (current_request_.method == RtspMethod::DESCRIBE)
-                {
-                    ctx.content_base = rtspParser::extract_header_value(header, "Content-Base");
-                    send_rtsp_setup(body);
-                }
-                else if (current_request_.method == RtspMethod::SETUP)
-                {
-                    if (rtspParser::parse_server_ports(header, ctx) != 0)
-                    {
-                        Logger::error("Can't parser server port");
-                        on_closed_callback_();
-                        return;
-                    }
-
-                    if (header.find("interleaved=") != std::string::npos)
-                    {
-                        is_tcp_mode_ = true;
-                        interleaved_rtp_channel_ = static_cast<uint8_t>(ctx.server_rtp_port);
-                        interleaved_rtcp_channel_ = static_cast<uint8_t>(ctx.server_rtcp_port);
-                        Logger::debug("[RTSP] SETUP done (TCP Interleaved), Channels: " +
-                                     std::to_string(interleaved_rtp_channel_) + "-" +
-                                     std::to_string(interleaved_rtcp_channel_));
-                    }
-                    else
-                    {
-                        is_tcp_mode_ = false;
-                        Logger::debug(std::string("[RTSP] SETUP done (UDP), server port: " +
-                                                 std::to_string(ctx.server_rtp_port) + "-" +
-                                                 std::to_string(ctx.server_rtcp_port)));
-                        init_rtp_rtcp_server_addr();
-                        if (ServerConfig::isNatEnabled() && ServerConfig::getNatMethod() == "zte")
-                        {
-                            send_zte_heartbeat();
-                        }
-                        else
-                        {
-                            send_rtp_trigger();
-                        }
-                    }
-                    send_rtsp_play();
-                }
-                else if (current_request_.method == RtspMethod::PLAY)
-                {
-                    Logger::debug(std::string("[RTSP] Streaming Start: " + ctx.rtsp_url));
-                    rtp_pipeline_->reset();
-                    init_timer_fd();
-                    state_ = RtspState::STREAMING;
-                }
-            }
-        }
-        else if (n == 0)
-        {
-            Logger::debug("[RTSP] Server closed connection");
-            on_closed_callback_();
-            return;
-        }
-        else if (errno == EAGAIN || errno == EWOULDBLOCK)
-        {
-            break;
-        }
-        else
-        {
-            Logger::warn("[RTSP] Receive failed");
-            on_closed_callback_();
-            return;
-        }
+        uint64_t expirations;
+        read(coalesce_timer_fd_, &expirations, sizeof(expirations));
+        coalesce_timer_armed_ = false;
+        coalescer_->flush_expired();
+        arm_coalesce_timer();
+        want_client_writable();
     }
 }
 
-void RTSPToHttpClient::on_rtp_writable()
+void RTSPToHttpClient::handle_pace_timer(uint32_t event)
 {
+    if (!(event & EPOLLIN))
+        return;
+
+    uint64_t expirations;
+    read(pace_timer_fd_, &expirations, sizeof(expirations));
+    pace_timer_due_ = {};
+    arm_pace_timer(pacer_->release(std::chrono::steady_clock::now()));
+    apply_pacing_rate();
+    want_client_writable();
 }
 
-void RTSPToHttpClient::on_rtp_readable()
+void RTSPToHttpClient::arm_pace_timer(PcrPacer::Clock::time_point due)
 {
-    auto buf = buffer_pool_.acquire();
-    ssize_t n = recvfrom(rtp_fd_, buf.get(), buffer_pool_.get_buffer_size(), 0, nullptr, nullptr);
+    if (pace_timer_fd_ < 0 || due == PcrPacer::Clock::time_point{} ||
+        (pace_timer_due_ != PcrPacer::Clock::time_point{} && pace_timer_due_ <= due))
+        return;
 
-    if (n <= 0)
-    {
-        buffer_pool_.release(std::move(buf));
+    // steady_clock is CLOCK_MONOTONIC, so the deadline can be set as is.
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(due.time_since_epoch()).count();
+    itimerspec its{};
+    its.it_value.tv_sec = ns / 1000000000;
+    its.it_value.tv_nsec = ns % 1000000000;
+    timerfd_settime(pace_timer_fd_, TFD_TIMER_ABSTIME, &its, nullptr);
+    pace_timer_due_ = due;
+}
+
+void RTSPToHttpClient::apply_pacing_rate()
+{
+#ifdef SO_MAX_PACING_RATE
+    // Only once the initial burst is out, which the kernel limit would otherwise slow down.
+    uint64_t rate = pacer_->rate_bytes_per_sec() * KERNEL_PACING_HEADROOM;
+    if (!pacer_->pacing() || rate == 0 || (rate > pacing_rate_ * 9 / 10 && rate < pacing_rate_ * 11 / 10))
         return;
-    }
 
-    upstream_est_.addBytes(n);
-    Statistics::getInstance().addUpstreamBytes(n);
-    size_t recv_len = static_cast<size_t>(n);
+    unsigned int value = static_cast<unsigned int>(std::min<uint64_t>(rate, UINT32_MAX - 1));
+    if (setsockopt(client_fd_, SOL_SOCKET, SO_MAX_PACING_RATE, &value, sizeof(value)) == 0)
+        pacing_rate_ = rate;
+#endif
+}
 
-    if (rtp_pipeline_->process(buf.get(), recv_len))
+void RTSPToHttpClient::forward_rtp_packet(Packet &&pkt)
+{
+    if (unlikely(is_closed_))
     {
-        size_t payload_off = 0;
-        if (RtpPipeline::get_payload_offset(buf.get(), recv_len, payload_off))
-        {
-            if (send_queue_.size() > 512) {
-                auto &old = send_queue_.front();
-                if (old.data) buffer_pool_.release(std::move(old.data));
-                send_queue_.pop_front();
-            }
-            send_queue_.push_back(Packet{std::move(buf), recv_len, payload_off});
-        }
-        else
-        {
-            buffer_pool_.release(std::move(buf));
-        }
+        buffer_pool_.release(std::move(pkt.data));
+        return;
     }
-    else if (!is_init_ok)
+
+    size_t len = pkt.length;
+    size_t payload_off = 0;
+    if (unlikely(resync_.active()) &&
+        (!RtpPipeline::get_payload_offset(pkt.data.get(), len, payload_off) ||
+         !resync_.process(pkt.data.get() + payload_off, len - payload_off)))
     {
-        if (ServerConfig::isNatEnabled() == true)
-        {
-            if (StunClient::extract_stun_mapping_from_response(buf.get(), recv_len, nat_wan_ip, nat_wan_port) == 0)
-            {
-                Logger::debug("[RTP] Extract STUN mapping success: " + nat_wan_ip + ":" + std::to_string(nat_wan_port));
-            };
-            loop_->set(rtp_ctx_.get(), rtp_fd_, EPOLLIN);
-        }
-        buffer_pool_.release(std::move(buf));
-        is_init_ok = true;
-        send_rtsp_option();
+        buffer_pool_.release(std::move(pkt.data));
+        return;
     }
-    else
+
+    if (!rtp_pipeline_->process(pkt.data.get(), len) ||
+        !RtpPipeline::get_payload_offset(pkt.data.get(), len, payload_off))
     {
-        buffer_pool_.release(std::move(buf));
+        buffer_pool_.release(std::move(pkt.data));
+        return;
     }
 
-    if (loop_ && client_fd_ >= 0 && client_ctx_)
-        loop_->set(client_ctx_.get(), client_fd_, EPOLLRDHUP | EPOLLHUP | EPOLLERR | EPOLLOUT);
-}
-
-void RTSPToHttpClient::on_rtcp_writable()
-{
+    if (coalescer_)
+    {
+        coalescer_->push(Packet{std::move(pkt.data), len, payload_off});
+        arm_coalesce_timer();
+        return;
+    }
+    queue_payload(Packet{std::move(pkt.data), len, payload_off});
 }
 
-void RTSPToHttpClient::on_rtcp_readable()
+void RTSPToHttpClient::queue_payload(Packet &&pkt)
 {
-}
+    if (unlikely(is_closed_))
+    {
+        buffer_pool_.release(std::move(pkt.data));
+        return;
+    }
 
-void RTSPToHttpClient::handle_interleaved_packet(uint8_t channel, const uint8_t *data, size_t len)
-{
-    if (channel != interleaved_rtp_channel_)
+    size_t header = 0;
+    if (websocket_ && !frame_websocket(pkt, header))
         return;
 
-    auto buf = buffer_pool_.acquire();
-    size_t max_buf_size = buffer_pool_.get_buffer_size();
-    size_t actual_len = std::min(len, max_buf_size);
-    memcpy(buf.get(), data, actual_len);
-    if (rtp_pipeline_->process(buf.get(), actual_len))
+    size_t len = pkt.length;
+    size_t queued = len - pkt.offset;
+    size_t payload_off = pkt.offset + header;
+    uint8_t *payload = pkt.data.get() + payload_off;
+    bool sync_point = send_queue_.resyncing() && ts::find_sync_point(payload, len - payload_off);
+    DownstreamQueue::Verdict verdict = send_queue_.push_media(std::move(pkt), sync_point);
+    switch (verdict)
     {
-        size_t payload_off = 0;
-        if (RtpPipeline::get_payload_offset(buf.get(), actual_len, payload_off))
-        {
-            if (send_queue_.size() > 512) {
-                auto &old = send_queue_.front();
-                if (old.data) buffer_pool_.release(std::move(old.data));
-                send_queue_.pop_front();
-            }
-            send_queue_.push_back(Packet{std::move(buf), actual_len, payload_off});
-        }
-        else
-        {
-            buffer_pool_.release(std::move(buf));
-        }
+    case DownstreamQueue::Verdict::RESYNC:
+        Logger::debug(std::string("[RTSP] Viewer ") + inet_ntoa(client_addr_.sin_addr) +
+                     " is falling behind, skipping to the next keyframe");
+        break;
+    case DownstreamQueue::Verdict::RESUMED:
+        // The viewer missed part of the stream: flag the splice like an upstream restart.
+        resync_.mark();
+        resync_.process(payload, len - payload_off);
+        break;
+    case DownstreamQueue::Verdict::TOO_SLOW:
+        Logger::warn(std::string("[RTSP] Disconnecting viewer ") + inet_ntoa(client_addr_.sin_addr) +
+                     ", too slow for " + std::to_string(ServerConfig::getSlowClientTimeoutMs()) + " ms");
+        on_client_closed();
+        break;
+    default:
+        break;
     }
-    else
+
+    if (pacer_ && (verdict == DownstreamQueue::Verdict::QUEUED || verdict == DownstreamQueue::Verdict::RESUMED))
     {
-        buffer_pool_.release(std::move(buf));
+        auto now = std::chrono::steady_clock::now();
+        pacer_->on_queued(payload, len - payload_off, queued, now);
+        arm_pace_timer(pacer_->release(now));
     }
+}
 
-    if (loop_ && client_fd_ >= 0 && client_ctx_)
-        loop_->set(client_ctx_.get(), client_fd_, EPOLLRDHUP | EPOLLHUP | EPOLLERR | EPOLLOUT | EPOLLIN);
+void RTSPToHttpClient::want_client_writable()
+{
+    if (!loop_ || client_fd_ < 0 || !client_ctx_ || send_queue_.empty() || (pacer_ && pacer_->allowance() == 0))
+        return;
+    // A WebSocket viewer's close and ping frames must still be read while output is pending.
+    uint32_t events = EPOLLRDHUP | EPOLLHUP | EPOLLERR | EPOLLOUT;
+    if (websocket_)
+        events |= EPOLLIN;
+    loop_->set(client_ctx_.get(), client_fd_, events);
 }
 
 void RTSPToHttpClient::on_client_writable()
@@ -447,7 +636,16 @@ void RTSPToHttpClient::on_client_writable()
     while (!send_queue_.empty())
     {
         auto &packet = send_queue_.front();
-        ssize_t n = send(client_fd_, packet.data.get() + packet.offset, packet.length - packet.offset, 0);
+        size_t len = packet.length - packet.offset;
+        if (pacer_)
+        {
+            len = std::min(len, pacer_->allowance());
+            if (len == 0)
+                break;
+        }
+        // Tell the stack more follows right away so it can fill whole segments.
+        bool more = send_queue_.size() > 1 && (!pacer_ || pacer_->allowance() > len);
+        ssize_t n = send(client_fd_, packet.data.get() + packet.offset, len, more ? MSG_MORE : 0);
         if (n < 0)
         {
             if (errno == EAGAIN || errno == EWOULDBLOCK)
@@ -462,10 +660,11 @@ void RTSPToHttpClient::on_client_writable()
         Statistics::getInstance().addDownstreamBytes(n);
         downstream_est_.addBytes(n);
         packet.offset += n;
+        if (pacer_)
+            pacer_->on_sent(n);
 
         if (packet.offset == packet.length)
         {
-            buffer_pool_.release(std::move(packet.data));
             send_queue_.pop_front();
         }
         else
@@ -474,317 +673,262 @@ void RTSPToHttpClient::on_client_writable()
         }
     }
 
-    if (send_queue_.empty())
+    if (upstream_paused_ && send_queue_.drained())
+        set_upstream_paused(false);
+
+    if (websocket_closing_ && send_queue_.empty())
+    {
+        on_client_closed();
+        return;
+    }
+
+    // Paced out: the pace timer asks for EPOLLOUT again once more is due.
+    if (send_queue_.empty() || (pacer_ && pacer_->allowance() == 0))
         loop_->set(client_ctx_.get(), client_fd_, EPOLLRDHUP | EPOLLHUP | EPOLLERR | EPOLLIN);
 }
 
 void RTSPToHttpClient::on_client_readable()
 {
-}
-
-void RTSPToHttpClient::on_client_closed()
-{
-    if (is_closed_) return;
-    is_closed_ = true;
-    if (on_closed_callback_)
-        on_closed_callback_();
-}
+    uint8_t buf[MAX_WEBSOCKET_INPUT];
+    ssize_t n = recv(client_fd_, buf, sizeof(buf), 0);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+    if (n <= 0)
+    {
+        on_client_closed();
+        return;
+    }
+    // An HTTP viewer has nothing more to say; whatever it sends is dropped.
+    if (!websocket_)
+        return;
 
-void RTSPToHttpClient::push_request_into_queue(RtspMethod method, const std::string &uri, const std::string &extra_headers, const std::string &body)
-{
-    RtspRequest req{method, uri, extra_headers, body, cseq_++};
-    request_queue_.push(req);
+    websocket_in_.append(reinterpret_cast<const char *>(buf), n);
+    on_websocket_input();
 }
 
-void RTSPToHttpClient::build_and_send_request()
+void RTSPToHttpClient::on_websocket_input()
 {
-    if (!request_queue_.empty())
+    size_t used = 0;
+    while (!is_closed_ && used < websocket_in_.size())
     {
-        current_request_ = request_queue_.front();
-        request_queue_.pop();
-
-        req_buf_.clear();
-        req_buf_ += RtspMethodToString(current_request_.method) + " " + current_request_.uri + " RTSP/1.0\r\n";
-        req_buf_ += "CSeq: " + std::to_string(current_request_.cseq) + "\r\n";
-        if (!ctx.session_id.empty())
-            req_buf_ += "Session: " + ctx.session_id + "\r\n";
-        req_buf_ += current_request_.headers;
-        if (!current_request_.body.empty())
-            req_buf_ += "Content-Length: " + std::to_string(current_request_.body.size()) + "\r\n\r\n" + current_request_.body;
-        else
-            req_buf_ += "\r\n";
+        ws::Frame frame;
+        auto *data = reinterpret_cast<uint8_t *>(websocket_in_.data()) + used;
+        ws::Result result = ws::read_frame(data, websocket_in_.size() - used, ws::MAX_CONTROL_PAYLOAD, frame);
+        if (result == ws::Result::INCOMPLETE && websocket_in_.size() < MAX_WEBSOCKET_INPUT)
+            break;
+        if (result != ws::Result::COMPLETE || !frame.masked)
+        {
+            Logger::debug(std::string("[RTSP] Closing WebSocket viewer ") + inet_ntoa(client_addr_.sin_addr) +
+                          ": unexpected frame");
+            on_client_closed();
+            return;
+        }
+        used += frame.size;
 
-        tcp_send_offset_ = 0;
-        loop_->set(rtsp_ctx_.get(), rtsp_fd_, EPOLLOUT);
+        if (frame.opcode == ws::CLOSE && !websocket_closing_)
+        {
+            // Echo the status code, then close once what is queued has gone out.
+            send_websocket_control(ws::CLOSE, frame.payload, std::min<size_t>(frame.length, 2));
+            websocket_closing_ = true;
+        }
+        else if (frame.opcode == ws::PING && !websocket_closing_)
+        {
+            send_websocket_control(ws::PONG, frame.payload, frame.length);
+        }
     }
+    websocket_in_.erase(0, used);
 }
 
-void RTSPToHttpClient::init_rtp_rtcp_sockets()
+bool RTSPToHttpClient::frame_websocket(Packet &pkt, size_t &header)
 {
-    if (bind_udp_pair_from_pool(rtp_fd_.get_ref(), rtcp_fd_.get_ref(), rtp_port_, ServerConfig::getHttpUpstreamInterface()) < 0)
+    if (websocket_closing_)
     {
-        Logger::error("[RTP] Failed to bind RTP/RTCP sockets from pool");
-        if (on_closed_callback_) on_closed_callback_();
-        return;
+        buffer_pool_.release(std::move(pkt.data));
+        return false;
     }
 
-
-    rtp_ctx_ = std::make_unique<SocketCtx>(
-        rtp_fd_,
-        [this](uint32_t event)
-        { handle_rtp(event); });
-
-    rtcp_ctx_ = std::make_unique<SocketCtx>(
-        rtcp_fd_,
-        [this](uint32_t event)
-        { handle_rtcp(event); });
-
-    loop_->set(rtp_ctx_.get(), rtp_fd_, EPOLLIN);
-    loop_->set(rtcp_ctx_.get(), rtcp_fd_, EPOLLIN);
+    // RTP headers and the coalescer's headroom leave room for the frame
+    // header in front of the payload; otherwise it is copied once.
+    size_t len = pkt.length - pkt.offset;
+    header = ws::header_size(len);
+    if (unlikely(pkt.offset < header))
+    {
+        auto buf = buffer_pool_.acquire(header + len);
+        if (!buf)
+        {
+            buffer_pool_.release(std::move(pkt.data));
+            return false;
+        }
+        memcpy(buf.get() + header, pkt.data.get() + pkt.offset, len);
+        buffer_pool_.release(std::move(pkt.data));
+        pkt = Packet{std::move(buf), header + len, header};
+    }
+    pkt.offset -= header;
+    ws::write_header(pkt.data.get() + pkt.offset, ws::BINARY, len);
+    return true;
 }
 
-void RTSPToHttpClient::init_rtp_rtcp_server_addr()
+void RTSPToHttpClient::send_websocket_control(ws::Opcode opcode, const uint8_t *payload, size_t len)
 {
-    server_rtp_addr_.sin_family = AF_INET;
-    server_rtp_addr_.sin_port = htons(ctx.server_rtp_port);
-    inet_pton(AF_INET, ctx.server_ip.c_str(), &server_rtp_addr_.sin_addr);
-
-    server_rtcp_addr_.sin_family = AF_INET;
-    server_rtcp_addr_.sin_port = htons(ctx.server_rtcp_port);
-    inet_pton(AF_INET, ctx.server_ip.c_str(), &server_rtcp_addr_.sin_addr);
+    auto buf = buffer_pool_.acquire(ws::MAX_HEADER + len);
+    size_t header = ws::write_header(buf.get(), opcode, len);
+    if (len > 0)
+        memcpy(buf.get() + header, payload, len);
+
+    send_queue_.push_control(Packet{std::move(buf), header + len, 0});
+    if (pacer_)
+        pacer_->on_control(header + len);
+    want_client_writable();
 }
 
-void RTSPToHttpClient::send_rtp_trigger()
+void RTSPToHttpClient::on_client_closed()
 {
-    char dummy = 0;
-    ssize_t n = sendto(rtp_fd_, &dummy, 1, 0,
-                       (struct sockaddr *)&server_rtp_addr_, sizeof(server_rtp_addr_));
-    if (n < 0)
+    if (is_closed_) return;
+    is_closed_ = true;
+    if (multicast_id_ != 0)
     {
-        Logger::error("[RTP] Trigger send failed");
+        MulticastHub::getInstance().unsubscribe(multicast_id_);
+        multicast_id_ = 0;
     }
+    if (on_closed_callback_)
+        on_closed_callback_();
 }
 
-void RTSPToHttpClient::send_zte_heartbeat()
+void RTSPToHttpClient::init_reorder_timer()
 {
-    uint8_t payload[84];
-    memset(payload, 0, sizeof(payload));
-    memcpy(payload, "ZXV10STB", 8);
-    payload[8] = 0x7f;
-    payload[9] = 0xff;
-    payload[10] = 0xff;
-    payload[11] = 0xff;
-
-    struct in_addr addr;
-    if (inet_pton(AF_INET, local_ip_.c_str(), &addr) == 1) {
-        memcpy(payload + 12, &addr.s_addr, 4);
+    reorder_timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (reorder_timer_fd_ < 0)
+    {
+        Logger::warn("[RTP] Failed to create reorder timer, gaps will only be skipped on later packets");
+        return;
     }
 
-    uint16_t udp_port = rtp_port_;
-    uint16_t tcp_port = local_tcp_port_;
-
-    payload[16] = (udp_port >> 8) & 0xFF;
-    payload[17] = udp_port & 0xFF;
-    payload[18] = (tcp_port >> 8) & 0xFF;
-    payload[19] = tcp_port & 0xFF;
+    reorder_timer_ctx_ = std::make_unique<SocketCtx>(
+        reorder_timer_fd_,
+        [this](uint32_t event)
+        { handle_reorder_timer(event); });
 
-    ssize_t n = sendto(rtp_fd_, payload, sizeof(payload), 0,
-                       (struct sockaddr *)&server_rtp_addr_, sizeof(server_rtp_addr_));
-    if (n < 0)
-    {
-        Logger::error("[RTP] ZTE heartbeat send failed");
-    }
-    else
-    {
-        Logger::debug("[RTP] ZTE heartbeat sent to " + ctx.server_ip + ":" + std::to_string(ctx.server_rtp_port));
-    }
+    loop_->set(reorder_timer_ctx_.get(), reorder_timer_fd_, EPOLLIN);
 }
 
-void RTSPToHttpClient::init_timer_fd()
+void RTSPToHttpClient::init_watchdog()
 {
-    using namespace std::chrono;
-
-    // Use FdGuard to ensure old FD is removed from epoll and closed
-    timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
-    itimerspec its{};
-    auto interval = seconds(20);
-
-    its.it_value.tv_sec = interval.count();
-    its.it_interval.tv_sec = interval.count();
-
-    timerfd_settime(timer_fd_, 0, &its, nullptr);
-
-    // Defer deletion of old context if it exists
-    if (timer_ctx_)
+    watchdog_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (watchdog_fd_ < 0)
     {
-        loop_->defer_delete(std::move(timer_ctx_));
+        Logger::warn("[RTSP] Failed to create upstream watchdog, stalls will not be detected");
+        return;
     }
 
-    timer_ctx_ = std::make_unique<SocketCtx>(
-        timer_fd_,
+    itimerspec its{};
+    its.it_value.tv_nsec = WATCHDOG_INTERVAL_MS * 1000000L;
+    its.it_interval.tv_nsec = WATCHDOG_INTERVAL_MS * 1000000L;
+    timerfd_settime(watchdog_fd_, 0, &its, nullptr);
+
+    watchdog_ctx_ = std::make_unique<SocketCtx>(
+        watchdog_fd_,
         [this](uint32_t event)
-        { handle_timer(event); });
+        { handle_watchdog(event); });
 
-    loop_->set(timer_ctx_.get(), timer_fd_, EPOLLIN);
+    loop_->set(watchdog_ctx_.get(), watchdog_fd_, EPOLLIN);
 }
 
-void RTSPToHttpClient::send_http_response()
+void RTSPToHttpClient::arm_reorder_timer()
 {
-    auto buf = buffer_pool_.acquire();
-
-    const char *response_header =
-        "HTTP/1.1 200 OK\r\n"
-        "Content-Type: video/mp2t\r\n"
-        "Connection: close\r\n"
-        "\r\n";
-
-    size_t len = strlen(response_header);
-    memcpy(buf.get(), response_header, len);
+    if (reorder_timer_armed_ || reorder_timer_fd_ < 0 || !reorder_->is_holding())
+        return;
 
-    send_queue_.push_back(Packet{std::move(buf), len, 0});
+    // One-shot timer for the oldest gap; re-armed from handle_reorder_timer().
+    int ms = std::max(reorder_->next_deadline_ms(), 1);
+    itimerspec its{};
+    its.it_value.tv_sec = ms / 1000;
+    its.it_value.tv_nsec = (ms % 1000) * 1000000L;
+    timerfd_settime(reorder_timer_fd_, 0, &its, nullptr);
+    reorder_timer_armed_ = true;
 }
 
-
-std::string RTSPToHttpClient::RtspMethodToString(RtspMethod method)
+void RTSPToHttpClient::init_coalesce_timer()
 {
-    switch (method)
+    coalesce_timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (coalesce_timer_fd_ < 0)
     {
-    case RtspMethod::OPTIONS:
-        return "OPTIONS";
-    case RtspMethod::DESCRIBE:
-        return "DESCRIBE";
-    case RtspMethod::SETUP:
-        return "SETUP";
-    case RtspMethod::PLAY:
-        return "PLAY";
-    case RtspMethod::PAUSE:
-        return "PAUSE";
-    case RtspMethod::TEARDOWN:
-        return "TEARDOWN";
-    case RtspMethod::GET_PARAMETER:
-        return "GET_PARAMETER";
-    case RtspMethod::SET_PARAMETER:
-        return "SET_PARAMETER";
-    default:
-        return "";
+        Logger::warn("[RTSP] Failed to create coalesce timer, TS is sent per packet");
+        coalescer_.reset();
+        return;
     }
-}
 
-void RTSPToHttpClient::send_rtsp_option()
-{
-    connect_server();
-    push_request_into_queue(RtspMethod::OPTIONS, "rtsp://" + ctx.server_ip + ":" + std::to_string(ctx.server_rtsp_port) + ctx.path, "", "");
-    build_and_send_request();
+    coalesce_timer_ctx_ = std::make_unique<SocketCtx>(
+        coalesce_timer_fd_,
+        [this](uint32_t event)
+        { handle_coalesce_timer(event); });
+
+    loop_->set(coalesce_timer_ctx_.get(), coalesce_timer_fd_, EPOLLIN);
 }
 
-void RTSPToHttpClient::send_rtsp_describe()
+void RTSPToHttpClient::arm_coalesce_timer()
 {
-    std::string headers = "Accept: application/sdp\r\n";
-    if (ServerConfig::isNatEnabled() && ServerConfig::getNatMethod() == "zte") {
-        headers += "User-Agent: HMTL RTSP 1.0; CTC/2.0\r\n";
-        headers += "x-NAT: " + local_ip_ + ":" + std::to_string(local_tcp_port_) + "\r\n";
-        headers += "Timeshift: 1\r\n";
-        headers += "x-BurstSize: 1048576\r\n";
-    }
-    push_request_into_queue(RtspMethod::DESCRIBE, "rtsp://" + ctx.server_ip + ":" + std::to_string(ctx.server_rtsp_port) + ctx.path, headers, "");
-    build_and_send_request();
+    if (coalesce_timer_armed_ || coalesce_timer_fd_ < 0 || !coalescer_->is_holding())
+        return;
+
+    // One-shot timer for the chunk being filled; re-armed from handle_coalesce_timer().
+    int ms = std::max(coalescer_->next_deadline_ms(), 1);
+    itimerspec its{};
+    its.it_value.tv_sec = ms / 1000;
+    its.it_value.tv_nsec = (ms % 1000) * 1000000L;
+    timerfd_settime(coalesce_timer_fd_, 0, &its, nullptr);
+    coalesce_timer_armed_ = true;
 }
 
-void RTSPToHttpClient::send_rtsp_setup(const std::string &sdp_data)
+void RTSPToHttpClient::init_pace_timer()
 {
-    if (!sdp_data.empty())
+    pace_timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (pace_timer_fd_ < 0)
     {
-        rtspParser::SDP::parseSDP(sdp_data, ctx);
+        Logger::warn("[RTSP] Failed to create pace timer, output is not paced");
+        pacer_.reset();
+        return;
     }
 
-    std::string track;
-
-    for (const auto &media : ctx.sdp.media_streams)
-    {
-
-        if (std::find(media.formats.begin(), media.formats.end(), "33") != media.formats.end())
-        {
-            track = media.trackID;
-            break;
-        }
-    }
+    pace_timer_ctx_ = std::make_unique<SocketCtx>(
+        pace_timer_fd_,
+        [this](uint32_t event)
+        { handle_pace_timer(event); });
 
-    if (track.empty())
-    {
-        Logger::error("[RTSP] Unsupported video format, no track with format 33 found!");
-        on_closed_callback_();
-        return;
-    }
+    loop_->set(pace_timer_ctx_.get(), pace_timer_fd_, EPOLLIN);
+}
 
-    int port1 = nat_wan_port ? nat_wan_port : rtp_port_;
-    int port2 = port1 + 1;
+void RTSPToHttpClient::send_http_response(const std::string &websocket_accept)
+{
+    auto buf = buffer_pool_.acquire();
 
-    std::string header;
-    if (setup_retry_with_tcp_)
-    {
-        header = "Transport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n";
-        Logger::debug("[RTSP] SETUP with TCP Interleaved mode");
-    }
-    else if (ServerConfig::isNatEnabled() && ServerConfig::getNatMethod() == "zte")
+    std::string response_header;
+    if (websocket_)
     {
-        header = "Transport: MP2T/RTP/UDP;unicast;client_address=" + local_ip_ +
-                 ";client_port=" + std::to_string(port1) + "-" + std::to_string(port2) +
-                 ";mode=PLAY\r\n";
-        header += "User-Agent: HMTL RTSP 1.0; CTC/2.0\r\n";
-        header += "x-NAT: " + local_ip_ + ":" + std::to_string(local_tcp_port_) + "\r\n";
-        Logger::debug("[RTSP] ZTE SETUP with client port: " + std::to_string(port1) + "-" + std::to_string(port2));
+        response_header = "HTTP/1.1 101 Switching Protocols\r\n"
+                          "Upgrade: websocket\r\n"
+                          "Connection: Upgrade\r\n"
+                          "Sec-WebSocket-Accept: " + websocket_accept + "\r\n"
+                          "\r\n";
     }
     else
     {
-        header = "Transport: RTP/AVP;unicast;client_port=" +
-                 std::to_string(port1) + "-" + std::to_string(port2) + "\r\n";
-        Logger::debug("[RTSP] SETUP with client port: " + std::to_string(port1) + "-" + std::to_string(port2));
+        response_header = "HTTP/1.1 200 OK\r\n"
+                          "Content-Type: video/mp2t\r\n"
+                          "Connection: close\r\n"
+                          "\r\n";
     }
 
-    std::string base_url;
-    if (!ctx.content_base.empty()) {
-        base_url = ctx.content_base;
-    } else {
-        base_url = "rtsp://" + ctx.server_ip + ":" + std::to_string(ctx.server_rtsp_port) + ctx.path;
-        size_t query_pos = base_url.find('?');
-        if (query_pos != std::string::npos) {
-            base_url = base_url.substr(0, query_pos);
-        }
-    }
+    size_t len = response_header.size();
+    memcpy(buf.get(), response_header.data(), len);
 
-    if (!base_url.empty() && base_url.back() != '/' && !track.empty() && track[0] != '*') {
-        base_url += "/";
-    }
-    
-    std::string url = base_url + track;
-    push_request_into_queue(RtspMethod::SETUP, url, header, "");
-
-    build_and_send_request();
+    send_queue_.push_control(Packet{std::move(buf), len, 0});
+    if (pacer_)
+        pacer_->on_control(len);
+    // The browser only opens the socket, and starts its player, on the answer.
+    if (websocket_)
+        want_client_writable();
 }
 
-void RTSPToHttpClient::send_rtsp_play()
-{
-    std::string base_url;
-    if (!ctx.content_base.empty()) {
-        base_url = ctx.content_base;
-    } else {
-        base_url = "rtsp://" + ctx.server_ip + ":" + std::to_string(ctx.server_rtsp_port) + ctx.path;
-    }
-
-    std::string header = "Range: npt=0.000-\r\n";
-    if (ServerConfig::isNatEnabled() && ServerConfig::getNatMethod() == "zte") {
-        // Only use clock=end- for live streams (usually no query params like tvdr)
-        if (ctx.path.find('?') == std::string::npos) {
-            header = "Range: clock=end-\r\n";
-        }
-        header += "User-Agent: HMTL RTSP 1.0; CTC/2.0\r\n";
-        header += "x-BurstSize: 1048576\r\n";
-        header += "Scale: 1.0\r\n";
-    }
-    
-    push_request_into_queue(RtspMethod::PLAY, base_url, header);
-    build_and_send_request();
-}
 
 //////////////////////////////
 // FdGuard
@@ -835,20 +979,100 @@ RTSPToHttpClient::FdGuard::operator int() const { return fd_; }
 json RTSPToHttpClient::get_info() const
 {
     json info;
-    info["type"] = "http-proxy";
-    info["transport"] = is_tcp_mode_ ? "TCP" : "UDP";
-    
+    info["type"] = websocket_ ? "websocket" : "http-proxy";
+
     char addr[INET_ADDRSTRLEN];
     inet_ntop(AF_INET, &client_addr_.sin_addr, addr, INET_ADDRSTRLEN);
     info["downstream"] = std::string(addr) + ":" + std::to_string(ntohs(client_addr_.sin_port));
-    
-    info["upstream"] = ctx.server_ip + ":" + std::to_string(ctx.server_rtsp_port);
+    info["url"] = uri_;
+
+    if (legs_.empty())
+    {
+        info["transport"] = "multicast";
+        info["upstream"] = multicast_group_.to_string();
+    }
+    else
+    {
+        const LegSlot &primary = legs_.front();
+        const rtspCtx &primary_ctx = primary.upstream ? primary.upstream->ctx() : primary.sources[primary.source];
+        info["transport"] = primary.upstream && primary.upstream->is_tcp() ? "TCP" : "UDP";
+        info["upstream"] = primary_ctx.server_ip + ":" + std::to_string(primary_ctx.server_rtsp_port);
+    }
     
     auto now = std::chrono::steady_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::seconds>(now - start_time_).count();
     info["proxy"] = std::to_string(duration);
-    info["upstream_bandwidth"] = (uint64_t)upstream_est_.getBandwidth();
+
+    double upstream_bandwidth = 0;
+    for (const auto &leg : legs_)
+        if (leg.upstream) upstream_bandwidth += leg.upstream->bandwidth();
+    info["upstream_bandwidth"] = (uint64_t)upstream_bandwidth;
     info["downstream_bandwidth"] = (uint64_t)downstream_est_.getBandwidth();
-    
+
+    auto ps = rtp_pipeline_->stats();
+    info["pipeline"] = {{"profile", rtp_pipeline_->profile().name},
+                        {"packets", ps.packets},
+                        {"dropped", ps.dropped},
+                        {"cc_errors", ps.cc_errors}};
+
+    const auto &rs = reorder_->stats();
+    info["rtp"] = {{"received", rs.received},
+                   {"lost", rs.lost},
+                   {"reordered", rs.reordered},
+                   {"duplicates", rs.duplicates},
+                   {"late", rs.late}};
+    info["resumes"] = resync_.resumes();
+
+    const auto &qs = send_queue_.stats();
+    info["queue"] = {{"bytes", send_queue_.bytes()},
+                     {"high_water", qs.high_water},
+                     {"drops", qs.drops},
+                     {"resyncs", qs.resyncs}};
+    if (coalescer_)
+    {
+        info["coalesce"] = {{"payloads", coalescer_->payloads()},
+                            {"chunks", coalescer_->chunks()}};
+    }
+    if (pacer_)
+    {
+        info["pacing"] = {{"rate", pacer_->rate_bytes_per_sec()},
+                          {"held", pacer_->held_bytes()},
+                          {"rebases", pacer_->rebases()}};
+    }
+
+    if (leg_monitor_)
+    {
+        json legs = json::array();
+        for (size_t i = 0; i < legs_.size(); ++i)
+        {
+            json leg = legs_[i].upstream ? legs_[i].upstream->get_info()
+                                         : json{{"name", legs_[i].opts.name}, {"state", "reconnecting"}};
+            leg["reconnects"] = legs_[i].reconnects;
+            const auto &ls = leg_monitor_->stats(i);
+            leg["received"] = ls.received;
+            leg["lost"] = ls.lost;
+            leg["first"] = ls.first;
+            leg["lag_ms"] = ls.avg_lag_ms();
+            legs.push_back(std::move(leg));
+        }
+        info["legs"] = std::move(legs);
+        info["redundancy"] = redundancy_ == Redundancy::MERGE     ? "merge"
+                             : redundancy_ == Redundancy::STANDBY ? "standby"
+                                                                  : "pending";
+        if (redundancy_ != Redundancy::MERGE)
+            info["active_leg"] = legs_[active_leg_].opts.name;
+        info["leg_switches"] = leg_switches_;
+    }
+    else if (!legs_.empty())
+    {
+        const LegSlot &primary = legs_.front();
+        info["reconnects"] = primary.reconnects;
+        if (primary.upstream)
+        {
+            json leg = primary.upstream->get_info();
+            if (leg.contains("fec")) info["fec"] = leg["fec"];
+        }
+    }
+
     return info;
 }
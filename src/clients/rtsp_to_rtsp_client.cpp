@@ -4,13 +4,18 @@
 #include "core/epoll_loop.h"
 #include "core/logger.h"
 #include "core/server_config.h"
+#include "core/upstream_selector.h"
+#include "core/upstream_conn_pool.h"
 #include "core/buffer_pool.h"
 #include "common/socket_ctx.h"
 #include "common/rtsp_ctx.h"
 #include "protocol/rtsp_parser.h"
+#include "protocol/rtsp_message.h"
 #include "utils/socket_helper.h"
 #include "utils/stun_client.h"
+#include "utils/utils.h"
 #include "core/port_pool.h"
+#include "core/shared_rtp_socket.h"
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <unistd.h>
@@ -18,7 +23,6 @@
 #include <cstring>
 #include <sys/timerfd.h>
 #include <chrono>
-#include <regex>
 
 
 /* ========================================================================= */
@@ -30,24 +34,44 @@ static std::string replace_header(const std::string &msg,
                                   const std::string &header_name,
                                   const std::string &new_value)
 {
-    std::string result = msg;
-    std::string lower_result = result;
-    std::string lower_hdr = header_name;
-    std::transform(lower_result.begin(), lower_result.end(), lower_result.begin(), ::tolower);
-    std::transform(lower_hdr.begin(), lower_hdr.end(), lower_hdr.begin(), ::tolower);
-
-    size_t pos = lower_result.find(lower_hdr + ":");
-    if (pos == std::string::npos)
-        return msg;
-
-    size_t end = result.find("\r\n", pos);
-    if (end == std::string::npos)
+    std::string_view value = rtspParser::find_header(msg, header_name);
+    if (value.data() == nullptr)
         return msg;
 
-    result.replace(pos, end - pos, header_name + ": " + new_value);
+    std::string result = msg;
+    result.replace(value.data() - msg.data(), value.size(), new_value);
     return result;
 }
 
+// Rebuilds a Transport value with the parameter starting with key replaced
+// (or dropped when replacement is empty). Returns false if it is absent.
+static bool replace_transport_param(std::string &transport, std::string_view key, std::string_view replacement)
+{
+    size_t pos = 0;
+    while (pos < transport.size())
+    {
+        size_t semi = transport.find(';', pos);
+        size_t end = semi == std::string::npos ? transport.size() : semi;
+        if (transport.compare(pos, key.size(), key) == 0)
+        {
+            if (!replacement.empty())
+            {
+                transport.replace(pos, end - pos, replacement);
+            }
+            else
+            {
+                // Drop the parameter together with one adjacent separator.
+                size_t from = pos > 0 ? pos - 1 : pos;
+                size_t to = (pos == 0 && semi != std::string::npos) ? end + 1 : end;
+                transport.erase(from, to - from);
+            }
+            return true;
+        }
+        pos = end + 1;
+    }
+    return false;
+}
+
 /* ========================================================================= */
 /* Constructor / Destructor                                                   */
 /* ========================================================================= */
@@ -68,10 +92,14 @@ RTSPToRtspClient::RTSPToRtspClient(EpollLoop *loop, BufferPool &pool,
       rtp_ds_fd_(-1, loop),
       rtcp_ds_fd_(-1, loop),
       timer_fd_(-1, loop),
+      fec_col_fd_(-1, loop),
+      fec_row_fd_(-1, loop),
       ctx_(config.ctx),
+      to_downstream_q_(pool),
+      ds_rtp_batch_(pool),
       proxy_uri_prefix_(config.proxy_uri_prefix),
       upstream_uri_base_(config.upstream_uri_base),
-      rtp_pipeline_(std::make_unique<RtpPipeline>())
+      rtp_pipeline_(RtpPipeline::create(config.profile))
 {
     // Remove the simple EPOLLIN watch that was set by the accept handler;
     // we will re-register it ourselves.
@@ -79,7 +107,11 @@ RTSPToRtspClient::RTSPToRtspClient(EpollLoop *loop, BufferPool &pool,
 
     // Stash the first request so it gets forwarded once the upstream TCP
     // connection is established.
-    downstream_recv_buf_ = first_request;
+    first_request_ = first_request;
+
+    // Interleaved RTP from the server is received into pool blocks with room
+    // for the downstream '$' header, so it is relayed without further copies.
+    upstream_demux_.set_frame_pool(&pool_, INTERLEAVED_HEADROOM);
 
     // Register downstream fd for HUP/ERR only; we will not read more until
     // upstream is ready.
@@ -91,15 +123,14 @@ RTSPToRtspClient::RTSPToRtspClient(EpollLoop *loop, BufferPool &pool,
 
 RTSPToRtspClient::~RTSPToRtspClient()
 {
-    for (auto &packet : to_downstream_q_) {
-        if (packet.data) {
-            pool_.release(std::move(packet.data));
-        }
-    }
+    fec_.reset();
     to_downstream_q_.clear();
 
-    if (local_rtp_us_port_ != 0) {
-        PortPool::getInstance().release_pair(local_rtp_us_port_);
+    if (shared_rtp_id_ != 0) {
+        SharedRtpSocket::getInstance().unsubscribe(shared_rtp_id_);
+    }
+    if (local_rtp_us_port_ != 0 && !shared_rtp_) {
+        PortPool::getInstance().release_pair(local_rtp_us_port_, us_port_pairs_);
     }
     if (local_rtp_ds_port_ != 0) {
         PortPool::getInstance().release_pair(local_rtp_ds_port_);
@@ -117,10 +148,17 @@ void RTSPToRtspClient::set_on_closed_callback(ClosedCallback cb)
 
 void RTSPToRtspClient::connect_upstream()
 {
-    upstream_fd_ = create_nonblocking_tcp(ctx_.server_ip, ctx_.server_rtsp_port,
-                                          ServerConfig::getMitmUpstreamInterface());
+    connect_start_ = std::chrono::steady_clock::now();
+    // The relay forwards the client's CSeq numbers, so only never-used pooled connections fit.
+    auto lease = UpstreamConnPool::getInstance().acquire(ctx_.server_ip, ctx_.server_rtsp_port,
+                                                         ServerConfig::getMitmUpstreamInterface(), false);
+    pooled_ = lease.fd >= 0;
+    upstream_fd_ = pooled_ ? lease.fd
+                           : create_nonblocking_tcp(ctx_.server_ip, ctx_.server_rtsp_port,
+                                                    ServerConfig::getMitmUpstreamInterface());
     if (upstream_fd_ < 0)
     {
+        UpstreamSelector::getInstance().report_failure(ctx_);
         throw std::runtime_error("Failed to connect to upstream " + ctx_.server_ip +
                                 ":" + std::to_string(ctx_.server_rtsp_port));
     }
@@ -138,47 +176,51 @@ void RTSPToRtspClient::connect_upstream()
 /* Helpers                                                                    */
 /* ========================================================================= */
 
-bool RTSPToRtspClient::extract_client_port(const std::string &req,
+bool RTSPToRtspClient::extract_client_port(std::string_view req,
                                          uint16_t &rtp_port, uint16_t &rtcp_port)
 {
-    std::string transport = rtspParser::extract_header_value(req, "Transport");
+    std::string_view transport = rtspParser::find_header(req, "Transport");
     if (transport.empty())
         return false;
 
     // client_port=NNNN-MMMM
-    std::regex re(R"(client_port=(\d+)-(\d+))");
-    std::smatch m;
-    if (!std::regex_search(transport, m, re))
-        return false;
-
-    rtp_port = static_cast<uint16_t>(std::stoi(m[1]));
-    rtcp_port = static_cast<uint16_t>(std::stoi(m[2]));
-    return true;
+    return rtspParser::parse_transport_pair(transport, "client_port=", rtp_port, rtcp_port);
 }
 
-bool RTSPToRtspClient::extract_interleaved_channels(const std::string &req,
+bool RTSPToRtspClient::extract_interleaved_channels(std::string_view req,
                                                  uint8_t &rtp_chan, uint8_t &rtcp_chan)
 {
-    std::string transport = rtspParser::extract_header_value(req, "Transport");
+    std::string_view transport = rtspParser::find_header(req, "Transport");
     if (transport.empty())
         return false;
 
     // interleaved=0-1
-    std::regex re(R"(interleaved=(\d+)-(\d+))");
-    std::smatch m;
-    if (!std::regex_search(transport, m, re))
+    uint16_t rtp = 0, rtcp = 0;
+    if (!rtspParser::parse_transport_pair(transport, "interleaved=", rtp, rtcp) || rtp > 255 || rtcp > 255)
         return false;
 
-    rtp_chan = static_cast<uint8_t>(std::stoi(m[1]));
-    rtcp_chan = static_cast<uint8_t>(std::stoi(m[2]));
+    rtp_chan = static_cast<uint8_t>(rtp);
+    rtcp_chan = static_cast<uint8_t>(rtcp);
     return true;
 }
 
 bool RTSPToRtspClient::init_relay_sockets()
 {
-    // 1. Allocate UPSTREAM-facing sockets (bound to mitm interface)
-    if (bind_udp_pair_from_pool(rtp_us_fd_.get_ref(), rtcp_us_fd_.get_ref(), 
-                                local_rtp_us_port_, ServerConfig::getMitmUpstreamInterface()) < 0)
+    // 1. Allocate UPSTREAM-facing sockets (bound to mitm interface);
+    //    with FEC the column/row ports at +2/+4 are reserved as well.
+    //    Without FEC or STUN the shared port pair is used instead.
+    auto &shared = SharedRtpSocket::getInstance();
+    if (shared.enabled() && !ServerConfig::isFecEnabled() &&
+        !(ServerConfig::isNatEnabled() && ServerConfig::getNatMethod() == "stun"))
+    {
+        local_rtp_us_port_ = shared.port(ServerConfig::getMitmUpstreamInterface());
+        shared_rtp_ = local_rtp_us_port_ != 0;
+    }
+    us_port_pairs_ = ServerConfig::isFecEnabled() ? 3 : 1;
+    if (!shared_rtp_ &&
+        bind_udp_pair_from_pool(rtp_us_fd_.get_ref(), rtcp_us_fd_.get_ref(), 
+                                local_rtp_us_port_, ServerConfig::getMitmUpstreamInterface(),
+                                us_port_pairs_) < 0)
     {
         Logger::error("[MITM] Failed to bind upstream-facing UDP sockets");
         return false;
@@ -195,12 +237,17 @@ bool RTSPToRtspClient::init_relay_sockets()
     local_rtcp_ds_port_ = local_rtp_ds_port_ + 1;
 
     // Register all for EPOLLIN
-    rtp_us_ctx_ = std::make_unique<SocketCtx>(
-        rtp_us_fd_,
-        [this](uint32_t ev) { handle_rtp_from_upstream(ev); });
-    rtcp_us_ctx_ = std::make_unique<SocketCtx>(
-        rtcp_us_fd_,
-        [this](uint32_t ev) { handle_rtcp_from_upstream(ev); });
+    if (!shared_rtp_)
+    {
+        rtp_us_ctx_ = std::make_unique<SocketCtx>(
+            rtp_us_fd_,
+            [this](uint32_t ev) { handle_rtp_from_upstream(ev); });
+        rtcp_us_ctx_ = std::make_unique<SocketCtx>(
+            rtcp_us_fd_,
+            [this](uint32_t ev) { handle_rtcp_from_upstream(ev); });
+        loop_->set(rtp_us_ctx_.get(), rtp_us_fd_, EPOLLIN);
+        loop_->set(rtcp_us_ctx_.get(), rtcp_us_fd_, EPOLLIN);
+    }
     rtp_ds_ctx_ = std::make_unique<SocketCtx>(
         rtp_ds_fd_,
         [this](uint32_t ev) { handle_rtp_from_client(ev); });
@@ -208,164 +255,110 @@ bool RTSPToRtspClient::init_relay_sockets()
         rtcp_ds_fd_,
         [this](uint32_t ev) { handle_rtcp_from_client(ev); });
 
-    loop_->set(rtp_us_ctx_.get(), rtp_us_fd_, EPOLLIN);
-    loop_->set(rtcp_us_ctx_.get(), rtcp_us_fd_, EPOLLIN);
     loop_->set(rtp_ds_ctx_.get(), rtp_ds_fd_, EPOLLIN);
     loop_->set(rtcp_ds_ctx_.get(), rtcp_ds_fd_, EPOLLIN);
 
+    if (ServerConfig::isFecEnabled())
+    {
+        init_fec_sockets();
+    }
 
-    Logger::debug("[MITM] Relay ports: US=" + std::to_string(local_rtp_us_port_) + 
+    Logger::debug("[MITM] Relay ports: US=" + std::to_string(local_rtp_us_port_) + (shared_rtp_ ? " (shared)" : "") +
                  ", DS=" + std::to_string(local_rtp_ds_port_));
     return true;
 }
 
+void RTSPToRtspClient::init_fec_sockets()
+{
+    if (bind_udp_fec_sockets(fec_col_fd_.get_ref(), fec_row_fd_.get_ref(), local_rtp_us_port_,
+                             ServerConfig::getMitmUpstreamInterface()) < 0)
+    {
+        Logger::warn("[MITM] Failed to bind FEC sockets, continuing without FEC");
+        return;
+    }
+
+    fec_ = std::make_unique<RtpFecDecoder>(
+        pool_,
+        [this](Packet &&pkt) { relay_rtp_downstream(std::move(pkt.data), 0, pkt.length); });
+
+    int col_fd = fec_col_fd_;
+    int row_fd = fec_row_fd_;
+    fec_col_ctx_ = std::make_unique<SocketCtx>(
+        col_fd,
+        [this, col_fd](uint32_t ev) { handle_fec_from_upstream(col_fd, ev); });
+    fec_row_ctx_ = std::make_unique<SocketCtx>(
+        row_fd,
+        [this, row_fd](uint32_t ev) { handle_fec_from_upstream(row_fd, ev); });
+
+    loop_->set(fec_col_ctx_.get(), col_fd, EPOLLIN);
+    loop_->set(fec_row_ctx_.get(), row_fd, EPOLLIN);
+}
+
 /* ========================================================================= */
 /* Response patching for client (MITM)                                        */
 /* ========================================================================= */
 
-std::string RTSPToRtspClient::patch_response_for_client(const std::string &resp)
+void RTSPToRtspClient::patch_response_for_client(const RtspMessage &resp, std::string &out)
 {
-    std::string result = resp;
-
     // Dynamically get local IP/port that the client connected to
     struct sockaddr_in local_addr{};
     socklen_t addr_len = sizeof(local_addr);
     getsockname(downstream_fd_, (struct sockaddr *)&local_addr, &addr_len);
-    std::string proxy_ip = inet_ntoa(local_addr.sin_addr);
-    uint16_t proxy_port = ntohs(local_addr.sin_port);
+    char proxy_ip[INET_ADDRSTRLEN] = {0};
+    inet_ntop(AF_INET, &local_addr.sin_addr, proxy_ip, sizeof(proxy_ip));
 
-    // 1. Rewrite Transport header (if present)
-    std::string transport = rtspParser::extract_header_value(result, "Transport");
+    // Parse server_port from upstream response and remember it.
+    std::string_view transport = resp.header("Transport");
+    uint16_t srv_rtp = 0, srv_rtcp = 0;
     if (!transport.empty())
     {
-        Logger::debug("[MITM] Original Transport: " + transport);
-
-        if (!ds_transport_protocol_.empty()) {
-            size_t pos = transport.find("MP2T/RTP/UDP");
-            if (pos != std::string::npos) {
-                transport.replace(pos, 12, ds_transport_protocol_);
-            }
-        }
-
-        // Parse server_port from upstream response and remember it.
-        std::regex sp_re(R"(server_port=(\d+)-(\d+))");
-        std::smatch sm;
-        if (std::regex_search(transport, sm, sp_re))
+        Logger::debug("[MITM] Original Transport: " + std::string(transport));
+    }
+    if (rtspParser::parse_transport_pair(transport, "server_port=", srv_rtp, srv_rtcp))
+    {
+        server_rtp_addr_.sin_family = AF_INET;
+        server_rtp_addr_.sin_port = htons(srv_rtp);
+        inet_pton(AF_INET, ctx_.server_ip.c_str(), &server_rtp_addr_.sin_addr);
+        server_rtcp_addr_.sin_family = AF_INET;
+        server_rtcp_addr_.sin_port = htons(srv_rtcp);
+        inet_pton(AF_INET, ctx_.server_ip.c_str(), &server_rtcp_addr_.sin_addr);
+
+        if (!is_upstream_tcp_)
         {
-            uint16_t srv_rtp = static_cast<uint16_t>(std::stoi(sm[1]));
-            uint16_t srv_rtcp = static_cast<uint16_t>(std::stoi(sm[2]));
-            server_rtp_addr_.sin_family = AF_INET;
-            server_rtp_addr_.sin_port = htons(srv_rtp);
-            inet_pton(AF_INET, ctx_.server_ip.c_str(), &server_rtp_addr_.sin_addr);
-            server_rtcp_addr_.sin_family = AF_INET;
-            server_rtcp_addr_.sin_port = htons(srv_rtcp);
-            inet_pton(AF_INET, ctx_.server_ip.c_str(), &server_rtcp_addr_.sin_addr);
-            
-            if (!is_upstream_tcp_)
+            if (shared_rtp_ && shared_rtp_id_ == 0)
             {
-                if (ServerConfig::isNatEnabled() && ServerConfig::getNatMethod() == "zte")
-                {
-                    send_zte_heartbeat();
-                }
-                else
-                {
-                    send_rtp_trigger();
-                }
+                subscribe_shared_rtp(transport);
             }
-        }
-
-        // Rewrite client_port back to original client ports.
-        std::regex cp_re(R"(client_port=\d+-\d+)");
-
-        if (is_downstream_tcp_)
-        {
-            // If downstream requested TCP, ensure the response says so.
-            if (transport.find("RTP/AVP/TCP") == std::string::npos)
+            if (ServerConfig::isNatEnabled() && ServerConfig::getNatMethod() == "zte")
             {
-                size_t pos = transport.find("RTP/AVP");
-                if (pos != std::string::npos)
-                    transport.replace(pos, 7, "RTP/AVP/TCP");
+                send_zte_heartbeat();
             }
-            // Remove server_port and client_port, replace with interleaved
-            transport = std::regex_replace(transport, cp_re, "");
-            transport = std::regex_replace(transport, sp_re, "");
-            
-            // Clean up double semicolons or trailing semicolons
-            while (transport.find(";;") != std::string::npos) transport.replace(transport.find(";;"), 2, ";");
-            if (!transport.empty() && transport.back() == ';') transport.pop_back();
-
-            if (transport.find("interleaved=") == std::string::npos)
+            else
             {
-                transport += ";interleaved=" + std::to_string(ds_interleaved_rtp_) + "-" +
-                             std::to_string(ds_interleaved_rtcp_);
+                send_rtp_trigger();
             }
         }
-        else
-        {
-            std::string client_rtp_str = std::to_string(ntohs(client_rtp_addr_.sin_port));
-            std::string client_rtcp_str = std::to_string(ntohs(client_rtcp_addr_.sin_port));
-            transport = std::regex_replace(
-                transport, cp_re,
-                "client_port=" + client_rtp_str + "-" + client_rtcp_str);
-
-            // Rewrite server_port to OUR downstream-facing relay ports.
-            transport = std::regex_replace(
-                transport, sp_re,
-                "server_port=" + std::to_string(local_rtp_ds_port_) + "-" +
-                    std::to_string(local_rtcp_ds_port_));
-        }
-
-        // Rewrite source to our proxy IP
-        std::regex src_re(R"(source=[0-9.]+)");
-        transport = std::regex_replace(transport, src_re, "source=" + proxy_ip);
-
-        Logger::debug("[MITM] Patched Transport: " + transport);
-        result = replace_header(result, "Transport", transport);
     }
-    // 2. Rewrite Content-Base and RTP-Info (URIs pointing to upstream)
-    // We need to be flexible with ports because the server might use 9820 or other ports.
-    // Regex matches rtsp://<upstream-ip>:<any-port>/
-    std::string upstream_pattern = "rtsp://" + ctx_.server_ip + "(:[0-9]+)?/";
-    std::regex uri_re(upstream_pattern);
-    
-    auto patch_uri_header = [&](const std::string& h_name) {
-        std::string val = rtspParser::extract_header_value(result, h_name);
-        if (!val.empty()) {
-            std::smatch m;
-            if (std::regex_search(val, m, uri_re)) {
-                // The match is the upstream base. We want to prefix it.
-                // But wait, the proxy format is rtsp://proxy/real-host:port/path
-                // So we replace rtsp://real-host:port/ with rtsp://proxy/real-host:port/
-                std::string matched = m.str(); // e.g. "rtsp://112.245.125.44:53364/"
-                std::string host_port = matched.substr(7, matched.size() - 8); // "112.245.125.44:53364"
-                std::string replacement = "rtsp://" + proxy_ip + ":" + std::to_string(proxy_port) + "/" + host_port + "/";
-                val = std::regex_replace(val, uri_re, replacement);
-                result = replace_header(result, h_name, val);
-            }
-        }
-    };
-    patch_uri_header("Content-Base");
-    patch_uri_header("RTP-Info");
 
-    // 3. Rewrite SDP (c= and o= lines)
-    size_t sdp_pos = result.find("\r\n\r\n");
-    if (sdp_pos != std::string::npos)
-    {
-        std::string headers = result.substr(0, sdp_pos + 4);
-        std::string sdp     = result.substr(sdp_pos + 4);
-        if (!sdp.empty() && headers.find("application/sdp") != std::string::npos)
-        {
-            // Replace upstream IP in c= and o= lines
-            std::regex ip_re(R"(IP4 [0-9.]+)");
-            sdp = std::regex_replace(sdp, ip_re, "IP4 " + proxy_ip);
+    // Transport, URI headers and the SDP body are rewritten in one pass.
+    RtspRewriter::Rules rules;
+    rules.upstream_host = ctx_.server_ip;
+    rules.proxy_ip = proxy_ip;
+    rules.proxy_port = ntohs(local_addr.sin_port);
+    rules.transport_protocol = ds_transport_protocol_;
+    rules.interleaved = is_downstream_tcp_;
+    rules.rtp_channel = ds_interleaved_rtp_;
+    rules.rtcp_channel = ds_interleaved_rtcp_;
+    rules.client_rtp_port = ntohs(client_rtp_addr_.sin_port);
+    rules.client_rtcp_port = ntohs(client_rtcp_addr_.sin_port);
+    rules.server_rtp_port = local_rtp_ds_port_;
+    rules.server_rtcp_port = local_rtcp_ds_port_;
+    rewriter_.rewrite_response(resp, rules, out);
 
-            // Update Content-Length
-            result = headers + sdp;
-            result = replace_header(result, "Content-Length", std::to_string(sdp.size()));
-        }
+    if (!transport.empty())
+    {
+        Logger::debug("[MITM] Patched Transport: " + std::string(rtspParser::find_header(out, "Transport")));
     }
-
-    return result;
 }
 
 std::string RTSPToRtspClient::patch_transport_for_upstream(const std::string &req)
@@ -400,7 +393,7 @@ std::string RTSPToRtspClient::patch_transport_for_upstream(const std::string &re
         rtcp_port = nat_wan_port_us_ + 1;
     }
 
-    std::regex re(R"(client_port=\d+-\d+)");
+    std::string client_port = "client_port=" + std::to_string(rtp_port) + "-" + std::to_string(rtcp_port);
     std::string new_transport = transport;
 
     if (transport.find("RTP/AVP/TCP") != std::string::npos || transport.find("interleaved=") != std::string::npos)
@@ -410,19 +403,14 @@ std::string RTSPToRtspClient::patch_transport_for_upstream(const std::string &re
         if (pos != std::string::npos)
             new_transport.replace(pos, 11, "RTP/AVP");
 
-        std::regex int_re(R"(interleaved=\d+-\d+;?)");
-        new_transport = std::regex_replace(new_transport, int_re, "");
-        if (new_transport.back() == ';') new_transport.pop_back();
+        replace_transport_param(new_transport, "interleaved=", "");
+        if (!new_transport.empty() && new_transport.back() == ';') new_transport.pop_back();
 
-        new_transport += ";client_port=" + std::to_string(rtp_port) + "-" +
-                         std::to_string(rtcp_port);
+        new_transport += ";" + client_port;
     }
     else
     {
-        new_transport = std::regex_replace(
-            transport, re,
-            "client_port=" + std::to_string(rtp_port) + "-" +
-                std::to_string(rtcp_port));
+        replace_transport_param(new_transport, "client_port=", client_port);
     }
 
     return replace_header(req, "Transport", new_transport);
@@ -481,6 +469,7 @@ std::string RTSPToRtspClient::rewrite_request_for_upstream(const std::string &re
     {
         uri = upstream_uri_base_ + uri.substr(proxy_uri_prefix_.size());
     }
+    uri = RequestParser::strip_local_params(uri);
 
     return method + " " + uri + " " + rtsp_ver + rest;
 }
@@ -543,7 +532,8 @@ void RTSPToRtspClient::handle_upstream(uint32_t events)
 
 void RTSPToRtspClient::handle_rtp_from_upstream(uint32_t /*events*/)
 {
-    if (ServerConfig::isNatEnabled() && ServerConfig::getNatMethod() == "stun" && state_ == State::WAIT_STUN)
+    // Only ever entered with NAT method "stun"; no string compare per wakeup.
+    if (unlikely(state_ == State::WAIT_STUN))
     {
         sockaddr_in src{};
         socklen_t slen = sizeof(src);
@@ -572,47 +562,123 @@ void RTSPToRtspClient::handle_rtp_from_upstream(uint32_t /*events*/)
         return;
     }
 
-    while (true)
+    std::unique_ptr<uint8_t[]> bufs[RELAY_BATCH];
+    mmsghdr msgs[RELAY_BATCH];
+    iovec iovs[RELAY_BATCH];
+    sockaddr_in src[RELAY_BATCH];
+    size_t capacity = pool_.get_buffer_size() - INTERLEAVED_HEADROOM;
+
+    relay_batching_ = true;
+    while (!closed_)
     {
-        sockaddr_in src{};
-        socklen_t slen = sizeof(src);
-        auto buf = pool_.acquire();
-        ssize_t n = recvfrom(rtp_us_fd_, buf.get(), pool_.get_buffer_size(), 0,
-                             (sockaddr *)&src, &slen);
-        if (n <= 0) {
-            pool_.release(std::move(buf));
+        for (unsigned int i = 0; i < RELAY_BATCH; ++i)
+        {
+            if (!bufs[i])
+                bufs[i] = pool_.acquire();
+            iovs[i] = iovec{bufs[i].get() + INTERLEAVED_HEADROOM, capacity};
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &src[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(src[i]);
+        }
+
+        int count = recvmmsg(rtp_us_fd_, msgs, RELAY_BATCH, 0, nullptr);
+        if (count <= 0)
             break;
+
+        if (unlikely(!us_peer_checked_))
+        {
+            // Let the kernel demux the server's RTP straight to this socket, but only
+            // if it comes from the advertised server_port: many servers send from elsewhere.
+            us_peer_checked_ = true;
+            if (src[0].sin_addr.s_addr == server_rtp_addr_.sin_addr.s_addr && src[0].sin_port == server_rtp_addr_.sin_port)
+                connect(rtp_us_fd_, (sockaddr *)&server_rtp_addr_, sizeof(server_rtp_addr_));
         }
 
-        // Packet from upstream server -> send to downstream client
-        // if (src.sin_port == server_rtp_addr_.sin_port &&
-        //     src.sin_addr.s_addr == server_rtp_addr_.sin_addr.s_addr)
+        for (int i = 0; i < count && !closed_; ++i)
         {
+            // Packet from upstream server -> send to downstream client
+            size_t n = msgs[i].msg_len;
             upstream_est_.addBytes(n);
             Statistics::getInstance().addUpstreamBytes(n);
-            size_t actual_n = static_cast<size_t>(n);
-
-            if (!rtp_pipeline_->process(buf.get(), actual_n)) {
-                pool_.release(std::move(buf));
-                continue;
-            }
-            n = static_cast<ssize_t>(actual_n);
-            
-            if (n > 0) {
-                if (is_downstream_tcp_)
-                {
-                    send_interleaved_downstream(ds_interleaved_rtp_, buf.get(), n);
-                }
-                else if (client_rtp_addr_.sin_port != 0)
-                {
-                    sendto(rtp_ds_fd_, buf.get(), n, 0,
-                           (sockaddr *)&client_rtp_addr_, sizeof(client_rtp_addr_));
-                    downstream_est_.addBytes(n);
-                    Statistics::getInstance().addDownstreamBytes(n);
-                }
-            }
+            if (fec_) fec_->on_media(bufs[i].get() + INTERLEAVED_HEADROOM, n);
+            relay_rtp_downstream(std::move(bufs[i]), INTERLEAVED_HEADROOM, n);
         }
+        if (static_cast<unsigned int>(count) < RELAY_BATCH)
+            break;
+    }
+    relay_batching_ = false;
+
+    size_t sent = ds_rtp_batch_.flush();
+    downstream_est_.addBytes(sent);
+    Statistics::getInstance().addDownstreamBytes(sent);
+
+    for (auto &buf : bufs)
         pool_.release(std::move(buf));
+}
+
+void RTSPToRtspClient::connect_relay_downstream()
+{
+    // A client behind NAT punches from a port that may differ from its SETUP
+    // client_port. Until its first packet has shown the real port the socket
+    // stays unconnected, so those packets are received from any port.
+    if (client_rtp_learned_ &&
+        connect(rtp_ds_fd_, (sockaddr *)&client_rtp_addr_, sizeof(client_rtp_addr_)) == 0)
+    {
+        ds_rtp_batch_.set_peer(rtp_ds_fd_, nullptr);
+        return;
+    }
+    sockaddr unspec{};
+    unspec.sa_family = AF_UNSPEC;
+    connect(rtp_ds_fd_, &unspec, sizeof(unspec));
+    ds_rtp_batch_.set_peer(rtp_ds_fd_, &client_rtp_addr_);
+}
+
+void RTSPToRtspClient::relay_rtp_downstream(std::unique_ptr<uint8_t[]> buf, size_t off, size_t len)
+{
+    uint8_t *rtp = buf.get() + off;
+    if (!rtp_pipeline_->process(rtp, len) || len == 0) {
+        pool_.release(std::move(buf));
+        return;
+    }
+
+    if (is_downstream_tcp_)
+    {
+        if (off >= INTERLEAVED_HEADROOM) {
+            queue_interleaved_downstream(ds_interleaved_rtp_, std::move(buf), off, len);
+            return;
+        }
+        send_interleaved_downstream(ds_interleaved_rtp_, rtp, len);
+    }
+    else if (client_rtp_addr_.sin_port != 0)
+    {
+        if (unlikely(!ds_rtp_batch_.ready()))
+            connect_relay_downstream();
+        ds_rtp_batch_.add(std::move(buf), off, len);
+        if (!relay_batching_)
+        {
+            size_t sent = ds_rtp_batch_.flush();
+            downstream_est_.addBytes(sent);
+            Statistics::getInstance().addDownstreamBytes(sent);
+        }
+        return;
+    }
+    pool_.release(std::move(buf));
+}
+
+void RTSPToRtspClient::handle_fec_from_upstream(int fd, uint32_t /*events*/)
+{
+    uint8_t buf[2048];
+    while (true)
+    {
+        ssize_t n = recvfrom(fd, buf, sizeof(buf), 0, nullptr, nullptr);
+        if (n <= 0)
+            break;
+
+        upstream_est_.addBytes(n);
+        Statistics::getInstance().addUpstreamBytes(n);
+        fec_->on_fec(buf, static_cast<size_t>(n));
     }
 }
 
@@ -623,7 +689,8 @@ void RTSPToRtspClient::handle_rtcp_from_upstream(uint32_t /*events*/)
         sockaddr_in src{};
         socklen_t slen = sizeof(src);
         auto buf = pool_.acquire();
-        ssize_t n = recvfrom(rtcp_us_fd_, buf.get(), pool_.get_buffer_size(), 0,
+        ssize_t n = recvfrom(rtcp_us_fd_, buf.get() + INTERLEAVED_HEADROOM,
+                             pool_.get_buffer_size() - INTERLEAVED_HEADROOM, 0,
                              (sockaddr *)&src, &slen);
         if (n <= 0) {
             pool_.release(std::move(buf));
@@ -633,52 +700,120 @@ void RTSPToRtspClient::handle_rtcp_from_upstream(uint32_t /*events*/)
         // Packet from upstream server -> send to downstream client
         // if (src.sin_port == server_rtcp_addr_.sin_port &&
         //     src.sin_addr.s_addr == server_rtcp_addr_.sin_addr.s_addr)
-        {
-            upstream_est_.addBytes(n);
-            Statistics::getInstance().addUpstreamBytes(n);
-            if (is_downstream_tcp_)
-            {
-                send_interleaved_downstream(ds_interleaved_rtcp_, buf.get(), n);
-            }
-            else if (client_rtcp_addr_.sin_port != 0)
-            {
-                sendto(rtcp_ds_fd_, buf.get(), n, 0,
-                       (sockaddr *)&client_rtcp_addr_, sizeof(client_rtcp_addr_));
-                downstream_est_.addBytes(n);
-                Statistics::getInstance().addDownstreamBytes(n);
-            }
+        upstream_est_.addBytes(n);
+        Statistics::getInstance().addUpstreamBytes(n);
+        relay_rtcp_downstream(std::move(buf), INTERLEAVED_HEADROOM, n);
+    }
+}
+
+void RTSPToRtspClient::relay_rtcp_downstream(std::unique_ptr<uint8_t[]> buf, size_t off, size_t len)
+{
+    if (is_downstream_tcp_)
+    {
+        if (off >= INTERLEAVED_HEADROOM) {
+            queue_interleaved_downstream(ds_interleaved_rtcp_, std::move(buf), off, len);
+            return;
         }
-        pool_.release(std::move(buf));
+        send_interleaved_downstream(ds_interleaved_rtcp_, buf.get() + off, len);
     }
+    else if (client_rtcp_addr_.sin_port != 0)
+    {
+        sendto(rtcp_ds_fd_, buf.get() + off, len, 0,
+               (sockaddr *)&client_rtcp_addr_, sizeof(client_rtcp_addr_));
+        downstream_est_.addBytes(len);
+        Statistics::getInstance().addDownstreamBytes(len);
+    }
+    pool_.release(std::move(buf));
+}
+
+void RTSPToRtspClient::subscribe_shared_rtp(std::string_view transport)
+{
+    // Shared-port media comes without headroom; a TCP client gets it copied.
+    shared_rtp_id_ = SharedRtpSocket::getInstance().subscribe(
+        ServerConfig::getMitmUpstreamInterface(), server_rtp_addr_,
+        [this](Packet &&pkt)
+        {
+            upstream_est_.addBytes(pkt.length);
+            Statistics::getInstance().addUpstreamBytes(pkt.length);
+            relay_rtp_downstream(std::move(pkt.data), 0, pkt.length);
+        },
+        [this](Packet &&pkt)
+        {
+            upstream_est_.addBytes(pkt.length);
+            Statistics::getInstance().addUpstreamBytes(pkt.length);
+            relay_rtcp_downstream(std::move(pkt.data), 0, pkt.length);
+        });
+    if (shared_rtp_id_ == 0)
+    {
+        Logger::warn("[MITM] Shared RTP port is not available, no UDP media will be relayed");
+        return;
+    }
+    uint32_t ssrc = 0;
+    if (rtspParser::parse_transport_ssrc(transport, ssrc))
+        SharedRtpSocket::getInstance().expect_ssrc(shared_rtp_id_, ssrc);
+}
+
+ssize_t RTSPToRtspClient::send_to_upstream(bool rtcp, const void *data, size_t len)
+{
+    const sockaddr_in &to = rtcp ? server_rtcp_addr_ : server_rtp_addr_;
+    if (shared_rtp_)
+    {
+        return SharedRtpSocket::getInstance().send_to(ServerConfig::getMitmUpstreamInterface(), rtcp, to, data, len)
+                   ? static_cast<ssize_t>(len) : -1;
+    }
+    return sendto(rtcp ? rtcp_us_fd_ : rtp_us_fd_, data, len, 0, (const sockaddr *)&to, sizeof(to));
 }
 
 void RTSPToRtspClient::send_interleaved_downstream(uint8_t channel, const uint8_t *data, size_t len)
 {
     if (closed_ || downstream_fd_ < 0) return;
 
-    size_t pool_block_size = pool_.get_buffer_size();
-    if (len + 4 > pool_block_size) {
-        Logger::warn("[MITM] Packet too large, truncated (" + std::to_string(len + 4) + " > " + std::to_string(pool_block_size) + ")");
-        len = pool_block_size - 4;
+    if (len > 0xFFFF) {
+        Logger::warn("[MITM] Packet too large for interleaved framing, dropped (" + std::to_string(len) + " bytes)");
+        return;
+    }
+
+    auto buf = pool_.acquire(len + INTERLEAVED_HEADROOM);
+    memcpy(buf.get() + INTERLEAVED_HEADROOM, data, len);
+    queue_interleaved_downstream(channel, std::move(buf), INTERLEAVED_HEADROOM, len);
+}
+
+void RTSPToRtspClient::queue_interleaved_downstream(uint8_t channel, std::unique_ptr<uint8_t[]> buf, size_t off, size_t len)
+{
+    if (closed_ || downstream_fd_ < 0) {
+        pool_.release(std::move(buf));
+        return;
     }
 
-    auto buf = pool_.acquire();
-    buf[0] = '$';
-    buf[1] = static_cast<uint8_t>(channel);
+    uint8_t *hdr = buf.get() + off - INTERLEAVED_HEADROOM;
+    hdr[0] = '$';
+    hdr[1] = channel;
     uint16_t nlen = htons(static_cast<uint16_t>(len));
-    memcpy(buf.get() + 2, &nlen, 2);
-    memcpy(buf.get() + 4, data, len);
+    memcpy(hdr + 2, &nlen, 2);
 
-    // Prevent memory exhaustion by limiting queue size (Drop oldest if full)
-    if (to_downstream_q_.size() > 2048)
+    // A client that falls behind resumes on the next RTP packet with a TS sync point.
+    bool sync_point = to_downstream_q_.resyncing() && channel == ds_interleaved_rtp_ &&
+                      RtpPipeline::check_keyframe(buf.get() + off, len);
+
+    // The packet is sent from its header, which sits 'off - 4' bytes into the block.
+    switch (to_downstream_q_.push_media(Packet{std::move(buf), off + len, off - INTERLEAVED_HEADROOM}, sync_point))
     {
-        auto &old_packet = to_downstream_q_.front();
-        if (old_packet.data) pool_.release(std::move(old_packet.data));
-        to_downstream_q_.pop_front();
+    case DownstreamQueue::Verdict::QUEUED:
+    case DownstreamQueue::Verdict::RESUMED:
+        downstream_est_.addBytes(len + INTERLEAVED_HEADROOM);
+        break;
+    case DownstreamQueue::Verdict::RESYNC:
+        Logger::debug(std::string("[MITM] Client ") + inet_ntoa(client_addr_.sin_addr) +
+                     " is falling behind, skipping to the next keyframe");
+        return;
+    case DownstreamQueue::Verdict::TOO_SLOW:
+        Logger::warn(std::string("[MITM] Disconnecting client ") + inet_ntoa(client_addr_.sin_addr) +
+                     ", too slow for " + std::to_string(ServerConfig::getSlowClientTimeoutMs()) + " ms");
+        close_all();
+        return;
+    case DownstreamQueue::Verdict::DROPPED:
+        return;
     }
-
-    to_downstream_q_.push_back(Packet{std::move(buf), len + 4, 0});
-    downstream_est_.addBytes(len + 4);
     
     // We need to trigger EPOLLOUT to drain the queue
     loop_->set(downstream_ctx_.get(), downstream_fd_,
@@ -693,8 +828,7 @@ void RTSPToRtspClient::handle_interleaved_from_client(uint8_t channel, const uin
     {
         if (server_rtp_addr_.sin_port != 0)
         {
-            sendto(rtp_us_fd_, data, len, 0,
-                   (sockaddr *)&server_rtp_addr_, sizeof(server_rtp_addr_));
+            send_to_upstream(false, data, len);
             Statistics::getInstance().addUpstreamBytes(len);
         }
     }
@@ -702,50 +836,46 @@ void RTSPToRtspClient::handle_interleaved_from_client(uint8_t channel, const uin
     {
         if (server_rtcp_addr_.sin_port != 0)
         {
-            sendto(rtcp_us_fd_, data, len, 0,
-                   (sockaddr *)&server_rtcp_addr_, sizeof(server_rtcp_addr_));
+            send_to_upstream(true, data, len);
             Statistics::getInstance().addUpstreamBytes(len);
         }
     }
 }
 
-void RTSPToRtspClient::handle_interleaved_from_upstream(uint8_t channel, const uint8_t *data, size_t len)
+void RTSPToRtspClient::handle_interleaved_from_upstream(RtspDemuxer::Item &item)
 {
     // Relay RTP/RTCP from upstream (TCP) to downstream
-    if (channel == us_interleaved_rtp_)
+    // The demuxer hands over every frame in a pool block sized for it, with
+    // the payload behind INTERLEAVED_HEADROOM.
+    if ((item.channel != us_interleaved_rtp_ && item.channel != us_interleaved_rtcp_) || !item.block)
     {
-        upstream_est_.addBytes(len);
-        Statistics::getInstance().addUpstreamBytes(len);
+        pool_.release(std::move(item.block));
+        return;
+    }
 
-        auto buf = pool_.acquire();
-        size_t n = std::min(len, pool_.get_buffer_size());
-        memcpy(buf.get(), data, n);
+    upstream_est_.addBytes(item.len);
+    Statistics::getInstance().addUpstreamBytes(item.len);
 
-        if (!rtp_pipeline_->process(buf.get(), n)) {
-            pool_.release(std::move(buf));
-            return;
-        }
+    std::unique_ptr<uint8_t[]> buf = std::move(item.block);
+    size_t n = item.len;
 
-        if (n > 0) {
-            if (is_downstream_tcp_) {
-                send_interleaved_downstream(ds_interleaved_rtp_, buf.get(), n);
-            } else if (client_rtp_addr_.sin_port != 0) {
-                sendto(rtp_ds_fd_, buf.get(), n, 0, (sockaddr *)&client_rtp_addr_, sizeof(client_rtp_addr_));
-                Statistics::getInstance().addDownstreamBytes(n);
-            }
-        }
-        pool_.release(std::move(buf));
-    }
-    else if (channel == us_interleaved_rtcp_)
+    if (item.channel == us_interleaved_rtp_)
     {
-        upstream_est_.addBytes(len);
-        if (is_downstream_tcp_)
-            send_interleaved_downstream(ds_interleaved_rtcp_, data, len);
-        else if (client_rtcp_addr_.sin_port != 0) {
-            sendto(rtcp_ds_fd_, data, len, 0, (sockaddr *)&client_rtcp_addr_, sizeof(client_rtcp_addr_));
-            Statistics::getInstance().addUpstreamBytes(len);
-        }
+        relay_rtp_downstream(std::move(buf), INTERLEAVED_HEADROOM, n);
+        if (!upstream_paused_ && !closed_ && is_downstream_tcp_ && to_downstream_q_.congested())
+            set_upstream_paused(true);
+        return;
+    }
+
+    if (is_downstream_tcp_) {
+        queue_interleaved_downstream(ds_interleaved_rtcp_, std::move(buf), INTERLEAVED_HEADROOM, n);
+        return;
+    }
+    if (client_rtcp_addr_.sin_port != 0) {
+        sendto(rtcp_ds_fd_, buf.get() + INTERLEAVED_HEADROOM, n, 0, (sockaddr *)&client_rtcp_addr_, sizeof(client_rtcp_addr_));
+        Statistics::getInstance().addDownstreamBytes(n);
     }
+    pool_.release(std::move(buf));
 }
 
 void RTSPToRtspClient::handle_rtp_from_client(uint32_t /*events*/)
@@ -765,14 +895,16 @@ void RTSPToRtspClient::handle_rtp_from_client(uint32_t /*events*/)
         // Packet from downstream client -> send to upstream server
         if (src.sin_addr.s_addr == client_addr_.sin_addr.s_addr)
         {
-            if (client_rtp_addr_.sin_port != src.sin_port) {
+            if (!client_rtp_learned_ || client_rtp_addr_.sin_port != src.sin_port) {
                 client_rtp_addr_.sin_port = src.sin_port;
+                client_rtp_learned_ = true;
+                if (ds_rtp_batch_.ready())
+                    connect_relay_downstream();
             }
 
             if (server_rtp_addr_.sin_port != 0)
             {
-                sendto(rtp_us_fd_, buf.get(), n, 0,
-                       (sockaddr *)&server_rtp_addr_, sizeof(server_rtp_addr_));
+                send_to_upstream(false, buf.get(), n);
                 Statistics::getInstance().addUpstreamBytes(n);
             }
         }
@@ -803,8 +935,7 @@ void RTSPToRtspClient::handle_rtcp_from_client(uint32_t /*events*/)
 
             if (server_rtcp_addr_.sin_port != 0)
             {
-                sendto(rtcp_us_fd_, buf.get(), n, 0,
-                       (sockaddr *)&server_rtcp_addr_, sizeof(server_rtcp_addr_));
+                send_to_upstream(true, buf.get(), n);
                 Statistics::getInstance().addUpstreamBytes(n);
             }
         }
@@ -816,13 +947,25 @@ void RTSPToRtspClient::handle_timer(uint32_t /*events*/)
 {
     uint64_t exp;
     read(timer_fd_, &exp, sizeof(exp));
+
+    // Checked on the keepalive tick, so the limit is honoured to within one interval.
+    auto slow_timeout = std::chrono::milliseconds(ServerConfig::getSlowClientTimeoutMs());
+    if (upstream_paused_ && slow_timeout.count() > 0 &&
+        std::chrono::steady_clock::now() - paused_since_ >= slow_timeout)
+    {
+        Logger::warn(std::string("[MITM] Disconnecting client ") + inet_ntoa(client_addr_.sin_addr) +
+                     ", too slow for " + std::to_string(slow_timeout.count()) + " ms");
+        close_all();
+        return;
+    }
+
     // Send a GET_PARAMETER to upstream as keepalive.
     std::string ka = "GET_PARAMETER " + ctx_.rtsp_url + " RTSP/1.0\r\n"
                      "CSeq: 99\r\n"
                      "Session: " + ctx_.session_id + "\r\n"
                      "\r\n";
     to_upstream_q_.push_back(ka);
-    loop_->set(upstream_ctx_.get(), upstream_fd_, EPOLLIN | EPOLLOUT);
+    loop_->set(upstream_ctx_.get(), upstream_fd_, upstream_events());
 
     // if (ServerConfig::isNatEnabled() && ServerConfig::getNatMethod() == "zte")
     // {
@@ -836,42 +979,33 @@ void RTSPToRtspClient::handle_timer(uint32_t /*events*/)
 
 void RTSPToRtspClient::on_downstream_readable()
 {
-    char buf[8192];
-    ssize_t n = recv(downstream_fd_, buf, sizeof(buf) - 1, 0);
+    ssize_t n = downstream_demux_.read_from(downstream_fd_);
     if (n <= 0)
     {
         if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
             on_downstream_closed();
         return;
     }
-    buf[n] = 0;
-    downstream_recv_buf_.append(buf, n);
 
-    // Wait for a complete RTSP message (ends with \r\n\r\n) or Interleaved packet ($)
-    while (!downstream_recv_buf_.empty())
+    // Handle every complete RTSP request and interleaved ($) packet
+    while (true)
     {
-        if (downstream_recv_buf_[0] == '$')
+        RtspDemuxer::Item item = downstream_demux_.next();
+        if (item.type == RtspDemuxer::Type::NONE)
+            break;
+        if (item.type == RtspDemuxer::Type::ERROR)
         {
-            if (downstream_recv_buf_.size() < 4)
-                break;
-            
-            uint16_t len = ntohs(*reinterpret_cast<const uint16_t *>(downstream_recv_buf_.data() + 2));
-            if (downstream_recv_buf_.size() < static_cast<size_t>(len) + 4)
-                break;
-
-            uint8_t channel = static_cast<uint8_t>(downstream_recv_buf_[1]);
-            handle_interleaved_from_client(channel, reinterpret_cast<const uint8_t *>(downstream_recv_buf_.data() + 4), len);
-            downstream_recv_buf_.erase(0, 4 + len);
+            Logger::warn("[MITM] Oversized or malformed request from client");
+            on_downstream_closed();
+            return;
+        }
+        if (item.type == RtspDemuxer::Type::FRAME)
+        {
+            handle_interleaved_from_client(item.channel, item.data, item.len);
             continue;
         }
 
-        size_t end = downstream_recv_buf_.find("\r\n\r\n");
-        if (end == std::string::npos)
-            break;
-
-        // Include the trailing \r\n\r\n
-        std::string req = downstream_recv_buf_.substr(0, end + 4);
-        downstream_recv_buf_ = downstream_recv_buf_.substr(end + 4);
+        std::string req(reinterpret_cast<const char *>(item.data), item.len);
 
         // Check if this is a SETUP request — we need to prepare relay sockets.
         bool is_setup = (req.find("SETUP ") == 0);
@@ -896,6 +1030,9 @@ void RTSPToRtspClient::on_downstream_readable()
                     client_rtp_addr_.sin_family = AF_INET;
                     client_rtp_addr_.sin_port = htons(crtp);
                     client_rtp_addr_.sin_addr = client_addr_.sin_addr;
+                    client_rtp_learned_ = false;
+                    if (ds_rtp_batch_.ready())
+                        connect_relay_downstream();
 
                     client_rtcp_addr_.sin_family = AF_INET;
                     client_rtcp_addr_.sin_port = htons(crtcp);
@@ -942,7 +1079,7 @@ void RTSPToRtspClient::on_downstream_readable()
         req = rewrite_request_for_upstream(req);
 
         to_upstream_q_.push_back(req);
-        loop_->set(upstream_ctx_.get(), upstream_fd_, EPOLLIN | EPOLLOUT);
+        loop_->set(upstream_ctx_.get(), upstream_fd_, upstream_events());
     }
 }
 
@@ -951,16 +1088,17 @@ void RTSPToRtspClient::on_downstream_writable()
     while (!to_downstream_q_.empty())
     {
         auto &packet = to_downstream_q_.front();
+        // Interleaved frames are small: let the stack merge them into full segments.
+        int flags = to_downstream_q_.size() > 1 ? MSG_MORE : 0;
         ssize_t n = send(downstream_fd_,
                          packet.data.get() + packet.offset,
-                         packet.length - packet.offset, 0);
+                         packet.length - packet.offset, flags);
         if (n > 0)
         {
             Statistics::getInstance().addDownstreamBytes(n);
             packet.offset += n;
             if (packet.offset == packet.length)
             {
-                pool_.release(std::move(packet.data));
                 to_downstream_q_.pop_front();
             }
         }
@@ -975,6 +1113,9 @@ void RTSPToRtspClient::on_downstream_writable()
         }
     }
 
+    if (upstream_paused_ && to_downstream_q_.drained())
+        set_upstream_paused(false);
+
     // Once the queue is empty, go back to only waiting for incoming data.
     if (to_downstream_q_.empty())
     {
@@ -999,12 +1140,18 @@ void RTSPToRtspClient::on_upstream_writable()
         if (getsockopt(upstream_fd_, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0)
         {
             Logger::error("[MITM] Upstream connect failed");
+            UpstreamSelector::getInstance().report_failure(ctx_);
             close_all();
             return;
         }
         Logger::debug("[MITM] Connected to upstream " + ctx_.server_ip +
                      ":" + std::to_string(ctx_.server_rtsp_port));
         state_ = State::IDLE;
+        if (!pooled_)
+        {
+            UpstreamSelector::getInstance().report_success(
+                ctx_, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - connect_start_).count(), -1);
+        }
 
         struct sockaddr_in local_addr;
         socklen_t addr_len = sizeof(local_addr);
@@ -1015,14 +1162,14 @@ void RTSPToRtspClient::on_upstream_writable()
         }
 
         // Now that we are connected, forward the first request that was
-        // stashed in downstream_recv_buf_.
-        if (!downstream_recv_buf_.empty())
+        // stashed in first_request_.
+        if (!first_request_.empty())
         {
             // The stashed buffer is the raw first request.
             // Apply URI rewriting before forwarding.
-            std::string first = rewrite_request_for_upstream(downstream_recv_buf_);
+            std::string first = rewrite_request_for_upstream(first_request_);
             to_upstream_q_.push_back(first);
-            downstream_recv_buf_.clear();
+            first_request_.clear();
         }
 
         // Also enable reading from the downstream client now.
@@ -1059,17 +1206,36 @@ void RTSPToRtspClient::on_upstream_writable()
         }
     }
 
+    loop_->set(upstream_ctx_.get(), upstream_fd_, upstream_events());
+}
+
+uint32_t RTSPToRtspClient::upstream_events() const
+{
     // Decide what to watch for next on the upstream fd.
-    uint32_t upstream_events = EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR;
+    uint32_t events = EPOLLRDHUP | EPOLLHUP | EPOLLERR;
+    if (!upstream_paused_)
+        events |= EPOLLIN;
     if (!to_upstream_q_.empty())
-        upstream_events |= EPOLLOUT;
-    loop_->set(upstream_ctx_.get(), upstream_fd_, upstream_events);
+        events |= EPOLLOUT;
+    return events;
+}
+
+void RTSPToRtspClient::set_upstream_paused(bool paused)
+{
+    // Not reading the interleaved upstream lets TCP flow control slow the
+    // server down to the client's pace instead of dropping media here.
+    upstream_paused_ = paused;
+    if (paused)
+        paused_since_ = std::chrono::steady_clock::now();
+    Logger::debug(std::string("[MITM] ") + (paused ? "Pausing" : "Resuming") + " upstream for client " +
+                  inet_ntoa(client_addr_.sin_addr));
+    if (!closed_ && upstream_fd_ >= 0)
+        loop_->set(upstream_ctx_.get(), upstream_fd_, upstream_events());
 }
 
 void RTSPToRtspClient::on_upstream_readable()
 {
-    char buf[8192];
-    ssize_t n = recv(upstream_fd_, buf, sizeof(buf) - 1, 0);
+    ssize_t n = upstream_demux_.read_from(upstream_fd_);
     if (n <= 0)
     {
         if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
@@ -1079,58 +1245,38 @@ void RTSPToRtspClient::on_upstream_readable()
         }
         return;
     }
-    buf[n] = 0;
-    upstream_recv_buf_.append(buf, n);
 
-    // Forward complete RTSP responses or handle Interleaved packets
-    while (!upstream_recv_buf_.empty())
+    // Forward complete RTSP responses (with body) or handle Interleaved packets
+    while (true)
     {
-        if (upstream_recv_buf_[0] == '$')
+        RtspDemuxer::Item item = upstream_demux_.next();
+        if (item.type == RtspDemuxer::Type::NONE)
+            break;
+        if (item.type == RtspDemuxer::Type::ERROR)
         {
-            if (upstream_recv_buf_.size() < 4)
-                break;
-            
-            uint16_t len = ntohs(*reinterpret_cast<const uint16_t *>(upstream_recv_buf_.data() + 2));
-            if (upstream_recv_buf_.size() < static_cast<size_t>(len) + 4)
-                break;
-
-            uint8_t channel = static_cast<uint8_t>(upstream_recv_buf_[1]);
-            handle_interleaved_from_upstream(channel, reinterpret_cast<const uint8_t *>(upstream_recv_buf_.data() + 4), len);
-            upstream_recv_buf_.erase(0, 4 + len);
-            continue;
+            Logger::warn("[MITM] Oversized or malformed response from upstream");
+            close_all();
+            return;
         }
-
-        size_t end = upstream_recv_buf_.find("\r\n\r\n");
-        if (end == std::string::npos)
-            break;
-
-        // A response may have a body (SDP). Read Content-Length.
-        size_t body_len = 0;
-        std::string cl_val = rtspParser::extract_header_value(
-            upstream_recv_buf_.substr(0, end + 4), "Content-Length");
-        if (!cl_val.empty())
+        if (item.type == RtspDemuxer::Type::FRAME)
         {
-            try { body_len = std::stoul(cl_val); } catch (...) {}
+            handle_interleaved_from_upstream(item);
+            continue;
         }
 
-        size_t total = end + 4 + body_len;
-        if (upstream_recv_buf_.size() < total)
-            break; // wait for the full body
-
-        std::string resp = upstream_recv_buf_.substr(0, total);
-        upstream_recv_buf_ = upstream_recv_buf_.substr(total);
+        const RtspMessage &msg = *item.message;
 
         // Check if this is a response to our injected keepalive (CSeq: 99).
-        if (resp.find("CSeq: 99\r\n") != std::string::npos)
+        if (msg.header("CSeq") == "99")
         {
             Logger::debug("[MITM] Consumed keepalive response from upstream");
             continue;
         }
 
         // Parse session id if present.
-        rtspParser::parse_session_id(resp, ctx_);
+        rtspParser::parse_session_id(msg, ctx_);
 
-        int status = rtspParser::parse_status_code(resp);
+        int status = msg.status_code();
 
         // -----------------------------------------------------------
         // Auto-fallback to TCP if UDP is not supported (Status 461)
@@ -1150,9 +1296,9 @@ void RTSPToRtspClient::on_upstream_readable()
         }
 
         // If it's a 200 OK for SETUP, check if it's TCP interleaved
-        if (status == 200 && resp.find("interleaved=") != std::string::npos)
+        if (status == 200 && msg.header("Transport").find("interleaved=") != std::string_view::npos)
         {
-            if (extract_interleaved_channels(resp, us_interleaved_rtp_, us_interleaved_rtcp_))
+            if (extract_interleaved_channels(msg.head(), us_interleaved_rtp_, us_interleaved_rtcp_))
             {
                 is_upstream_tcp_ = true;
                 Logger::debug("[MITM] Upstream confirmed TCP interleaved: " +
@@ -1162,7 +1308,8 @@ void RTSPToRtspClient::on_upstream_readable()
         }
 
         // Apply robust response patching (Transport, Content-Base, etc.)
-        resp = patch_response_for_client(resp);
+        ctrl_out_.clear();
+        patch_response_for_client(msg, ctrl_out_);
 
         // Detect PLAY response -> start streaming state
         if (status == 200 && pending_play_)
@@ -1170,6 +1317,7 @@ void RTSPToRtspClient::on_upstream_readable()
             pending_play_ = false;
             Logger::debug(std::string("[MITM] Streaming Start: " + ctx_.rtsp_url));
             rtp_pipeline_->reset();
+            if (fec_) fec_->reset();
             init_timer_fd();
             state_ = State::STREAMING;
             
@@ -1182,10 +1330,16 @@ void RTSPToRtspClient::on_upstream_readable()
             }
         }
 
-        // Convert RTSP response string to Packet
-        auto buf = pool_.acquire();
-        memcpy(buf.get(), resp.data(), resp.size());
-        to_downstream_q_.push_back(Packet{std::move(buf), resp.size(), 0});
+        // Queue the patched response in a block sized for it; only a response
+        // larger than the biggest size class spans several blocks.
+        for (size_t off = 0; off < ctrl_out_.size();)
+        {
+            size_t n = std::min(ctrl_out_.size() - off, pool_.get_max_buffer_size());
+            auto buf = pool_.acquire(n);
+            memcpy(buf.get(), ctrl_out_.data() + off, n);
+            to_downstream_q_.push_control(Packet{std::move(buf), n, 0});
+            off += n;
+        }
         loop_->set(downstream_ctx_.get(), downstream_fd_,
                    EPOLLRDHUP | EPOLLHUP | EPOLLERR | EPOLLOUT | EPOLLIN);
     }
@@ -1200,6 +1354,11 @@ void RTSPToRtspClient::close_all()
     if (closed_)
         return;
     closed_ = true;
+    if (shared_rtp_id_ != 0)
+    {
+        SharedRtpSocket::getInstance().unsubscribe(shared_rtp_id_);
+        shared_rtp_id_ = 0;
+    }
     if (on_closed_)
         on_closed_();
 }
@@ -1255,10 +1414,10 @@ void RTSPToRtspClient::send_rtp_trigger()
     
     char dummy = 0;
     // Trigger RTP
-    sendto(rtp_us_fd_, &dummy, 1, 0, (struct sockaddr *)&server_rtp_addr_, sizeof(server_rtp_addr_));
+    send_to_upstream(false, &dummy, 1);
     // Trigger RTCP
     if (server_rtcp_addr_.sin_port != 0) {
-        sendto(rtcp_us_fd_, &dummy, 1, 0, (struct sockaddr *)&server_rtcp_addr_, sizeof(server_rtcp_addr_));
+        send_to_upstream(true, &dummy, 1);
     }
     Logger::debug("[MITM] Sent RTP/RTCP trigger packets to upstream");
 }
@@ -1289,8 +1448,7 @@ void RTSPToRtspClient::send_zte_heartbeat()
     payload[18] = (tcp_port >> 8) & 0xFF;
     payload[19] = tcp_port & 0xFF;
 
-    ssize_t n = sendto(rtp_us_fd_, payload, sizeof(payload), 0,
-                       (struct sockaddr *)&server_rtp_addr_, sizeof(server_rtp_addr_));
+    ssize_t n = send_to_upstream(false, payload, sizeof(payload));
     if (n < 0)
     {
         Logger::error("[MITM] ZTE heartbeat send failed");
@@ -1311,7 +1469,7 @@ void RTSPToRtspClient::process_pending_setup()
     req = rewrite_request_for_upstream(req);
 
     to_upstream_q_.push_back(req);
-    loop_->set(upstream_ctx_.get(), upstream_fd_, EPOLLIN | EPOLLOUT);
+    loop_->set(upstream_ctx_.get(), upstream_fd_, upstream_events());
 }
 
 json RTSPToRtspClient::get_info() const
@@ -1336,13 +1494,32 @@ json RTSPToRtspClient::get_info() const
     info["proxy"] = std::to_string(duration);
     info["upstream_bandwidth"] = (uint64_t)upstream_est_.getBandwidth();
     info["downstream_bandwidth"] = (uint64_t)downstream_est_.getBandwidth();
+
+    const auto &qs = to_downstream_q_.stats();
+    info["queue"] = {{"bytes", to_downstream_q_.bytes()},
+                     {"high_water", qs.high_water},
+                     {"drops", qs.drops},
+                     {"resyncs", qs.resyncs}};
+
+    auto ps = rtp_pipeline_->stats();
+    info["pipeline"] = {{"profile", rtp_pipeline_->profile().name},
+                        {"packets", ps.packets},
+                        {"dropped", ps.dropped},
+                        {"cc_errors", ps.cc_errors}};
+
+    if (fec_)
+    {
+        const auto &fs = fec_->stats();
+        info["fec"] = {{"packets", fs.fec_packets},
+                       {"recovered", fs.recovered},
+                       {"unrecoverable", fs.unrecoverable}};
+    }
     return info;
 }
 
-RtspMitmConfig RTSPToRtspClient::resolve_upstream(const std::string &first_request)
+RtspMitmConfig RTSPToRtspClient::resolve_upstream(const RequestInfo &info)
 {
     RtspMitmConfig config;
-    auto info = RequestParser::parse(first_request);
 
     if (info.upstream_url.empty())
     {
@@ -1364,7 +1541,14 @@ RtspMitmConfig RTSPToRtspClient::resolve_upstream(const std::string &first_reque
     if (path_pos != std::string::npos) {
         config.proxy_uri_prefix = info.raw_uri.substr(0, path_pos);
     }
+    // Within an upstream group the session goes to the best ranked host.
+    rtspCtx best = UpstreamSelector::getInstance().candidates(config.ctx).front();
+    config.ctx.server_ip = best.server_ip;
+    config.ctx.server_rtsp_port = best.server_rtsp_port;
+    config.ctx.rtsp_url = best.rtsp_url;
     config.upstream_uri_base = "rtsp://" + config.ctx.server_ip + ":" + std::to_string(config.ctx.server_rtsp_port);
 
+    config.profile = PipelineProfiles::resolve(info.clean_uri, std::string(info.param("profile")));
+
     return config;
 }
@@ -0,0 +1,866 @@
+#include "clients/rtsp_upstream.h"
+#include "core/statistics.h"
+#include "core/epoll_loop.h"
+#include "core/logger.h"
+#include "core/server_config.h"
+#include "core/port_pool.h"
+#include "core/shared_rtp_socket.h"
+#include "core/upstream_conn_pool.h"
+#include "common/socket_ctx.h"
+#include "protocol/rtsp_parser.h"
+#include "utils/stun_client.h"
+#include "utils/socket_helper.h"
+#include "utils/utils.h"
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+
+RtspUpstream::RtspUpstream(EpollLoop *loop, BufferPool &pool, const rtspCtx &ctx, const Options &opts)
+    : loop_(loop),
+      pool_(pool),
+      ctx_(ctx),
+      opts_(opts),
+      rtsp_fd_(-1, loop_),
+      rtp_fd_(-1, loop_),
+      rtcp_fd_(-1, loop_),
+      timer_fd_(-1, loop_),
+      fec_col_fd_(-1, loop_),
+      fec_row_fd_(-1, loop_)
+{
+    // Interleaved RTP lands in the pool block that is delivered downstream.
+    demux_.set_frame_pool(&pool_, 0);
+}
+
+RtspUpstream::~RtspUpstream()
+{
+    // A cleanly playing UDP session ends with a TEARDOWN; the pool keeps the
+    // control connection if the server allows another session on it.
+    if (state_ == State::STREAMING && !failed_ && !is_tcp_mode_ && rtsp_fd_ >= 0 &&
+        request_queue_.empty() && req_buf_.empty() && demux_.buffered() == 0)
+    {
+        std::string teardown = "TEARDOWN rtsp://" + ctx_.server_ip + ":" + std::to_string(ctx_.server_rtsp_port) + ctx_.path + " RTSP/1.0\r\n";
+        teardown += "CSeq: " + std::to_string(cseq_) + "\r\n";
+        if (!ctx_.session_id.empty())
+            teardown += "Session: " + ctx_.session_id + "\r\n";
+        teardown += "\r\n";
+        if (UpstreamConnPool::getInstance().recycle(rtsp_fd_, ctx_.server_ip, ctx_.server_rtsp_port, opts_.iface, teardown, cseq_ + 1))
+        {
+            rtsp_fd_.get_ref() = -1;
+        }
+    }
+
+    fec_.reset();
+    if (shared_rtp_id_ != 0)
+    {
+        SharedRtpSocket::getInstance().unsubscribe(shared_rtp_id_);
+    }
+    if (rtp_port_ != 0 && !shared_rtp_)
+    {
+        PortPool::getInstance().release_pair(rtp_port_, rtp_port_pairs_);
+    }
+}
+
+void RtspUpstream::start()
+{
+    if (!init_rtp_rtcp_sockets())
+        return;
+
+    if (ServerConfig::isNatEnabled() && ServerConfig::getNatMethod() == "stun")
+    {
+        StunClient::send_stun_mapping_request(rtp_fd_);
+    }
+    else
+    {
+        is_init_ok_ = true;
+        send_rtsp_option();
+    }
+}
+
+double RtspUpstream::elapsed_ms(std::chrono::steady_clock::time_point since)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+}
+
+void RtspUpstream::fail(const std::string &reason)
+{
+    if (failed_)
+        return;
+    failed_ = true;
+    Logger::error("[RTSP] " + reason + (opts_.name.empty() ? "" : " (" + opts_.name + ")"));
+    if (on_failed_)
+        on_failed_();
+}
+
+void RtspUpstream::deliver(Packet &&pkt)
+{
+    ++rtp_packets_;
+    last_rtp_time_ = std::chrono::steady_clock::now();
+    if (on_rtp_)
+        on_rtp_(std::move(pkt));
+    else
+        pool_.release(std::move(pkt.data));
+}
+
+void RtspUpstream::connect_server()
+{
+    connect_start_ = std::chrono::steady_clock::now();
+    auto lease = UpstreamConnPool::getInstance().acquire(ctx_.server_ip, ctx_.server_rtsp_port, opts_.iface);
+    if (lease.fd >= 0)
+    {
+        rtsp_fd_ = lease.fd;
+        cseq_ = lease.cseq;
+        pooled_ = true;
+    }
+    else
+    {
+        rtsp_fd_ = create_nonblocking_tcp(ctx_.server_ip, ctx_.server_rtsp_port, opts_.iface);
+    }
+
+    if (rtsp_fd_ < 0)
+    {
+        fail("Connect to upstream failed.");
+        return;
+    }
+
+    rtsp_ctx_ = std::make_unique<SocketCtx>(
+        rtsp_fd_,
+        [this](uint32_t event)
+        { handle_rtsp(event); });
+
+    loop_->set(rtsp_ctx_.get(), rtsp_fd_, EPOLLOUT);
+
+    state_ = State::CONNECTING;
+}
+
+uint32_t RtspUpstream::rtsp_read_events() const
+{
+    return paused_ && is_tcp_mode_ && state_ == State::STREAMING ? 0u : static_cast<uint32_t>(EPOLLIN);
+}
+
+void RtspUpstream::set_paused(bool paused)
+{
+    if (paused_ == paused)
+        return;
+    paused_ = paused;
+    if (!paused)
+    {
+        // The gap was ours; do not let the stall watchdog count it.
+        last_rtp_time_ = std::chrono::steady_clock::now();
+    }
+    // While a request is being sent the fd waits for EPOLLOUT; the new read
+    // events are applied once the request is out.
+    if (rtsp_ctx_ && !failed_ && req_buf_.empty())
+        loop_->set(rtsp_ctx_.get(), rtsp_fd_, rtsp_read_events());
+}
+
+void RtspUpstream::handle_rtsp(uint32_t event)
+{
+    if ((event & (EPOLLHUP | EPOLLERR)) && !(event & (EPOLLIN | EPOLLOUT)))
+    {
+        // Only reported on its own while reading is paused.
+        fail("Upstream control connection closed.");
+        return;
+    }
+    if (event & EPOLLIN)
+    {
+        on_rtsp_readable();
+    }
+    if ((event & EPOLLOUT) && !failed_)
+    {
+        on_rtsp_writable();
+    }
+}
+
+void RtspUpstream::handle_rtp(uint32_t event)
+{
+    if (event & EPOLLIN)
+    {
+        on_rtp_readable();
+    }
+}
+
+void RtspUpstream::handle_fec(int fd, uint32_t event)
+{
+    if (!(event & EPOLLIN))
+        return;
+
+    uint8_t buf[2048];
+    ssize_t n = recvfrom(fd, buf, sizeof(buf), 0, nullptr, nullptr);
+    if (n <= 0)
+        return;
+
+    est_.addBytes(n);
+    Statistics::getInstance().addUpstreamBytes(n);
+    fec_->on_fec(buf, static_cast<size_t>(n));
+}
+
+void RtspUpstream::handle_timer(uint32_t event)
+{
+    if (event & EPOLLIN)
+    {
+        uint64_t expirations;
+        read(timer_fd_, &expirations, sizeof(expirations));
+        push_request_into_queue(RtspMethod::GET_PARAMETER, "rtsp://" + ctx_.server_ip + ":" + std::to_string(ctx_.server_rtsp_port) + ctx_.path);
+        build_and_send_request();
+    }
+}
+
+void RtspUpstream::on_rtsp_writable()
+{
+    if (state_ == State::CONNECTING)
+    {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(rtsp_fd_, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0)
+        {
+            fail("Connect to upstream failed.");
+            return;
+        }
+        Logger::debug("[RTSP] Connection to upstream established.");
+        state_ = State::CONNECTED;
+        // A pooled connection was set up earlier; its connect time says nothing about the RTT.
+        if (!pooled_)
+            connect_ms_ = elapsed_ms(connect_start_);
+
+        struct sockaddr_in local_addr;
+        socklen_t addr_len = sizeof(local_addr);
+        if (getsockname(rtsp_fd_, (struct sockaddr *)&local_addr, &addr_len) == 0) {
+            local_ip_ = inet_ntoa(local_addr.sin_addr);
+            local_tcp_port_ = ntohs(local_addr.sin_port);
+            Logger::debug("[RTSP] Local IP: " + local_ip_ + ", Local TCP Port: " + std::to_string(local_tcp_port_));
+        }
+    }
+
+    ssize_t n = send(rtsp_fd_, req_buf_.data() + tcp_send_offset_,
+                     req_buf_.size() - tcp_send_offset_, 0);
+    if (n > 0)
+    {
+        tcp_send_offset_ += n;
+        if (tcp_send_offset_ == req_buf_.size())
+        {
+            tcp_send_offset_ = 0;
+            req_buf_.clear();
+            loop_->set(rtsp_ctx_.get(), rtsp_fd_, rtsp_read_events());
+        }
+    }
+    else
+    {
+        fail("RTSP control message send failed.");
+    }
+}
+
+void RtspUpstream::on_rtsp_readable()
+{
+    while (!failed_ && rtsp_read_events() != 0)
+    {
+        ssize_t n = demux_.read_from(rtsp_fd_);
+        if (n > 0)
+        {
+            while (!failed_)
+            {
+                RtspDemuxer::Item item = demux_.next();
+                if (item.type == RtspDemuxer::Type::NONE)
+                    break;
+                if (item.type == RtspDemuxer::Type::ERROR)
+                {
+                    fail("Malformed or oversized RTSP message from upstream.");
+                    return;
+                }
+                if (item.type == RtspDemuxer::Type::FRAME)
+                {
+                    est_.addBytes(item.len + 4);
+                    Statistics::getInstance().addUpstreamBytes(item.len + 4);
+                    handle_interleaved_packet(item);
+                    continue;
+                }
+
+                const RtspMessage &msg = *item.message;
+                rtspParser::parse_session_id(msg, ctx_);
+                int status = msg.status_code();
+
+                if (status == -1)
+                {
+                    std::string cseq(msg.header("CSeq"));
+                    if (!cseq.empty())
+                    {
+                        Logger::debug("[RTSP] Received request from server, responding with 200 OK (CSeq: " + cseq + ")");
+                        std::string resp = "RTSP/1.0 200 OK\r\nCSeq: " + cseq + "\r\n\r\n";
+                        send(rtsp_fd_, resp.data(), resp.size(), 0);
+                        continue;
+                    }
+                }
+
+                if (status == 461 && current_request_.method == RtspMethod::SETUP && !setup_retry_with_tcp_)
+                {
+                    Logger::warn("[RTSP] Upstream rejected UDP SETUP (461). Retrying with TCP Interleaved...");
+                    setup_retry_with_tcp_ = true;
+                    send_rtsp_setup();
+                    continue;
+                }
+
+                if (status != 200)
+                {
+                    fail("Connection to upstream refused. Status: " + std::to_string(status) + ", Header: " + std::string(msg.head()));
+                    return;
+                }
+
+                if (current_request_.method == RtspMethod::OPTIONS)
+                {
+                    send_rtsp_describe();
+                }
+                else if (current_request_.method == RtspMethod::DESCRIBE)
+                {
+                    ctx_.content_base = std::string(msg.header("Content-Base"));
+                    send_rtsp_setup(std::string(msg.body()));
+                }
+                else if (current_request_.method == RtspMethod::SETUP)
+                {
+                    if (rtspParser::parse_server_ports(msg, ctx_) != 0)
+                    {
+                        fail("Can't parser server port");
+                        return;
+                    }
+
+                    if (msg.header("Transport").find("interleaved=") != std::string_view::npos)
+                    {
+                        is_tcp_mode_ = true;
+                        interleaved_rtp_channel_ = static_cast<uint8_t>(ctx_.server_rtp_port);
+                        interleaved_rtcp_channel_ = static_cast<uint8_t>(ctx_.server_rtcp_port);
+                        Logger::debug("[RTSP] SETUP done (TCP Interleaved), Channels: " +
+                                     std::to_string(interleaved_rtp_channel_) + "-" +
+                                     std::to_string(interleaved_rtcp_channel_));
+                    }
+                    else
+                    {
+                        is_tcp_mode_ = false;
+                        Logger::debug(std::string("[RTSP] SETUP done (UDP), server port: " +
+                                                 std::to_string(ctx_.server_rtp_port) + "-" +
+                                                 std::to_string(ctx_.server_rtcp_port)));
+                        init_rtp_rtcp_server_addr();
+                        if (shared_rtp_ && shared_rtp_id_ == 0)
+                        {
+                            subscribe_shared_rtp(msg.header("Transport"));
+                            if (failed_)
+                                return;
+                        }
+                        if (ServerConfig::isNatEnabled() && ServerConfig::getNatMethod() == "zte")
+                        {
+                            send_zte_heartbeat();
+                        }
+                        else
+                        {
+                            send_rtp_trigger();
+                        }
+                    }
+                    send_rtsp_play();
+                }
+                else if (current_request_.method == RtspMethod::PLAY)
+                {
+                    Logger::debug(std::string("[RTSP] Streaming Start: " + ctx_.rtsp_url));
+                    if (fec_) fec_->reset();
+                    init_timer_fd();
+                    state_ = State::STREAMING;
+                    handshake_ms_ = elapsed_ms(connect_start_);
+                    if (paused_ && req_buf_.empty())
+                        loop_->set(rtsp_ctx_.get(), rtsp_fd_, rtsp_read_events());
+                    if (on_playing_) on_playing_();
+                }
+            }
+        }
+        else if (n == 0)
+        {
+            Logger::debug("[RTSP] Server closed connection");
+            fail("Upstream closed the control connection.");
+            return;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            break;
+        }
+        else
+        {
+            fail("Receive failed");
+            return;
+        }
+    }
+}
+
+void RtspUpstream::on_rtp_readable()
+{
+    auto buf = pool_.acquire();
+    ssize_t n = recvfrom(rtp_fd_, buf.get(), pool_.get_buffer_size(), 0, nullptr, nullptr);
+
+    if (n <= 0)
+    {
+        pool_.release(std::move(buf));
+        return;
+    }
+
+    est_.addBytes(n);
+    Statistics::getInstance().addUpstreamBytes(n);
+    size_t recv_len = static_cast<size_t>(n);
+
+    if (unlikely(!is_init_ok_))
+    {
+        if (ServerConfig::isNatEnabled() == true)
+        {
+            if (StunClient::extract_stun_mapping_from_response(buf.get(), recv_len, nat_wan_ip_, nat_wan_port_) == 0)
+            {
+                Logger::debug("[RTP] Extract STUN mapping success: " + nat_wan_ip_ + ":" + std::to_string(nat_wan_port_));
+            };
+            loop_->set(rtp_ctx_.get(), rtp_fd_, EPOLLIN);
+        }
+        pool_.release(std::move(buf));
+        is_init_ok_ = true;
+        send_rtsp_option();
+        return;
+    }
+
+    if (fec_) fec_->on_media(buf.get(), recv_len);
+    deliver(Packet{std::move(buf), recv_len, 0});
+}
+
+void RtspUpstream::handle_interleaved_packet(RtspDemuxer::Item &item)
+{
+    // Every 16-bit frame fits a pool size class, so the demuxer always hands over a block.
+    if (item.channel != interleaved_rtp_channel_ || !item.block)
+    {
+        pool_.release(std::move(item.block));
+        return;
+    }
+
+    deliver(Packet{std::move(item.block), item.len, 0});
+}
+
+void RtspUpstream::push_request_into_queue(RtspMethod method, const std::string &uri, const std::string &extra_headers, const std::string &body)
+{
+    RtspRequest req{method, uri, extra_headers, body, cseq_++};
+    request_queue_.push(req);
+}
+
+void RtspUpstream::build_and_send_request()
+{
+    if (!request_queue_.empty() && rtsp_ctx_)
+    {
+        current_request_ = request_queue_.front();
+        request_queue_.pop();
+
+        req_buf_.clear();
+        req_buf_ += RtspMethodToString(current_request_.method) + " " + current_request_.uri + " RTSP/1.0\r\n";
+        req_buf_ += "CSeq: " + std::to_string(current_request_.cseq) + "\r\n";
+        if (!ctx_.session_id.empty())
+            req_buf_ += "Session: " + ctx_.session_id + "\r\n";
+        req_buf_ += current_request_.headers;
+        if (!current_request_.body.empty())
+            req_buf_ += "Content-Length: " + std::to_string(current_request_.body.size()) + "\r\n\r\n" + current_request_.body;
+        else
+            req_buf_ += "\r\n";
+
+        tcp_send_offset_ = 0;
+        loop_->set(rtsp_ctx_.get(), rtsp_fd_, EPOLLOUT);
+    }
+}
+
+bool RtspUpstream::init_rtp_rtcp_sockets()
+{
+    // FEC and STUN need ports of their own; everything else can share one pair.
+    auto &shared = SharedRtpSocket::getInstance();
+    if (shared.enabled() && !opts_.fec && !(ServerConfig::isNatEnabled() && ServerConfig::getNatMethod() == "stun"))
+    {
+        rtp_port_ = shared.port(opts_.iface);
+        if (rtp_port_ != 0)
+        {
+            shared_rtp_ = true;
+            return true;
+        }
+    }
+
+    // With FEC the column/row ports at +2/+4 are reserved together with the pair.
+    rtp_port_pairs_ = opts_.fec ? 3 : 1;
+    if (bind_udp_pair_from_pool(rtp_fd_.get_ref(), rtcp_fd_.get_ref(), rtp_port_, opts_.iface, rtp_port_pairs_) < 0)
+    {
+        rtp_port_ = 0;
+        fail("Failed to bind RTP/RTCP sockets from pool");
+        return false;
+    }
+
+    rtp_ctx_ = std::make_unique<SocketCtx>(
+        rtp_fd_,
+        [this](uint32_t event)
+        { handle_rtp(event); });
+
+    // RTCP from the upstream is not used; drain it so the fd does not stay readable.
+    rtcp_ctx_ = std::make_unique<SocketCtx>(
+        rtcp_fd_,
+        [this](uint32_t)
+        {
+            char discard[1500];
+            while (recv(rtcp_fd_, discard, sizeof(discard), 0) > 0) {}
+        });
+
+    loop_->set(rtp_ctx_.get(), rtp_fd_, EPOLLIN);
+    loop_->set(rtcp_ctx_.get(), rtcp_fd_, EPOLLIN);
+
+    if (opts_.fec)
+    {
+        init_fec_sockets();
+    }
+    return true;
+}
+
+void RtspUpstream::init_fec_sockets()
+{
+    if (bind_udp_fec_sockets(fec_col_fd_.get_ref(), fec_row_fd_.get_ref(), rtp_port_, opts_.iface) < 0)
+    {
+        Logger::warn("[FEC] Failed to bind FEC sockets on " + std::to_string(rtp_port_ + 2) + "/" +
+                     std::to_string(rtp_port_ + 4) + ", continuing without FEC");
+        return;
+    }
+
+    fec_ = std::make_unique<RtpFecDecoder>(pool_,
+                                           [this](Packet &&pkt)
+                                           { deliver(std::move(pkt)); });
+
+    int col_fd = fec_col_fd_;
+    int row_fd = fec_row_fd_;
+    fec_col_ctx_ = std::make_unique<SocketCtx>(
+        col_fd,
+        [this, col_fd](uint32_t event)
+        { handle_fec(col_fd, event); });
+    fec_row_ctx_ = std::make_unique<SocketCtx>(
+        row_fd,
+        [this, row_fd](uint32_t event)
+        { handle_fec(row_fd, event); });
+
+    loop_->set(fec_col_ctx_.get(), col_fd, EPOLLIN);
+    loop_->set(fec_row_ctx_.get(), row_fd, EPOLLIN);
+}
+
+void RtspUpstream::init_rtp_rtcp_server_addr()
+{
+    server_rtp_addr_.sin_family = AF_INET;
+    server_rtp_addr_.sin_port = htons(ctx_.server_rtp_port);
+    inet_pton(AF_INET, ctx_.server_ip.c_str(), &server_rtp_addr_.sin_addr);
+
+    server_rtcp_addr_.sin_family = AF_INET;
+    server_rtcp_addr_.sin_port = htons(ctx_.server_rtcp_port);
+    inet_pton(AF_INET, ctx_.server_ip.c_str(), &server_rtcp_addr_.sin_addr);
+}
+
+void RtspUpstream::subscribe_shared_rtp(std::string_view transport)
+{
+    shared_rtp_id_ = SharedRtpSocket::getInstance().subscribe(
+        opts_.iface, server_rtp_addr_,
+        [this](Packet &&pkt)
+        {
+            est_.addBytes(pkt.length);
+            Statistics::getInstance().addUpstreamBytes(pkt.length);
+            deliver(std::move(pkt));
+        });
+    if (shared_rtp_id_ == 0)
+    {
+        fail("Shared RTP port is not available");
+        return;
+    }
+    uint32_t ssrc = 0;
+    if (rtspParser::parse_transport_ssrc(transport, ssrc))
+        SharedRtpSocket::getInstance().expect_ssrc(shared_rtp_id_, ssrc);
+}
+
+ssize_t RtspUpstream::send_rtp_datagram(const void *data, size_t len)
+{
+    if (shared_rtp_)
+    {
+        return SharedRtpSocket::getInstance().send_to(opts_.iface, false, server_rtp_addr_, data, len) ? static_cast<ssize_t>(len) : -1;
+    }
+    return sendto(rtp_fd_, data, len, 0, (struct sockaddr *)&server_rtp_addr_, sizeof(server_rtp_addr_));
+}
+
+void RtspUpstream::send_rtp_trigger()
+{
+    char dummy = 0;
+    ssize_t n = send_rtp_datagram(&dummy, 1);
+    if (n < 0)
+    {
+        Logger::error("[RTP] Trigger send failed");
+    }
+}
+
+void RtspUpstream::send_zte_heartbeat()
+{
+    uint8_t payload[84];
+    memset(payload, 0, sizeof(payload));
+    memcpy(payload, "ZXV10STB", 8);
+    payload[8] = 0x7f;
+    payload[9] = 0xff;
+    payload[10] = 0xff;
+    payload[11] = 0xff;
+
+    struct in_addr addr;
+    if (inet_pton(AF_INET, local_ip_.c_str(), &addr) == 1) {
+        memcpy(payload + 12, &addr.s_addr, 4);
+    }
+
+    uint16_t udp_port = rtp_port_;
+    uint16_t tcp_port = local_tcp_port_;
+
+    payload[16] = (udp_port >> 8) & 0xFF;
+    payload[17] = udp_port & 0xFF;
+    payload[18] = (tcp_port >> 8) & 0xFF;
+    payload[19] = tcp_port & 0xFF;
+
+    ssize_t n = send_rtp_datagram(payload, sizeof(payload));
+    if (n < 0)
+    {
+        Logger::error("[RTP] ZTE heartbeat send failed");
+    }
+    else
+    {
+        Logger::debug("[RTP] ZTE heartbeat sent to " + ctx_.server_ip + ":" + std::to_string(ctx_.server_rtp_port));
+    }
+}
+
+void RtspUpstream::init_timer_fd()
+{
+    using namespace std::chrono;
+
+    // Use FdGuard to ensure old FD is removed from epoll and closed
+    timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    itimerspec its{};
+    auto interval = seconds(20);
+
+    its.it_value.tv_sec = interval.count();
+    its.it_interval.tv_sec = interval.count();
+
+    timerfd_settime(timer_fd_, 0, &its, nullptr);
+
+    // Defer deletion of old context if it exists
+    if (timer_ctx_)
+    {
+        loop_->defer_delete(std::move(timer_ctx_));
+    }
+
+    timer_ctx_ = std::make_unique<SocketCtx>(
+        timer_fd_,
+        [this](uint32_t event)
+        { handle_timer(event); });
+
+    loop_->set(timer_ctx_.get(), timer_fd_, EPOLLIN);
+}
+
+std::string RtspUpstream::RtspMethodToString(RtspMethod method)
+{
+    switch (method)
+    {
+    case RtspMethod::OPTIONS:
+        return "OPTIONS";
+    case RtspMethod::DESCRIBE:
+        return "DESCRIBE";
+    case RtspMethod::SETUP:
+        return "SETUP";
+    case RtspMethod::PLAY:
+        return "PLAY";
+    case RtspMethod::PAUSE:
+        return "PAUSE";
+    case RtspMethod::TEARDOWN:
+        return "TEARDOWN";
+    case RtspMethod::GET_PARAMETER:
+        return "GET_PARAMETER";
+    case RtspMethod::SET_PARAMETER:
+        return "SET_PARAMETER";
+    default:
+        return "";
+    }
+}
+
+void RtspUpstream::send_rtsp_option()
+{
+    connect_server();
+    if (failed_)
+        return;
+    push_request_into_queue(RtspMethod::OPTIONS, "rtsp://" + ctx_.server_ip + ":" + std::to_string(ctx_.server_rtsp_port) + ctx_.path, "", "");
+    build_and_send_request();
+}
+
+void RtspUpstream::send_rtsp_describe()
+{
+    std::string headers = "Accept: application/sdp\r\n";
+    if (ServerConfig::isNatEnabled() && ServerConfig::getNatMethod() == "zte") {
+        headers += "User-Agent: HMTL RTSP 1.0; CTC/2.0\r\n";
+        headers += "x-NAT: " + local_ip_ + ":" + std::to_string(local_tcp_port_) + "\r\n";
+        headers += "Timeshift: 1\r\n";
+        headers += "x-BurstSize: 1048576\r\n";
+    }
+    push_request_into_queue(RtspMethod::DESCRIBE, "rtsp://" + ctx_.server_ip + ":" + std::to_string(ctx_.server_rtsp_port) + ctx_.path, headers, "");
+    build_and_send_request();
+}
+
+void RtspUpstream::send_rtsp_setup(const std::string &sdp_data)
+{
+    if (!sdp_data.empty())
+    {
+        rtspParser::SDP::parseSDP(sdp_data, ctx_);
+    }
+
+    std::string track;
+
+    for (const auto &media : ctx_.sdp.media_streams)
+    {
+
+        if (std::find(media.formats.begin(), media.formats.end(), "33") != media.formats.end())
+        {
+            track = media.trackID;
+            break;
+        }
+    }
+
+    if (track.empty())
+    {
+        fail("Unsupported video format, no track with format 33 found!");
+        return;
+    }
+
+    int port1 = nat_wan_port_ ? nat_wan_port_ : rtp_port_;
+    int port2 = port1 + 1;
+
+    std::string header;
+    if (setup_retry_with_tcp_)
+    {
+        header = "Transport: RTP/AVP/TCP;unicast;interleaved=0-1\r\n";
+        Logger::debug("[RTSP] SETUP with TCP Interleaved mode");
+    }
+    else if (ServerConfig::isNatEnabled() && ServerConfig::getNatMethod() == "zte")
+    {
+        header = "Transport: MP2T/RTP/UDP;unicast;client_address=" + local_ip_ +
+                 ";client_port=" + std::to_string(port1) + "-" + std::to_string(port2) +
+                 ";mode=PLAY\r\n";
+        header += "User-Agent: HMTL RTSP 1.0; CTC/2.0\r\n";
+        header += "x-NAT: " + local_ip_ + ":" + std::to_string(local_tcp_port_) + "\r\n";
+        Logger::debug("[RTSP] ZTE SETUP with client port: " + std::to_string(port1) + "-" + std::to_string(port2));
+    }
+    else
+    {
+        header = "Transport: RTP/AVP;unicast;client_port=" +
+                 std::to_string(port1) + "-" + std::to_string(port2) + "\r\n";
+        Logger::debug("[RTSP] SETUP with client port: " + std::to_string(port1) + "-" + std::to_string(port2));
+    }
+
+    std::string base_url;
+    if (!ctx_.content_base.empty()) {
+        base_url = ctx_.content_base;
+    } else {
+        base_url = "rtsp://" + ctx_.server_ip + ":" + std::to_string(ctx_.server_rtsp_port) + ctx_.path;
+        size_t query_pos = base_url.find('?');
+        if (query_pos != std::string::npos) {
+            base_url = base_url.substr(0, query_pos);
+        }
+    }
+
+    if (!base_url.empty() && base_url.back() != '/' && !track.empty() && track[0] != '*') {
+        base_url += "/";
+    }
+
+    std::string url = base_url + track;
+    push_request_into_queue(RtspMethod::SETUP, url, header, "");
+
+    build_and_send_request();
+}
+
+void RtspUpstream::send_rtsp_play()
+{
+    std::string base_url;
+    if (!ctx_.content_base.empty()) {
+        base_url = ctx_.content_base;
+    } else {
+        base_url = "rtsp://" + ctx_.server_ip + ":" + std::to_string(ctx_.server_rtsp_port) + ctx_.path;
+    }
+
+    std::string header = "Range: npt=0.000-\r\n";
+    if (ServerConfig::isNatEnabled() && ServerConfig::getNatMethod() == "zte") {
+        // Only use clock=end- for live streams (usually no query params like tvdr)
+        if (ctx_.path.find('?') == std::string::npos) {
+            header = "Range: clock=end-\r\n";
+        }
+        header += "User-Agent: HMTL RTSP 1.0; CTC/2.0\r\n";
+        header += "x-BurstSize: 1048576\r\n";
+        header += "Scale: 1.0\r\n";
+    }
+
+    push_request_into_queue(RtspMethod::PLAY, base_url, header);
+    build_and_send_request();
+}
+
+json RtspUpstream::get_info() const
+{
+    json info;
+    if (!opts_.name.empty()) info["name"] = opts_.name;
+    info["upstream"] = ctx_.server_ip + ":" + std::to_string(ctx_.server_rtsp_port);
+    info["transport"] = is_tcp_mode_ ? "TCP" : "UDP";
+    if (!opts_.iface.empty()) info["interface"] = opts_.iface;
+    if (pooled_) info["pooled"] = true;
+    if (shared_rtp_) info["shared_rtp"] = true;
+    info["state"] = failed_ ? "failed" : (state_ == State::STREAMING ? "streaming" : "connecting");
+    info["packets"] = rtp_packets_;
+    if (connect_ms_ >= 0) info["connect_ms"] = connect_ms_;
+    if (handshake_ms_ >= 0) info["handshake_ms"] = handshake_ms_;
+    info["bandwidth"] = (uint64_t)est_.getBandwidth();
+
+    if (fec_)
+    {
+        const auto &fs = fec_->stats();
+        info["fec"] = {{"packets", fs.fec_packets},
+                       {"recovered", fs.recovered},
+                       {"unrecoverable", fs.unrecoverable}};
+    }
+    return info;
+}
+
+//////////////////////////////
+// FdGuard
+//////////////////////////////
+
+RtspUpstream::FdGuard::FdGuard() = default;
+
+RtspUpstream::FdGuard::FdGuard(int fd, EpollLoop *loop) : fd_(fd), loop_(loop) {}
+
+RtspUpstream::FdGuard::~FdGuard()
+{
+    if (fd_ >= 0)
+    {
+        if (loop_)
+            loop_->remove(fd_);
+        close(fd_);
+    }
+}
+
+RtspUpstream::FdGuard::FdGuard(FdGuard &&other) noexcept
+    : fd_(other.fd_), loop_(other.loop_)
+{
+    other.fd_ = -1;
+    other.loop_ = nullptr;
+}
+
+RtspUpstream::FdGuard &RtspUpstream::FdGuard::operator=(FdGuard &&other) noexcept
+{
+    if (this != &other)
+    {
+        if (fd_ >= 0)
+        {
+            if (loop_)
+                loop_->remove(fd_);
+            close(fd_);
+        }
+        fd_ = other.fd_;
+        loop_ = other.loop_;
+        other.fd_ = -1;
+        other.loop_ = nullptr;
+    }
+    return *this;
+}
+
+int &RtspUpstream::FdGuard::get_ref() { return fd_; }
+int RtspUpstream::FdGuard::get() const { return fd_; }
+RtspUpstream::FdGuard::operator int() const { return fd_; }
@@ -0,0 +1,114 @@
+#include "core/buffer_pool.h"
+#include <algorithm>
+
+namespace
+{
+    // Idle blocks kept per extra class; the base class keeps everything it ever allocated.
+    constexpr size_t SMALL_MAX_IDLE = 4096;
+    constexpr size_t LARGE_MAX_IDLE = 256;
+    constexpr size_t JUMBO_MAX_IDLE = 64;
+}
+
+BufferPool::BufferPool(size_t buf_size, size_t pool_size)
+{
+    const std::pair<size_t, size_t> extra[] = {
+        {SMALL_BLOCK_SIZE, SMALL_MAX_IDLE},
+        {LARGE_BLOCK_SIZE, LARGE_MAX_IDLE},
+        {JUMBO_BLOCK_SIZE, JUMBO_MAX_IDLE},
+    };
+    for (const auto &e : extra)
+    {
+        if (e.first != buf_size)
+            classes_.emplace_back(e.first, e.second);
+    }
+    classes_.emplace_back(buf_size, 0);
+    std::sort(classes_.begin(), classes_.end(),
+              [](const SizeClass &a, const SizeClass &b) { return a.size < b.size; });
+
+    for (size_t i = 0; i < classes_.size(); ++i)
+    {
+        if (classes_[i].size == buf_size && classes_[i].max_idle == 0)
+            base_ = static_cast<uint8_t>(i);
+    }
+
+    SizeClass &base = classes_[base_];
+    base.free.reserve(pool_size);
+    for (size_t i = 0; i < pool_size; ++i)
+        base.free.push_back(std::make_unique<uint8_t[]>(buf_size));
+    base.allocated = pool_size;
+}
+
+std::unique_ptr<uint8_t[]> BufferPool::take(uint8_t index)
+{
+    SizeClass &cls = classes_[index];
+    std::unique_ptr<uint8_t[]> buf;
+    if (cls.free.empty())
+    {
+        buf = std::make_unique<uint8_t[]>(cls.size);
+        cls.allocated++;
+        if (index != base_)
+            owner_.emplace(buf.get(), index);
+    }
+    else
+    {
+        buf = std::move(cls.free.back());
+        cls.free.pop_back();
+    }
+
+    size_t used = cls.allocated - cls.free.size();
+    if (used > cls.peak_used) cls.peak_used = used;
+    return buf;
+}
+
+std::unique_ptr<uint8_t[]> BufferPool::acquire()
+{
+    return take(base_);
+}
+
+std::unique_ptr<uint8_t[]> BufferPool::acquire(size_t min_size)
+{
+    for (size_t i = 0; i < classes_.size(); ++i)
+    {
+        if (classes_[i].size >= min_size)
+            return take(static_cast<uint8_t>(i));
+    }
+    return nullptr;
+}
+
+void BufferPool::release(std::unique_ptr<uint8_t[]> buf)
+{
+    if (!buf) return;
+
+    uint8_t index = base_;
+    auto it = owner_.empty() ? owner_.end() : owner_.find(buf.get());
+    if (it != owner_.end())
+        index = it->second;
+
+    SizeClass &cls = classes_[index];
+    if (cls.max_idle != 0 && cls.free.size() >= cls.max_idle)
+    {
+        // Over the cap: give the memory back instead of keeping it idle.
+        owner_.erase(it);
+        cls.allocated--;
+        cls.freed++;
+        return;
+    }
+    cls.free.push_back(std::move(buf));
+}
+
+size_t BufferPool::get_total_bytes() const
+{
+    size_t total = 0;
+    for (const auto &cls : classes_)
+        total += cls.allocated * cls.size;
+    return total;
+}
+
+std::vector<BufferPool::ClassStats> BufferPool::get_class_stats() const
+{
+    std::vector<ClassStats> stats;
+    stats.reserve(classes_.size());
+    for (const auto &cls : classes_)
+        stats.push_back(ClassStats{cls.size, cls.free.size(), cls.allocated, cls.peak_used, cls.max_idle, cls.freed});
+    return stats;
+}
@@ -0,0 +1,92 @@
+#include "core/downstream_queue.h"
+#include "core/server_config.h"
+#include "utils/utils.h"
+
+size_t DownstreamQueue::total_bytes_ = 0;
+
+DownstreamQueue::DownstreamQueue(BufferPool &pool)
+    : pool_(pool),
+      budget_(static_cast<size_t>(ServerConfig::getClientBufferKb()) * 1024)
+{
+}
+
+DownstreamQueue::~DownstreamQueue()
+{
+    clear();
+}
+
+bool DownstreamQueue::over_budget(size_t len) const
+{
+    if (bytes_ + len > budget_)
+        return true;
+    size_t total_budget = static_cast<size_t>(ServerConfig::getTotalBufferMb()) * 1024 * 1024;
+    return total_bytes_ + len > total_budget && bytes_ >= FAIR_SHARE;
+}
+
+void DownstreamQueue::enqueue(Packet &&pkt)
+{
+    size_t len = pkt.length - pkt.offset;
+    bytes_ += len;
+    total_bytes_ += len;
+    if (bytes_ > stats_.high_water)
+        stats_.high_water = bytes_;
+    queue_.push_back(Entry{std::move(pkt), len});
+}
+
+DownstreamQueue::Verdict DownstreamQueue::push_media(Packet &&pkt, bool sync_point)
+{
+    if (likely(state_ == State::FLOWING))
+    {
+        if (likely(!over_budget(pkt.length - pkt.offset)))
+        {
+            enqueue(std::move(pkt));
+            return Verdict::QUEUED;
+        }
+        state_ = State::DRAINING;
+        skipping_since_ = Clock::now();
+        ++stats_.drops;
+        pool_.release(std::move(pkt.data));
+        return Verdict::RESYNC;
+    }
+
+    if (state_ == State::DRAINING && bytes_ <= budget_ / 2)
+        state_ = State::WAIT_SYNC;
+
+    if (state_ == State::WAIT_SYNC && sync_point && !over_budget(pkt.length - pkt.offset))
+    {
+        state_ = State::FLOWING;
+        ++stats_.resyncs;
+        enqueue(std::move(pkt));
+        return Verdict::RESUMED;
+    }
+
+    ++stats_.drops;
+    pool_.release(std::move(pkt.data));
+
+    int timeout_ms = ServerConfig::getSlowClientTimeoutMs();
+    if (timeout_ms > 0 && Clock::now() - skipping_since_ >= std::chrono::milliseconds(timeout_ms))
+        return Verdict::TOO_SLOW;
+    return Verdict::DROPPED;
+}
+
+void DownstreamQueue::push_control(Packet &&pkt)
+{
+    enqueue(std::move(pkt));
+}
+
+void DownstreamQueue::pop_front()
+{
+    Entry &entry = queue_.front();
+    Packet &pkt = entry.pkt;
+    bytes_ -= entry.bytes;
+    total_bytes_ -= entry.bytes;
+    if (pkt.data)
+        pool_.release(std::move(pkt.data));
+    queue_.pop_front();
+}
+
+void DownstreamQueue::clear()
+{
+    while (!queue_.empty())
+        pop_front();
+}
@@ -0,0 +1,279 @@
+#include "core/multicast_hub.h"
+#include "core/epoll_loop.h"
+#include "core/logger.h"
+#include "core/server_config.h"
+#include "common/socket_ctx.h"
+#include "utils/socket_helper.h"
+#include "utils/utils.h"
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+std::string MulticastHub::Group::to_string() const
+{
+    char buf[INET_ADDRSTRLEN] = {0};
+    std::string result;
+    if (source != 0)
+    {
+        in_addr in{source};
+        inet_ntop(AF_INET, &in, buf, sizeof(buf));
+        result = std::string(buf) + "@";
+    }
+    in_addr in{addr};
+    inet_ntop(AF_INET, &in, buf, sizeof(buf));
+    return result + buf + ":" + std::to_string(port);
+}
+
+MulticastHub &MulticastHub::getInstance()
+{
+    static MulticastHub instance;
+    return instance;
+}
+
+MulticastHub::~MulticastHub()
+{
+    for (auto &channel : channels_)
+    {
+        if (channel->fd >= 0) close(channel->fd);
+    }
+}
+
+void MulticastHub::attach(EpollLoop *loop, BufferPool *pool)
+{
+    loop_ = loop;
+    pool_ = pool;
+}
+
+MulticastHub::Channel *MulticastHub::join(const Group &group)
+{
+    for (auto &channel : channels_)
+    {
+        if (channel->group == group)
+            return channel.get();
+    }
+    if (!loop_)
+        return nullptr;
+
+    auto channel = std::make_unique<Channel>();
+    channel->group = group;
+    channel->rtp = group.rtp;
+    channel->ssrc = ntohl(group.addr) ^ (static_cast<uint32_t>(group.port) << 16) ^ ntohl(group.source);
+
+    const std::string &iface = ServerConfig::getHttpUpstreamInterface();
+    if (join_multicast_socket(channel->fd, group.addr, group.source, group.port, iface) < 0)
+    {
+        Logger::error("[MCAST] Failed to join " + group.to_string() + (iface.empty() ? "" : " on " + iface) +
+                      ": " + strerror(errno));
+        return nullptr;
+    }
+
+    Channel *raw = channel.get();
+    raw->ctx = std::make_unique<SocketCtx>(raw->fd, [this, raw](uint32_t event)
+                                           { handle_channel(raw, event); });
+    loop_->set(raw->ctx.get(), raw->fd, EPOLLIN);
+    channels_.push_back(std::move(channel));
+
+    Logger::info("[MCAST] Joined " + group.to_string() + (iface.empty() ? "" : " on " + iface));
+    return raw;
+}
+
+void MulticastHub::leave(Channel *channel)
+{
+    Logger::info("[MCAST] Left " + channel->group.to_string());
+    // Closing the socket drops the membership.
+    loop_->remove(channel->fd);
+    close(channel->fd);
+    channel->fd = -1;
+
+    // This may run from the channel's own handler: destroy it once the batch is done.
+    auto it = std::find_if(channels_.begin(), channels_.end(), [channel](const std::unique_ptr<Channel> &c)
+                           { return c.get() == channel; });
+    std::shared_ptr<Channel> retired(std::move(*it));
+    channels_.erase(it);
+    loop_->add_task([retired]() {});
+}
+
+uint64_t MulticastHub::subscribe(const Group &group, Receiver on_rtp)
+{
+    Channel *channel = join(group);
+    if (!channel)
+        return 0;
+
+    uint64_t id = next_id_++;
+    subs_[id] = Subscription{channel, std::move(on_rtp)};
+    channel->viewers.push_back(id);
+    Logger::debug("[MCAST] " + group.to_string() + " has " + std::to_string(channel->viewers.size()) + " viewer(s)");
+    return id;
+}
+
+void MulticastHub::unsubscribe(uint64_t id)
+{
+    auto it = subs_.find(id);
+    if (it == subs_.end() || it->second.dead)
+        return;
+
+    // A receiver may end its own session while its channel is delivering.
+    if (dispatching_)
+    {
+        it->second.dead = true;
+        dead_.push_back(id);
+        return;
+    }
+    remove(id);
+}
+
+void MulticastHub::remove(uint64_t id)
+{
+    auto it = subs_.find(id);
+    if (it == subs_.end())
+        return;
+
+    Channel *channel = it->second.channel;
+    subs_.erase(it);
+    auto &viewers = channel->viewers;
+    viewers.erase(std::remove(viewers.begin(), viewers.end(), id), viewers.end());
+    if (viewers.empty())
+        leave(channel);
+}
+
+bool MulticastHub::frame(Channel &channel, uint8_t *buf, size_t off, size_t n, size_t &len)
+{
+    const uint8_t *data = buf + off;
+    bool is_rtp = n >= RTP_HEADER && (data[0] >> 6) == 2;
+    if (!is_rtp && (n == 0 || data[0] != 0x47))
+        return false;
+
+    if (is_rtp != channel.rtp)
+    {
+        Logger::info("[MCAST] " + channel.group.to_string() + " carries " + (is_rtp ? "RTP" : "raw TS"));
+        channel.rtp = is_rtp;
+    }
+
+    if (is_rtp)
+    {
+        if (off != 0)
+            memmove(buf, buf + off, n);
+        len = n;
+        return true;
+    }
+
+    // Raw TS: put an RTP header in front of it.
+    if (off != RTP_HEADER)
+        memmove(buf + RTP_HEADER, buf + off, n);
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    uint32_t ts = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(now).count() * 9 / 100);
+    uint16_t seq = htons(channel.seq++);
+    uint32_t ts_n = htonl(ts);
+    uint32_t ssrc = htonl(channel.ssrc);
+    buf[0] = 0x80;
+    buf[1] = RTP_PT_MP2T;
+    memcpy(buf + 2, &seq, 2);
+    memcpy(buf + 4, &ts_n, 4);
+    memcpy(buf + 8, &ssrc, 4);
+    len = n + RTP_HEADER;
+    return true;
+}
+
+void MulticastHub::handle_channel(Channel *channel, uint32_t event)
+{
+    if (!(event & EPOLLIN))
+        return;
+
+    std::unique_ptr<uint8_t[]> bufs[RECV_BATCH];
+    mmsghdr msgs[RECV_BATCH];
+    iovec iovs[RECV_BATCH];
+    // Room for the header a raw TS datagram gets, whichever kind arrives.
+    size_t capacity = pool_->get_buffer_size() - RTP_HEADER;
+
+    dispatching_ = true;
+    while (true)
+    {
+        // Received where the expected kind needs no move.
+        size_t off = channel->rtp ? 0 : RTP_HEADER;
+        for (unsigned int i = 0; i < RECV_BATCH; ++i)
+        {
+            if (!bufs[i])
+                bufs[i] = pool_->acquire();
+            iovs[i] = iovec{bufs[i].get() + off, capacity};
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int count = recvmmsg(channel->fd, msgs, RECV_BATCH, 0, nullptr);
+        if (count <= 0)
+            break;
+
+        for (int i = 0; i < count; ++i)
+        {
+            size_t len = 0;
+            ++channel->packets;
+            channel->bytes += msgs[i].msg_len;
+            if (!frame(*channel, bufs[i].get(), off, msgs[i].msg_len, len))
+            {
+                ++channel->dropped;
+                continue;
+            }
+
+            // Every viewer but the last gets a copy; the last one takes the buffer.
+            const auto &viewers = channel->viewers;
+            size_t last = viewers.size();
+            for (size_t v = viewers.size(); v-- > 0;)
+            {
+                if (!subs_[viewers[v]].dead)
+                {
+                    last = v;
+                    break;
+                }
+            }
+            for (size_t v = 0; v < last; ++v)
+            {
+                Subscription &sub = subs_[viewers[v]];
+                if (sub.dead)
+                    continue;
+                auto copy = pool_->acquire();
+                memcpy(copy.get(), bufs[i].get(), len);
+                sub.on_rtp(Packet{std::move(copy), len, 0});
+            }
+            if (last < viewers.size())
+                subs_[viewers[last]].on_rtp(Packet{std::move(bufs[i]), len, 0});
+        }
+        if (static_cast<unsigned int>(count) < RECV_BATCH)
+            break;
+    }
+    dispatching_ = false;
+
+    for (auto &buf : bufs)
+        pool_->release(std::move(buf));
+    reap();
+}
+
+void MulticastHub::reap()
+{
+    std::vector<uint64_t> dead;
+    dead.swap(dead_);
+    for (uint64_t id : dead)
+        remove(id);
+}
+
+nlohmann::json MulticastHub::get_info() const
+{
+    nlohmann::json groups = nlohmann::json::array();
+    for (const auto &channel : channels_)
+    {
+        nlohmann::json g;
+        g["group"] = channel->group.to_string();
+        g["payload"] = channel->rtp ? "rtp" : "ts";
+        g["viewers"] = channel->viewers.size();
+        g["packets"] = channel->packets;
+        g["bytes"] = channel->bytes;
+        g["dropped"] = channel->dropped;
+        groups.push_back(std::move(g));
+    }
+    nlohmann::json info;
+    info["groups"] = std::move(groups);
+    return info;
+}
@@ -9,58 +9,141 @@ PortPool& PortPool::getInstance()
 
 PortPool::PortPool()
 {
-    // Initialize with standard range
-    next_port_ = start_port_;
+    // Bits past the last pair of the final word are never free.
+    if (PAIRS % 64 != 0)
+    {
+        used_[WORDS - 1].store(~0ULL << (PAIRS % 64), std::memory_order_relaxed);
+    }
 }
 
-uint16_t PortPool::acquire_pair()
+uint32_t PortPool::now_sec()
 {
-    std::lock_guard<std::mutex> lock(mutex_);
+    using namespace std::chrono;
+    return static_cast<uint32_t>(duration_cast<seconds>(steady_clock::now().time_since_epoch()).count());
+}
 
-    uint16_t attempts = 0;
-    uint16_t total_ports = end_port_ - start_port_;
+uint16_t PortPool::acquire_pair(int pairs)
+{
+    if (pairs < 1 || pairs > MAX_PAIRS_PER_ACQUIRE)
+        return 0;
 
-    while (attempts < total_ports / 2)
-    {
-        uint16_t p = next_port_;
-        
-        // Ensure even
-        if (p % 2 != 0) p++;
-        if (p >= end_port_) p = start_port_;
+    const uint64_t run = (1ULL << pairs) - 1;
+    const size_t start = cursor_.load(std::memory_order_relaxed) % PAIRS;
+    uint32_t now = 0;
 
-        next_port_ = p + 2;
-        if (next_port_ >= end_port_) next_port_ = start_port_;
+    // One lap over the words from the cursor; the cursor's own word is
+    // visited again at the end for the bits before the cursor.
+    for (size_t step = 0; step <= WORDS; ++step)
+    {
+        size_t w = (start / 64 + step) % WORDS;
+        uint64_t from = step == 0 ? ~0ULL << (start % 64) : ~0ULL;
 
-        if (used_ports_.find(p) == used_ports_.end() && 
-            used_ports_.find(p + 1) == used_ports_.end())
+        if (quarantined_[w].load(std::memory_order_relaxed) != 0)
         {
-            used_ports_.insert(p);
-            used_ports_.insert(p + 1);
-            return p;
+            if (now == 0) now = now_sec();
+            expire(w, now);
         }
 
-        attempts++;
+        uint64_t word = used_[w].load(std::memory_order_acquire);
+        while (true)
+        {
+            // Bit b stays set if pairs b .. b + pairs - 1 are all free. The
+            // shifts bring in zeros, so a run never crosses into the next word.
+            uint64_t free = ~word;
+            for (int i = 1; i < pairs; ++i)
+                free &= ~word >> i;
+            free &= from;
+            if (free == 0)
+                break;
+
+            int bit = __builtin_ctzll(free);
+            if (used_[w].compare_exchange_weak(word, word | (run << bit),
+                                               std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                size_t index = w * 64 + bit;
+                cursor_.store(index + pairs, std::memory_order_relaxed);
+                acquired_.fetch_add(1, std::memory_order_relaxed);
+                return static_cast<uint16_t>(START_PORT + 2 * index);
+            }
+            // Another thread changed the word; 'word' now holds its new value.
+        }
     }
 
-    Logger::error("[PortPool] No available port pairs in range " + 
-                 std::to_string(start_port_) + "-" + std::to_string(end_port_));
+    exhausted_.fetch_add(1, std::memory_order_relaxed);
+    Logger::error("[PortPool] No available port pairs in range " +
+                 std::to_string(START_PORT) + "-" + std::to_string(END_PORT));
     return 0;
 }
 
-void PortPool::release_pair(uint16_t port)
+void PortPool::release_pair(uint16_t port, int pairs)
 {
-    if (port == 0) return;
-    
-    std::lock_guard<std::mutex> lock(mutex_);
-    used_ports_.erase(port);
-    used_ports_.erase(port + 1);
+    if (port < START_PORT || port >= END_PORT) return;
+
+    size_t index = (port - START_PORT) / 2;
+    for (int i = 0; i < pairs && index + i < PAIRS; ++i)
+    {
+        size_t w = (index + i) / 64;
+        uint64_t bit = 1ULL << ((index + i) % 64);
+        // A quarantined pair stays out until its hold ends.
+        if (quarantined_[w].load(std::memory_order_acquire) & bit)
+            continue;
+        used_[w].fetch_and(~bit, std::memory_order_release);
+    }
 }
 
 void PortPool::mark_occupied(uint16_t port)
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    used_ports_.insert(port);
-    // We don't automatically release it, but it will be skipped.
-    // In a real system, we might want a timer to clear these, 
-    // but for now, we just skip it to avoid immediate re-collision.
+    if (port < START_PORT || port >= END_PORT) return;
+
+    size_t index = (port - START_PORT) / 2;
+    size_t w = index / 64;
+    uint64_t bit = 1ULL << (index % 64);
+
+    collisions_.fetch_add(1, std::memory_order_relaxed);
+    hold_until_[index].store(now_sec() + static_cast<uint32_t>(OCCUPIED_HOLD.count()), std::memory_order_relaxed);
+    used_[w].fetch_or(bit, std::memory_order_acq_rel);
+    quarantined_[w].fetch_or(bit, std::memory_order_release);
+}
+
+void PortPool::expire(size_t word, uint32_t now)
+{
+    uint64_t held = quarantined_[word].load(std::memory_order_acquire);
+    while (held != 0)
+    {
+        int bit = __builtin_ctzll(held);
+        held &= held - 1;
+        if (static_cast<int32_t>(hold_until_[word * 64 + bit].load(std::memory_order_relaxed) - now) > 0)
+            continue;
+
+        // Only the thread that clears the quarantine bit frees the pair.
+        uint64_t mask = 1ULL << bit;
+        if (quarantined_[word].fetch_and(~mask, std::memory_order_acq_rel) & mask)
+        {
+            used_[word].fetch_and(~mask, std::memory_order_release);
+            expired_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+nlohmann::json PortPool::get_info() const
+{
+    size_t used = 0;
+    size_t quarantined = 0;
+    for (size_t w = 0; w < WORDS; ++w)
+    {
+        used += __builtin_popcountll(used_[w].load(std::memory_order_relaxed));
+        quarantined += __builtin_popcountll(quarantined_[w].load(std::memory_order_relaxed));
+    }
+    used -= WORDS * 64 - PAIRS; // the padding bits of the last word
+
+    nlohmann::json info;
+    info["range"] = std::to_string(START_PORT) + "-" + std::to_string(END_PORT);
+    info["pairs"] = PAIRS;
+    info["in_use"] = used - quarantined;
+    info["quarantined"] = quarantined;
+    info["acquired"] = acquired_.load(std::memory_order_relaxed);
+    info["exhausted"] = exhausted_.load(std::memory_order_relaxed);
+    info["collisions"] = collisions_.load(std::memory_order_relaxed);
+    info["expired"] = expired_.load(std::memory_order_relaxed);
+    return info;
 }
@@ -1,6 +1,11 @@
 #include "core/proxy_server.h"
 #include "core/logger.h"
 #include "core/server_config.h"
+#include "core/shared_rtp_socket.h"
+#include "core/multicast_hub.h"
+#include "clients/multicast_publisher.h"
+#include "clients/hls_output.h"
+#include "core/upstream_conn_pool.h"
 #include "handlers/master_handle.h"
 #include "utils/socket_helper.h"
 #include "common/socket_ctx.h"
@@ -129,7 +134,13 @@ int ProxyServer::start_worker()
     int listen_fd = create_listen_socket(listen_port, ServerConfig::getListenInterface());
     if (listen_fd < 0) return EXIT_FAILURE;
 
-    setup_accept_handler(listen_fd, loop, pool);
+    setup_accept_handler(listen_fd, loop);
+    MasterHandle::getInstance().attach(&loop, &pool);
+    UpstreamConnPool::getInstance().attach(&loop);
+    SharedRtpSocket::getInstance().attach(&loop, &pool);
+    MulticastHub::getInstance().attach(&loop, &pool);
+    MulticastPublisher::getInstance().attach(&loop, &pool);
+    HlsOutput::getInstance().attach(&loop, &pool);
 
     Logger::info("[SERVER] Unified HTTP/RTSP server listening on port " + std::to_string(listen_port));
     loop.loop();
@@ -150,9 +161,9 @@ void ProxyServer::setup_signals()
     }
 }
 
-void ProxyServer::setup_accept_handler(int listen_fd, EpollLoop &loop, BufferPool &pool)
+void ProxyServer::setup_accept_handler(int listen_fd, EpollLoop &loop)
 {
-    auto accept_handler = [listen_fd, &loop, &pool](uint32_t events)
+    auto accept_handler = [listen_fd](uint32_t events)
     {
         [[maybe_unused]] uint32_t unused_events = events;
         while (true)
@@ -170,15 +181,7 @@ void ProxyServer::setup_accept_handler(int listen_fd, EpollLoop &loop, BufferPoo
             fcntl(client_fd, F_SETFL, O_NONBLOCK);
             set_tcp_nodelay(client_fd);
 
-            auto ctx = std::make_unique<SocketCtx>();
-            ctx->fd = client_fd;
-            ctx->handler = [client_fd, client_addr, &loop, &pool](uint32_t e)
-            {
-                [[maybe_unused]] uint32_t unused_events = e;
-                MasterHandle::handle(client_fd, client_addr, &loop, pool);
-            };
-
-            loop.set(std::move(ctx), client_fd, EPOLLIN);
+            MasterHandle::getInstance().accept(client_fd, client_addr);
         }
     };
 
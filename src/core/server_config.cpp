@@ -1,5 +1,8 @@
 #include "core/server_config.h"
 #include "utils/url_rewriter.h"
+#include "protocol/pipeline_profile.h"
+#include "core/upstream_selector.h"
+#include "clients/multicast_publisher.h"
 #include "3rd/json.hpp"
 #include "core/logger.h"
 #include <iostream>
@@ -21,11 +24,28 @@ std::string ServerConfig::json_path = "config.json";
 std::string ServerConfig::auth_token = "";
 std::string ServerConfig::http_upstream_interface = "";
 std::string ServerConfig::mitm_upstream_interface = "";
+std::string ServerConfig::redundant_interface = "";
 std::string ServerConfig::listen_interface = "";
 std::string ServerConfig::log_file_path = "";
 size_t ServerConfig::log_file_lines = 10000;
 bool ServerConfig::strip_padding = false;
 bool ServerConfig::wait_keyframe = false;
+int ServerConfig::reorder_latency_ms = 0;
+bool ServerConfig::fec_enabled = false;
+int ServerConfig::stall_timeout_ms = 5000;
+int ServerConfig::upstream_retries = 3;
+bool ServerConfig::upstream_race = false;
+int ServerConfig::upstream_pool_size = 0;
+int ServerConfig::client_buffer_kb = 4096;
+int ServerConfig::total_buffer_mb = 64;
+int ServerConfig::slow_client_timeout_ms = 10000;
+bool ServerConfig::pace_output = false;
+int ServerConfig::pace_burst_ms = 2000;
+int ServerConfig::coalesce_ms = 0;
+int ServerConfig::shared_rtp_port = 0;
+int ServerConfig::hls_segment_ms = 2000;
+int ServerConfig::hls_part_ms = 0;
+int ServerConfig::hls_window = 6;
 bool ServerConfig::watchdog_enabled = false;
 bool ServerConfig::daemon_enabled = false;
 std::vector<std::string> ServerConfig::blacklist = {};
@@ -41,6 +61,7 @@ void ServerConfig::parseCommandLine(int argc, char *argv[])
         {"auth-token", required_argument, nullptr, 't'},
         {"http-interface", required_argument, nullptr, 0},
         {"mitm-interface", required_argument, nullptr, 0},
+        {"redundant-interface", required_argument, nullptr, 0},
         {"listen-interface", required_argument, nullptr, 'l'},
         {"config", required_argument, nullptr, 'c'},
         {"stun-port", required_argument, nullptr, 0},
@@ -53,6 +74,22 @@ void ServerConfig::parseCommandLine(int argc, char *argv[])
         {"log-level", required_argument, nullptr, 0},
         {"strip-padding", no_argument, nullptr, 0},
         {"wait-keyframe", no_argument, nullptr, 0},
+        {"reorder-latency", required_argument, nullptr, 0},
+        {"stall-timeout", required_argument, nullptr, 0},
+        {"upstream-retries", required_argument, nullptr, 0},
+        {"upstream-race", no_argument, nullptr, 0},
+        {"upstream-pool", required_argument, nullptr, 0},
+        {"client-buffer", required_argument, nullptr, 0},
+        {"total-buffer", required_argument, nullptr, 0},
+        {"slow-client-timeout", required_argument, nullptr, 0},
+        {"pace", no_argument, nullptr, 0},
+        {"pace-burst", required_argument, nullptr, 0},
+        {"coalesce", required_argument, nullptr, 0},
+        {"shared-rtp-port", required_argument, nullptr, 0},
+        {"hls-segment", required_argument, nullptr, 0},
+        {"hls-part", required_argument, nullptr, 0},
+        {"hls-window", required_argument, nullptr, 0},
+        {"enable-fec", no_argument, nullptr, 0},
         {nullptr, 0, nullptr, 0}
     };
 
@@ -89,6 +126,7 @@ void ServerConfig::parseCommandLine(int argc, char *argv[])
             else if (longindex >= 0 && strcmp(long_options[longindex].name, "stun-port") == 0) setStunPort(std::stoi(optarg));
             else if (longindex >= 0 && strcmp(long_options[longindex].name, "http-interface") == 0) setHttpUpstreamInterface(optarg);
             else if (longindex >= 0 && strcmp(long_options[longindex].name, "mitm-interface") == 0) setMitmUpstreamInterface(optarg);
+            else if (longindex >= 0 && strcmp(long_options[longindex].name, "redundant-interface") == 0) setRedundantInterface(optarg);
             else if (longindex >= 0 && strcmp(long_options[longindex].name, "log-file") == 0) setLogFile(optarg);
             else if (longindex >= 0 && strcmp(long_options[longindex].name, "log-lines") == 0) setLogLines(std::stoull(optarg));
             else if (longindex >= 0 && strcmp(long_options[longindex].name, "log-level") == 0) {
@@ -100,6 +138,22 @@ void ServerConfig::parseCommandLine(int argc, char *argv[])
             }
             else if (longindex >= 0 && strcmp(long_options[longindex].name, "strip-padding") == 0) setStripPadding(true);
             else if (longindex >= 0 && strcmp(long_options[longindex].name, "wait-keyframe") == 0) setWaitKeyframe(true);
+            else if (longindex >= 0 && strcmp(long_options[longindex].name, "reorder-latency") == 0) setReorderLatencyMs(std::stoi(optarg));
+            else if (longindex >= 0 && strcmp(long_options[longindex].name, "stall-timeout") == 0) setStallTimeoutMs(std::stoi(optarg));
+            else if (longindex >= 0 && strcmp(long_options[longindex].name, "upstream-retries") == 0) setUpstreamRetries(std::stoi(optarg));
+            else if (longindex >= 0 && strcmp(long_options[longindex].name, "upstream-race") == 0) setUpstreamRaceEnabled(true);
+            else if (longindex >= 0 && strcmp(long_options[longindex].name, "upstream-pool") == 0) setUpstreamPoolSize(std::stoi(optarg));
+            else if (longindex >= 0 && strcmp(long_options[longindex].name, "client-buffer") == 0) setClientBufferKb(std::stoi(optarg));
+            else if (longindex >= 0 && strcmp(long_options[longindex].name, "total-buffer") == 0) setTotalBufferMb(std::stoi(optarg));
+            else if (longindex >= 0 && strcmp(long_options[longindex].name, "slow-client-timeout") == 0) setSlowClientTimeoutMs(std::stoi(optarg));
+            else if (longindex >= 0 && strcmp(long_options[longindex].name, "pace") == 0) setPaceOutputEnabled(true);
+            else if (longindex >= 0 && strcmp(long_options[longindex].name, "pace-burst") == 0) setPaceBurstMs(std::stoi(optarg));
+            else if (longindex >= 0 && strcmp(long_options[longindex].name, "coalesce") == 0) setCoalesceMs(std::stoi(optarg));
+            else if (longindex >= 0 && strcmp(long_options[longindex].name, "shared-rtp-port") == 0) setSharedRtpPort(std::stoi(optarg));
+            else if (longindex >= 0 && strcmp(long_options[longindex].name, "hls-segment") == 0) setHlsSegmentMs(std::stoi(optarg));
+            else if (longindex >= 0 && strcmp(long_options[longindex].name, "hls-part") == 0) setHlsPartMs(std::stoi(optarg));
+            else if (longindex >= 0 && strcmp(long_options[longindex].name, "hls-window") == 0) setHlsWindow(std::stoi(optarg));
+            else if (longindex >= 0 && strcmp(long_options[longindex].name, "enable-fec") == 0) setFecEnabled(true);
             break;
         default:
             printUsage(argv[0]);
@@ -162,6 +216,10 @@ void ServerConfig::setMitmUpstreamInterface(std::string iface)
 {
     mitm_upstream_interface = iface;
 }
+void ServerConfig::setRedundantInterface(std::string iface)
+{
+    redundant_interface = iface;
+}
 
 void ServerConfig::setListenInterface(std::string iface)
 {
@@ -189,6 +247,81 @@ void ServerConfig::setWaitKeyframe(bool enable)
 {
     wait_keyframe = enable;
 }
+void ServerConfig::setReorderLatencyMs(int ms)
+{
+    reorder_latency_ms = ms < 0 ? 0 : ms;
+}
+void ServerConfig::setFecEnabled(bool enable)
+{
+    fec_enabled = enable;
+}
+void ServerConfig::setStallTimeoutMs(int ms)
+{
+    stall_timeout_ms = ms < 0 ? 0 : ms;
+}
+void ServerConfig::setUpstreamRetries(int retries)
+{
+    upstream_retries = retries < 0 ? 0 : retries;
+}
+void ServerConfig::setUpstreamRaceEnabled(bool enable)
+{
+    upstream_race = enable;
+}
+void ServerConfig::setUpstreamPoolSize(int size)
+{
+    upstream_pool_size = size < 0 ? 0 : size;
+}
+
+void ServerConfig::setClientBufferKb(int kb)
+{
+    client_buffer_kb = kb < 64 ? 64 : kb;
+}
+
+void ServerConfig::setTotalBufferMb(int mb)
+{
+    total_buffer_mb = mb < 1 ? 1 : mb;
+}
+
+void ServerConfig::setSlowClientTimeoutMs(int ms)
+{
+    slow_client_timeout_ms = ms < 0 ? 0 : ms;
+}
+
+void ServerConfig::setPaceOutputEnabled(bool enable)
+{
+    pace_output = enable;
+}
+
+void ServerConfig::setPaceBurstMs(int ms)
+{
+    pace_burst_ms = ms < 0 ? 0 : ms;
+}
+
+void ServerConfig::setCoalesceMs(int ms)
+{
+    coalesce_ms = ms < 0 ? 0 : (ms > 200 ? 200 : ms);
+}
+
+void ServerConfig::setSharedRtpPort(int port)
+{
+    // Even, so that RTCP is on port + 1 as for the pooled pairs.
+    shared_rtp_port = port <= 0 || port > 65532 ? 0 : port & ~1;
+}
+
+void ServerConfig::setHlsSegmentMs(int ms)
+{
+    hls_segment_ms = ms < 1000 ? 1000 : (ms > 10000 ? 10000 : ms);
+}
+
+void ServerConfig::setHlsPartMs(int ms)
+{
+    hls_part_ms = ms <= 0 ? 0 : (ms < 100 ? 100 : (ms > 2000 ? 2000 : ms));
+}
+
+void ServerConfig::setHlsWindow(int segments)
+{
+    hls_window = segments < 3 ? 3 : (segments > 30 ? 30 : segments);
+}
 void ServerConfig::setWatchdogEnabled(bool enable)
 {
     watchdog_enabled = enable;
@@ -253,6 +386,10 @@ std::string ServerConfig::getMitmUpstreamInterface()
 {
     return mitm_upstream_interface;
 }
+std::string ServerConfig::getRedundantInterface()
+{
+    return redundant_interface;
+}
 
 std::string ServerConfig::getListenInterface()
 {
@@ -280,6 +417,73 @@ bool ServerConfig::isWaitKeyframe()
 {
     return wait_keyframe;
 }
+int ServerConfig::getReorderLatencyMs()
+{
+    return reorder_latency_ms;
+}
+int ServerConfig::getStallTimeoutMs()
+{
+    return stall_timeout_ms;
+}
+int ServerConfig::getUpstreamRetries()
+{
+    return upstream_retries;
+}
+bool ServerConfig::isUpstreamRaceEnabled()
+{
+    return upstream_race;
+}
+int ServerConfig::getUpstreamPoolSize()
+{
+    return upstream_pool_size;
+}
+
+int ServerConfig::getClientBufferKb()
+{
+    return client_buffer_kb;
+}
+
+int ServerConfig::getTotalBufferMb()
+{
+    return total_buffer_mb;
+}
+
+int ServerConfig::getSlowClientTimeoutMs()
+{
+    return slow_client_timeout_ms;
+}
+bool ServerConfig::isPaceOutputEnabled()
+{
+    return pace_output;
+}
+int ServerConfig::getPaceBurstMs()
+{
+    return pace_burst_ms;
+}
+int ServerConfig::getCoalesceMs()
+{
+    return coalesce_ms;
+}
+int ServerConfig::getSharedRtpPort()
+{
+    return shared_rtp_port;
+}
+int ServerConfig::getHlsSegmentMs()
+{
+    return hls_segment_ms;
+}
+int ServerConfig::getHlsPartMs()
+{
+    return hls_part_ms;
+}
+int ServerConfig::getHlsWindow()
+{
+    return hls_window;
+}
+bool ServerConfig::isFecEnabled()
+{
+    return fec_enabled;
+}
 bool ServerConfig::isWatchdogEnabled()
 {
     return watchdog_enabled;
@@ -299,8 +503,9 @@ void ServerConfig::printUsage(const std::string &program_name)
     std::cout << "  -b, --buffer-pool-count <count> Set BufferPool block count (default: " << buffer_pool_count << ")" << std::endl;
     std::cout << "  -s, --buffer-pool-block-size <size>  Set BufferPool block size (default: " << buffer_pool_block_size << ")" << std::endl;
     std::cout << "  -t, --auth-token      <token> Set auth token for HTTP API and RTSP access (default: none)" << std::endl;
-    std::cout << "      --http-interface  <iface> Set HTTP mode upstream interface" << std::endl;
+    std::cout << "      --http-interface  <iface> Set HTTP mode upstream and multicast interface" << std::endl;
     std::cout << "      --mitm-interface  <iface> Set MITM mode upstream interface" << std::endl;
+    std::cout << "      --redundant-interface <iface> Set upstream interface for the redundant leg (?redundant=)" << std::endl;
     std::cout << "  -l, --listen-interface <iface> Set interface to listen on" << std::endl;
     std::cout << "  -c, --config          <path>  Set JSON file path (default: " << json_path << ")" << std::endl;
     std::cout << "  -d, --daemon                  Run rtsproxy in the background" << std::endl;
@@ -313,6 +518,22 @@ void ServerConfig::printUsage(const std::string &program_name)
     std::cout << "      --stun-port       <port>  Set STUN server port (default: " << stun_server_port << ")" << std::endl;
     std::cout << "      --strip-padding           Strip RTP padding and TS null packets" << std::endl;
     std::cout << "      --wait-keyframe           Wait for keyframe before starting relay (Anti-Greenscreen)" << std::endl;
+    std::cout << "      --reorder-latency <ms>    Hold out-of-order RTP packets up to <ms> (default: " << reorder_latency_ms << ", 0 = off)" << std::endl;
+    std::cout << "      --stall-timeout   <ms>    Reconnect upstream after <ms> without RTP (default: " << stall_timeout_ms << ", 0 = off)" << std::endl;
+    std::cout << "      --upstream-retries <n>  Reconnect attempts before closing the viewer (default: " << upstream_retries << ", 0 = off)" << std::endl;
+    std::cout << "      --upstream-race           Connect to the two best hosts of an upstream group and keep the faster one" << std::endl;
+    std::cout << "      --upstream-pool   <n>     Idle pre-connected RTSP control connections per upstream (default: " << upstream_pool_size << ", 0 = off)" << std::endl;
+    std::cout << "      --client-buffer   <kb>    Send queue budget per viewer before skipping to the next keyframe (default: " << client_buffer_kb << ")" << std::endl;
+    std::cout << "      --total-buffer    <mb>    Send queue budget for all viewers together (default: " << total_buffer_mb << ")" << std::endl;
+    std::cout << "      --slow-client-timeout <ms> Disconnect a viewer that stays over budget for <ms> (default: " << slow_client_timeout_ms << ", 0 = never)" << std::endl;
+    std::cout << "      --pace                    Send TS to HTTP viewers at the rate given by its PCR" << std::endl;
+    std::cout << "      --pace-burst      <ms>    Stream time sent unpaced when a viewer starts (default: " << pace_burst_ms << ")" << std::endl;
+    std::cout << "      --coalesce        <ms>    Merge TS payloads into chunks of up to 64 KB for HTTP viewers, waiting at most <ms> (default: " << coalesce_ms << ", 0 = off)" << std::endl;
+    std::cout << "      --shared-rtp-port <port>  Receive upstream UDP RTP of all sessions on <port>/<port>+1 (default: " << shared_rtp_port << ", 0 = per-session ports)" << std::endl;
+    std::cout << "      --hls-segment     <ms>    Target duration of HLS segments (default: " << hls_segment_ms << ")" << std::endl;
+    std::cout << "      --hls-part        <ms>    Target duration of LL-HLS partial segments (default: " << hls_part_ms << ", 0 = off)" << std::endl;
+    std::cout << "      --hls-window      <n>     Segments listed in an HLS playlist (default: " << hls_window << ")" << std::endl;
+    std::cout << "      --enable-fec              Receive SMPTE 2022-1 FEC on RTP port+2/+4 and repair lost packets" << std::endl;
 }
 
 bool ServerConfig::loadFromFile(const std::string &path)
@@ -362,10 +583,27 @@ bool ServerConfig::loadFromFile(const std::string &path)
         }
         if (s.contains("strip_padding")) setStripPadding(s["strip_padding"].get<bool>());
         if (s.contains("wait_keyframe")) setWaitKeyframe(s["wait_keyframe"].get<bool>());
+        if (s.contains("reorder_latency_ms")) setReorderLatencyMs(s["reorder_latency_ms"].get<int>());
+        if (s.contains("stall_timeout_ms")) setStallTimeoutMs(s["stall_timeout_ms"].get<int>());
+        if (s.contains("upstream_retries")) setUpstreamRetries(s["upstream_retries"].get<int>());
+        if (s.contains("upstream_race")) setUpstreamRaceEnabled(s["upstream_race"].get<bool>());
+        if (s.contains("upstream_pool_size")) setUpstreamPoolSize(s["upstream_pool_size"].get<int>());
+        if (s.contains("client_buffer_kb")) setClientBufferKb(s["client_buffer_kb"].get<int>());
+        if (s.contains("total_buffer_mb")) setTotalBufferMb(s["total_buffer_mb"].get<int>());
+        if (s.contains("slow_client_timeout_ms")) setSlowClientTimeoutMs(s["slow_client_timeout_ms"].get<int>());
+        if (s.contains("pace_output")) setPaceOutputEnabled(s["pace_output"].get<bool>());
+        if (s.contains("pace_burst_ms")) setPaceBurstMs(s["pace_burst_ms"].get<int>());
+        if (s.contains("coalesce_ms")) setCoalesceMs(s["coalesce_ms"].get<int>());
+        if (s.contains("shared_rtp_port")) setSharedRtpPort(s["shared_rtp_port"].get<int>());
+        if (s.contains("hls_segment_ms")) setHlsSegmentMs(s["hls_segment_ms"].get<int>());
+        if (s.contains("hls_part_ms")) setHlsPartMs(s["hls_part_ms"].get<int>());
+        if (s.contains("hls_window")) setHlsWindow(s["hls_window"].get<int>());
+        if (s.contains("enable_fec")) setFecEnabled(s["enable_fec"].get<bool>());
         if (s.contains("watchdog")) setWatchdogEnabled(s["watchdog"].get<bool>());
         if (s.contains("daemon")) setDaemonEnabled(s["daemon"].get<bool>());
         if (s.contains("http_interface")) setHttpUpstreamInterface(s["http_interface"].get<std::string>());
         if (s.contains("mitm_interface")) setMitmUpstreamInterface(s["mitm_interface"].get<std::string>());
+        if (s.contains("redundant_interface")) setRedundantInterface(s["redundant_interface"].get<std::string>());
         if (s.contains("listen_interface")) setListenInterface(s["listen_interface"].get<std::string>());
         if (s.contains("stun_host")) setStunHost(s["stun_host"].get<std::string>());
         if (s.contains("stun_port")) setStunPort(s["stun_port"].get<int>());
@@ -376,6 +614,22 @@ bool ServerConfig::loadFromFile(const std::string &path)
         URLRewriter::set_replace_templates(config["replace_templates"]);
     }
 
+    if (config.contains("upstream_groups"))
+    {
+        UpstreamSelector::getInstance().load(config["upstream_groups"]);
+    }
+
+    if (config.contains("multicast_outputs"))
+    {
+        MulticastPublisher::getInstance().load(config["multicast_outputs"]);
+    }
+
+    if (config.contains("pipeline_profiles"))
+    {
+        PipelineProfiles::load(config["pipeline_profiles"],
+                               config.contains("pipeline_rules") ? config["pipeline_rules"] : nlohmann::json());
+    }
+
     return true;
 }
 
@@ -393,6 +647,20 @@ void ServerConfig::printConfig()
     Logger::info("[CONFIG] Buffer Pool Size:  " + std::to_string(buffer_pool_block_size));
     Logger::info("[CONFIG] Strip Padding:     " + std::string(strip_padding ? "YES" : "NO"));
     Logger::info("[CONFIG] Wait Keyframe:     " + std::string(wait_keyframe ? "YES" : "NO"));
+    Logger::info("[CONFIG] Reorder Latency:   " + (reorder_latency_ms > 0 ? std::to_string(reorder_latency_ms) + " ms" : std::string("OFF")));
+    Logger::info("[CONFIG] FEC Enabled:       " + std::string(fec_enabled ? "YES" : "NO"));
+    Logger::info("[CONFIG] Stall Timeout:     " + (stall_timeout_ms > 0 ? std::to_string(stall_timeout_ms) + " ms" : std::string("OFF")));
+    Logger::info("[CONFIG] Upstream Retries:  " + std::to_string(upstream_retries));
+    Logger::info("[CONFIG] Upstream Race:     " + std::string(upstream_race ? "YES" : "NO"));
+    Logger::info("[CONFIG] Upstream Pool:     " + (upstream_pool_size > 0 ? std::to_string(upstream_pool_size) : std::string("OFF")));
+    Logger::info("[CONFIG] Client Buffer:     " + std::to_string(client_buffer_kb) + " KB");
+    Logger::info("[CONFIG] Total Buffer:      " + std::to_string(total_buffer_mb) + " MB");
+    Logger::info("[CONFIG] Slow Client:       " + (slow_client_timeout_ms > 0 ? std::to_string(slow_client_timeout_ms) + " ms" : std::string("NEVER")));
+    Logger::info("[CONFIG] Pace Output:       " + (pace_output ? "PCR, " + std::to_string(pace_burst_ms) + " ms burst" : std::string("NO")));
+    Logger::info("[CONFIG] Coalesce:          " + (coalesce_ms > 0 ? std::to_string(coalesce_ms) + " ms" : std::string("OFF")));
+    Logger::info("[CONFIG] Shared RTP Port:   " + (shared_rtp_port > 0 ? std::to_string(shared_rtp_port) : std::string("OFF")));
+    Logger::info("[CONFIG] HLS:               " + std::to_string(hls_segment_ms) + " ms segments, " + std::to_string(hls_window) + " listed" +
+                 (hls_part_ms > 0 ? ", " + std::to_string(hls_part_ms) + " ms parts" : std::string()));
     Logger::info("[CONFIG] Watchdog:          " + std::string(watchdog_enabled ? "YES" : "NO"));
     Logger::info("[CONFIG] Daemon:            " + std::string(daemon_enabled ? "YES" : "NO"));
     Logger::info(std::string("[CONFIG] Auth Token:        ") + (auth_token.empty() ? "NONE" : "SET (MASKED)"));
@@ -400,6 +668,8 @@ void ServerConfig::printConfig()
         Logger::info("[CONFIG] HTTP Upstream If:  " + http_upstream_interface);
     if (!mitm_upstream_interface.empty())
         Logger::info("[CONFIG] MITM Upstream If:  " + mitm_upstream_interface);
+    if (!redundant_interface.empty())
+        Logger::info("[CONFIG] Redundant If:      " + redundant_interface);
 }
 
 void ServerConfig::kill_previous_instance()
@@ -0,0 +1,365 @@
+#include "core/shared_rtp_socket.h"
+#include "core/epoll_loop.h"
+#include "core/logger.h"
+#include "core/server_config.h"
+#include "common/socket_ctx.h"
+#include "utils/socket_helper.h"
+#include "utils/utils.h"
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+
+SharedRtpSocket &SharedRtpSocket::getInstance()
+{
+    static SharedRtpSocket instance;
+    return instance;
+}
+
+SharedRtpSocket::~SharedRtpSocket()
+{
+    for (auto &ep : endpoints_)
+    {
+        if (ep->rtp_fd >= 0) close(ep->rtp_fd);
+        if (ep->rtcp_fd >= 0) close(ep->rtcp_fd);
+    }
+}
+
+void SharedRtpSocket::attach(EpollLoop *loop, BufferPool *pool)
+{
+    if (ServerConfig::getSharedRtpPort() <= 0)
+        return;
+    loop_ = loop;
+    pool_ = pool;
+}
+
+SharedRtpSocket::Endpoint *SharedRtpSocket::endpoint(const std::string &iface)
+{
+    for (auto &ep : endpoints_)
+    {
+        if (ep->iface == iface)
+            return ep->rtp_fd >= 0 ? ep.get() : nullptr;
+    }
+    if (!loop_)
+        return nullptr;
+
+    // A pair that fails to bind stays in the list so it is not retried per session.
+    size_t index = endpoints_.size();
+    auto ep = std::make_unique<Endpoint>();
+    ep->iface = iface;
+    ep->port = static_cast<uint16_t>(ServerConfig::getSharedRtpPort() + 2 * index);
+    Endpoint *raw = ep.get();
+    endpoints_.push_back(std::move(ep));
+
+    std::string where = std::to_string(raw->port) + (iface.empty() ? "" : " on " + iface);
+    if (bind_udp_shared_socket(raw->rtp_fd, raw->port, iface) < 0 ||
+        bind_udp_shared_socket(raw->rtcp_fd, raw->port + 1, iface) < 0)
+    {
+        Logger::error("[RTP] Failed to bind shared RTP port " + where + ", sessions fall back to their own ports");
+        if (raw->rtp_fd >= 0) close(raw->rtp_fd);
+        raw->rtp_fd = -1;
+        raw->rtcp_fd = -1;
+        return nullptr;
+    }
+
+    raw->rtp_ctx = std::make_unique<SocketCtx>(raw->rtp_fd, [this, index](uint32_t event)
+                                               { handle_rtp(index, event); });
+    raw->rtcp_ctx = std::make_unique<SocketCtx>(raw->rtcp_fd, [this, index](uint32_t event)
+                                                { handle_rtcp(index, event); });
+    loop_->set(raw->rtp_ctx.get(), raw->rtp_fd, EPOLLIN);
+    loop_->set(raw->rtcp_ctx.get(), raw->rtcp_fd, EPOLLIN);
+
+    Logger::info("[RTP] Shared RTP/RTCP port " + where + " opened");
+    return raw;
+}
+
+uint16_t SharedRtpSocket::port(const std::string &iface)
+{
+    Endpoint *ep = endpoint(iface);
+    return ep ? ep->port : 0;
+}
+
+uint64_t SharedRtpSocket::subscribe(const std::string &iface, const sockaddr_in &server, Receiver on_rtp, Receiver on_rtcp)
+{
+    Endpoint *ep = endpoint(iface);
+    if (!ep)
+        return 0;
+
+    size_t index = 0;
+    while (endpoints_[index].get() != ep)
+        ++index;
+
+    uint64_t id = next_id_++;
+    Subscription &sub = subs_[id];
+    sub.endpoint = index;
+    sub.server = server;
+    sub.on_rtp = std::move(on_rtp);
+    sub.on_rtcp = std::move(on_rtcp);
+    ep->waiting.push_back(id);
+    return id;
+}
+
+void SharedRtpSocket::unsubscribe(uint64_t id)
+{
+    auto it = subs_.find(id);
+    if (it == subs_.end() || it->second.dead)
+        return;
+
+    Subscription &sub = it->second;
+    unroute(id, sub);
+    auto &waiting = endpoints_[sub.endpoint]->waiting;
+    waiting.erase(std::remove(waiting.begin(), waiting.end(), id), waiting.end());
+
+    // A receiver may end its own session; its std::function must outlive the call.
+    if (dispatching_)
+    {
+        sub.dead = true;
+        dead_.push_back(id);
+        return;
+    }
+    subs_.erase(it);
+}
+
+void SharedRtpSocket::expect_ssrc(uint64_t id, uint32_t ssrc)
+{
+    auto it = subs_.find(id);
+    if (it == subs_.end() || it->second.dead)
+        return;
+    it->second.has_ssrc = true;
+    it->second.ssrc = htonl(ssrc);
+}
+
+bool SharedRtpSocket::send_to(const std::string &iface, bool rtcp, const sockaddr_in &to, const void *data, size_t len)
+{
+    Endpoint *ep = endpoint(iface);
+    if (!ep)
+        return false;
+    return sendto(rtcp ? ep->rtcp_fd : ep->rtp_fd, data, len, 0, (const sockaddr *)&to, sizeof(to)) >= 0;
+}
+
+void SharedRtpSocket::bind_route(uint64_t id, Subscription &sub, const Route &route)
+{
+    sub.routed = true;
+    sub.route = route;
+    routes_[route] = id;
+    if (sub.on_rtcp)
+        rtcp_routes_[Route{route.addr, 0, route.ssrc}] = id;
+
+    char addr[INET_ADDRSTRLEN] = {0};
+    in_addr in{route.addr};
+    inet_ntop(AF_INET, &in, addr, sizeof(addr));
+    Logger::debug("[RTP] Shared port routes " + std::string(addr) + ":" + std::to_string(ntohs(route.port)) +
+                  " SSRC " + std::to_string(ntohl(route.ssrc)) + " to session " + std::to_string(id));
+}
+
+void SharedRtpSocket::unroute(uint64_t id, Subscription &sub)
+{
+    if (!sub.routed)
+        return;
+    sub.routed = false;
+
+    auto it = routes_.find(sub.route);
+    if (it != routes_.end() && it->second == id)
+        routes_.erase(it);
+    auto rit = rtcp_routes_.find(Route{sub.route.addr, 0, sub.route.ssrc});
+    if (rit != rtcp_routes_.end() && rit->second == id)
+        rtcp_routes_.erase(rit);
+}
+
+SharedRtpSocket::Subscription *SharedRtpSocket::claim(size_t ep, const Route &route)
+{
+    // A session that was told its SSRC in the SETUP reply takes exactly that stream.
+    auto &waiting = endpoints_[ep]->waiting;
+    auto take = [&](std::vector<uint64_t>::iterator it)
+    {
+        uint64_t id = *it;
+        waiting.erase(it);
+        Subscription &sub = subs_[id];
+        bind_route(id, sub, route);
+        return &sub;
+    };
+    for (auto it = waiting.begin(); it != waiting.end(); ++it)
+    {
+        const Subscription &sub = subs_[*it];
+        if (sub.has_ssrc && sub.ssrc == route.ssrc && sub.server.sin_addr.s_addr == route.addr)
+            return take(it);
+    }
+
+    // Otherwise it goes to the session waiting for that server, preferring one
+    // whose advertised server_port it comes from. Two such sessions may have
+    // asked for different channels: rather than guess, the packet is dropped.
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        auto match = waiting.end();
+        size_t candidates = 0;
+        for (auto it = waiting.begin(); it != waiting.end(); ++it)
+        {
+            const Subscription &sub = subs_[*it];
+            if (sub.has_ssrc || sub.server.sin_addr.s_addr != route.addr ||
+                (pass == 0 && sub.server.sin_port != route.port))
+                continue;
+            if (candidates++ == 0)
+                match = it;
+        }
+        if (candidates == 1)
+            return take(match);
+        if (candidates > 1)
+        {
+            ++endpoints_[ep]->ambiguous;
+            return nullptr;
+        }
+    }
+
+    // Nobody is waiting: a known source with a new SSRC (server-side restart)
+    // belongs to the session it fed, if that is unambiguous.
+    uint64_t owner = 0;
+    for (auto &[id, sub] : subs_)
+    {
+        if (sub.endpoint != ep || !sub.routed || sub.route.addr != route.addr || sub.route.port != route.port)
+            continue;
+        if (owner != 0)
+            return nullptr;
+        owner = id;
+    }
+    if (owner == 0)
+        return nullptr;
+
+    Subscription &sub = subs_[owner];
+    unroute(owner, sub);
+    bind_route(owner, sub, route);
+    return &sub;
+}
+
+void SharedRtpSocket::handle_rtp(size_t ep, uint32_t event)
+{
+    if (!(event & EPOLLIN))
+        return;
+
+    int fd = endpoints_[ep]->rtp_fd;
+    std::unique_ptr<uint8_t[]> bufs[RECV_BATCH];
+    mmsghdr msgs[RECV_BATCH];
+    iovec iovs[RECV_BATCH];
+    sockaddr_in src[RECV_BATCH];
+    size_t capacity = pool_->get_buffer_size();
+
+    dispatching_ = true;
+    while (true)
+    {
+        for (unsigned int i = 0; i < RECV_BATCH; ++i)
+        {
+            if (!bufs[i])
+                bufs[i] = pool_->acquire();
+            iovs[i] = iovec{bufs[i].get(), capacity};
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &src[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(src[i]);
+        }
+
+        int count = recvmmsg(fd, msgs, RECV_BATCH, 0, nullptr);
+        if (count <= 0)
+            break;
+
+        for (int i = 0; i < count; ++i)
+        {
+            size_t n = msgs[i].msg_len;
+            const uint8_t *rtp = bufs[i].get();
+            ++endpoints_[ep]->packets;
+            if (n < 12 || (rtp[0] >> 6) != 2)
+            {
+                ++endpoints_[ep]->unrouted;
+                continue;
+            }
+
+            Route route{src[i].sin_addr.s_addr, src[i].sin_port, 0};
+            memcpy(&route.ssrc, rtp + 8, 4);
+
+            Subscription *sub = nullptr;
+            auto it = routes_.find(route);
+            if (likely(it != routes_.end()))
+                sub = &subs_[it->second];
+            else
+                sub = claim(ep, route);
+
+            if (!sub || sub->dead)
+            {
+                ++endpoints_[ep]->unrouted;
+                continue;
+            }
+            sub->on_rtp(Packet{std::move(bufs[i]), n, 0});
+        }
+        if (static_cast<unsigned int>(count) < RECV_BATCH)
+            break;
+    }
+    dispatching_ = false;
+
+    for (auto &buf : bufs)
+        pool_->release(std::move(buf));
+    reap();
+}
+
+void SharedRtpSocket::handle_rtcp(size_t ep, uint32_t event)
+{
+    if (!(event & EPOLLIN))
+        return;
+
+    int fd = endpoints_[ep]->rtcp_fd;
+    dispatching_ = true;
+    while (true)
+    {
+        sockaddr_in src{};
+        socklen_t slen = sizeof(src);
+        auto buf = pool_->acquire();
+        ssize_t n = recvfrom(fd, buf.get(), pool_->get_buffer_size(), 0, (sockaddr *)&src, &slen);
+        if (n <= 0)
+        {
+            pool_->release(std::move(buf));
+            break;
+        }
+
+        // The sender SSRC of the first report ties RTCP to its RTP stream.
+        Route route{src.sin_addr.s_addr, 0, 0};
+        if (n >= 8)
+            memcpy(&route.ssrc, buf.get() + 4, 4);
+        auto it = n >= 8 ? rtcp_routes_.find(route) : rtcp_routes_.end();
+        if (it == rtcp_routes_.end() || subs_[it->second].dead)
+        {
+            pool_->release(std::move(buf));
+            continue;
+        }
+        subs_[it->second].on_rtcp(Packet{std::move(buf), static_cast<size_t>(n), 0});
+    }
+    dispatching_ = false;
+    reap();
+}
+
+void SharedRtpSocket::reap()
+{
+    for (uint64_t id : dead_)
+        subs_.erase(id);
+    dead_.clear();
+}
+
+nlohmann::json SharedRtpSocket::get_info() const
+{
+    nlohmann::json info;
+    info["sessions"] = subs_.size();
+    info["routes"] = routes_.size();
+    nlohmann::json eps = nlohmann::json::array();
+    for (const auto &ep : endpoints_)
+    {
+        nlohmann::json e;
+        e["port"] = ep->port;
+        if (!ep->iface.empty()) e["interface"] = ep->iface;
+        e["open"] = ep->rtp_fd >= 0;
+        e["packets"] = ep->packets;
+        e["unrouted"] = ep->unrouted;
+        e["ambiguous"] = ep->ambiguous;
+        e["waiting"] = ep->waiting.size();
+        eps.push_back(e);
+    }
+    info["ports"] = eps;
+    return info;
+}
@@ -0,0 +1,135 @@
+#include "core/udp_batch_sender.h"
+#include <cerrno>
+#include <cstring>
+#include <netinet/udp.h>
+#include <sys/uio.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+UdpBatchSender::UdpBatchSender(BufferPool &pool)
+    : pool_(pool)
+{
+}
+
+UdpBatchSender::~UdpBatchSender()
+{
+    clear();
+}
+
+void UdpBatchSender::set_peer(int fd, const sockaddr_in *peer)
+{
+    fd_ = fd;
+    has_peer_ = peer != nullptr;
+    if (peer)
+        peer_ = *peer;
+
+    int segment = 0;
+    socklen_t optlen = sizeof(segment);
+    gso_ = getsockopt(fd, SOL_UDP, UDP_SEGMENT, &segment, &optlen) == 0;
+}
+
+void UdpBatchSender::add(std::unique_ptr<uint8_t[]> buf, size_t off, size_t len)
+{
+    if (count_ == MAX_BATCH)
+        flush();
+
+    Item &item = items_[count_++];
+    item.buf = std::move(buf);
+    item.off = off;
+    item.len = len;
+}
+
+size_t UdpBatchSender::flush()
+{
+    if (count_ == 0)
+        return 0;
+
+    size_t sent = fd_ >= 0 ? send_items(gso_) : 0;
+    datagrams_ += count_;
+    clear();
+    return sent;
+}
+
+size_t UdpBatchSender::send_items(bool use_gso)
+{
+    mmsghdr msgs[MAX_BATCH];
+    iovec iovs[MAX_BATCH];
+    alignas(cmsghdr) char control[MAX_BATCH][CMSG_SPACE(sizeof(uint16_t))];
+    bool any_gso = false;
+
+    size_t m = 0;
+    for (size_t i = 0; i < count_;)
+    {
+        size_t len = items_[i].len;
+        size_t j = i + 1;
+        if (use_gso)
+        {
+            while (j < count_ && items_[j].len == len && j - i < GSO_MAX_SEGMENTS && (j - i + 1) * len <= GSO_MAX_BYTES)
+                ++j;
+        }
+
+        for (size_t k = i; k < j; ++k)
+            iovs[k] = iovec{items_[k].buf.get() + items_[k].off, items_[k].len};
+
+        msghdr &h = msgs[m].msg_hdr;
+        memset(&h, 0, sizeof(h));
+        if (has_peer_)
+        {
+            h.msg_name = &peer_;
+            h.msg_namelen = sizeof(peer_);
+        }
+        h.msg_iov = &iovs[i];
+        h.msg_iovlen = j - i;
+
+        if (j - i > 1)
+        {
+            // The segments are gathered from their own blocks; the kernel splits at gso_size.
+            h.msg_control = control[m];
+            h.msg_controllen = sizeof(control[m]);
+            cmsghdr *cm = CMSG_FIRSTHDR(&h);
+            cm->cmsg_level = SOL_UDP;
+            cm->cmsg_type = UDP_SEGMENT;
+            cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            uint16_t segment = static_cast<uint16_t>(len);
+            memcpy(CMSG_DATA(cm), &segment, sizeof(segment));
+            any_gso = true;
+        }
+        ++m;
+        i = j;
+    }
+
+    size_t bytes = 0;
+    size_t done = 0;
+    while (done < m)
+    {
+        int n = sendmmsg(fd_, msgs + done, static_cast<unsigned int>(m - done), 0);
+        ++syscalls_;
+        if (n < 0)
+        {
+            if (done == 0 && any_gso && (errno == EIO || errno == EINVAL || errno == EOPNOTSUPP || errno == ENOPROTOOPT))
+            {
+                // No GSO on this path after all (old kernel, no checksum offload): send one by one from now on.
+                gso_ = false;
+                return send_items(false);
+            }
+            break;
+        }
+        for (int k = 0; k < n; ++k)
+        {
+            bytes += msgs[done + k].msg_len;
+            if (msgs[done + k].msg_hdr.msg_iovlen > 1)
+                ++gso_sends_;
+        }
+        done += n;
+    }
+    return bytes;
+}
+
+void UdpBatchSender::clear()
+{
+    for (size_t i = 0; i < count_; ++i)
+        pool_.release(std::move(items_[i].buf));
+    count_ = 0;
+}
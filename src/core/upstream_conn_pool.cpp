@@ -0,0 +1,326 @@
+#include "core/upstream_conn_pool.h"
+#include "core/epoll_loop.h"
+#include "core/logger.h"
+#include "core/server_config.h"
+#include "common/socket_ctx.h"
+#include "protocol/rtsp_message.h"
+#include "utils/socket_helper.h"
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <vector>
+
+UpstreamConnPool &UpstreamConnPool::getInstance()
+{
+    static UpstreamConnPool instance;
+    return instance;
+}
+
+std::string UpstreamConnPool::key(const std::string &ip, uint16_t port, const std::string &iface)
+{
+    return ip + ":" + std::to_string(port) + (iface.empty() ? "" : "%" + iface);
+}
+
+void UpstreamConnPool::attach(EpollLoop *loop)
+{
+    loop_ = loop;
+    if (ServerConfig::getUpstreamPoolSize() <= 0)
+        return;
+
+    timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd_ < 0)
+    {
+        Logger::warn("[POOL] Failed to create refill timer, upstream connection pool disabled");
+        loop_ = nullptr;
+        return;
+    }
+
+    itimerspec its{};
+    its.it_value.tv_sec = REFILL_INTERVAL_MS / 1000;
+    its.it_interval.tv_sec = REFILL_INTERVAL_MS / 1000;
+    timerfd_settime(timer_fd_, 0, &its, nullptr);
+
+    timer_ctx_ = std::make_unique<SocketCtx>(timer_fd_, [this](uint32_t event)
+                                             { handle_timer(event); });
+    loop_->set(timer_ctx_.get(), timer_fd_, EPOLLIN);
+}
+
+UpstreamConnPool::Lease UpstreamConnPool::acquire(const std::string &ip, uint16_t port, const std::string &iface, bool allow_reused)
+{
+    Lease lease;
+    if (!loop_ || ServerConfig::getUpstreamPoolSize() <= 0)
+        return lease;
+
+    std::string k = key(ip, port, iface);
+    Upstream &upstream = upstreams_[k];
+    if (upstream.ip.empty())
+    {
+        upstream.ip = ip;
+        upstream.port = port;
+        upstream.iface = iface;
+    }
+    upstream.last_used = Clock::now();
+
+    // Prefer established connections over ones still connecting, newest first.
+    int best = -1;
+    for (auto &[fd, conn] : conns_)
+    {
+        if (conn.key != k || conn.state == State::DRAINING || (conn.reused && !allow_reused))
+            continue;
+        if (conn.state == State::IDLE)
+        {
+            // The server may have closed it since the last epoll round.
+            char probe;
+            ssize_t n = recv(fd, &probe, 1, MSG_PEEK | MSG_DONTWAIT);
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+                continue;
+        }
+        if (best < 0 || (conn.state == State::IDLE && conns_[best].state != State::IDLE) ||
+            (conn.state == conns_[best].state && conn.since > conns_[best].since))
+            best = fd;
+    }
+
+    if (best < 0)
+    {
+        ++upstream.misses;
+        refill(k, upstream);
+        return lease;
+    }
+
+    Conn &conn = conns_[best];
+    lease.fd = best;
+    lease.cseq = conn.cseq;
+    lease.reused = conn.reused;
+    ++upstream.hits;
+
+    // Events already fetched for this fd in the current batch find no entry and are ignored.
+    loop_->remove(best);
+    loop_->defer_delete(std::move(conn.ctx));
+    conns_.erase(best);
+
+    Logger::debug("[POOL] Reusing " + std::string(lease.reused ? "recycled" : "pre-connected") + " connection to " + k);
+    refill(k, upstream);
+    return lease;
+}
+
+bool UpstreamConnPool::recycle(int fd, const std::string &ip, uint16_t port, const std::string &iface,
+                               const std::string &teardown, int next_cseq)
+{
+    if (!loop_ || ServerConfig::getUpstreamPoolSize() <= 0 || fd < 0)
+        return false;
+
+    ssize_t n = send(fd, teardown.data(), teardown.size(), MSG_NOSIGNAL);
+    if (n != static_cast<ssize_t>(teardown.size()))
+        return false;
+
+    std::string k = key(ip, port, iface);
+    Conn &conn = conns_[fd];
+    conn.key = k;
+    conn.state = State::DRAINING;
+    conn.since = Clock::now();
+    conn.cseq = next_cseq;
+    conn.reused = true;
+    conn.buf.clear();
+    conn.ctx = std::make_unique<SocketCtx>(fd, [this, fd](uint32_t event)
+                                           { handle_conn(fd, event); });
+    loop_->set(conn.ctx.get(), fd, EPOLLIN | EPOLLRDHUP);
+    return true;
+}
+
+void UpstreamConnPool::handle_conn(int fd, uint32_t event)
+{
+    auto it = conns_.find(fd);
+    if (it == conns_.end())
+        return;
+    Conn &conn = it->second;
+
+    // A refused connect usually reports EPOLLERR|EPOLLHUP together with EPOLLOUT.
+    bool failed = event & (EPOLLERR | EPOLLHUP | EPOLLRDHUP);
+    if (!failed && conn.state == State::CONNECTING && (event & EPOLLOUT))
+    {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        failed = getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0;
+    }
+
+    if (failed)
+    {
+        if (conn.state == State::CONNECTING)
+        {
+            auto up = upstreams_.find(conn.key);
+            if (up != upstreams_.end())
+                up->second.retry_after = Clock::now() + CONNECT_BACKOFF;
+        }
+        drop(fd);
+        return;
+    }
+
+    if (conn.state == State::CONNECTING && (event & EPOLLOUT))
+    {
+        conn.state = State::IDLE;
+        conn.since = Clock::now();
+        loop_->set(conn.ctx.get(), fd, EPOLLIN | EPOLLRDHUP);
+        return;
+    }
+
+    if (event & EPOLLIN)
+    {
+        char buf[1024];
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0 || conn.state != State::DRAINING)
+        {
+            // An idle control connection has nothing to say; anything but EAGAIN ends it.
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return;
+            drop(fd);
+            return;
+        }
+
+        conn.buf.append(buf, n);
+        RtspMessage msg;
+        RtspMessage::Result result = msg.parse(conn.buf);
+        if (result == RtspMessage::Result::INCOMPLETE)
+        {
+            if (conn.buf.size() > 4096)
+                drop(fd);
+            return;
+        }
+
+        std::string connection(msg.header("Connection"));
+        std::transform(connection.begin(), connection.end(), connection.begin(), ::tolower);
+        if (result == RtspMessage::Result::ERROR || msg.status_code() != 200 ||
+            connection.find("close") != std::string::npos || conn.buf.size() != msg.length())
+        {
+            drop(fd);
+            return;
+        }
+
+        conn.buf.clear();
+        conn.state = State::IDLE;
+        conn.since = Clock::now();
+        auto up = upstreams_.find(conn.key);
+        if (up != upstreams_.end())
+        {
+            ++up->second.reuses;
+            // Over capacity: the recycled connection replaces the oldest idle one.
+            if (pooled(conn.key) > static_cast<size_t>(ServerConfig::getUpstreamPoolSize()))
+            {
+                int oldest = -1;
+                for (const auto &[other_fd, other] : conns_)
+                {
+                    if (other.key == conn.key && other_fd != fd && other.state != State::DRAINING &&
+                        (oldest < 0 || other.since < conns_[oldest].since))
+                        oldest = other_fd;
+                }
+                if (oldest >= 0)
+                    drop(oldest);
+            }
+        }
+        Logger::debug("[POOL] Upstream kept the connection after TEARDOWN: " + conn.key);
+    }
+}
+
+void UpstreamConnPool::handle_timer(uint32_t event)
+{
+    if (!(event & EPOLLIN))
+        return;
+
+    uint64_t expirations;
+    read(timer_fd_, &expirations, sizeof(expirations));
+
+    auto now = Clock::now();
+    std::vector<int> stale;
+    for (const auto &[fd, conn] : conns_)
+    {
+        auto age = now - conn.since;
+        if ((conn.state == State::DRAINING && age >= DRAIN_TIMEOUT) ||
+            (conn.state != State::DRAINING && age >= IDLE_TIMEOUT))
+            stale.push_back(fd);
+    }
+    for (int fd : stale)
+        drop(fd);
+
+    for (auto it = upstreams_.begin(); it != upstreams_.end();)
+    {
+        if (now - it->second.last_used >= KEEP_WARM)
+        {
+            std::vector<int> fds;
+            for (const auto &[fd, conn] : conns_)
+                if (conn.key == it->first) fds.push_back(fd);
+            for (int fd : fds)
+                drop(fd);
+            it = upstreams_.erase(it);
+            continue;
+        }
+        refill(it->first, it->second);
+        ++it;
+    }
+}
+
+size_t UpstreamConnPool::pooled(const std::string &key) const
+{
+    return std::count_if(conns_.begin(), conns_.end(), [&key](const std::pair<const int, Conn> &c)
+                         { return c.second.key == key && c.second.state != State::DRAINING; });
+}
+
+void UpstreamConnPool::refill(const std::string &key, Upstream &upstream)
+{
+    if (Clock::now() < upstream.retry_after)
+        return;
+    size_t want = static_cast<size_t>(ServerConfig::getUpstreamPoolSize());
+    for (size_t have = pooled(key); have < want; ++have)
+        open_conn(key, upstream);
+}
+
+void UpstreamConnPool::open_conn(const std::string &key, Upstream &upstream)
+{
+    int fd = create_nonblocking_tcp(upstream.ip, upstream.port, upstream.iface);
+    if (fd < 0)
+    {
+        upstream.retry_after = Clock::now() + CONNECT_BACKOFF;
+        return;
+    }
+
+    Conn &conn = conns_[fd];
+    conn.key = key;
+    conn.state = State::CONNECTING;
+    conn.since = Clock::now();
+    conn.ctx = std::make_unique<SocketCtx>(fd, [this, fd](uint32_t event)
+                                           { handle_conn(fd, event); });
+    loop_->set(conn.ctx.get(), fd, EPOLLOUT | EPOLLRDHUP);
+}
+
+void UpstreamConnPool::drop(int fd)
+{
+    auto it = conns_.find(fd);
+    if (it == conns_.end())
+        return;
+    loop_->remove(fd);
+    loop_->defer_delete(std::move(it->second.ctx));
+    close(fd);
+    conns_.erase(it);
+}
+
+nlohmann::json UpstreamConnPool::get_info() const
+{
+    nlohmann::json info = nlohmann::json::array();
+    for (const auto &[k, upstream] : upstreams_)
+    {
+        size_t idle = 0, connecting = 0;
+        for (const auto &[fd, conn] : conns_)
+        {
+            if (conn.key != k) continue;
+            if (conn.state == State::IDLE) ++idle;
+            else if (conn.state == State::CONNECTING) ++connecting;
+        }
+        info.push_back({{"upstream", k},
+                        {"idle", idle},
+                        {"connecting", connecting},
+                        {"hits", upstream.hits},
+                        {"misses", upstream.misses},
+                        {"reuses", upstream.reuses}});
+    }
+    return info;
+}
@@ -0,0 +1,178 @@
+#include "core/upstream_selector.h"
+#include "core/logger.h"
+#include <algorithm>
+#include <limits>
+
+UpstreamSelector &UpstreamSelector::getInstance()
+{
+    static UpstreamSelector instance;
+    return instance;
+}
+
+std::string UpstreamSelector::key(const rtspCtx &ctx)
+{
+    return ctx.server_ip + ":" + std::to_string(ctx.server_rtsp_port);
+}
+
+bool UpstreamSelector::parse_host(const std::string &entry, Host &host)
+{
+    size_t colon = entry.rfind(':');
+    host.ip = entry.substr(0, colon);
+    if (host.ip.empty())
+        return false;
+
+    unsigned long port = 554;
+    if (colon != std::string::npos)
+    {
+        std::string digits = entry.substr(colon + 1);
+        if (digits.empty() || digits.size() > 5 || digits.find_first_not_of("0123456789") != std::string::npos)
+            return false;
+        port = std::stoul(digits);
+    }
+    if (port == 0 || port > 65535)
+        return false;
+    host.port = static_cast<uint16_t>(port);
+    host.key = host.ip + ":" + std::to_string(host.port);
+    return true;
+}
+
+void UpstreamSelector::load(const nlohmann::json &groups)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    groups_.clear();
+    group_of_.clear();
+
+    if (!groups.is_array())
+        return;
+
+    for (const auto &item : groups)
+    {
+        if (!item.is_object() || !item.contains("hosts") || !item["hosts"].is_array())
+            continue;
+
+        Group group;
+        group.name = item.value("name", "group" + std::to_string(groups_.size()));
+        for (const auto &h : item["hosts"])
+        {
+            if (!h.is_string())
+                continue;
+            Host host;
+            if (!parse_host(h.get<std::string>(), host))
+            {
+                Logger::warn("[CONFIG] Invalid upstream host '" + h.get<std::string>() + "' in group " + group.name + ", skipped");
+                continue;
+            }
+            if (group_of_.count(host.key))
+            {
+                Logger::warn("[CONFIG] Upstream " + host.key + " is listed in more than one group, keeping the first");
+                continue;
+            }
+            group_of_[host.key] = groups_.size();
+            group.hosts.push_back(std::move(host));
+        }
+        if (group.hosts.size() > 1)
+            Logger::info("[CONFIG] Upstream group " + group.name + ": " + std::to_string(group.hosts.size()) + " hosts");
+        groups_.push_back(std::move(group));
+    }
+}
+
+bool UpstreamSelector::is_healthy(const HostStats &stats, Clock::time_point now) const
+{
+    return stats.consecutive_failures < UNHEALTHY_FAILURES || now - stats.last_failure >= COOLDOWN;
+}
+
+double UpstreamSelector::score(const HostStats &stats) const
+{
+    // Untried hosts score 0 and are probed first; hosts that never succeeded go last.
+    if (stats.successes == 0)
+        return stats.failures == 0 ? 0.0 : std::numeric_limits<double>::max();
+    return (stats.connect_ms + stats.handshake_ms) * (1.0 + 4.0 * stats.failure_rate);
+}
+
+std::vector<rtspCtx> UpstreamSelector::candidates(const rtspCtx &ctx)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = group_of_.find(key(ctx));
+    if (it == group_of_.end())
+        return {ctx};
+
+    auto now = Clock::now();
+    std::vector<Host> hosts = groups_[it->second].hosts;
+    std::stable_sort(hosts.begin(), hosts.end(), [&](const Host &a, const Host &b)
+                     {
+                         const HostStats &sa = hosts_[a.key];
+                         const HostStats &sb = hosts_[b.key];
+                         bool ha = is_healthy(sa, now), hb = is_healthy(sb, now);
+                         if (ha != hb) return ha;
+                         return score(sa) < score(sb); });
+
+    std::vector<rtspCtx> result;
+    result.reserve(hosts.size());
+    for (const auto &host : hosts)
+    {
+        rtspCtx c = ctx;
+        c.server_ip = host.ip;
+        c.server_rtsp_port = host.port;
+        c.rtsp_url = "rtsp://" + host.key + ctx.path;
+        result.push_back(std::move(c));
+    }
+    return result;
+}
+
+void UpstreamSelector::report_success(const rtspCtx &ctx, double connect_ms, double handshake_ms)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!group_of_.count(key(ctx)))
+        return;
+
+    HostStats &stats = hosts_[key(ctx)];
+    bool first = stats.successes == 0;
+    ++stats.successes;
+    stats.consecutive_failures = 0;
+    stats.failure_rate *= 1.0 - EWMA_ALPHA;
+    if (connect_ms >= 0)
+        stats.connect_ms = first ? connect_ms : stats.connect_ms + EWMA_ALPHA * (connect_ms - stats.connect_ms);
+    if (handshake_ms >= 0)
+        stats.handshake_ms = first ? handshake_ms : stats.handshake_ms + EWMA_ALPHA * (handshake_ms - stats.handshake_ms);
+}
+
+void UpstreamSelector::report_failure(const rtspCtx &ctx)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!group_of_.count(key(ctx)))
+        return;
+
+    HostStats &stats = hosts_[key(ctx)];
+    ++stats.failures;
+    ++stats.consecutive_failures;
+    stats.failure_rate += EWMA_ALPHA * (1.0 - stats.failure_rate);
+    stats.last_failure = Clock::now();
+    if (stats.consecutive_failures == UNHEALTHY_FAILURES)
+        Logger::warn("[RTSP] Upstream " + key(ctx) + " marked unhealthy for " + std::to_string(COOLDOWN.count()) + "s");
+}
+
+nlohmann::json UpstreamSelector::get_info()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto now = Clock::now();
+
+    nlohmann::json info = nlohmann::json::array();
+    for (const auto &group : groups_)
+    {
+        nlohmann::json hosts = nlohmann::json::array();
+        for (const auto &host : group.hosts)
+        {
+            const HostStats &stats = hosts_[host.key];
+            hosts.push_back({{"host", host.key},
+                             {"healthy", is_healthy(stats, now)},
+                             {"successes", stats.successes},
+                             {"failures", stats.failures},
+                             {"connect_ms", stats.connect_ms},
+                             {"handshake_ms", stats.handshake_ms},
+                             {"failure_rate", stats.failure_rate}});
+        }
+        info.push_back({{"name", group.name}, {"hosts", std::move(hosts)}});
+    }
+    return info;
+}
@@ -1,15 +1,47 @@
 #include "handlers/api_handle.h"
 #include "core/statistics.h"
+#include "core/upstream_selector.h"
+#include "core/upstream_conn_pool.h"
+#include "core/shared_rtp_socket.h"
+#include "core/multicast_hub.h"
+#include "core/port_pool.h"
+#include "clients/multicast_publisher.h"
+#include "clients/hls_output.h"
 #include "core/logger.h"
 #include "3rd/json.hpp"
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <fstream>
 #include <sstream>
+#include <algorithm>
 
 using json = nlohmann::json;
 
-bool ApiHandle::dispatch(int client_fd, const RequestInfo &info, EpollLoop *loop, BufferPool &pool)
+namespace
+{
+    // Decodes %XX escapes, e.g. in an upstream URL passed as a query parameter.
+    std::string percent_decode(std::string_view value)
+    {
+        std::string out;
+        out.reserve(value.size());
+        for (size_t i = 0; i < value.size(); ++i)
+        {
+            if (value[i] == '%' && i + 2 < value.size() && isxdigit(value[i + 1]) && isxdigit(value[i + 2]))
+            {
+                out += static_cast<char>(std::stoi(std::string(value.substr(i + 1, 2)), nullptr, 16));
+                i += 2;
+            }
+            else
+            {
+                out += value[i] == '+' ? ' ' : value[i];
+            }
+        }
+        return out;
+    }
+}
+
+bool ApiHandle::dispatch(int client_fd, const RequestInfo &info, EpollLoop *loop, BufferPool &pool, bool &keep_alive)
 {
     const std::string &path = info.clean_uri;
 
@@ -29,15 +61,14 @@ bool ApiHandle::dispatch(int client_fd, const RequestInfo &info, EpollLoop *loop
     {
         Logger::debug("[SERVER] Unauthorized admin access: " + path);
         send_unauthorized(client_fd);
+        keep_alive = false;
         return true;
     }
 
     // 3. Handle specific routes
     if (is_favicon)
     {
-        std::string resp = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
-        send(client_fd, resp.c_str(), resp.size(), 0);
-        close(client_fd);
+        send_response(client_fd, "404 Not Found", "", "", keep_alive);
         return true;
     }
 
@@ -51,7 +82,18 @@ bool ApiHandle::dispatch(int client_fd, const RequestInfo &info, EpollLoop *loop
             status["pool"]["used"] = pool.get_total_allocated() - pool.get_available_count();
             status["pool"]["peak"] = pool.get_peak_used();
             status["pool"]["buffer_size"] = pool.get_buffer_size();
-            status["pool"]["total_bytes"] = pool.get_total_allocated() * pool.get_buffer_size();
+            status["pool"]["total_bytes"] = pool.get_total_bytes();
+            status["pool"]["classes"] = json::array();
+            for (const auto &cls : pool.get_class_stats())
+            {
+                status["pool"]["classes"].push_back({{"buffer_size", cls.block_size},
+                                                     {"available", cls.available},
+                                                     {"allocated", cls.allocated},
+                                                     {"used", cls.allocated - cls.available},
+                                                     {"peak", cls.peak_used},
+                                                     {"max_idle", cls.max_idle},
+                                                     {"freed", cls.freed}});
+            }
             
             auto& stats = Statistics::getInstance();
             stats.setActiveClients(loop->get_client_count());
@@ -62,43 +104,51 @@ bool ApiHandle::dispatch(int client_fd, const RequestInfo &info, EpollLoop *loop
             status["stats"]["down_bandwidth"] = (uint64_t)stats.getDownstreamBandwidth();
             status["stats"]["active_clients"] = stats.getActiveClients();
             status["clients"] = loop->get_all_clients_info();
+            status["upstream_groups"] = UpstreamSelector::getInstance().get_info();
+            status["upstream_pool"] = UpstreamConnPool::getInstance().get_info();
+            status["port_pool"] = PortPool::getInstance().get_info();
+            if (SharedRtpSocket::getInstance().enabled())
+                status["shared_rtp"] = SharedRtpSocket::getInstance().get_info();
+            status["multicast"] = MulticastHub::getInstance().get_info();
+            status["publish"] = MulticastPublisher::getInstance().get_info();
+            status["hls"] = HlsOutput::getInstance().get_info();
             
-            send_json_response(client_fd, status);
+            send_json_response(client_fd, status, keep_alive);
             return true;
         }
         
+        if (path.find("/api/publish") == 0)
+        {
+            handle_publish(client_fd, info, keep_alive);
+            return true;
+        }
+
         if (path.find("/api/logs") == 0)
         {
             json response;
             response["logs"] = Logger::getRecentLogs();
             response["level"] = (int)Logger::getLogLevel();
-            send_json_response(client_fd, response);
+            send_json_response(client_fd, response, keep_alive);
             return true;
         }
     }
 
     if (is_admin)
     {
-        serve_admin_file(client_fd, info);
+        serve_admin_file(client_fd, info, keep_alive);
         return true;
     }
 
     return false;
 }
 
-void ApiHandle::serve_admin_file(int client_fd, const RequestInfo &info)
+void ApiHandle::serve_admin_file(int client_fd, const RequestInfo &info, bool &keep_alive)
 {
     std::string clean_path = info.clean_uri;
 
     if (clean_path == "/admin")
     {
-        std::string response = "HTTP/1.1 301 Moved Permanently\r\n"
-                               "Location: /admin/\r\n"
-                               "Content-Length: 0\r\n"
-                               "Connection: close\r\n"
-                               "\r\n";
-        send(client_fd, response.c_str(), response.size(), 0);
-        close(client_fd);
+        send_response(client_fd, "301 Moved Permanently", "Location: /admin/\r\n", "", keep_alive);
         return;
     }
 
@@ -113,9 +163,7 @@ void ApiHandle::serve_admin_file(int client_fd, const RequestInfo &info)
     if (!ifs.is_open())
     {
         Logger::error("[SERVER] Admin file not found: " + local_path);
-        std::string response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
-        send(client_fd, response.c_str(), response.size(), 0);
-        close(client_fd);
+        send_response(client_fd, "404 Not Found", "", "", keep_alive);
         return;
     }
     
@@ -123,28 +171,78 @@ void ApiHandle::serve_admin_file(int client_fd, const RequestInfo &info)
     ss << ifs.rdbuf();
     std::string content = ss.str();
     
-    std::string header = "HTTP/1.1 200 OK\r\n"
-                         "Content-Type: " + get_mime_type(local_path) + "\r\n"
-                         "Content-Length: " + std::to_string(content.size()) + "\r\n"
-                         "Connection: close\r\n"
-                         "\r\n";
-    send(client_fd, header.c_str(), header.size(), 0);
-    send(client_fd, content.c_str(), content.size(), 0);
-    close(client_fd);
+    send_response(client_fd, "200 OK", "Content-Type: " + get_mime_type(local_path) + "\r\n", content, keep_alive);
 }
 
-void ApiHandle::send_json_response(int client_fd, const json &j)
+void ApiHandle::handle_publish(int client_fd, const RequestInfo &info, bool &keep_alive)
 {
-    std::string body = j.dump();
-    std::string header = "HTTP/1.1 200 OK\r\n"
-                         "Content-Type: application/json\r\n"
-                         "Content-Length: " + std::to_string(body.size()) + "\r\n"
-                         "Access-Control-Allow-Origin: *\r\n"
-                         "Connection: close\r\n"
-                         "\r\n";
-    send(client_fd, header.c_str(), header.size(), 0);
-    send(client_fd, body.c_str(), body.size(), 0);
-    close(client_fd);
+    auto &publisher = MulticastPublisher::getInstance();
+    const std::string &path = info.clean_uri;
+    std::string error;
+    bool ok = true;
+
+    if (path.find("/api/publish/start") == 0)
+    {
+        json spec_json;
+        for (const char *key : {"name", "url", "group", "ttl", "format", "start", "stop"})
+        {
+            if (info.has_param(key))
+                spec_json[key] = percent_decode(info.param(key));
+        }
+        MulticastPublisher::Spec spec;
+        ok = MulticastPublisher::parse_spec(spec_json, spec, error) && publisher.publish(spec, error);
+    }
+    else if (path.find("/api/publish/stop") == 0)
+    {
+        std::string at = percent_decode(info.param("at"));
+        if (at.size() > 18 || !std::all_of(at.begin(), at.end(), ::isdigit))
+        {
+            error = "at must be a Unix time";
+            ok = false;
+        }
+        else
+        {
+            ok = publisher.stop(percent_decode(info.param("name")), at.empty() ? 0 : std::stoll(at), error);
+        }
+    }
+
+    if (!ok)
+    {
+        send_response(client_fd, "400 Bad Request",
+                      "Content-Type: application/json\r\n"
+                      "Access-Control-Allow-Origin: *\r\n",
+                      json{{"error", error}}.dump(), keep_alive);
+        return;
+    }
+
+    json response;
+    response["outputs"] = publisher.get_info();
+    send_json_response(client_fd, response, keep_alive);
+}
+
+void ApiHandle::send_json_response(int client_fd, const json &j, bool &keep_alive)
+{
+    send_response(client_fd, "200 OK",
+                  "Content-Type: application/json\r\n"
+                  "Access-Control-Allow-Origin: *\r\n",
+                  j.dump(), keep_alive);
+}
+
+void ApiHandle::send_response(int client_fd, const char *status, const std::string &headers,
+                              const std::string &body, bool &keep_alive)
+{
+    std::string head = std::string("HTTP/1.1 ") + status + "\r\n" + headers +
+                       "Content-Length: " + std::to_string(body.size()) + "\r\n" +
+                       (keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n") +
+                       "\r\n";
+
+    // Header and body leave in one call. A response that does not fit into
+    // the socket buffer is truncated, so the connection cannot be reused.
+    iovec iov[2] = {{const_cast<char *>(head.data()), head.size()},
+                    {const_cast<char *>(body.data()), body.size()}};
+    ssize_t n = writev(client_fd, iov, body.empty() ? 1 : 2);
+    if (n < 0 || static_cast<size_t>(n) != head.size() + body.size())
+        keep_alive = false;
 }
 
 void ApiHandle::send_unauthorized(int client_fd)
@@ -160,7 +258,6 @@ void ApiHandle::send_unauthorized(int client_fd)
                            "<p>Usage: <code>/admin/?token=YOUR_TOKEN</code></p>"
                            "</body></html>";
     send(client_fd, response.c_str(), response.size(), 0);
-    close(client_fd);
 }
 
 std::string ApiHandle::get_mime_type(const std::string &path)
@@ -0,0 +1,153 @@
+#include "handlers/hls_handle.h"
+#include "clients/hls_output.h"
+#include "core/logger.h"
+#include "protocol/rtsp_parser.h"
+#include "protocol/pipeline_profile.h"
+#include "utils/blacklist_checker.h"
+#include "utils/url_rewriter.h"
+#include <sys/socket.h>
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+namespace
+{
+    bool to_number(std::string_view s, uint64_t &value)
+    {
+        if (s.empty() || s.size() > 19 || !std::all_of(s.begin(), s.end(), ::isdigit))
+            return false;
+        value = std::stoull(std::string(s));
+        return true;
+    }
+
+    bool ends_with(const std::string &s, const char *suffix, std::string_view &stem)
+    {
+        size_t n = strlen(suffix);
+        if (s.size() <= n || s.compare(s.size() - n, n, suffix) != 0)
+            return false;
+        stem = std::string_view(s.data(), s.size() - n);
+        return true;
+    }
+
+    // index.m3u8 / cmaf.m3u8, <seq>.ts / <seq>.m4s, <seq>.<part>.ts / .m4s,
+    // init-<id>.mp4 or live.mp4
+    bool parse_file(const std::string &file, const RequestInfo &info, HlsOutput::Request &req)
+    {
+        using Kind = HlsOutput::Request::Kind;
+        using Format = HlsSegmenter::Format;
+        uint64_t value = 0;
+        std::string_view name;
+
+        if (file == "index.m3u8" || file == "cmaf.m3u8")
+        {
+            req.kind = Kind::PLAYLIST;
+            req.format = file == "cmaf.m3u8" ? Format::FMP4 : Format::TS;
+            if (info.has_param("_HLS_msn"))
+            {
+                if (!to_number(info.param("_HLS_msn"), req.seq))
+                    return false;
+                req.block = true;
+                if (info.has_param("_HLS_part"))
+                {
+                    if (!to_number(info.param("_HLS_part"), value) || value > 10000)
+                        return false;
+                    req.part = static_cast<int>(value);
+                }
+            }
+            return true;
+        }
+
+        if (file == "live.mp4")
+        {
+            req.kind = Kind::STREAM;
+            req.format = Format::FMP4;
+            return true;
+        }
+
+        if (ends_with(file, ".mp4", name))
+        {
+            req.kind = Kind::INIT;
+            req.format = Format::FMP4;
+            return name.compare(0, 5, "init-") == 0 && to_number(name.substr(5), req.seq);
+        }
+
+        if (ends_with(file, ".ts", name))
+            req.format = Format::TS;
+        else if (ends_with(file, ".m4s", name))
+            req.format = Format::FMP4;
+        else
+            return false;
+        size_t dot = name.find('.');
+        if (!to_number(name.substr(0, dot), req.seq))
+            return false;
+        if (dot == std::string_view::npos)
+        {
+            req.kind = Kind::SEGMENT;
+            return true;
+        }
+        if (!to_number(name.substr(dot + 1), value) || value > 10000)
+            return false;
+        req.kind = Kind::PART;
+        req.part = static_cast<int>(value);
+        return true;
+    }
+}
+
+bool HlsHandle::dispatch(int client_fd, const sockaddr_in &client_addr, const RequestInfo &info,
+                         bool &keep_alive, bool &taken)
+{
+    taken = false;
+    if (!info.is_http || info.clean_uri.compare(0, 5, "/hls/") != 0)
+        return false;
+
+    // /hls/<channel path>/<file>
+    std::string path = info.clean_uri.substr(4, info.clean_uri.find('?') - 4);
+    size_t slash = path.rfind('/');
+    HlsOutput::Request req;
+    if (slash == 0 || !parse_file(path.substr(slash + 1), info, req))
+    {
+        send_error(client_fd, "404 Not Found", keep_alive);
+        return true;
+    }
+
+    HlsOutput::Source source;
+    source.key = path.substr(0, slash);
+    source.profile = PipelineProfiles::resolve(source.key, std::string(info.param("profile")));
+
+    if (info.multicast_port != 0)
+    {
+        source.multicast = true;
+        source.group = MulticastHub::Group{info.multicast_group, info.multicast_source, info.multicast_port, info.multicast_rtp};
+    }
+    else
+    {
+        std::string rtsp_url;
+        if (!URLRewriter::rewrite_path(source.key, rtsp_url) || rtspParser::parse_url(rtsp_url, source.ctx) != 0)
+        {
+            send_error(client_fd, "404 Not Found", keep_alive);
+            return true;
+        }
+        if (BlacklistChecker::is_blacklisted(source.ctx.server_ip) ||
+            BlacklistChecker::is_loopback(source.ctx.server_ip, source.ctx.server_rtsp_port, client_fd))
+        {
+            Logger::warn("[HLS] Refusing upstream " + source.ctx.server_ip + " for " + source.key);
+            send_error(client_fd, "403 Forbidden", keep_alive);
+            return true;
+        }
+    }
+
+    // URIs in the playlist are relative and would lose the token otherwise.
+    if (info.has_param("token"))
+        req.query = "?token=" + std::string(info.param("token"));
+
+    taken = HlsOutput::getInstance().serve(client_fd, client_addr, source, req, keep_alive);
+    return true;
+}
+
+void HlsHandle::send_error(int client_fd, const char *status, bool &keep_alive)
+{
+    std::string resp = std::string("HTTP/1.1 ") + status + "\r\nContent-Length: 0\r\n" +
+                       (keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n");
+    if (send(client_fd, resp.data(), resp.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(resp.size()))
+        keep_alive = false;
+}
@@ -1,67 +1,241 @@
 #include "handlers/master_handle.h"
 #include "handlers/api_handle.h"
+#include "handlers/hls_handle.h"
 #include "handlers/rtsp_to_http_handle.h"
 #include "handlers/rtsp_to_rtsp_handle.h"
 #include "core/epoll_loop.h"
 #include "core/logger.h"
+#include "common/socket_ctx.h"
 #include "protocol/request_parser.h"
 #include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <string>
+#include <vector>
 #include <unistd.h>
 #include <arpa/inet.h>
 
-void MasterHandle::handle(int client_fd, sockaddr_in client_addr, EpollLoop *loop, BufferPool &pool)
+MasterHandle &MasterHandle::getInstance()
+{
+    static MasterHandle instance;
+    return instance;
+}
+
+std::string MasterHandle::host_of(const sockaddr_in &addr)
+{
+    return std::string(inet_ntoa(addr.sin_addr)) + ":" + std::to_string(ntohs(addr.sin_port));
+}
+
+void MasterHandle::attach(EpollLoop *loop, BufferPool *pool)
+{
+    loop_ = loop;
+    pool_ = pool;
+
+    timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd_ < 0)
+    {
+        Logger::warn("[MASTER] Failed to create request timeout timer, idle connections are not reaped");
+        return;
+    }
+
+    itimerspec its{};
+    its.it_value.tv_sec = SWEEP_INTERVAL_MS / 1000;
+    its.it_interval.tv_sec = SWEEP_INTERVAL_MS / 1000;
+    timerfd_settime(timer_fd_, 0, &its, nullptr);
+
+    timer_ctx_ = std::make_unique<SocketCtx>(timer_fd_, [this](uint32_t event)
+                                             { handle_timer(event); });
+    loop_->set(timer_ctx_.get(), timer_fd_, EPOLLIN);
+}
+
+void MasterHandle::accept(int client_fd, const sockaddr_in &client_addr)
 {
     if (client_fd < 0) return;
 
-    char buf[4096];
-    ssize_t n = recv(client_fd, buf, sizeof(buf) - 1, 0);
-    
-    if (n <= 0) {
+    Conn &conn = conns_[client_fd];
+    conn = Conn();
+    conn.addr = client_addr;
+    conn.deadline = Clock::now() + REQUEST_TIMEOUT;
+
+    auto ctx = std::make_unique<SocketCtx>();
+    ctx->fd = client_fd;
+    ctx->handler = [this, client_fd](uint32_t event)
+    {
+        handle_conn(client_fd, event);
+    };
+    loop_->set(std::move(ctx), client_fd, EPOLLIN | EPOLLRDHUP);
+}
+
+void MasterHandle::handle_conn(int fd, uint32_t event)
+{
+    auto it = conns_.find(fd);
+    if (it == conns_.end()) return;
+    Conn &conn = it->second;
+
+    if (event & (EPOLLHUP | EPOLLERR))
+    {
+        close_conn(fd);
+        return;
+    }
+
+    // The common case is a whole request in one segment: parse it straight
+    // from the stack and only keep bytes across reads when it is split.
+    char stack_buf[MAX_REQUEST_BYTES];
+    ssize_t n = recv(fd, stack_buf, MAX_REQUEST_BYTES - conn.buf.size(), 0);
+    if (n <= 0)
+    {
         if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
-        close(client_fd);
+        close_conn(fd);
         return;
     }
 
-    buf[n] = 0;
-    std::string req(buf, n);
-    
-    // 1. Parse the first request to identify protocol, path, and auth.
-    auto info = RequestParser::parse(req);
-    std::string client_host = std::string(inet_ntoa(client_addr.sin_addr)) + ":" + std::to_string(ntohs(client_addr.sin_port));
+    std::string_view data(stack_buf, n);
+    if (!conn.buf.empty())
+    {
+        conn.buf.append(stack_buf, n);
+        data = conn.buf;
+    }
+
+    size_t consumed = 0;
+    while (consumed < data.size())
+    {
+        std::string_view rest = data.substr(consumed);
+        RtspMessage::Result result = conn.msg.parse(rest);
+        if (result == RtspMessage::Result::ERROR)
+        {
+            reject(fd, conn, "400 Bad Request");
+            return;
+        }
+        if (result == RtspMessage::Result::INCOMPLETE)
+        {
+            if (rest.size() >= MAX_REQUEST_BYTES)
+            {
+                reject(fd, conn, "431 Request Header Fields Too Large");
+                return;
+            }
+            break;
+        }
+
+        size_t length = conn.msg.length();
+        if (!dispatch(fd, conn, rest.substr(0, length), rest))
+            return; // handed off or closed; conn is gone
+        consumed += length;
+        conn.msg.reset();
+        conn.deadline = Clock::now() + REQUEST_TIMEOUT;
+    }
+
+    if (data.data() == stack_buf)
+        conn.buf.assign(data.substr(consumed));
+    else
+        conn.buf.erase(0, consumed);
+}
+
+bool MasterHandle::dispatch(int fd, Conn &conn, std::string_view request, std::string_view pending)
+{
+    // 1. Parse the request to identify protocol, path, and auth.
+    auto info = RequestParser::parse(request);
+
+    // 2. HTTP/1.1 keeps the connection unless told otherwise, HTTP/1.0 only on request.
+    bool keep_alive = false;
+    if (info.is_http)
+    {
+        std::string_view connection = conn.msg.header("Connection");
+        keep_alive = info.version == "HTTP/1.1" ? !RtspMessage::iequals(connection, "close")
+                                                : RtspMessage::iequals(connection, "keep-alive");
+
+        // A WebSocket upgrade of a stream URL gets the same TS in binary frames.
+        if (RtspMessage::iequals(conn.msg.header("Upgrade"), "websocket"))
+            info.websocket_key = std::string(conn.msg.header("Sec-WebSocket-Key"));
+    }
 
-    // 2. Common Authorization Check (except for Admin paths which may have their own logic)
-    // Actually, ApiHandle::dispatch handles its own auth for /api and /admin.
-    
     // 3. Dispatch to specific handles
-    
+
     // --- Case A: API / Admin / WebUI ---
-    if (ApiHandle::dispatch(client_fd, info, loop, pool)) {
-        return; 
+    if (ApiHandle::dispatch(fd, info, loop_, *pool_, keep_alive)) {
+        if (keep_alive) return true;
+        close_conn(fd);
+        return false;
     }
 
+    // Streaming sessions take the connection over from here.
+    sockaddr_in client_addr = conn.addr;
+
     // --- Common Auth Check for Streaming ---
     if (!info.is_authorized) {
-        Logger::warn("[MASTER] Unauthorized request from " + client_host + ": " + info.clean_uri);
-        std::string resp = info.is_http ? 
+        Logger::warn("[MASTER] Unauthorized request from " + host_of(client_addr) + ": " + info.clean_uri);
+        std::string resp = info.is_http ?
             "HTTP/1.1 401 Unauthorized\r\nContent-Length: 0\r\n\r\n" :
             "RTSP/1.0 401 Unauthorized\r\nCSeq: 1\r\nContent-Length: 0\r\n\r\n";
-        send(client_fd, resp.c_str(), resp.size(), 0);
-        close(client_fd);
-        return;
+        send(fd, resp.c_str(), resp.size(), 0);
+        close_conn(fd);
+        return false;
     }
 
-    // --- Case B: RTSP-to-HTTP Streaming ---
-    if (RtspToHttpHandle::dispatch(client_fd, client_addr, info, loop, pool)) {
-        return;
+    // --- Case B: HLS playlists and segments, served from memory ---
+    bool taken = false;
+    if (HlsHandle::dispatch(fd, client_addr, info, keep_alive, taken)) {
+        if (taken) {
+            conns_.erase(fd); // back through accept() once answered
+            return false;
+        }
+        if (keep_alive) return true;
+        close_conn(fd);
+        return false;
     }
 
-    // --- Case C: RTSP-to-RTSP Proxy ---
-    if (RtspToRtspHandle::dispatch(client_fd, client_addr, info, req, loop, pool)) {
-        return;
+    // The MITM relay forwards the first request, and anything pipelined after it, verbatim.
+    std::string raw_request(pending);
+    conns_.erase(fd);
+
+    // --- Case C: RTSP-to-HTTP Streaming ---
+    if (RtspToHttpHandle::dispatch(fd, client_addr, info, loop_, *pool_)) {
+        return false;
+    }
+
+    // --- Case D: RTSP-to-RTSP Proxy ---
+    if (RtspToRtspHandle::dispatch(fd, client_addr, info, raw_request, loop_, *pool_)) {
+        return false;
     }
 
     // --- No handler matched ---
-    Logger::error("[MASTER] No handler found for " + client_host + " request: " + info.clean_uri);
-    close(client_fd);
+    Logger::error("[MASTER] No handler found for " + host_of(client_addr) + " request: " + info.clean_uri);
+    loop_->remove(fd);
+    close(fd);
+    return false;
+}
+
+void MasterHandle::reject(int fd, const Conn &conn, const char *http_status)
+{
+    Logger::warn("[MASTER] Rejecting request from " + host_of(conn.addr) + ": " + http_status);
+    std::string resp = std::string("HTTP/1.1 ") + http_status + "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    send(fd, resp.c_str(), resp.size(), MSG_NOSIGNAL);
+    close_conn(fd);
+}
+
+void MasterHandle::close_conn(int fd)
+{
+    conns_.erase(fd);
+    loop_->remove(fd);
+    close(fd);
+}
+
+void MasterHandle::handle_timer(uint32_t event)
+{
+    [[maybe_unused]] uint32_t unused_events = event;
+    uint64_t expirations;
+    while (read(timer_fd_, &expirations, sizeof(expirations)) > 0)
+    {
+    }
+
+    auto now = Clock::now();
+    std::vector<int> expired;
+    for (const auto &entry : conns_)
+    {
+        if (now >= entry.second.deadline)
+            expired.push_back(entry.first);
+    }
+    for (int fd : expired)
+    {
+        Logger::debug("[MASTER] Closing idle connection from " + host_of(conns_[fd].addr));
+        close_conn(fd);
+    }
 }
@@ -1,17 +1,61 @@
 #include "handlers/rtsp_to_http_handle.h"
 #include "clients/rtsp_to_http_client.h"
 #include "core/logger.h"
+#include "core/server_config.h"
+#include "core/upstream_selector.h"
 #include "protocol/rtsp_parser.h"
+#include "protocol/pipeline_profile.h"
+#include "protocol/websocket.h"
 #include "utils/blacklist_checker.h"
 #include <arpa/inet.h>
+#include <sstream>
+
+namespace
+{
+    void start_session(int client_fd, const sockaddr_in &client_addr, RtspHttpConfig &config, const RequestInfo &info,
+                       EpollLoop *loop, BufferPool &pool, const std::string &client_host)
+    {
+        config.uri = info.clean_uri;
+        if (!info.websocket_key.empty())
+            config.websocket_accept = ws::accept_key(info.websocket_key);
+
+        auto client = std::make_unique<RTSPToHttpClient>(loop, pool, client_addr, client_fd, config);
+        loop->add_client_to_map(client_fd, std::move(client));
+
+        auto client_ptr = loop->get_client_from_map(client_fd);
+        if (client_ptr) {
+            client_ptr->set_on_closed_callback([client_fd, loop, client_host]() {
+                Logger::debug("[RTSP2HTTP] Client disconnected: " + client_host);
+                loop->add_task([client_fd, loop]() {
+                    loop->remove_client_from_map(client_fd);
+                });
+            });
+        }
+    }
+}
 
 bool RtspToHttpHandle::dispatch(int client_fd, const sockaddr_in &client_addr, const RequestInfo &info, EpollLoop *loop, BufferPool &pool)
 {
-    if (!info.is_http || info.upstream_url.empty()) {
+    if (!info.is_http) {
         return false;
     }
 
     std::string client_host = std::string(inet_ntoa(client_addr.sin_addr)) + ":" + std::to_string(ntohs(client_addr.sin_port));
+
+    // udpxy-style multicast: the group is joined once and shared by all of its viewers.
+    if (info.multicast_port != 0) {
+        RtspHttpConfig config;
+        config.multicast = true;
+        config.group = MulticastHub::Group{info.multicast_group, info.multicast_source, info.multicast_port, info.multicast_rtp};
+        config.profile = PipelineProfiles::resolve(info.clean_uri, std::string(info.param("profile")));
+        Logger::debug("[RTSP2HTTP] Dispatching multicast session: " + client_host + " -> " + config.group.to_string());
+        start_session(client_fd, client_addr, config, info, loop, pool, client_host);
+        return true;
+    }
+
+    if (info.upstream_url.empty()) {
+        return false;
+    }
     
     try {
         rtspCtx ctx;
@@ -29,18 +73,61 @@ bool RtspToHttpHandle::dispatch(int client_fd, const sockaddr_in &client_addr, c
 
         Logger::debug("[RTSP2HTTP] Dispatching session: " + client_host + " -> " + info.upstream_url);
         
-        auto client = std::make_unique<RTSPToHttpClient>(loop, pool, client_addr, client_fd, ctx);
-        loop->add_client_to_map(client_fd, std::move(client));
+        auto profile = PipelineProfiles::resolve(info.clean_uri, std::string(info.param("profile")));
 
-        auto client_ptr = loop->get_client_from_map(client_fd);
-        if (client_ptr) {
-            client_ptr->set_on_closed_callback([client_fd, loop, client_host]() {
-                Logger::debug("[RTSP2HTTP] Client disconnected: " + client_host);
-                loop->add_task([client_fd, loop]() {
-                    loop->remove_client_from_map(client_fd);
-                });
-            });
+        // Members of an upstream group are ranked; the best one serves, the rest become mirrors.
+        auto candidates = UpstreamSelector::getInstance().candidates(ctx);
+
+        RtspHttpConfig config;
+        config.ctx = candidates.front();
+        config.profile = profile;
+        config.mirrors.assign(candidates.begin() + 1, candidates.end());
+
+        // ?redundant=1 opens a second leg to the same upstream, ?redundant=host[:port] to a backup server.
+        std::string_view redundant = info.param("redundant");
+        if (!redundant.empty() && redundant != "0") {
+            std::string value(redundant);
+            if (value == "1" || value == "true") {
+                // Prefer the runner-up of the group so the legs take different paths.
+                config.redundant_ctx = candidates.size() > 1 ? candidates[1] : config.ctx;
+            } else {
+                std::string url = "rtsp://" + value;
+                if (value.find(':') == std::string::npos) url += ":" + std::to_string(ctx.server_rtsp_port);
+                url += ctx.path;
+                if (rtspParser::parse_url(url, config.redundant_ctx) != 0) {
+                    throw std::runtime_error("Failed to parse redundant upstream: " + value);
+                }
+                if (BlacklistChecker::is_blacklisted(config.redundant_ctx.server_ip)) {
+                    throw std::runtime_error("Upstream " + config.redundant_ctx.server_ip + " is blacklisted.");
+                }
+                if (BlacklistChecker::is_loopback(config.redundant_ctx.server_ip, config.redundant_ctx.server_rtsp_port, client_fd)) {
+                    throw std::runtime_error("Recursive connection detected.");
+                }
+            }
+            config.redundant = true;
+            config.redundant_iface = ServerConfig::getRedundantInterface();
+        }
+
+        // ?mirror=host[:port][,host...] lists fallback servers for reconnects, same path as the primary.
+        if (info.has_param("mirror")) {
+            std::stringstream ss{std::string(info.param("mirror"))};
+            std::string host;
+            while (std::getline(ss, host, ',')) {
+                if (host.empty()) continue;
+                rtspCtx mirror;
+                std::string url = "rtsp://" + host;
+                if (host.find(':') == std::string::npos) url += ":" + std::to_string(ctx.server_rtsp_port);
+                url += ctx.path;
+                if (rtspParser::parse_url(url, mirror) != 0 || BlacklistChecker::is_blacklisted(mirror.server_ip) ||
+                    BlacklistChecker::is_loopback(mirror.server_ip, mirror.server_rtsp_port, client_fd)) {
+                    Logger::warn("[RTSP2HTTP] Ignoring mirror " + host);
+                    continue;
+                }
+                config.mirrors.push_back(std::move(mirror));
+            }
         }
+
+        start_session(client_fd, client_addr, config, info, loop, pool, client_host);
         return true;
 
     } catch (const std::exception &e) {
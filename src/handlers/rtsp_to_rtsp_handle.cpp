@@ -29,7 +29,7 @@ bool RtspToRtspHandle::dispatch(int client_fd, const sockaddr_in &client_addr, c
 
         Logger::debug("[RTSP2RTSP] Dispatching session: " + client_host + " -> " + info.upstream_url);
         
-        auto config = RTSPToRtspClient::resolve_upstream(raw_request);
+        auto config = RTSPToRtspClient::resolve_upstream(info);
         auto client = std::make_unique<RTSPToRtspClient>(loop, pool, client_addr, client_fd, config, raw_request);
         loop->add_client_to_map(client_fd, std::move(client));
 
@@ -0,0 +1,1072 @@
+#include "protocol/fmp4_remuxer.h"
+#include "protocol/ts_utils.h"
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    constexpr uint64_t TIMESTAMP_WRAP = 1ULL << 33;
+    constexpr uint32_t SAMPLE_RATES[13] = {96000, 88200, 64000, 48000, 44100, 32000, 24000,
+                                           22050, 16000, 12000, 11025, 8000, 7350};
+
+    void put8(std::string &o, uint32_t v) { o.push_back(static_cast<char>(v & 0xFF)); }
+    void put16(std::string &o, uint32_t v) { put8(o, v >> 8); put8(o, v); }
+    void put24(std::string &o, uint32_t v) { put8(o, v >> 16); put16(o, v); }
+    void put32(std::string &o, uint32_t v) { put16(o, v >> 16); put16(o, v); }
+    void put64(std::string &o, uint64_t v) { put32(o, static_cast<uint32_t>(v >> 32)); put32(o, static_cast<uint32_t>(v)); }
+
+    void patch32(std::string &o, size_t at, uint32_t v)
+    {
+        o[at] = static_cast<char>(v >> 24);
+        o[at + 1] = static_cast<char>(v >> 16);
+        o[at + 2] = static_cast<char>(v >> 8);
+        o[at + 3] = static_cast<char>(v);
+    }
+
+    // Opens a box; end() fills in its size.
+    size_t box(std::string &o, const char *type)
+    {
+        size_t at = o.size();
+        put32(o, 0);
+        o.append(type, 4);
+        return at;
+    }
+
+    size_t full_box(std::string &o, const char *type, uint8_t version, uint32_t flags)
+    {
+        size_t at = box(o, type);
+        put32(o, (static_cast<uint32_t>(version) << 24) | flags);
+        return at;
+    }
+
+    void end(std::string &o, size_t at) { patch32(o, at, static_cast<uint32_t>(o.size() - at)); }
+
+    void matrix(std::string &o)
+    {
+        const uint32_t unity[9] = {0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000};
+        for (uint32_t v : unity)
+            put32(o, v);
+    }
+
+    uint64_t read_timestamp(const uint8_t *p)
+    {
+        return (static_cast<uint64_t>((p[0] >> 1) & 0x07) << 30) | (static_cast<uint64_t>(p[1]) << 22) |
+               (static_cast<uint64_t>(p[2] >> 1) << 15) | (static_cast<uint64_t>(p[3]) << 7) | (p[4] >> 1);
+    }
+
+    // a - b for 33-bit timestamps that may have wrapped.
+    int64_t ts_diff(uint64_t a, uint64_t b)
+    {
+        int64_t d = static_cast<int64_t>((a - b) & (TIMESTAMP_WRAP - 1));
+        return d >= static_cast<int64_t>(TIMESTAMP_WRAP / 2) ? d - static_cast<int64_t>(TIMESTAMP_WRAP) : d;
+    }
+
+    // First 00 00 01 (start) or 00 00 0x with x <= 1 (end of a NAL unit) at or after i; n if none.
+    size_t find_zeros(const uint8_t *p, size_t n, size_t i, bool start)
+    {
+        while (i + 3 <= n)
+        {
+            const uint8_t *z = static_cast<const uint8_t *>(memchr(p + i, 0, n - i - 2));
+            if (!z)
+                return n;
+            i = z - p;
+            if (p[i + 1] == 0 && (start ? p[i + 2] == 1 : p[i + 2] <= 1))
+                return i;
+            ++i;
+        }
+        return n;
+    }
+
+    // Next Annex B NAL unit at or after pos: its bytes are [begin, end).
+    bool next_nal(const uint8_t *p, size_t n, size_t &pos, size_t &begin, size_t &end)
+    {
+        while (true)
+        {
+            size_t i = find_zeros(p, n, pos, true);
+            if (i >= n)
+                return false;
+            begin = i + 3;
+            pos = find_zeros(p, n, begin, false);
+            end = pos;
+            while (end > begin && p[end - 1] == 0)
+                --end;
+            if (end > begin)
+                return true;
+        }
+    }
+
+    class BitReader
+    {
+    public:
+        BitReader(const uint8_t *data, size_t size) : data_(data), bits_(size * 8) {}
+
+        uint32_t bit()
+        {
+            if (pos_ >= bits_)
+            {
+                overrun_ = true;
+                return 0;
+            }
+            uint32_t b = (data_[pos_ >> 3] >> (7 - (pos_ & 7))) & 1;
+            ++pos_;
+            return b;
+        }
+
+        uint32_t read(int n)
+        {
+            uint32_t v = 0;
+            while (n-- > 0)
+                v = (v << 1) | bit();
+            return v;
+        }
+
+        void skip(size_t n)
+        {
+            pos_ += n;
+            if (pos_ > bits_)
+                overrun_ = true;
+        }
+
+        // Exp-Golomb
+        uint32_t ue()
+        {
+            int zeros = 0;
+            while (!bit())
+            {
+                if (overrun_ || ++zeros >= 32)
+                {
+                    overrun_ = true;
+                    return 0;
+                }
+            }
+            return ((1u << zeros) - 1) + read(zeros);
+        }
+
+        int32_t se()
+        {
+            uint32_t v = ue();
+            return (v & 1) ? static_cast<int32_t>((v + 1) / 2) : -static_cast<int32_t>(v / 2);
+        }
+
+        bool ok() const { return !overrun_; }
+
+    private:
+        const uint8_t *data_;
+        size_t bits_;
+        size_t pos_{0};
+        bool overrun_{false};
+    };
+
+    struct SpsInfo
+    {
+        uint32_t width{0};
+        uint32_t height{0};
+        uint32_t chroma_format{1};
+        uint32_t bit_depth_luma{8};
+        uint32_t bit_depth_chroma{8};
+        uint32_t sub_layers{1};
+        bool temporal_nesting{false};
+    };
+
+    // RBSP of a NAL unit without its 'header' bytes, emulation prevention removed.
+    void unescape(const uint8_t *nal, size_t len, size_t header, std::string &out)
+    {
+        out.clear();
+        int zeros = 0;
+        for (size_t i = header; i < len; ++i)
+        {
+            if (zeros >= 2 && nal[i] == 3)
+            {
+                zeros = 0;
+                continue;
+            }
+            out.push_back(static_cast<char>(nal[i]));
+            zeros = nal[i] == 0 ? zeros + 1 : 0;
+        }
+    }
+
+    bool parse_avc_sps(const std::string &rbsp, SpsInfo &info)
+    {
+        BitReader br(reinterpret_cast<const uint8_t *>(rbsp.data()), rbsp.size());
+        uint32_t profile = br.read(8);
+        br.skip(16); // constraint flags, level
+        br.ue();     // seq_parameter_set_id
+
+        bool separate_planes = false;
+        if (profile == 100 || profile == 110 || profile == 122 || profile == 244 || profile == 44 ||
+            profile == 83 || profile == 86 || profile == 118 || profile == 128 || profile == 138 ||
+            profile == 139 || profile == 134 || profile == 135)
+        {
+            info.chroma_format = br.ue();
+            if (info.chroma_format == 3)
+                separate_planes = br.bit();
+            info.bit_depth_luma = 8 + br.ue();
+            info.bit_depth_chroma = 8 + br.ue();
+            br.skip(1); // qpprime_y_zero_transform_bypass
+            if (br.bit())
+            {
+                for (int i = 0; i < (info.chroma_format != 3 ? 8 : 12); ++i)
+                {
+                    if (!br.bit())
+                        continue;
+                    int last = 8, next = 8;
+                    for (int j = 0; j < (i < 6 ? 16 : 64) && br.ok(); ++j)
+                    {
+                        if (next != 0)
+                            next = (last + br.se() + 256) % 256;
+                        if (next != 0)
+                            last = next;
+                    }
+                }
+            }
+        }
+
+        br.ue(); // log2_max_frame_num_minus4
+        uint32_t poc_type = br.ue();
+        if (poc_type == 0)
+            br.ue();
+        else if (poc_type == 1)
+        {
+            br.skip(1);
+            br.se();
+            br.se();
+            uint32_t cycle = br.ue();
+            for (uint32_t i = 0; i < cycle && i < 256; ++i)
+                br.se();
+        }
+        br.ue();    // max_num_ref_frames
+        br.skip(1); // gaps_in_frame_num_value_allowed
+        uint32_t width_mbs = br.ue() + 1;
+        uint32_t height_units = br.ue() + 1;
+        uint32_t frame_mbs_only = br.bit();
+        if (!frame_mbs_only)
+            br.skip(1);
+        br.skip(1); // direct_8x8_inference
+        uint32_t left = 0, right = 0, top = 0, bottom = 0;
+        if (br.bit())
+        {
+            left = br.ue();
+            right = br.ue();
+            top = br.ue();
+            bottom = br.ue();
+        }
+        if (!br.ok())
+            return false;
+
+        uint32_t crop_x = 1, crop_y = 2 - frame_mbs_only;
+        if (!separate_planes && info.chroma_format == 1)
+        {
+            crop_x = 2;
+            crop_y *= 2;
+        }
+        else if (!separate_planes && info.chroma_format == 2)
+            crop_x = 2;
+        int64_t width = static_cast<int64_t>(width_mbs) * 16 - crop_x * (left + right);
+        int64_t height = static_cast<int64_t>(2 - frame_mbs_only) * height_units * 16 - crop_y * (top + bottom);
+        if (width <= 0 || height <= 0 || width > 16384 || height > 16384)
+            return false;
+        info.width = static_cast<uint32_t>(width);
+        info.height = static_cast<uint32_t>(height);
+        return true;
+    }
+
+    bool parse_hevc_sps(const std::string &rbsp, SpsInfo &info)
+    {
+        BitReader br(reinterpret_cast<const uint8_t *>(rbsp.data()), rbsp.size());
+        br.skip(4); // sps_video_parameter_set_id
+        info.sub_layers = br.read(3) + 1;
+        info.temporal_nesting = br.bit();
+
+        // profile_tier_level: the general part, then what is present per sub-layer.
+        br.skip(96);
+        bool profile_present[8] = {}, level_present[8] = {};
+        for (uint32_t i = 0; i + 1 < info.sub_layers; ++i)
+        {
+            profile_present[i] = br.bit();
+            level_present[i] = br.bit();
+        }
+        if (info.sub_layers > 1)
+            br.skip(2 * (9 - info.sub_layers));
+        for (uint32_t i = 0; i + 1 < info.sub_layers; ++i)
+            br.skip((profile_present[i] ? 88 : 0) + (level_present[i] ? 8 : 0));
+
+        br.ue(); // sps_seq_parameter_set_id
+        info.chroma_format = br.ue();
+        if (info.chroma_format == 3)
+            br.skip(1);
+        uint32_t width = br.ue();
+        uint32_t height = br.ue();
+        uint32_t left = 0, right = 0, top = 0, bottom = 0;
+        if (br.bit())
+        {
+            left = br.ue();
+            right = br.ue();
+            top = br.ue();
+            bottom = br.ue();
+        }
+        info.bit_depth_luma = 8 + br.ue();
+        info.bit_depth_chroma = 8 + br.ue();
+        if (!br.ok() || rbsp.size() < 13)
+            return false;
+
+        uint32_t sub_width = (info.chroma_format == 1 || info.chroma_format == 2) ? 2 : 1;
+        uint32_t sub_height = info.chroma_format == 1 ? 2 : 1;
+        int64_t w = static_cast<int64_t>(width) - sub_width * (left + right);
+        int64_t h = static_cast<int64_t>(height) - sub_height * (top + bottom);
+        if (w <= 0 || h <= 0 || w > 16384 || h > 16384)
+            return false;
+        info.width = static_cast<uint32_t>(w);
+        info.height = static_cast<uint32_t>(h);
+        return true;
+    }
+
+    bool same(const std::string &have, const uint8_t *p, size_t len)
+    {
+        return have.size() == len && memcmp(have.data(), p, len) == 0;
+    }
+}
+
+Fmp4Remuxer::Fmp4Remuxer()
+{
+    video_.id = 1;
+    audio_.id = 2;
+}
+
+void Fmp4Remuxer::push(const uint8_t *ts)
+{
+    if (ts[0] != 0x47)
+        return;
+
+    uint16_t pid = ts::pid(ts);
+    if (pid == 0)
+    {
+        uint16_t pmt_pid = ts::pat_pmt_pid(ts);
+        if (pmt_pid != ts::NULL_PID)
+            pmt_pid_ = pmt_pid;
+        return;
+    }
+    if (pid == pmt_pid_)
+    {
+        on_pmt(ts);
+        return;
+    }
+
+    Track *t = pid == video_.pid ? &video_ : pid == audio_.pid ? &audio_ : nullptr;
+    if (!t || !ts::has_payload(ts))
+        return;
+    size_t off = ts::payload_offset(ts);
+    const uint8_t *payload = ts + off;
+    size_t len = ts::PACKET_SIZE - off;
+
+    if (ts::pusi(ts))
+    {
+        if (len < 9 || payload[0] != 0 || payload[1] != 0 || payload[2] != 1 || 9u + payload[8] > len)
+        {
+            t->in_pes = false;
+            t->pes.clear();
+            t->pes_read = 0;
+            return;
+        }
+        size_t header = 9 + payload[8];
+        bool has_pts = (payload[7] & 0x80) && header >= 14;
+        uint64_t pts = has_pts ? read_timestamp(payload + 9) : 0;
+        uint64_t dts = (payload[7] & 0xC0) == 0xC0 && header >= 19 ? read_timestamp(payload + 14) : pts;
+
+        if (t == &video_)
+        {
+            if (!has_pts)
+                pts = dts = (video_.dts + video_.last_duration) & (TIMESTAMP_WRAP - 1);
+            if (video_.in_pes)
+                complete_video(dts);
+            video_.pes.clear();
+            video_.pts = pts;
+            video_.dts = dts;
+            video_.random_access = ts::afc(ts) >= 2 && ts[4] > 0 && (ts[5] & 0x40);
+        }
+        else if (has_pts)
+        {
+            audio_.pts = pts;
+            audio_.pts_valid = true;
+        }
+        t->in_pes = true;
+        payload += header;
+        len -= header;
+    }
+    if (!t->in_pes || len == 0)
+        return;
+
+    if (t->pes.size() + len > MAX_PES_BYTES)
+    {
+        t->in_pes = false;
+        t->pes.clear();
+        t->pes_read = 0;
+        return;
+    }
+    t->pes.append(reinterpret_cast<const char *>(payload), len);
+    if (t == &audio_)
+        extract_audio();
+}
+
+void Fmp4Remuxer::reset()
+{
+    drop_tracks();
+    pmt_pid_ = NO_PID;
+    video_.pid = NO_PID;
+    audio_.pid = NO_PID;
+}
+
+void Fmp4Remuxer::on_pmt(const uint8_t *ts)
+{
+    uint16_t video = NO_PID, audio = NO_PID;
+    uint8_t video_type = 0;
+    if (!ts::pmt_streams(ts, [&](uint8_t type, uint16_t pid)
+                         {
+                             if (video == NO_PID && (type == 0x1B || type == 0x24))
+                             {
+                                 video = pid;
+                                 video_type = type;
+                             }
+                             else if (audio == NO_PID && type == 0x0F)
+                                 audio = pid; }))
+        return;
+    if (video == video_.pid && video_type == video_.stream_type && audio == audio_.pid)
+        return;
+
+    // Another program: its configuration is learnt from scratch.
+    drop_tracks();
+    video_.pid = video;
+    video_.stream_type = video_type;
+    video_.cur = Config{};
+    audio_.pid = audio;
+    audio_.stream_type = audio != NO_PID ? 0x0F : 0;
+    audio_.cur = Config{};
+}
+
+void Fmp4Remuxer::drop_tracks()
+{
+    for (Track *t : {&video_, &audio_})
+    {
+        t->pes.clear();
+        t->pes_read = 0;
+        t->in_pes = false;
+        t->pts_valid = false;
+        t->samples.clear();
+        t->data.clear();
+        t->boundary = 0;
+        t->queue_time = t->next_time;
+    }
+    ready_ = false;
+    pending_ = false;
+}
+
+void Fmp4Remuxer::complete_video(uint64_t next_dts)
+{
+    Track &t = video_;
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(t.pes.data());
+    size_t n = t.pes.size();
+    bool hevc = t.stream_type == 0x24;
+    bool sync = t.random_access;
+
+    // Parameter sets go to the sample entry, access unit delimiters nowhere.
+    const uint8_t *vps = nullptr, *sps = nullptr, *pps = nullptr;
+    size_t vps_len = 0, sps_len = 0, pps_len = 0;
+    size_t size = 0;
+    size_t pos = 0, begin = 0, end = 0;
+    while (next_nal(p, n, pos, begin, end))
+    {
+        const uint8_t *nal = p + begin;
+        size_t len = end - begin;
+        uint8_t type = hevc ? (nal[0] >> 1) & 0x3F : nal[0] & 0x1F;
+        if (hevc && type == 32)
+        {
+            vps = nal;
+            vps_len = len;
+        }
+        else if (hevc ? type == 33 : type == 7)
+        {
+            sps = nal;
+            sps_len = len;
+        }
+        else if (hevc ? type == 34 : type == 8)
+        {
+            pps = nal;
+            pps_len = len;
+        }
+        else if (hevc ? type != 35 : type != 9)
+        {
+            if (hevc ? (type >= 16 && type <= 21) : type == 5)
+                sync = true;
+            size += 4 + len;
+        }
+    }
+    if (vps || sps || pps)
+        update_video_config(vps, vps_len, sps, sps_len, pps, pps_len);
+
+    if (!ready_ && (!sync || !try_ready(t.dts)))
+        return;
+    if (size == 0)
+        return;
+
+    uint32_t duration = t.last_duration;
+    int64_t step = ts_diff(next_dts, t.dts);
+    if (step > 0 && step < MAX_STEP)
+        duration = t.last_duration = static_cast<uint32_t>(step);
+    else
+    {
+        // A jump: the next access unit carries on where this one ends.
+        origin_in_ = next_dts;
+        origin_out_ = static_cast<int64_t>(t.next_time + duration);
+    }
+    int64_t offset = std::clamp<int64_t>(ts_diff(t.pts, t.dts), -MAX_STEP, MAX_STEP);
+
+    size_t start = t.data.size();
+    pos = 0;
+    while (next_nal(p, n, pos, begin, end))
+    {
+        uint8_t type = hevc ? (p[begin] >> 1) & 0x3F : p[begin] & 0x1F;
+        if (hevc ? (type >= 32 && type <= 35) : (type >= 7 && type <= 9))
+            continue;
+        put32(t.data, static_cast<uint32_t>(end - begin));
+        t.data.append(reinterpret_cast<const char *>(p + begin), end - begin);
+    }
+    queue(t, Sample{static_cast<uint32_t>(t.data.size() - start), duration, static_cast<int32_t>(offset), sync});
+}
+
+void Fmp4Remuxer::update_video_config(const uint8_t *vps, size_t vps_len, const uint8_t *sps, size_t sps_len,
+                                      const uint8_t *pps, size_t pps_len)
+{
+    const Config &latest = pending_ ? video_.next : video_.cur;
+    if ((!vps || same(latest.vps, vps, vps_len)) && (!sps || same(latest.sps, sps, sps_len)) &&
+        (!pps || same(latest.pps, pps, pps_len)))
+        return;
+
+    bool hevc = video_.stream_type == 0x24;
+    SpsInfo info;
+    if (sps)
+    {
+        unescape(sps, sps_len, hevc ? 2 : 1, scratch_);
+        if (!(hevc ? parse_hevc_sps(scratch_, info) : parse_avc_sps(scratch_, info)))
+            return;
+    }
+
+    if (ready_ && !pending_)
+        begin_change();
+    Config &target = pending_ ? video_.next : video_.cur;
+    if (vps)
+        target.vps.assign(reinterpret_cast<const char *>(vps), vps_len);
+    if (pps)
+        target.pps.assign(reinterpret_cast<const char *>(pps), pps_len);
+    if (sps)
+    {
+        target.sps.assign(reinterpret_cast<const char *>(sps), sps_len);
+        target.width = static_cast<uint16_t>(info.width);
+        target.height = static_cast<uint16_t>(info.height);
+        target.chroma_format = static_cast<uint8_t>(info.chroma_format);
+        target.bit_depth_luma = static_cast<uint8_t>(info.bit_depth_luma);
+        target.bit_depth_chroma = static_cast<uint8_t>(info.bit_depth_chroma);
+        target.sub_layers = static_cast<uint8_t>(info.sub_layers);
+        target.temporal_nesting = info.temporal_nesting;
+        if (hevc)
+            memcpy(target.profile_tier_level, scratch_.data() + 1, sizeof(target.profile_tier_level));
+    }
+}
+
+void Fmp4Remuxer::extract_audio()
+{
+    Track &t = audio_;
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(t.pes.data());
+    size_t n = t.pes.size();
+
+    while (t.pes_read + 7 <= n)
+    {
+        const uint8_t *f = p + t.pes_read;
+        // ADTS sync word and layer 0
+        if (f[0] != 0xFF || (f[1] & 0xF6) != 0xF0)
+        {
+            ++t.pes_read;
+            continue;
+        }
+        size_t header = (f[1] & 0x01) ? 7 : 9;
+        size_t length = ((f[3] & 0x03) << 11) | (f[4] << 3) | (f[5] >> 5);
+        if (length <= header)
+        {
+            ++t.pes_read;
+            continue;
+        }
+        if (t.pes_read + length > n)
+            break;
+        on_audio_frame(f, header, length);
+        t.pes_read += length;
+    }
+
+    if (t.pes_read == n)
+    {
+        t.pes.clear();
+        t.pes_read = 0;
+    }
+    else if (t.pes_read >= 64 * 1024)
+    {
+        t.pes.erase(0, t.pes_read);
+        t.pes_read = 0;
+    }
+}
+
+void Fmp4Remuxer::on_audio_frame(const uint8_t *frame, size_t header, size_t length)
+{
+    Track &t = audio_;
+    uint8_t profile = frame[2] >> 6;
+    uint8_t rate_index = (frame[2] >> 2) & 0x0F;
+    uint8_t channels = ((frame[2] & 0x01) << 2) | (frame[3] >> 6);
+    if (rate_index >= 13)
+        return;
+
+    const Config &latest = pending_ ? t.next : t.cur;
+    if (latest.profile != profile || latest.sample_rate_index != rate_index || latest.channels != channels)
+    {
+        if (ready_ && !pending_)
+            begin_change();
+        Config &target = pending_ ? t.next : t.cur;
+        target.profile = profile;
+        target.sample_rate_index = rate_index;
+        target.channels = channels;
+        if (!ready_ && t.timescale != SAMPLE_RATES[rate_index])
+        {
+            // Keep the position on the timeline in the new unit.
+            t.next_time = t.next_time * SAMPLE_RATES[rate_index] / t.timescale;
+            t.queue_time = t.next_time;
+            t.timescale = SAMPLE_RATES[rate_index];
+        }
+    }
+
+    // Raw data blocks of 1024 samples each.
+    uint32_t duration = 1024 * ((frame[6] & 0x03) + 1);
+    if (!t.pts_valid)
+        return;
+    uint64_t pts = t.pts;
+    t.pts = (t.pts + static_cast<uint64_t>(duration) * HZ / SAMPLE_RATES[rate_index]) & (TIMESTAMP_WRAP - 1);
+
+    if (!ready_ && (video_.pid != NO_PID || !try_ready(pts)))
+        return;
+
+    int64_t mapped = map(pts);
+    if (mapped < 0)
+        return;
+    int64_t time = mapped * t.timescale / HZ;
+    if (!t.timed)
+    {
+        t.next_time = t.queue_time = static_cast<uint64_t>(time);
+        t.timed = true;
+    }
+    else
+    {
+        int64_t diff = time - static_cast<int64_t>(t.next_time);
+        int64_t tolerance = t.timescale / 10;
+        if (diff > MAX_STEP * t.timescale / HZ || diff < -MAX_STEP * static_cast<int64_t>(t.timescale) / HZ)
+        {
+            // A jump; with video it moves the timeline first.
+            if (video_.pid != NO_PID)
+                return;
+            origin_in_ = pts;
+            origin_out_ = static_cast<int64_t>(t.next_time * HZ / t.timescale);
+        }
+        else if (diff < -tolerance)
+            return; // would overlap what has been queued
+        else if (diff > tolerance)
+            t.next_time = static_cast<uint64_t>(time);
+    }
+
+    t.data.append(reinterpret_cast<const char *>(frame + header), length - header);
+    queue(t, Sample{static_cast<uint32_t>(length - header), duration, 0, true});
+}
+
+void Fmp4Remuxer::begin_change()
+{
+    pending_ = true;
+    for (Track *t : {&video_, &audio_})
+    {
+        t->next = t->cur;
+        t->boundary = t->samples.size();
+    }
+}
+
+void Fmp4Remuxer::apply_config()
+{
+    if (!pending_)
+        return;
+    pending_ = false;
+    std::swap(video_.cur, video_.next);
+    std::swap(audio_.cur, audio_.next);
+    if (audio_.pid != NO_PID && audio_.cur.sample_rate_index < 13 &&
+        audio_.timescale != SAMPLE_RATES[audio_.cur.sample_rate_index])
+    {
+        uint32_t rate = SAMPLE_RATES[audio_.cur.sample_rate_index];
+        audio_.next_time = audio_.next_time * rate / audio_.timescale;
+        audio_.queue_time = audio_.queue_time * rate / audio_.timescale;
+        audio_.timescale = rate;
+    }
+
+    build_init(scratch_);
+    if (scratch_ != init_)
+    {
+        init_.swap(scratch_);
+        ++version_;
+    }
+}
+
+bool Fmp4Remuxer::try_ready(uint64_t origin)
+{
+    bool video = video_.pid != NO_PID, audio = audio_.pid != NO_PID;
+    if (!video && !audio)
+        return false;
+    const Config &v = video_.cur;
+    if (video && (v.sps.empty() || v.pps.empty() || v.width == 0 || (video_.stream_type == 0x24 && v.vps.empty())))
+        return false;
+    if (audio && audio_.cur.sample_rate_index >= 13)
+        return false;
+
+    ready_ = true;
+    origin_in_ = origin;
+    origin_out_ = video ? static_cast<int64_t>(video_.next_time)
+                        : static_cast<int64_t>(audio_.next_time * HZ / audio_.timescale);
+
+    build_init(scratch_);
+    if (scratch_ != init_)
+    {
+        init_.swap(scratch_);
+        ++version_;
+    }
+    return true;
+}
+
+void Fmp4Remuxer::queue(Track &t, const Sample &sample)
+{
+    if (t.samples.empty())
+        t.queue_time = t.next_time;
+    t.samples.push_back(sample);
+    t.next_time += sample.duration;
+}
+
+int64_t Fmp4Remuxer::map(uint64_t ts) const
+{
+    return origin_out_ + ts_diff(ts, origin_in_);
+}
+
+bool Fmp4Remuxer::flush(std::string &out, bool &independent)
+{
+    Track *tracks[2] = {&video_, &audio_};
+    size_t counts[2] = {0, 0};
+    size_t bytes[2] = {0, 0};
+    for (int i = 0; i < 2; ++i)
+    {
+        Track &t = *tracks[i];
+        counts[i] = pending_ ? std::min(t.boundary, t.samples.size()) : t.samples.size();
+        for (size_t s = 0; s < counts[i]; ++s)
+            bytes[i] += t.samples[s].size;
+    }
+    if (counts[0] == 0 && counts[1] == 0)
+        return false;
+    independent = video_.pid == NO_PID || (counts[0] > 0 && video_.samples[0].sync);
+
+    size_t moof = box(out, "moof");
+    size_t mfhd = full_box(out, "mfhd", 0, 0);
+    put32(out, ++fragments_);
+    end(out, mfhd);
+
+    size_t data_offsets[2] = {0, 0};
+    for (int i = 0; i < 2; ++i)
+    {
+        if (counts[i] == 0)
+            continue;
+        Track &t = *tracks[i];
+        bool video = &t == &video_;
+
+        size_t traf = box(out, "traf");
+        size_t tfhd = full_box(out, "tfhd", 0, 0x020000); // default-base-is-moof
+        put32(out, t.id);
+        end(out, tfhd);
+        size_t tfdt = full_box(out, "tfdt", 1, 0);
+        put64(out, t.queue_time);
+        end(out, tfdt);
+
+        // data offset, duration and size; video also flags and composition offset
+        size_t trun = full_box(out, "trun", video ? 1 : 0, video ? 0xF01 : 0x301);
+        put32(out, static_cast<uint32_t>(counts[i]));
+        data_offsets[i] = out.size();
+        put32(out, 0);
+        for (size_t s = 0; s < counts[i]; ++s)
+        {
+            const Sample &sample = t.samples[s];
+            put32(out, sample.duration);
+            put32(out, sample.size);
+            if (video)
+            {
+                put32(out, sample.sync ? 0x02000000 : 0x01010000);
+                put32(out, static_cast<uint32_t>(sample.offset));
+            }
+        }
+        end(out, trun);
+        end(out, traf);
+    }
+    end(out, moof);
+
+    size_t mdat = box(out, "mdat");
+    for (int i = 0; i < 2; ++i)
+    {
+        if (counts[i] == 0)
+            continue;
+        Track &t = *tracks[i];
+        patch32(out, data_offsets[i], static_cast<uint32_t>(out.size() - moof));
+        out.append(t.data, 0, bytes[i]);
+
+        if (counts[i] == t.samples.size())
+        {
+            t.samples.clear();
+            t.data.clear();
+            t.queue_time = t.next_time;
+            continue;
+        }
+        for (size_t s = 0; s < counts[i]; ++s)
+            t.queue_time += t.samples[s].duration;
+        t.samples.erase(t.samples.begin(), t.samples.begin() + counts[i]);
+        t.data.erase(0, bytes[i]);
+        t.boundary -= counts[i];
+    }
+    end(out, mdat);
+    return true;
+}
+
+void Fmp4Remuxer::build_init(std::string &out) const
+{
+    out.clear();
+    size_t ftyp = box(out, "ftyp");
+    out.append("iso6", 4);
+    put32(out, 0);
+    out.append("iso6cmfcisommp41", 16);
+    end(out, ftyp);
+
+    size_t moov = box(out, "moov");
+    size_t mvhd = full_box(out, "mvhd", 0, 0);
+    put32(out, 0); // creation_time
+    put32(out, 0); // modification_time
+    put32(out, 1000);
+    put32(out, 0); // duration
+    put32(out, 0x00010000); // rate
+    put16(out, 0x0100);     // volume
+    out.append(10, '\0');
+    matrix(out);
+    out.append(24, '\0');
+    put32(out, 3); // next_track_ID
+    end(out, mvhd);
+
+    for (const Track *t : {&video_, &audio_})
+    {
+        if (t->pid == NO_PID)
+            continue;
+        bool video = t == &video_;
+
+        size_t trak = box(out, "trak");
+        size_t tkhd = full_box(out, "tkhd", 0, 0x000003); // enabled, in movie
+        put32(out, 0);
+        put32(out, 0);
+        put32(out, t->id);
+        put32(out, 0);
+        put32(out, 0); // duration
+        out.append(8, '\0');
+        put16(out, 0); // layer
+        put16(out, 0); // alternate_group
+        put16(out, video ? 0 : 0x0100);
+        put16(out, 0);
+        matrix(out);
+        put32(out, video ? static_cast<uint32_t>(t->cur.width) << 16 : 0);
+        put32(out, video ? static_cast<uint32_t>(t->cur.height) << 16 : 0);
+        end(out, tkhd);
+
+        size_t mdia = box(out, "mdia");
+        size_t mdhd = full_box(out, "mdhd", 0, 0);
+        put32(out, 0);
+        put32(out, 0);
+        put32(out, t->timescale);
+        put32(out, 0);
+        put16(out, 0x55C4); // "und"
+        put16(out, 0);
+        end(out, mdhd);
+        size_t hdlr = full_box(out, "hdlr", 0, 0);
+        put32(out, 0);
+        out.append(video ? "vide" : "soun", 4);
+        out.append(12, '\0');
+        out.append(video ? "VideoHandler" : "SoundHandler");
+        out.push_back('\0');
+        end(out, hdlr);
+
+        size_t minf = box(out, "minf");
+        if (video)
+        {
+            size_t vmhd = full_box(out, "vmhd", 0, 1);
+            out.append(8, '\0');
+            end(out, vmhd);
+        }
+        else
+        {
+            size_t smhd = full_box(out, "smhd", 0, 0);
+            out.append(4, '\0');
+            end(out, smhd);
+        }
+        size_t dinf = box(out, "dinf");
+        size_t dref = full_box(out, "dref", 0, 0);
+        put32(out, 1);
+        end(out, full_box(out, "url ", 0, 1)); // media in the same file
+        end(out, dref);
+        end(out, dinf);
+
+        size_t stbl = box(out, "stbl");
+        size_t stsd = full_box(out, "stsd", 0, 0);
+        put32(out, 1);
+        if (video)
+            write_video_entry(out);
+        else
+            write_audio_entry(out);
+        end(out, stsd);
+        // Samples are all in the fragments.
+        size_t stts = full_box(out, "stts", 0, 0);
+        put32(out, 0);
+        end(out, stts);
+        size_t stsc = full_box(out, "stsc", 0, 0);
+        put32(out, 0);
+        end(out, stsc);
+        size_t stsz = full_box(out, "stsz", 0, 0);
+        put32(out, 0);
+        put32(out, 0);
+        end(out, stsz);
+        size_t stco = full_box(out, "stco", 0, 0);
+        put32(out, 0);
+        end(out, stco);
+        end(out, stbl);
+        end(out, minf);
+        end(out, mdia);
+        end(out, trak);
+    }
+
+    size_t mvex = box(out, "mvex");
+    for (const Track *t : {&video_, &audio_})
+    {
+        if (t->pid == NO_PID)
+            continue;
+        size_t trex = full_box(out, "trex", 0, 0);
+        put32(out, t->id);
+        put32(out, 1); // sample description index
+        put32(out, 0);
+        put32(out, 0);
+        put32(out, 0);
+        end(out, trex);
+    }
+    end(out, mvex);
+    end(out, moov);
+}
+
+void Fmp4Remuxer::write_video_entry(std::string &out) const
+{
+    const Config &c = video_.cur;
+    bool hevc = video_.stream_type == 0x24;
+
+    size_t entry = box(out, hevc ? "hvc1" : "avc1");
+    out.append(6, '\0');
+    put16(out, 1); // data_reference_index
+    out.append(16, '\0');
+    put16(out, c.width);
+    put16(out, c.height);
+    put32(out, 0x00480000); // 72 dpi
+    put32(out, 0x00480000);
+    put32(out, 0);
+    put16(out, 1); // frame_count
+    out.append(32, '\0');
+    put16(out, 0x0018); // depth
+    put16(out, 0xFFFF);
+
+    if (hevc)
+    {
+        size_t hvcc = box(out, "hvcC");
+        put8(out, 1);
+        out.append(reinterpret_cast<const char *>(c.profile_tier_level), sizeof(c.profile_tier_level));
+        put16(out, 0xF000); // min_spatial_segmentation_idc
+        put8(out, 0xFC);    // parallelismType
+        put8(out, 0xFC | c.chroma_format);
+        put8(out, 0xF8 | (c.bit_depth_luma - 8));
+        put8(out, 0xF8 | (c.bit_depth_chroma - 8));
+        put16(out, 0); // avgFrameRate
+        put8(out, ((c.sub_layers & 0x07) << 3) | (c.temporal_nesting ? 0x04 : 0) | 0x03);
+        put8(out, 3);
+        const std::pair<uint8_t, const std::string *> arrays[3] = {{32, &c.vps}, {33, &c.sps}, {34, &c.pps}};
+        for (const auto &[type, nal] : arrays)
+        {
+            put8(out, 0x80 | type);
+            put16(out, 1);
+            put16(out, static_cast<uint32_t>(nal->size()));
+            out += *nal;
+        }
+        end(out, hvcc);
+    }
+    else
+    {
+        size_t avcc = box(out, "avcC");
+        put8(out, 1);
+        put8(out, static_cast<uint8_t>(c.sps[1])); // profile
+        put8(out, static_cast<uint8_t>(c.sps[2])); // compatibility
+        put8(out, static_cast<uint8_t>(c.sps[3])); // level
+        put8(out, 0xFF);                           // 4-byte lengths
+        put8(out, 0xE1);
+        put16(out, static_cast<uint32_t>(c.sps.size()));
+        out += c.sps;
+        put8(out, 1);
+        put16(out, static_cast<uint32_t>(c.pps.size()));
+        out += c.pps;
+        uint8_t profile = static_cast<uint8_t>(c.sps[1]);
+        if (profile == 100 || profile == 110 || profile == 122 || profile == 144)
+        {
+            put8(out, 0xFC | c.chroma_format);
+            put8(out, 0xF8 | (c.bit_depth_luma - 8));
+            put8(out, 0xF8 | (c.bit_depth_chroma - 8));
+            put8(out, 0);
+        }
+        end(out, avcc);
+    }
+    end(out, entry);
+}
+
+void Fmp4Remuxer::write_audio_entry(std::string &out) const
+{
+    const Config &c = audio_.cur;
+    uint32_t rate = SAMPLE_RATES[c.sample_rate_index];
+
+    size_t entry = box(out, "mp4a");
+    out.append(6, '\0');
+    put16(out, 1); // data_reference_index
+    out.append(8, '\0');
+    put16(out, c.channels ? c.channels : 2);
+    put16(out, 16); // sample size
+    put32(out, 0);
+    put32(out, rate <= 0xFFFF ? rate << 16 : 0);
+
+    // ES_Descriptor > DecoderConfigDescriptor > AudioSpecificConfig
+    size_t esds = full_box(out, "esds", 0, 0);
+    put8(out, 0x03);
+    put8(out, 25);
+    put16(out, 0); // ES_ID
+    put8(out, 0);
+    put8(out, 0x04);
+    put8(out, 17);
+    put8(out, 0x40); // MPEG-4 audio
+    put8(out, 0x15); // audio stream
+    put24(out, 0);   // buffer size
+    put32(out, 0);   // max bitrate
+    put32(out, 0);   // average bitrate
+    put8(out, 0x05);
+    put8(out, 2);
+    uint8_t object_type = c.profile + 1;
+    put8(out, (object_type << 3) | (c.sample_rate_index >> 1));
+    put8(out, ((c.sample_rate_index & 0x01) << 7) | (c.channels << 3));
+    put8(out, 0x06); // SLConfigDescriptor
+    put8(out, 1);
+    put8(out, 0x02);
+    end(out, esds);
+    end(out, entry);
+}
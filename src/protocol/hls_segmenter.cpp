@@ -0,0 +1,484 @@
+#include "protocol/hls_segmenter.h"
+#include "protocol/ts_utils.h"
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+
+namespace
+{
+    std::string seconds(uint64_t ticks, uint64_t hz)
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.3f", static_cast<double>(ticks) / hz);
+        return buf;
+    }
+
+    std::string iso_time(std::chrono::system_clock::time_point t)
+    {
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t.time_since_epoch()).count();
+        std::time_t secs = static_cast<std::time_t>(ms / 1000);
+        std::tm tm{};
+        gmtime_r(&secs, &tm);
+        char buf[40];
+        size_t n = strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+        snprintf(buf + n, sizeof(buf) - n, ".%03dZ", static_cast<int>(ms % 1000));
+        return buf;
+    }
+}
+
+HlsSegmenter::HlsSegmenter(const Options &opts)
+    : opts_(opts),
+      target_ticks_(static_cast<uint64_t>(opts.segment_ms) * HZ / 1000),
+      part_ticks_(static_cast<uint64_t>(std::min(opts.part_ms, opts.segment_ms / 2)) * HZ / 1000),
+      piece_ticks_(part_ticks_ > 0 || opts.format == Format::TS
+                       ? part_ticks_
+                       : static_cast<uint64_t>(std::min(FRAGMENT_MS, opts.segment_ms / 2)) * HZ / 1000),
+      target_duration_((opts.segment_ms + 999) / 1000),
+      // Sequence numbers start at the Unix time, so a channel that is set up
+      // again never reuses the URI of a segment a cache may still hold.
+      next_seq_(static_cast<uint64_t>(std::time(nullptr)))
+{
+    if (opts.format == Format::FMP4)
+        remux_ = std::make_unique<Fmp4Remuxer>();
+}
+
+bool HlsSegmenter::push(const uint8_t *ts, size_t len, Clock::time_point now)
+{
+    advance_clock(now);
+
+    bool completed = false;
+    for (size_t i = 0; i + ts::PACKET_SIZE <= len; i += ts::PACKET_SIZE)
+    {
+        const uint8_t *pkt = ts + i;
+        if (pkt[0] != 0x47)
+            continue;
+
+        uint16_t pid = ts::pid(pkt);
+        if (pid == 0 || pid == pmt_pid_)
+            on_psi(pkt, pid);
+
+        uint64_t pcr;
+        if ((pcr_pid_ == NO_PID || pid == pcr_pid_) && ts::read_pcr(pkt, pcr))
+        {
+            pcr_pid_ = pid;
+            on_pcr(pcr / 300, now);
+        }
+
+        if (remux_)
+        {
+            remux_->push(pkt);
+            if (remux_->config_pending() || remux_->version() != remux_version_)
+                completed |= change_init();
+        }
+
+        bool key = is_keyframe(pkt, pid);
+        if (!open_)
+        {
+            // Segments start decodable; a stream without recognisable keyframes is cut blindly after a while.
+            if (!key && clock_ - wait_start_ < target_ticks_ * MAX_SEGMENT_FACTOR)
+                continue;
+            start_segment(key);
+        }
+        else
+        {
+            uint64_t length = clock_ - seg_start_;
+            uint64_t part_length = clock_ - piece_start_;
+            if ((key && length >= target_ticks_) || length >= target_ticks_ * MAX_SEGMENT_FACTOR)
+            {
+                if (!key)
+                    ++forced_cuts_;
+                completed |= close_segment();
+                start_segment(key);
+            }
+            else if (piece_ticks_ > 0 && (remux_ ? remux_->has_samples() : !piece_->empty()) &&
+                     (key || part_length + std::min(last_step_, piece_ticks_ / 2) > piece_ticks_))
+            {
+                // A part ends before the next clock step would take it past the
+                // target, and on every keyframe so that players can join there.
+                completed |= seal_part();
+                start_piece(key);
+            }
+            else if (piece_ticks_ == 0 && piece_->size() + ts::PACKET_SIZE > PIECE_BYTES)
+            {
+                seal_part();
+                start_piece(false);
+            }
+        }
+        if (!remux_)
+            piece_->append(reinterpret_cast<const char *>(pkt), ts::PACKET_SIZE);
+    }
+    return completed;
+}
+
+bool HlsSegmenter::discontinuity()
+{
+    bool completed = false;
+    if (open_)
+        completed = close_segment();
+
+    // Program structure and clock are learnt again from the new input.
+    pmt_pid_ = NO_PID;
+    video_pid_ = NO_PID;
+    pmt_.clear();
+    pcr_pid_ = NO_PID;
+    pcr_locked_ = false;
+    pending_discontinuity_ = true;
+    wait_start_ = clock_;
+    ++discontinuities_;
+    if (remux_)
+        remux_->reset();
+    return completed;
+}
+
+void HlsSegmenter::advance_clock(Clock::time_point now)
+{
+    if (!clock_started_)
+    {
+        clock_started_ = true;
+        last_wall_ = now;
+        return;
+    }
+
+    if (pcr_locked_ && now - last_pcr_wall_ > PCR_LOST)
+        pcr_locked_ = false;
+    if (!pcr_locked_ && now > last_wall_)
+    {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(now - last_wall_).count();
+        last_step_ = static_cast<uint64_t>(us) * HZ / 1000000;
+        clock_ += last_step_;
+    }
+    last_wall_ = now;
+}
+
+void HlsSegmenter::on_pcr(uint64_t pcr, Clock::time_point now)
+{
+    if (pcr_locked_)
+    {
+        uint64_t step = (pcr + PCR_WRAP - last_pcr_) % PCR_WRAP;
+        if (step > MAX_PCR_STEP)
+        {
+            // A jump: stream time carries on at the pace of arrival.
+            auto us = std::chrono::duration_cast<std::chrono::microseconds>(now - last_pcr_wall_).count();
+            step = static_cast<uint64_t>(std::max<int64_t>(us, 0)) * HZ / 1000000;
+        }
+        last_step_ = step;
+        clock_ += step;
+    }
+    pcr_locked_ = true;
+    last_pcr_ = pcr;
+    last_pcr_wall_ = now;
+}
+
+void HlsSegmenter::on_psi(const uint8_t *ts, uint16_t pid)
+{
+    if (pid == 0)
+    {
+        uint16_t pmt_pid = ts::pat_pmt_pid(ts);
+        if (pmt_pid == NO_PID)
+            return;
+        if (pmt_pid != pmt_pid_)
+        {
+            pmt_pid_ = pmt_pid;
+            pmt_.clear();
+        }
+        pat_.assign(reinterpret_cast<const char *>(ts), ts::PACKET_SIZE);
+        return;
+    }
+
+    uint16_t video = NO_PID;
+    uint8_t video_type = 0;
+    if (ts::pmt_streams(ts, [&](uint8_t type, uint16_t es_pid)
+                        { if (video == NO_PID && ts::is_video_stream(type)) { video = es_pid; video_type = type; } }))
+    {
+        video_pid_ = video;
+        video_type_ = video_type;
+        pmt_.assign(reinterpret_cast<const char *>(ts), ts::PACKET_SIZE);
+    }
+}
+
+bool HlsSegmenter::is_keyframe(const uint8_t *ts, uint16_t pid) const
+{
+    if (!ts::pusi(ts))
+        return false;
+    if (video_pid_ != NO_PID)
+        return pid == video_pid_ && ts::is_keyframe(ts, video_type_);
+    // Radio: every audio frame can be decoded on its own.
+    return !pmt_.empty() && pid == pcr_pid_;
+}
+
+bool HlsSegmenter::change_init()
+{
+    // The samples before the new configuration end the open segment, and
+    // the next one starts with the new init segment.
+    bool completed = open_ && close_segment();
+    remux_->apply_config();
+    if (remux_->version() != remux_version_)
+    {
+        remux_version_ = remux_->version();
+        if (init_id_ != 0)
+            pending_discontinuity_ = true;
+        // Named like segments, so a recreated channel does not reuse the URI either.
+        init_id_ = std::max(next_seq_, init_id_ + 1);
+        inits_.emplace_back(init_id_, std::make_shared<const std::string>(remux_->init_segment()));
+    }
+    start_segment(true);
+    return completed;
+}
+
+void HlsSegmenter::start_segment(bool independent)
+{
+    open_seg_ = Segment{};
+    open_seg_.seq = next_seq_;
+    open_seg_.discontinuity = pending_discontinuity_;
+    open_seg_.start_time = std::chrono::system_clock::now();
+    pending_discontinuity_ = false;
+    open_ = true;
+    seg_start_ = clock_;
+    open_seg_.init = init_id_;
+
+    start_piece(independent);
+    if (!remux_)
+    {
+        piece_->append(pat_);
+        piece_->append(pmt_);
+    }
+}
+
+bool HlsSegmenter::close_segment()
+{
+    seal_part();
+    open_ = false;
+    wait_start_ = clock_;
+    if (open_seg_.parts.empty())
+        return false; // FMP4 before the remuxer had samples
+
+    open_seg_.duration = std::max<uint64_t>(clock_ - seg_start_, 1);
+    target_duration_ = std::max(target_duration_, static_cast<int>((open_seg_.duration + HZ / 2) / HZ));
+    segments_.push_back(std::move(open_seg_));
+    ++next_seq_;
+
+    while (segments_.size() > opts_.window + EXTRA_SEGMENTS)
+    {
+        if (segments_.front().discontinuity)
+            ++discontinuity_seq_;
+        recycle(segments_.front());
+        segments_.pop_front();
+    }
+    while (inits_.size() > 1 && inits_[1].first <= segments_.front().init)
+        inits_.pop_front();
+    return true;
+}
+
+bool HlsSegmenter::seal_part()
+{
+    // Samples of a new init segment (one that has not been applied yet) do
+    // not belong in the open segment.
+    if (remux_ && piece_ && piece_->empty() && remux_->version() == remux_version_)
+    {
+        bool independent = false;
+        if (remux_->flush(*piece_, independent))
+            piece_independent_ = independent;
+    }
+    if (!piece_ || piece_->empty())
+        return false;
+    open_seg_.parts.push_back(Part{std::move(piece_), clock_ - piece_start_, piece_independent_});
+    piece_.reset();
+    // Progressive FMP4 viewers are woken by every fragment.
+    return part_ticks_ > 0 || remux_;
+}
+
+void HlsSegmenter::start_piece(bool independent)
+{
+    // One that was left empty and not sealed is used again.
+    if (!piece_ && !spare_.empty())
+    {
+        piece_ = std::move(spare_.back());
+        spare_.pop_back();
+    }
+    else if (!piece_)
+    {
+        piece_ = std::make_shared<std::string>();
+        piece_->reserve(PIECE_BYTES);
+    }
+    piece_independent_ = independent;
+    piece_start_ = clock_;
+}
+
+void HlsSegmenter::recycle(Segment &segment)
+{
+    for (auto &part : segment.parts)
+    {
+        // Still being sent if anyone else holds it.
+        if (part.data.use_count() != 1 || spare_.size() >= MAX_SPARE_PIECES)
+            continue;
+        auto buf = std::const_pointer_cast<std::string>(part.data);
+        part.data.reset();
+        buf->clear();
+        spare_.push_back(std::move(buf));
+    }
+}
+
+const HlsSegmenter::Segment *HlsSegmenter::find(uint64_t seq) const
+{
+    if (segments_.empty() || seq < segments_.front().seq || seq > segments_.back().seq)
+        return nullptr;
+    return &segments_[seq - segments_.front().seq];
+}
+
+bool HlsSegmenter::has(uint64_t seq, int part) const
+{
+    if (seq < next_seq_)
+        return true; // complete, whichever part was asked for
+    return seq == next_seq_ && open_ && part >= 0 && static_cast<size_t>(part) < open_seg_.parts.size();
+}
+
+bool HlsSegmenter::segment(uint64_t seq, std::vector<Piece> &pieces) const
+{
+    const Segment *seg = find(seq);
+    if (!seg)
+        return false;
+    pieces.clear();
+    for (const auto &part : seg->parts)
+        pieces.push_back(part.data);
+    return true;
+}
+
+bool HlsSegmenter::part(uint64_t seq, size_t index, Piece &piece) const
+{
+    const Segment *seg = open_ && seq == open_seg_.seq ? &open_seg_ : find(seq);
+    if (!seg || index >= seg->parts.size())
+        return false;
+    piece = seg->parts[index].data;
+    return true;
+}
+
+uint64_t HlsSegmenter::init_of(uint64_t seq) const
+{
+    const Segment *seg = open_ && seq == open_seg_.seq ? &open_seg_ : find(seq);
+    return seg ? seg->init : 0;
+}
+
+bool HlsSegmenter::init(uint64_t id, Piece &piece) const
+{
+    for (const auto &[init_id, body] : inits_)
+    {
+        if (init_id == id)
+        {
+            piece = body;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool HlsSegmenter::live_start(uint64_t &seq, size_t &part) const
+{
+    auto search = [&](const Segment &seg)
+    {
+        for (size_t p = seg.parts.size(); p-- > 0;)
+        {
+            if (seg.parts[p].independent)
+            {
+                seq = seg.seq;
+                part = p;
+                return true;
+            }
+        }
+        return false;
+    };
+    if (open_ && search(open_seg_))
+        return true;
+    for (size_t i = segments_.size(); i-- > 0;)
+    {
+        if (search(segments_[i]))
+            return true;
+    }
+    return false;
+}
+
+std::string HlsSegmenter::playlist(const std::string &query) const
+{
+    size_t first = segments_.size() > opts_.window ? segments_.size() - opts_.window : 0;
+    uint64_t discontinuity_seq = discontinuity_seq_;
+    for (size_t i = 0; i < first; ++i)
+    {
+        if (segments_[i].discontinuity)
+            ++discontinuity_seq;
+    }
+
+    std::string out;
+    out.reserve(256 + (segments_.size() - first) * 128 + (part_ticks_ > 0 ? PART_SEGMENTS * 512 : 0));
+    bool fmp4 = opts_.format == Format::FMP4;
+    const char *ext = fmp4 ? ".m4s" : ".ts";
+    out += fmp4 ? "#EXTM3U\n#EXT-X-VERSION:7\n" : "#EXTM3U\n#EXT-X-VERSION:6\n";
+    out += "#EXT-X-TARGETDURATION:" + std::to_string(target_duration_) + "\n";
+    if (part_ticks_ > 0)
+    {
+        out += "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=" + seconds(3 * part_ticks_, HZ) + "\n";
+        out += "#EXT-X-PART-INF:PART-TARGET=" + seconds(part_ticks_, HZ) + "\n";
+    }
+    out += "#EXT-X-MEDIA-SEQUENCE:" + std::to_string(first < segments_.size() ? segments_[first].seq : next_seq_) + "\n";
+    out += "#EXT-X-DISCONTINUITY-SEQUENCE:" + std::to_string(discontinuity_seq) + "\n";
+
+    uint64_t map = 0;
+    auto add_map = [&](const Segment &seg)
+    {
+        if (fmp4 && seg.init != map)
+        {
+            map = seg.init;
+            out += "#EXT-X-MAP:URI=\"init-" + std::to_string(map) + ".mp4" + query + "\"\n";
+        }
+    };
+
+    auto add_parts = [&](const Segment &seg)
+    {
+        for (size_t p = 0; p < seg.parts.size(); ++p)
+        {
+            out += "#EXT-X-PART:DURATION=" + seconds(seg.parts[p].duration, HZ) + ",URI=\"" +
+                   std::to_string(seg.seq) + "." + std::to_string(p) + ext + query + "\"" +
+                   (seg.parts[p].independent ? ",INDEPENDENT=YES\n" : "\n");
+        }
+    };
+
+    for (size_t i = first; i < segments_.size(); ++i)
+    {
+        const Segment &seg = segments_[i];
+        if (seg.discontinuity)
+            out += "#EXT-X-DISCONTINUITY\n";
+        add_map(seg);
+        out += "#EXT-X-PROGRAM-DATE-TIME:" + iso_time(seg.start_time) + "\n";
+        if (part_ticks_ > 0 && i + PART_SEGMENTS >= segments_.size())
+            add_parts(seg);
+        out += "#EXTINF:" + seconds(seg.duration, HZ) + ",\n" + std::to_string(seg.seq) + ext + query + "\n";
+    }
+
+    if (part_ticks_ > 0 && open_)
+    {
+        if (open_seg_.discontinuity)
+            out += "#EXT-X-DISCONTINUITY\n";
+        add_map(open_seg_);
+        out += "#EXT-X-PROGRAM-DATE-TIME:" + iso_time(open_seg_.start_time) + "\n";
+        add_parts(open_seg_);
+        out += "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"" + std::to_string(open_seg_.seq) + "." +
+               std::to_string(open_seg_.parts.size()) + ext + query + "\"\n";
+    }
+    return out;
+}
+
+size_t HlsSegmenter::held_bytes() const
+{
+    size_t bytes = piece_ ? piece_->size() : 0;
+    for (const auto &init : inits_)
+        bytes += init.second->size();
+    for (const auto &part : open_seg_.parts)
+        bytes += part.data->size();
+    for (const auto &seg : segments_)
+    {
+        for (const auto &part : seg.parts)
+        {
+            if (part.data)
+                bytes += part.data->size();
+        }
+    }
+    return bytes;
+}
@@ -0,0 +1,110 @@
+#include "protocol/pcr_pacer.h"
+#include "protocol/ts_utils.h"
+
+PcrPacer::PcrPacer(std::chrono::milliseconds burst)
+    : burst_(burst)
+{
+}
+
+void PcrPacer::on_queued(const uint8_t *ts, size_t ts_len, size_t queued_len, Clock::time_point now)
+{
+    size_t start = queued_ + (queued_len - ts_len);
+    queued_ += queued_len;
+
+    if (ts_len >= ts::PACKET_SIZE && ts[0] == 0x47)
+    {
+        for (size_t i = 0; i + ts::PACKET_SIZE <= ts_len; i += ts::PACKET_SIZE)
+        {
+            const uint8_t *pkt = ts + i;
+            uint64_t pcr;
+            if ((!locked_ || ts::pid(pkt) == pcr_pid_) && ts::read_pcr(pkt, pcr))
+            {
+                pcr_pid_ = ts::pid(pkt);
+                on_pcr(pcr, start + i + ts::PACKET_SIZE, now);
+            }
+            else if (locked_ && ++packets_since_pcr_ > PCR_LOST_PACKETS)
+            {
+                // The PCR PID went away (e.g. a different upstream): stop pacing until a new one shows up.
+                locked_ = false;
+                checkpoints_.clear();
+            }
+        }
+    }
+
+    if (!locked_)
+        released_ = queued_;
+}
+
+void PcrPacer::on_control(size_t len)
+{
+    queued_ += len;
+    if (!locked_ || checkpoints_.empty())
+        released_ = queued_;
+    else
+        checkpoints_.push_back(Checkpoint{queued_, checkpoints_.back().due});
+}
+
+void PcrPacer::on_pcr(uint64_t pcr, size_t end, Clock::time_point now)
+{
+    packets_since_pcr_ = 0;
+    if (!locked_)
+    {
+        locked_ = true;
+        rebase(pcr, end, now);
+    }
+    else
+    {
+        uint64_t step = (pcr + PCR_WRAP - last_pcr_) % PCR_WRAP;
+        if (step > MAX_PCR_STEP)
+        {
+            ++rebases_;
+            rebase(pcr, end, now);
+        }
+        else
+        {
+            last_pcr_ = pcr;
+            stream_ticks_ += step;
+            window_ticks_ += step;
+        }
+    }
+
+    // The output stays burst_ ahead of real time.
+    auto due = origin_ + std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(stream_ticks_ * 1000 / 27)) - burst_;
+    if (due + burst_ + MAX_LATE < now)
+    {
+        // The source ran slower than real time for a while; do not burst to catch up.
+        ++rebases_;
+        rebase(pcr, end, now);
+        due = now - burst_;
+    }
+    checkpoints_.push_back(Checkpoint{end, due});
+
+    if (window_ticks_ >= RATE_WINDOW)
+    {
+        rate_ = (end - window_start_) * PCR_HZ / window_ticks_;
+        window_start_ = end;
+        window_ticks_ = 0;
+    }
+}
+
+void PcrPacer::rebase(uint64_t pcr, size_t end, Clock::time_point origin)
+{
+    last_pcr_ = pcr;
+    stream_ticks_ = 0;
+    origin_ = origin;
+    window_ticks_ = 0;
+    window_start_ = end;
+}
+
+PcrPacer::Clock::time_point PcrPacer::release(Clock::time_point now)
+{
+    while (!checkpoints_.empty() && checkpoints_.front().due <= now)
+    {
+        released_ = checkpoints_.front().end;
+        checkpoints_.pop_front();
+    }
+    if (checkpoints_.empty())
+        return {};
+    pacing_ = true;
+    return checkpoints_.front().due;
+}
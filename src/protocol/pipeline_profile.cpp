@@ -0,0 +1,104 @@
+#include "protocol/pipeline_profile.h"
+#include "core/server_config.h"
+#include "core/logger.h"
+
+std::map<std::string, PipelineProfile> PipelineProfiles::profiles_;
+std::vector<PipelineProfiles::Rule> PipelineProfiles::rules_;
+
+unsigned PipelineProfile::stage_mask() const
+{
+    unsigned mask = 0;
+    if (wait_keyframe) mask |= KEYFRAME_GATE;
+    if (strip_padding) mask |= PADDING_STRIP;
+    if (strip_null) mask |= NULL_STRIP;
+    if (!drop_pids.empty()) mask |= PID_FILTER;
+    if (stats) mask |= STATS;
+    return mask;
+}
+
+PipelineProfile PipelineProfiles::default_profile()
+{
+    PipelineProfile p;
+    p.wait_keyframe = ServerConfig::isWaitKeyframe();
+    p.strip_padding = ServerConfig::isStripPadding();
+    p.strip_null = ServerConfig::isStripPadding();
+    return p;
+}
+
+PipelineProfile PipelineProfiles::from_json(const std::string &name, const nlohmann::json &j)
+{
+    PipelineProfile p = default_profile();
+    p.name = name;
+    if (j.contains("wait_keyframe")) p.wait_keyframe = j["wait_keyframe"].get<bool>();
+    if (j.contains("strip_padding")) p.strip_padding = j["strip_padding"].get<bool>();
+    if (j.contains("strip_null")) p.strip_null = j["strip_null"].get<bool>();
+    if (j.contains("stats")) p.stats = j["stats"].get<bool>();
+    if (j.contains("drop_pids") && j["drop_pids"].is_array())
+    {
+        for (const auto &pid : j["drop_pids"])
+        {
+            if (pid.is_number_unsigned() && pid.get<unsigned>() < 0x2000)
+                p.drop_pids.push_back(static_cast<uint16_t>(pid.get<unsigned>()));
+        }
+    }
+    return p;
+}
+
+void PipelineProfiles::load(const nlohmann::json &profiles, const nlohmann::json &rules)
+{
+    profiles_.clear();
+    rules_.clear();
+
+    if (profiles.is_object())
+    {
+        for (auto it = profiles.begin(); it != profiles.end(); ++it)
+        {
+            if (!it.value().is_object()) continue;
+            try {
+                profiles_[it.key()] = from_json(it.key(), it.value());
+            } catch (const nlohmann::json::exception &e) {
+                Logger::error("[CONFIG] Invalid pipeline profile '" + it.key() + "': " + e.what());
+            }
+        }
+    }
+
+    if (rules.is_array())
+    {
+        for (const auto &r : rules)
+        {
+            if (!r.is_object() || !r.contains("match") || !r.contains("profile")) continue;
+            if (!r["match"].is_string() || !r["profile"].is_string())
+            {
+                Logger::warn("[CONFIG] Pipeline rule needs string 'match' and 'profile', skipped: " + r.dump());
+                continue;
+            }
+            Rule rule{r["match"].get<std::string>(), r["profile"].get<std::string>()};
+            if (profiles_.find(rule.profile) == profiles_.end())
+            {
+                Logger::warn("[CONFIG] Pipeline rule references unknown profile: " + rule.profile);
+                continue;
+            }
+            rules_.push_back(std::move(rule));
+        }
+    }
+}
+
+PipelineProfile PipelineProfiles::resolve(const std::string &uri, const std::string &requested)
+{
+    if (!requested.empty())
+    {
+        auto it = profiles_.find(requested);
+        if (it != profiles_.end()) return it->second;
+        Logger::warn("[Pipeline] Unknown profile requested: " + requested + ", using default");
+    }
+
+    for (const auto &rule : rules_)
+    {
+        if (uri.find(rule.match) != std::string::npos)
+        {
+            return profiles_[rule.profile];
+        }
+    }
+
+    return default_profile();
+}
@@ -1,70 +1,126 @@
 #include "protocol/request_parser.h"
 #include "core/server_config.h"
 #include "utils/url_rewriter.h"
-#include <sstream>
+#include <arpa/inet.h>
 
 
-RequestInfo RequestParser::parse(const std::string &request_data)
+namespace
+{
+    // Returns the next space-delimited token of line starting at pos.
+    std::string_view next_token(std::string_view line, size_t &pos)
+    {
+        while (pos < line.size() && (line[pos] == ' ' || line[pos] == '\t'))
+            ++pos;
+        size_t start = pos;
+        while (pos < line.size() && line[pos] != ' ' && line[pos] != '\t')
+            ++pos;
+        return line.substr(start, pos - start);
+    }
+}
+
+std::string_view RequestInfo::param(std::string_view key) const
+{
+    for (size_t i = 0; i < param_count_; ++i)
+    {
+        const Param &p = params_[i];
+        if (std::string_view(raw_uri).substr(p.key_off, p.key_len) == key)
+            return std::string_view(raw_uri).substr(p.value_off, p.value_len);
+    }
+    return {};
+}
+
+bool RequestInfo::has_param(std::string_view key) const
+{
+    for (size_t i = 0; i < param_count_; ++i)
+    {
+        const Param &p = params_[i];
+        if (std::string_view(raw_uri).substr(p.key_off, p.key_len) == key)
+            return true;
+    }
+    return false;
+}
+
+RequestInfo RequestParser::parse(std::string_view request_data)
 {
     RequestInfo info;
-    std::istringstream ss(request_data);
-    if (!(ss >> info.method >> info.raw_uri >> info.version))
+    std::string_view line = request_data.substr(0, request_data.find_first_of("\r\n"));
+    size_t pos = 0;
+    std::string_view method = next_token(line, pos);
+    std::string_view uri = next_token(line, pos);
+    std::string_view version = next_token(line, pos);
+    if (version.empty())
     {
         return info;
     }
+    info.method.assign(method);
+    info.raw_uri.assign(uri);
+    info.version.assign(version);
 
-    info.is_http = (info.version.find("HTTP/") == 0);
+    info.is_http = (version.compare(0, 5, "HTTP/") == 0);
 
-    if (ServerConfig::getToken().empty())
+    const std::string &server_token = ServerConfig::getToken();
+    if (server_token.empty())
     {
         info.is_authorized = true;
     }
 
-    info.clean_uri = info.raw_uri;
-    size_t qpos = info.raw_uri.find('?');
-    if (qpos != std::string::npos)
+    size_t qpos = uri.find('?');
+    if (qpos == std::string_view::npos)
     {
-        std::string query_str = info.raw_uri.substr(qpos + 1);
-        std::string base_uri = info.raw_uri.substr(0, qpos);
-        
-        std::vector<std::string> params_vec = split(query_str, '&');
-        std::vector<std::string> filtered_params;
-        
-        std::string server_token = ServerConfig::getToken();
-
-        for (const auto &p : params_vec)
+        info.clean_uri = info.raw_uri;
+    }
+    else
+    {
+        // Index key/value pairs in place; only the forwarded ones are copied into clean_uri.
+        info.clean_uri.reserve(uri.size());
+        info.clean_uri.assign(uri.substr(0, qpos));
+        char sep = '?';
+        size_t start = qpos + 1;
+        while (start <= uri.size())
         {
+            size_t amp = uri.find('&', start);
+            if (amp == std::string_view::npos)
+                amp = uri.size();
+            std::string_view p = uri.substr(start, amp - start);
+            size_t p_off = start;
+            start = amp + 1;
+
             size_t eq_pos = p.find('=');
-            if (eq_pos != std::string::npos)
+            if (eq_pos != std::string_view::npos)
             {
-                std::string key = p.substr(0, eq_pos);
-                std::string val = p.substr(eq_pos + 1);
-                info.params[key] = val;
+                std::string_view key = p.substr(0, eq_pos);
+                std::string_view val = p.substr(eq_pos + 1);
+                if (info.param_count_ < RequestInfo::MAX_PARAMS && uri.size() <= UINT16_MAX)
+                {
+                    info.params_[info.param_count_++] = RequestInfo::Param{
+                        static_cast<uint16_t>(p_off), static_cast<uint16_t>(key.size()),
+                        static_cast<uint16_t>(p_off + eq_pos + 1), static_cast<uint16_t>(val.size())};
+                }
 
-                if (key == "token")
+                if (key == "token" && val == server_token)
+                {
+                    info.is_authorized = true;
+                }
+                if (is_local_param(key))
                 {
-                    if (val == server_token)
-                    {
-                        info.is_authorized = true;
-                    }
                     continue;
                 }
             }
-            filtered_params.push_back(p);
-        }
-
-        info.clean_uri = base_uri;
-        if (!filtered_params.empty())
-        {
-            info.clean_uri += "?";
-            for (size_t i = 0; i < filtered_params.size(); ++i)
+            else if (p.empty() && start > uri.size())
             {
-                if (i != 0) info.clean_uri += "&";
-                info.clean_uri += filtered_params[i];
+                break; // trailing '&' or bare '?'
             }
+            info.clean_uri += sep;
+            info.clean_uri.append(p);
+            sep = '&';
         }
     }
 
+    std::string_view path = std::string_view(info.clean_uri).substr(0, info.clean_uri.find('?'));
+    if (parse_multicast(path, info)) {
+        return info;
+    }
+
     size_t path_start = info.clean_uri.find("/rtp/");
     if (path_start == std::string::npos) {
         path_start = info.clean_uri.find("/tv/");
@@ -78,19 +134,85 @@ RequestInfo RequestParser::parse(const std::string &request_data)
     return info;
 }
 
-std::vector<std::string> RequestParser::split(const std::string &str, char delimiter)
+bool RequestParser::parse_multicast(std::string_view path, RequestInfo &info)
 {
-    std::vector<std::string> tokens;
-    size_t start = 0;
-    size_t end = str.find(delimiter);
+    bool rtp = false;
+    size_t start = path.find("/udp/");
+    if (start == std::string_view::npos)
+    {
+        start = path.find("/rtp/");
+        rtp = true;
+    }
+    if (start == std::string_view::npos)
+        return false;
+
+    // [<source>@]<group>:<port>, anything after a further '/' is ignored.
+    std::string_view target = path.substr(start + 5);
+    target = target.substr(0, target.find('/'));
+    size_t colon = target.rfind(':');
+    if (colon == std::string_view::npos)
+        return false;
 
-    while (end != std::string::npos)
+    std::string_view source;
+    std::string_view group = target.substr(0, colon);
+    size_t at = group.find('@');
+    if (at != std::string_view::npos)
     {
-        tokens.push_back(str.substr(start, end - start));
-        start = end + 1;
-        end = str.find(delimiter, start);
+        source = group.substr(0, at);
+        group = group.substr(at + 1);
     }
-    tokens.push_back(str.substr(start, end));
 
-    return tokens;
+    // /rtp/ also names RTSP hosts; only a multicast group makes it a multicast URL.
+    in_addr group_addr{};
+    in_addr source_addr{};
+    if (!inet_pton(AF_INET, std::string(group).c_str(), &group_addr) || !IN_MULTICAST(ntohl(group_addr.s_addr)) ||
+        (!source.empty() && !inet_pton(AF_INET, std::string(source).c_str(), &source_addr)))
+        return false;
+
+    int port = 0;
+    for (char c : target.substr(colon + 1))
+    {
+        if (c < '0' || c > '9' || (port = port * 10 + (c - '0')) > 65535)
+            return false;
+    }
+    if (port == 0)
+        return false;
+
+    info.multicast_group = group_addr.s_addr;
+    info.multicast_source = source_addr.s_addr;
+    info.multicast_port = static_cast<uint16_t>(port);
+    info.multicast_rtp = rtp;
+    return true;
+}
+
+bool RequestParser::is_local_param(std::string_view key)
+{
+    // Parameters consumed by the proxy itself; never forwarded upstream.
+    return key == "token" || key == "profile" || key == "redundant" || key == "mirror";
+}
+
+std::string RequestParser::strip_local_params(const std::string &uri)
+{
+    size_t qpos = uri.find('?');
+    if (qpos == std::string::npos)
+        return uri;
+
+    std::string_view query = std::string_view(uri).substr(qpos + 1);
+    std::string result = uri.substr(0, qpos);
+    char sep = '?';
+    size_t start = 0;
+    while (start <= query.size())
+    {
+        size_t amp = query.find('&', start);
+        if (amp == std::string_view::npos)
+            amp = query.size();
+        std::string_view p = query.substr(start, amp - start);
+        start = amp + 1;
+        if (is_local_param(p.substr(0, p.find('='))))
+            continue;
+        result += sep;
+        result.append(p);
+        sep = '&';
+    }
+    return result;
 }
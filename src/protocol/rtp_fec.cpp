@@ -0,0 +1,225 @@
+#include "protocol/rtp_fec.h"
+#include "core/logger.h"
+#include "utils/utils.h"
+#include <arpa/inet.h>
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    inline uint16_t rd16(const uint8_t *p) { return static_cast<uint16_t>((p[0] << 8) | p[1]); }
+    inline uint32_t rd32(const uint8_t *p)
+    {
+        return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+               (static_cast<uint32_t>(p[2]) << 8) | p[3];
+    }
+
+    // Returns the RTP header size (fixed part plus CSRC list), or 0 if not RTP.
+    inline size_t rtp_header_size(const uint8_t *buf, size_t len)
+    {
+        if (len < 12 || (buf[0] & 0xC0) != 0x80) return 0;
+        size_t hdr = 12 + (buf[0] & 0x0F) * 4;
+        return hdr <= len ? hdr : 0;
+    }
+}
+
+RtpFecDecoder::RtpFecDecoder(BufferPool &pool, RecoverFn on_recovered)
+    : pool_(pool),
+      on_recovered_(std::move(on_recovered)),
+      max_payload_(pool.get_buffer_size() - 12),
+      slots_(HISTORY),
+      payloads_(HISTORY * max_payload_)
+{
+}
+
+void RtpFecDecoder::on_media(const uint8_t *buf, size_t len)
+{
+    size_t hdr = rtp_header_size(buf, len);
+    if (unlikely(hdr == 0)) return;
+
+    ssrc_ = rd32(buf + 8);
+    uint16_t seq = rd16(buf + 2);
+    store_media(seq, buf[1] & 0x7F, rd32(buf + 4), buf + hdr, len - hdr);
+
+    // A late packet may leave a pending group with a single gap.
+    if (unlikely(!pending_.empty()) &&
+        std::any_of(pending_.begin(), pending_.end(), [seq](const FecEntry &fec) { return covers(fec, seq); }))
+        retry_pending();
+}
+
+void RtpFecDecoder::on_fec(const uint8_t *buf, size_t len)
+{
+    size_t hdr = rtp_header_size(buf, len);
+    if (unlikely(hdr == 0 || hdr + FEC_HEADER_SIZE > len)) return;
+    ++stats_.fec_packets;
+
+    const uint8_t *p = buf + hdr;
+    FecEntry fec;
+    fec.base = rd16(p);
+    fec.length_recovery = rd16(p + 2);
+    fec.pt_recovery = p[4] & 0x7F;
+    fec.ts_recovery = rd32(p + 8);
+    fec.offset = p[13];
+    fec.na = p[14];
+    if (unlikely(fec.na == 0 || fec.offset == 0 || static_cast<size_t>(fec.na - 1) * fec.offset >= HISTORY))
+        return;
+    fec.payload.assign(p + FEC_HEADER_SIZE, buf + len);
+
+    // Drop groups that can no longer be repaired before adding a new one.
+    while (started_ && !pending_.empty() && is_expired(pending_.front()))
+    {
+        ++stats_.unrecoverable;
+        pending_.pop_front();
+    }
+
+    switch (started_ ? try_recover(fec) : Result::PENDING)
+    {
+    case Result::RECOVERED:
+        retry_pending();
+        break;
+    case Result::PENDING:
+        pending_.push_back(std::move(fec));
+        if (pending_.size() > MAX_PENDING)
+        {
+            ++stats_.unrecoverable;
+            pending_.pop_front();
+        }
+        break;
+    case Result::EXPIRED:
+        ++stats_.unrecoverable;
+        break;
+    case Result::COMPLETE:
+        break;
+    }
+}
+
+void RtpFecDecoder::reset()
+{
+    for (auto &slot : slots_) slot.valid = false;
+    pending_.clear();
+    started_ = false;
+}
+
+bool RtpFecDecoder::has_media(uint16_t seq) const
+{
+    const MediaSlot &slot = slots_[seq % HISTORY];
+    return slot.valid && slot.seq == seq;
+}
+
+void RtpFecDecoder::store_media(uint16_t seq, uint8_t pt, uint32_t ts, const uint8_t *payload, size_t len)
+{
+    if (!started_ || static_cast<int16_t>(seq - highest_seq_) > 0)
+    {
+        highest_seq_ = seq;
+        started_ = true;
+    }
+
+    MediaSlot &slot = slots_[seq % HISTORY];
+    if (unlikely(len > max_payload_))
+    {
+        slot.valid = false;
+        return;
+    }
+    slot.seq = seq;
+    slot.pt = pt;
+    slot.ts = ts;
+    slot.len = static_cast<uint16_t>(len);
+    slot.valid = true;
+    memcpy(payloads_.data() + (seq % HISTORY) * max_payload_, payload, len);
+}
+
+bool RtpFecDecoder::is_expired(const FecEntry &fec) const
+{
+    return static_cast<int16_t>(highest_seq_ - fec.base) >= static_cast<int>(HISTORY);
+}
+
+bool RtpFecDecoder::covers(const FecEntry &fec, uint16_t seq)
+{
+    uint16_t distance = seq - fec.base;
+    return distance % fec.offset == 0 && distance / fec.offset < fec.na;
+}
+
+RtpFecDecoder::Result RtpFecDecoder::try_recover(const FecEntry &fec)
+{
+    if (is_expired(fec))
+        return Result::EXPIRED;
+
+    int missing = 0;
+    uint16_t lost_seq = 0;
+    for (uint8_t j = 0; j < fec.na; ++j)
+    {
+        uint16_t s = fec.base + j * fec.offset;
+        if (!has_media(s))
+        {
+            lost_seq = s;
+            if (++missing > 1) return Result::PENDING;
+        }
+    }
+    if (missing == 0) return Result::COMPLETE;
+
+    uint16_t len = fec.length_recovery;
+    uint8_t pt = fec.pt_recovery;
+    uint32_t ts = fec.ts_recovery;
+    for (uint8_t j = 0; j < fec.na; ++j)
+    {
+        uint16_t s = fec.base + j * fec.offset;
+        if (s == lost_seq) continue;
+        const MediaSlot &slot = slots_[s % HISTORY];
+        len ^= slot.len;
+        pt ^= slot.pt;
+        ts ^= slot.ts;
+    }
+    if (unlikely(len > fec.payload.size() || len > max_payload_))
+    {
+        ++stats_.unrecoverable;
+        return Result::COMPLETE;
+    }
+
+    auto buf = pool_.acquire();
+    uint8_t *out = buf.get() + 12;
+    memcpy(out, fec.payload.data(), len);
+    for (uint8_t j = 0; j < fec.na; ++j)
+    {
+        uint16_t s = fec.base + j * fec.offset;
+        if (s == lost_seq) continue;
+        const MediaSlot &slot = slots_[s % HISTORY];
+        const uint8_t *in = payloads_.data() + (s % HISTORY) * max_payload_;
+        size_t n = std::min<size_t>(slot.len, len);
+        for (size_t i = 0; i < n; ++i) out[i] ^= in[i];
+    }
+
+    uint8_t *h = buf.get();
+    h[0] = 0x80;
+    h[1] = pt;
+    *reinterpret_cast<uint16_t *>(h + 2) = htons(lost_seq);
+    *reinterpret_cast<uint32_t *>(h + 4) = htonl(ts);
+    *reinterpret_cast<uint32_t *>(h + 8) = htonl(ssrc_);
+
+    store_media(lost_seq, pt, ts, out, len);
+    ++stats_.recovered;
+    Logger::debug("[FEC] Recovered RTP packet seq " + std::to_string(lost_seq));
+    on_recovered_(Packet{std::move(buf), 12 + static_cast<size_t>(len), 0});
+    return Result::RECOVERED;
+}
+
+void RtpFecDecoder::retry_pending()
+{
+    // A repair in one dimension can leave a single gap in the other; iterate until stable.
+    bool progress = true;
+    while (progress)
+    {
+        progress = false;
+        for (auto it = pending_.begin(); it != pending_.end();)
+        {
+            Result r = try_recover(*it);
+            if (r == Result::PENDING)
+            {
+                ++it;
+                continue;
+            }
+            if (r == Result::RECOVERED) progress = true;
+            if (r == Result::EXPIRED) ++stats_.unrecoverable;
+            it = pending_.erase(it);
+        }
+    }
+}
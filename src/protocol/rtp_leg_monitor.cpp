@@ -0,0 +1,80 @@
+#include "protocol/rtp_leg_monitor.h"
+#include "utils/utils.h"
+#include <arpa/inet.h>
+#include <cstdlib>
+
+RtpLegMonitor::RtpLegMonitor(size_t legs)
+    : legs_(legs), arrivals_(HISTORY)
+{
+}
+
+void RtpLegMonitor::on_packet(size_t leg, const uint8_t *buf, size_t len)
+{
+    if (unlikely(leg >= legs_.size() || len < 12 || (buf[0] & 0xC0) != 0x80))
+        return;
+
+    uint16_t seq = ntohs(*reinterpret_cast<const uint16_t *>(buf + 2));
+    auto now = Clock::now();
+
+    LegState &st = legs_[leg];
+    ++st.stats.received;
+    if (!st.started)
+    {
+        st.started = true;
+        st.received_base = st.stats.received - 1;
+        st.ssrc = ntohl(*reinterpret_cast<const uint32_t *>(buf + 8));
+        st.max_seq = seq;
+        st.base_seq = seq;
+    }
+    else if (static_cast<int16_t>(seq - st.max_seq) > 0)
+    {
+        if (seq < st.max_seq) st.cycles += 1u << 16;
+        st.max_seq = seq;
+    }
+    // RFC 3550 A.3: expected minus received, never negative.
+    uint64_t expected = static_cast<uint64_t>(st.cycles) + st.max_seq - st.base_seq + 1;
+    uint64_t received = st.stats.received - st.received_base;
+    st.stats.lost = st.lost_base + (expected > received ? expected - received : 0);
+
+    Arrival &a = arrivals_[seq % HISTORY];
+    if (a.valid && a.seq == seq)
+    {
+        if (a.leg != leg)
+        {
+            ++st.stats.lag_samples;
+            st.stats.lag_total_us += std::chrono::duration_cast<std::chrono::microseconds>(now - a.time).count();
+        }
+        return;
+    }
+    a.time = now;
+    a.seq = seq;
+    a.leg = static_cast<uint8_t>(leg);
+    a.valid = true;
+    ++st.stats.first;
+}
+
+void RtpLegMonitor::restart(size_t leg)
+{
+    if (leg >= legs_.size())
+        return;
+
+    LegState &st = legs_[leg];
+    st.started = false;
+    st.cycles = 0;
+    st.received_base = st.stats.received;
+    st.lost_base = st.stats.lost;
+}
+
+bool RtpLegMonitor::same_stream(size_t a, size_t b) const
+{
+    if (a >= legs_.size() || b >= legs_.size())
+        return false;
+
+    const LegState &x = legs_[a];
+    const LegState &y = legs_[b];
+    if (!x.started || !y.started || x.ssrc != y.ssrc)
+        return false;
+    // Copies of one stream are apart only by how far one leg lags behind.
+    int distance = static_cast<int16_t>(x.max_seq - y.max_seq);
+    return std::abs(distance) < SEQ_WINDOW;
+}
@@ -0,0 +1,255 @@
+#include "protocol/rtp_reorder_buffer.h"
+#include "utils/utils.h"
+#include <arpa/inet.h>
+
+RtpReorderBuffer::RtpReorderBuffer(BufferPool &pool, uint32_t latency_ms, EmitFn emit)
+    : pool_(pool),
+      latency_(latency_ms),
+      emit_(std::move(emit)),
+      slots_(latency_ms > 0 ? WINDOW : 0)
+{
+}
+
+RtpReorderBuffer::~RtpReorderBuffer()
+{
+    reset();
+}
+
+void RtpReorderBuffer::push(Packet &&pkt)
+{
+    if (unlikely(pkt.length < 12 || (pkt.data[0] & 0xC0) != 0x80))
+    {
+        emit_(std::move(pkt));
+        return;
+    }
+
+    uint16_t seq = ntohs(*reinterpret_cast<const uint16_t *>(pkt.data.get() + 2));
+    ++stats_.received;
+
+    if (unlikely(!started_))
+    {
+        started_ = true;
+        next_seq_ = seq;
+        highest_seq_ = seq;
+        emit(std::move(pkt), seq);
+        return;
+    }
+
+    int diff = seq_diff(seq, next_seq_);
+
+    // Behind the emit point: duplicate, late arrival or a source restart.
+    if (unlikely(diff < 0))
+    {
+        if (-diff < static_cast<int>(HISTORY / 2) && seen_.test(seq % HISTORY))
+        {
+            ++stats_.duplicates;
+            pool_.release(std::move(pkt.data));
+            return;
+        }
+        if (-diff > MAX_MISORDER)
+        {
+            // Two sequential packets far behind mean the source restarted.
+            if (bad_seq_valid_ && seq == bad_seq_)
+            {
+                restart(seq);
+                emit(std::move(pkt), seq);
+                return;
+            }
+            bad_seq_ = seq + 1;
+            bad_seq_valid_ = true;
+            ++stats_.late;
+            pool_.release(std::move(pkt.data));
+            return;
+        }
+        if (latency_.count() == 0)
+        {
+            // Pass-through mode forwards it anyway; it was counted lost when skipped.
+            ++stats_.reordered;
+            if (stats_.lost > 0) --stats_.lost;
+            seen_.set(seq % HISTORY);
+            emit_(std::move(pkt));
+            return;
+        }
+        ++stats_.late;
+        pool_.release(std::move(pkt.data));
+        return;
+    }
+
+    bad_seq_valid_ = false;
+    if (unlikely(diff >= MAX_DROPOUT))
+    {
+        restart(seq);
+        emit(std::move(pkt), seq);
+        return;
+    }
+
+    if (seq_diff(seq, highest_seq_) > 0)
+        highest_seq_ = seq;
+    else if (seq != highest_seq_)
+        ++stats_.reordered;
+
+    if (latency_.count() == 0)
+    {
+        stats_.lost += diff;
+        emit(std::move(pkt), seq);
+        return;
+    }
+
+    if (likely(diff == 0))
+    {
+        emit(std::move(pkt), seq);
+        emit_ready();
+        return;
+    }
+
+    // A gap precedes this packet; make room if it lies beyond the window.
+    while (diff >= static_cast<int>(WINDOW) && held_ > 0)
+    {
+        skip_to_next_held();
+        diff = seq_diff(seq, next_seq_);
+    }
+    if (diff >= static_cast<int>(WINDOW))
+    {
+        uint16_t new_next = seq - (WINDOW - 1);
+        stats_.lost += seq_diff(new_next, next_seq_);
+        for (uint16_t s = next_seq_; s != new_next; ++s) seen_.reset((s + HISTORY / 2) % HISTORY);
+        next_seq_ = new_next;
+    }
+    if (diff <= 0)
+    {
+        emit(std::move(pkt), seq);
+        emit_ready();
+        return;
+    }
+
+    Slot &slot = slots_[seq & (WINDOW - 1)];
+    if (slot.used && slot.seq == seq)
+    {
+        ++stats_.duplicates;
+        pool_.release(std::move(pkt.data));
+        return;
+    }
+    slot.pkt = std::move(pkt);
+    slot.seq = seq;
+    slot.arrival = Clock::now();
+    slot.used = true;
+    ++held_;
+}
+
+void RtpReorderBuffer::emit(Packet &&pkt, uint16_t seq)
+{
+    seen_.set(seq % HISTORY);
+    uint16_t new_next = seq + 1;
+    int step = seq_diff(new_next, next_seq_);
+    if (step >= static_cast<int>(HISTORY / 2))
+    {
+        seen_.reset();
+        seen_.set(seq % HISTORY);
+    }
+    else
+    {
+        // Forget sequence numbers that fall out of the look-back range.
+        for (int i = 0; i < step; ++i) seen_.reset((next_seq_ + i + HISTORY / 2) % HISTORY);
+    }
+    next_seq_ = new_next;
+    emit_(std::move(pkt));
+}
+
+void RtpReorderBuffer::emit_ready()
+{
+    while (held_ > 0)
+    {
+        Slot &slot = slots_[next_seq_ & (WINDOW - 1)];
+        if (!slot.used || slot.seq != next_seq_)
+            break;
+        slot.used = false;
+        --held_;
+        emit(std::move(slot.pkt), slot.seq);
+    }
+}
+
+void RtpReorderBuffer::skip_to_next_held()
+{
+    for (size_t i = 1; i < WINDOW; ++i)
+    {
+        uint16_t s = next_seq_ + i;
+        const Slot &slot = slots_[s & (WINDOW - 1)];
+        if (slot.used && slot.seq == s)
+        {
+            stats_.lost += i;
+            for (size_t j = 0; j < i; ++j) seen_.reset((next_seq_ + j + HISTORY / 2) % HISTORY);
+            next_seq_ = s;
+            emit_ready();
+            return;
+        }
+    }
+}
+
+void RtpReorderBuffer::flush_expired()
+{
+    auto now = Clock::now();
+    while (held_ > 0)
+    {
+        // The lowest held packet is the one blocked by the current gap.
+        const Slot *first = nullptr;
+        for (size_t i = 1; i < WINDOW; ++i)
+        {
+            const Slot &slot = slots_[(next_seq_ + i) & (WINDOW - 1)];
+            if (slot.used && slot.seq == static_cast<uint16_t>(next_seq_ + i))
+            {
+                first = &slot;
+                break;
+            }
+        }
+        if (!first || now - first->arrival < latency_)
+            break;
+        skip_to_next_held();
+    }
+}
+
+int RtpReorderBuffer::next_deadline_ms() const
+{
+    if (held_ == 0)
+        return -1;
+
+    auto now = Clock::now();
+    for (size_t i = 1; i < WINDOW; ++i)
+    {
+        const Slot &slot = slots_[(next_seq_ + i) & (WINDOW - 1)];
+        if (slot.used && slot.seq == static_cast<uint16_t>(next_seq_ + i))
+        {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(slot.arrival + latency_ - now).count();
+            return remaining > 0 ? static_cast<int>(remaining) : 0;
+        }
+    }
+    return 0;
+}
+
+void RtpReorderBuffer::flush_all()
+{
+    while (held_ > 0)
+        skip_to_next_held();
+}
+
+void RtpReorderBuffer::restart(uint16_t seq)
+{
+    flush_all();
+    next_seq_ = seq;
+    highest_seq_ = seq;
+    bad_seq_valid_ = false;
+    seen_.reset();
+}
+
+void RtpReorderBuffer::reset()
+{
+    for (auto &slot : slots_)
+    {
+        if (slot.used && slot.pkt.data)
+            pool_.release(std::move(slot.pkt.data));
+        slot.used = false;
+    }
+    held_ = 0;
+    started_ = false;
+    bad_seq_valid_ = false;
+    seen_.reset();
+}
@@ -0,0 +1,182 @@
+#include "protocol/rtsp_demuxer.h"
+#include "core/buffer_pool.h"
+#include "utils/utils.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+RtspDemuxer::RtspDemuxer(size_t capacity)
+    : buf_(new uint8_t[capacity]),
+      capacity_(capacity)
+{
+}
+
+RtspDemuxer::~RtspDemuxer()
+{
+    clear();
+}
+
+void RtspDemuxer::set_frame_pool(BufferPool *pool, size_t headroom)
+{
+    pool_ = pool;
+    headroom_ = headroom;
+}
+
+void RtspDemuxer::clear()
+{
+    if (fill_)
+        pool_->release(std::move(fill_));
+    head_ = tail_ = 0;
+    msg_.reset();
+    message_pending_ = false;
+}
+
+void RtspDemuxer::compact()
+{
+    if (head_ == tail_)
+    {
+        head_ = tail_ = 0;
+        return;
+    }
+    // Only the unconsumed tail moves, and only once at least half the buffer
+    // has been consumed, which keeps the copying linear in the stream size.
+    if (head_ > 0 && capacity_ - tail_ < capacity_ / 2)
+    {
+        memmove(buf_.get(), buf_.get() + head_, tail_ - head_);
+        tail_ -= head_;
+        head_ = 0;
+    }
+}
+
+ssize_t RtspDemuxer::read_from(int fd)
+{
+    compact();
+    if (fill_)
+    {
+        // One call finishes the pending frame in its block and reads ahead into the buffer.
+        size_t want = fill_len_ - fill_got_;
+        iovec iov[2] = {{fill_.get() + headroom_ + fill_got_, want},
+                        {buf_.get() + tail_, capacity_ - tail_}};
+        ssize_t n = readv(fd, iov, tail_ < capacity_ ? 2 : 1);
+        if (n > 0)
+        {
+            size_t into = std::min(static_cast<size_t>(n), want);
+            fill_got_ += into;
+            tail_ += n - into;
+        }
+        return n;
+    }
+    if (unlikely(tail_ == capacity_))
+    {
+        errno = ENOBUFS;
+        return -1;
+    }
+    ssize_t n = recv(fd, buf_.get() + tail_, capacity_ - tail_, 0);
+    if (n > 0)
+        tail_ += n;
+    return n;
+}
+
+bool RtspDemuxer::feed(const void *data, size_t len)
+{
+    compact();
+    if (fill_)
+    {
+        size_t into = std::min(len, fill_len_ - fill_got_);
+        memcpy(fill_.get() + headroom_ + fill_got_, data, into);
+        fill_got_ += into;
+        data = static_cast<const uint8_t *>(data) + into;
+        len -= into;
+    }
+    if (capacity_ - tail_ < len)
+        return false;
+    memcpy(buf_.get() + tail_, data, len);
+    tail_ += len;
+    return true;
+}
+
+RtspDemuxer::Item RtspDemuxer::next()
+{
+    Item item;
+    if (message_pending_)
+    {
+        msg_.reset();
+        message_pending_ = false;
+    }
+    if (fill_)
+    {
+        if (fill_got_ == fill_len_)
+            return take_fill();
+        return item;
+    }
+
+    const uint8_t *p = buf_.get() + head_;
+    size_t avail = tail_ - head_;
+    if (avail == 0)
+        return item;
+
+    if (p[0] == '$')
+    {
+        if (avail < 4)
+            return item;
+        size_t len = (static_cast<size_t>(p[2]) << 8) | p[3];
+        if (pool_ && headroom_ + len <= pool_->get_max_buffer_size())
+        {
+            // Whatever of the payload is here goes into the block now, the rest
+            // is received into it by the next read_from().
+            fill_ = pool_->acquire(headroom_ + len);
+            fill_channel_ = p[1];
+            fill_len_ = len;
+            fill_got_ = std::min(avail - 4, len);
+            memcpy(fill_.get() + headroom_, p + 4, fill_got_);
+            head_ += 4 + fill_got_;
+            if (fill_got_ == fill_len_)
+                return take_fill();
+            return item;
+        }
+        if (avail < 4 + len)
+            return item;
+
+        item.type = Type::FRAME;
+        item.channel = p[1];
+        item.data = p + 4;
+        item.len = len;
+        head_ += 4 + len;
+        return item;
+    }
+
+    // Resumes at the first line the previous call could not complete.
+    switch (msg_.parse(std::string_view(reinterpret_cast<const char *>(p), avail)))
+    {
+    case RtspMessage::Result::INCOMPLETE:
+        if (unlikely(avail == capacity_ || (msg_.headers_done() && msg_.length() > capacity_)))
+            item.type = Type::ERROR;
+        return item;
+    case RtspMessage::Result::ERROR:
+        item.type = Type::ERROR;
+        return item;
+    case RtspMessage::Result::COMPLETE:
+        break;
+    }
+
+    item.type = Type::MESSAGE;
+    item.data = p;
+    item.len = msg_.length();
+    item.message = &msg_;
+    head_ += item.len;
+    message_pending_ = true;
+    return item;
+}
+
+RtspDemuxer::Item RtspDemuxer::take_fill()
+{
+    Item item;
+    item.type = Type::FRAME;
+    item.channel = fill_channel_;
+    item.block = std::move(fill_);
+    item.data = item.block.get() + headroom_;
+    item.len = fill_len_;
+    return item;
+}
@@ -0,0 +1,184 @@
+#include "protocol/rtsp_message.h"
+#include <cstring>
+#include <strings.h>
+
+namespace
+{
+    inline bool is_space(char c) { return c == ' ' || c == '\t'; }
+}
+
+void RtspMessage::reset()
+{
+    *this = RtspMessage();
+}
+
+bool RtspMessage::iequals(std::string_view a, std::string_view b)
+{
+    return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+RtspMessage::Result RtspMessage::parse(std::string_view data)
+{
+    base_ = data.data();
+
+    while (!headers_done_)
+    {
+        const char *nl = static_cast<const char *>(memchr(base_ + pos_, '\n', data.size() - pos_));
+        if (!nl)
+            return data.size() > MAX_HEADER_BYTES ? Result::ERROR : Result::INCOMPLETE;
+
+        size_t end = nl - base_;
+        size_t len = end - pos_;
+        if (len > 0 && base_[end - 1] == '\r')
+            --len;
+
+        if (!start_done_)
+        {
+            // Stray blank lines before the start line are allowed (RFC 2326 15.1).
+            if (len > 0)
+            {
+                if (!parse_start_line(pos_, len))
+                    return Result::ERROR;
+                start_done_ = true;
+            }
+        }
+        else if (len == 0)
+        {
+            headers_done_ = true;
+            blank_off_ = pos_;
+            header_len_ = end + 1;
+        }
+        else if (is_space(base_[pos_]) && count_ > 0 && overflow_off_ == 0)
+        {
+            // Folded continuation line: extend the previous value.
+            size_t last = pos_ + len;
+            while (last > pos_ && is_space(base_[last - 1]))
+                --last;
+            Field &f = fields_[count_ - 1];
+            f.value.len = static_cast<uint32_t>(last - f.value.off);
+        }
+        else if (!parse_header_line(pos_, len))
+        {
+            return Result::ERROR;
+        }
+
+        pos_ = end + 1;
+        if (pos_ > MAX_HEADER_BYTES)
+            return Result::ERROR;
+    }
+
+    return data.size() >= length() ? Result::COMPLETE : Result::INCOMPLETE;
+}
+
+bool RtspMessage::parse_start_line(size_t off, size_t len)
+{
+    size_t end = off + len;
+    size_t p = off;
+    for (int i = 0; i < 3; ++i)
+    {
+        while (p < end && is_space(base_[p]))
+            ++p;
+        size_t tok = p;
+        // The last token (reason phrase or version) runs to the end of the line.
+        while (p < end && (i == 2 || !is_space(base_[p])))
+            ++p;
+        size_t tok_end = p;
+        while (tok_end > tok && is_space(base_[tok_end - 1]))
+            --tok_end;
+        start_[i] = Span{static_cast<uint32_t>(tok), static_cast<uint32_t>(tok_end - tok)};
+    }
+    if (start_[0].len == 0 || start_[1].len == 0)
+        return false;
+
+    std::string_view first = view(start_[0]);
+    response_ = first.compare(0, 5, "RTSP/") == 0 || first.compare(0, 5, "HTTP/") == 0;
+    if (response_)
+    {
+        std::string_view code = view(start_[1]);
+        if (code.size() != 3)
+            return false;
+        status_ = 0;
+        for (char c : code)
+        {
+            if (c < '0' || c > '9')
+                return false;
+            status_ = status_ * 10 + (c - '0');
+        }
+    }
+    return true;
+}
+
+bool RtspMessage::parse_header_line(size_t off, size_t len)
+{
+    const char *line = base_ + off;
+    const char *colon = static_cast<const char *>(memchr(line, ':', len));
+    if (!colon || colon == line)
+        return false;
+
+    size_t name_end = colon - base_;
+    while (name_end > off && is_space(base_[name_end - 1]))
+        --name_end;
+    size_t value = colon - base_ + 1;
+    size_t value_end = off + len;
+    while (value < value_end && is_space(base_[value]))
+        ++value;
+    while (value_end > value && is_space(base_[value_end - 1]))
+        --value_end;
+
+    Field f{Span{static_cast<uint32_t>(off), static_cast<uint32_t>(name_end - off)},
+            Span{static_cast<uint32_t>(value), static_cast<uint32_t>(value_end - value)}};
+
+    if (iequals(view(f.name), "Content-Length"))
+    {
+        std::string_view v = view(f.value);
+        if (v.empty())
+            return false;
+        size_t n = 0;
+        for (char c : v)
+        {
+            if (c < '0' || c > '9' || n > MAX_BODY)
+                return false;
+            n = n * 10 + (c - '0');
+        }
+        if (n > MAX_BODY)
+            return false;
+        content_length_ = n;
+    }
+
+    if (count_ < MAX_HEADERS)
+        fields_[count_++] = f;
+    else if (overflow_off_ == 0)
+        overflow_off_ = off;
+    return true;
+}
+
+std::string_view RtspMessage::header(std::string_view name) const
+{
+    for (size_t i = 0; i < count_; ++i)
+    {
+        if (iequals(view(fields_[i].name), name))
+            return view(fields_[i].value);
+    }
+    return {};
+}
+
+bool RtspMessage::has_header(std::string_view name) const
+{
+    for (size_t i = 0; i < count_; ++i)
+    {
+        if (iequals(view(fields_[i].name), name))
+            return true;
+    }
+    return false;
+}
+
+std::string_view RtspMessage::session_id() const
+{
+    std::string_view session = header("Session");
+    size_t semi = session.find(';');
+    if (semi != std::string_view::npos)
+        session = session.substr(0, semi);
+    while (!session.empty() && is_space(session.back()))
+        session.remove_suffix(1);
+    return session;
+}
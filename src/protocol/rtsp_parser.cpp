@@ -1,11 +1,10 @@
 #include "protocol/rtsp_parser.h"
 #include "core/logger.h"
 #include "common/rtsp_ctx.h"
+#include "protocol/rtsp_message.h"
 #include <unistd.h>
 #include <cstring>
 #include <sstream>
-#include <algorithm>
-#include <cctype>
 
 rtspParser::rtspParser() {}
 rtspParser::~rtspParser() {}
@@ -115,84 +114,123 @@ void rtspParser::SDP::parseBandwidth(const std::string &line, rtspCtx &ctx)
     }
 }
 
-int rtspParser::parse_server_ports(const std::string &resp, rtspCtx &ctx)
+namespace
 {
-    size_t pos = resp.find("Transport:");
-    if (pos == std::string::npos)
-        return -1;
-
-    size_t end = resp.find("\r\n", pos);
-    std::string transport_ = resp.substr(pos, end - pos);
-
-    size_t sp_pos = transport_.find("server_port=");
-    if (sp_pos != std::string::npos)
+    // Parses "<a>-<b>" at the start of v.
+    bool parse_port_pair(std::string_view v, int &first, int &second)
     {
-        sp_pos += strlen("server_port=");
-        size_t dash = transport_.find('-', sp_pos);
-        if (dash != std::string::npos)
+        int *out = &first;
+        bool digits = false;
+        first = second = 0;
+        for (char c : v)
         {
-            try
+            if (c >= '0' && c <= '9')
             {
-                ctx.server_rtp_port = std::stoi(transport_.substr(sp_pos, dash - sp_pos));
-                ctx.server_rtcp_port = std::stoi(transport_.substr(dash + 1));
-                return 0;
+                *out = *out * 10 + (c - '0');
+                digits = true;
+                if (*out > 65535)
+                    return false;
             }
-            catch (...)
-            {
-                return -1;
-            }
-        }
-    }
-
-    size_t int_pos = transport_.find("interleaved=");
-    if (int_pos != std::string::npos)
-    {
-        int_pos += strlen("interleaved=");
-        size_t dash = transport_.find('-', int_pos);
-        if (dash != std::string::npos)
-        {
-            // For interleaved mode, we can store channels in port fields
-            // The caller (RTSPToHttpClient) will check for "interleaved" in the string anyway
-            try
+            else if (c == '-' && out == &first && digits)
             {
-                ctx.server_rtp_port = std::stoi(transport_.substr(int_pos, dash - int_pos));
-                ctx.server_rtcp_port = std::stoi(transport_.substr(dash + 1));
-                return 0;
+                out = &second;
+                digits = false;
             }
-            catch (...)
+            else
             {
-                return -1;
+                break;
             }
         }
+        return out == &second && digits;
     }
+}
 
-    return -1;
+bool rtspParser::parse_transport_pair(std::string_view transport, std::string_view key, uint16_t &first, uint16_t &second)
+{
+    size_t pos = transport.find(key);
+    if (pos == std::string_view::npos)
+        return false;
+    int a = 0, b = 0;
+    if (!parse_port_pair(transport.substr(pos + key.size()), a, b))
+        return false;
+    first = static_cast<uint16_t>(a);
+    second = static_cast<uint16_t>(b);
+    return true;
 }
 
-int rtspParser::get_content_length(const std::string &resp)
+bool rtspParser::parse_transport_ssrc(std::string_view transport, uint32_t &ssrc)
+{
+    size_t pos = transport.find("ssrc=");
+    if (pos == std::string_view::npos || (pos > 0 && transport[pos - 1] != ';'))
+        return false;
+    uint32_t value = 0;
+    size_t digits = 0;
+    for (char c : transport.substr(pos + 5))
+    {
+        int d;
+        if (c >= '0' && c <= '9')
+            d = c - '0';
+        else if (c >= 'a' && c <= 'f')
+            d = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            d = c - 'A' + 10;
+        else
+            break;
+        if (++digits > 8)
+            return false;
+        value = value << 4 | static_cast<uint32_t>(d);
+    }
+    if (digits == 0)
+        return false;
+    ssrc = value;
+    return true;
+}
+
+int rtspParser::parse_transport_ports(std::string_view transport, rtspCtx &ctx)
 {
-    size_t pos = resp.find("Content-Length:");
-    if (pos == std::string::npos)
-        pos = resp.find("Content-length:");
-    if (pos == std::string::npos)
+    // server_port= takes precedence; for interleaved mode the channels are
+    // stored in the port fields and the caller checks for "interleaved".
+    for (std::string_view key : {std::string_view("server_port="), std::string_view("interleaved=")})
+    {
+        if (transport.find(key) == std::string_view::npos)
+            continue;
+        uint16_t rtp = 0, rtcp = 0;
+        if (!parse_transport_pair(transport, key, rtp, rtcp))
+            return -1;
+        ctx.server_rtp_port = rtp;
+        ctx.server_rtcp_port = rtcp;
         return 0;
+    }
+    return -1;
+}
 
-    pos += 15;
-    while (pos < resp.size() && (resp[pos] == ' ' || resp[pos] == '\t'))
-        ++pos;
+int rtspParser::parse_server_ports(const std::string &resp, rtspCtx &ctx)
+{
+    std::string_view transport = find_header(resp, "Transport");
+    if (transport.empty())
+        return -1;
+    return parse_transport_ports(transport, ctx);
+}
 
-    size_t end = resp.find_first_of("\r\n", pos);
-    if (end == std::string::npos)
-        return 0;
+int rtspParser::parse_server_ports(const RtspMessage &msg, rtspCtx &ctx)
+{
+    std::string_view transport = msg.header("Transport");
+    if (transport.empty())
+        return -1;
+    return parse_transport_ports(transport, ctx);
+}
 
-    try
-    {
-        return std::stoi(resp.substr(pos, end - pos));
-    }
-    catch (...)
+int rtspParser::get_content_length(const std::string &resp)
+{
+    std::string_view value = find_header(resp, "Content-Length");
+    int length = 0;
+    for (char c : value)
     {
-        return 0;
+        if (c < '0' || c > '9' || length > 0xFFFFFF)
+            return 0;
+        length = length * 10 + (c - '0');
     }
+    return length;
 }
 
 int rtspParser::parse_status_code(const std::string &resp)
@@ -204,14 +242,19 @@ int rtspParser::parse_status_code(const std::string &resp)
 
 int rtspParser::parse_session_id(const std::string &resp, rtspCtx &ctx)
 {
-    size_t pos = resp.find("Session:");
-    if (pos == std::string::npos)
+    std::string_view session = find_header(resp, "Session");
+    if (session.empty())
         return -1;
-    pos += 8;
-    while (pos < resp.size() && (resp[pos] == ' ' || resp[pos] == '\t'))
-        ++pos;
-    size_t end = resp.find_first_of(";\r\n", pos);
-    ctx.session_id = resp.substr(pos, end - pos);
+    ctx.session_id = std::string(session.substr(0, session.find(';')));
+    return 0;
+}
+
+int rtspParser::parse_session_id(const RtspMessage &msg, rtspCtx &ctx)
+{
+    std::string_view session = msg.session_id();
+    if (session.empty())
+        return -1;
+    ctx.session_id = std::string(session);
     return 0;
 }
 
@@ -255,19 +298,33 @@ int rtspParser::parse_url(const std::string &url, rtspCtx &ctx)
 
 std::string rtspParser::extract_header_value(const std::string &msg, const std::string &header_name)
 {
-    std::string lower_msg = msg;
-    std::string lower_hdr = header_name;
-    std::transform(lower_msg.begin(), lower_msg.end(), lower_msg.begin(), [](unsigned char c) { return std::tolower(c); });
-    std::transform(lower_hdr.begin(), lower_hdr.end(), lower_hdr.begin(), [](unsigned char c) { return std::tolower(c); });
+    return std::string(find_header(msg, header_name));
+}
 
-    size_t pos = lower_msg.find(lower_hdr + ":");
-    if (pos == std::string::npos)
-        return {};
-    pos += header_name.size() + 1;
-    while (pos < msg.size() && (msg[pos] == ' ' || msg[pos] == '\t'))
-        ++pos;
-    size_t end = msg.find("\r\n", pos);
-    if (end == std::string::npos)
-        return msg.substr(pos);
-    return msg.substr(pos, end - pos);
-}
\ No newline at end of file
+std::string_view rtspParser::find_header(std::string_view msg, std::string_view header_name)
+{
+    // Skip the start line, then compare each header name in place.
+    size_t pos = msg.find('\n');
+    while (pos != std::string_view::npos && ++pos < msg.size())
+    {
+        size_t eol = msg.find('\n', pos);
+        std::string_view line = msg.substr(pos, eol == std::string_view::npos ? std::string_view::npos : eol - pos);
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+        if (line.empty())
+            break;
+
+        if (line.size() > header_name.size() && line[header_name.size()] == ':' &&
+            RtspMessage::iequals(line.substr(0, header_name.size()), header_name))
+        {
+            std::string_view value = line.substr(header_name.size() + 1);
+            while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+                value.remove_prefix(1);
+            while (!value.empty() && (value.back() == ' ' || value.back() == '\t'))
+                value.remove_suffix(1);
+            return value;
+        }
+        pos = eol;
+    }
+    return {};
+}
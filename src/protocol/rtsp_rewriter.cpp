@@ -0,0 +1,219 @@
+#include "protocol/rtsp_rewriter.h"
+#include "protocol/rtsp_message.h"
+
+namespace
+{
+    inline void append_uint(std::string &out, unsigned v)
+    {
+        char buf[12];
+        char *p = buf + sizeof(buf);
+        do
+        {
+            *--p = static_cast<char>('0' + v % 10);
+            v /= 10;
+        } while (v);
+        out.append(p, buf + sizeof(buf) - p);
+    }
+
+    inline void append_pair(std::string &out, std::string_view key, unsigned a, unsigned b)
+    {
+        out.append(key);
+        append_uint(out, a);
+        out.push_back('-');
+        append_uint(out, b);
+    }
+
+    inline bool starts_with(std::string_view s, std::string_view prefix)
+    {
+        return s.substr(0, prefix.size()) == prefix;
+    }
+
+    // Appends line with every "IP4 <dotted address>" replaced by "IP4 <ip>".
+    void replace_ip4(std::string_view line, std::string_view ip, std::string &out)
+    {
+        size_t pos = 0;
+        for (size_t hit; (hit = line.find("IP4 ", pos)) != std::string_view::npos;)
+        {
+            size_t end = hit + 4;
+            while (end < line.size() && ((line[end] >= '0' && line[end] <= '9') || line[end] == '.'))
+                ++end;
+            if (end == hit + 4)
+            {
+                out.append(line.substr(pos, end - pos));
+            }
+            else
+            {
+                out.append(line.substr(pos, hit + 4 - pos));
+                out.append(ip);
+            }
+            pos = end;
+        }
+        out.append(line.substr(pos));
+    }
+}
+
+void RtspRewriter::rewrite_uris(std::string_view value, const Rules &rules, std::string &out)
+{
+    static constexpr std::string_view SCHEME = "rtsp://";
+
+    size_t pos = 0;
+    for (size_t hit; (hit = value.find(SCHEME, pos)) != std::string_view::npos;)
+    {
+        size_t host = hit + SCHEME.size();
+        size_t end = host + rules.upstream_host.size();
+        bool match = !rules.upstream_host.empty() && value.substr(host, rules.upstream_host.size()) == rules.upstream_host;
+        if (match && end < value.size() && value[end] == ':')
+        {
+            size_t digits = ++end;
+            while (end < value.size() && value[end] >= '0' && value[end] <= '9')
+                ++end;
+            match = end > digits;
+        }
+        match = match && end < value.size() && value[end] == '/';
+        if (!match)
+        {
+            out.append(value.substr(pos, host - pos));
+            pos = host;
+            continue;
+        }
+
+        // rtsp://host:port/path -> rtsp://proxy:port/host:port/path
+        out.append(value.substr(pos, hit - pos));
+        out.append(SCHEME);
+        out.append(rules.proxy_ip);
+        out.push_back(':');
+        append_uint(out, rules.proxy_port);
+        out.push_back('/');
+        out.append(value.substr(host, end - host));
+        pos = end;
+    }
+    out.append(value.substr(pos));
+}
+
+void RtspRewriter::rewrite_transport(std::string_view value, const Rules &rules, std::string &out)
+{
+    bool has_interleaved = false;
+    bool first = true;
+    size_t pos = 0;
+    while (pos <= value.size())
+    {
+        size_t semi = value.find(';', pos);
+        if (semi == std::string_view::npos)
+            semi = value.size();
+        std::string_view param = value.substr(pos, semi - pos);
+        pos = semi + 1;
+        if (param.empty())
+            continue;
+
+        size_t mark = out.size();
+        if (!first)
+            out.push_back(';');
+
+        if (first)
+        {
+            // Transport spec: MP2T/RTP/UDP, RTP/AVP, RTP/AVP/UDP or RTP/AVP/TCP.
+            std::string_view spec = param;
+            if (!rules.transport_protocol.empty() && spec == "MP2T/RTP/UDP")
+                spec = rules.transport_protocol;
+            size_t avp = spec.find("RTP/AVP");
+            if (rules.interleaved && spec.find("RTP/AVP/TCP") == std::string_view::npos && avp != std::string_view::npos)
+            {
+                size_t tail = avp + 7;
+                if (spec.substr(tail, 4) == "/UDP")
+                    tail += 4;
+                out.append(spec.substr(0, avp));
+                out.append("RTP/AVP/TCP");
+                out.append(spec.substr(tail));
+            }
+            else
+            {
+                out.append(spec);
+            }
+        }
+        else if (starts_with(param, "client_port="))
+        {
+            if (rules.interleaved)
+                out.resize(mark);
+            else
+                append_pair(out, "client_port=", rules.client_rtp_port, rules.client_rtcp_port);
+        }
+        else if (starts_with(param, "server_port="))
+        {
+            if (rules.interleaved)
+                out.resize(mark);
+            else
+                append_pair(out, "server_port=", rules.server_rtp_port, rules.server_rtcp_port);
+        }
+        else if (starts_with(param, "source="))
+        {
+            out.append("source=");
+            out.append(rules.proxy_ip);
+        }
+        else
+        {
+            has_interleaved = has_interleaved || starts_with(param, "interleaved=");
+            out.append(param);
+        }
+        first = false;
+    }
+
+    if (rules.interleaved && !has_interleaved)
+        append_pair(out, ";interleaved=", rules.rtp_channel, rules.rtcp_channel);
+}
+
+void RtspRewriter::rewrite_sdp(std::string_view sdp, const Rules &rules)
+{
+    body_.clear();
+    size_t pos = 0;
+    while (pos < sdp.size())
+    {
+        size_t nl = sdp.find('\n', pos);
+        size_t end = nl == std::string_view::npos ? sdp.size() : nl + 1;
+        std::string_view line = sdp.substr(pos, end - pos);
+        pos = end;
+
+        if (starts_with(line, "a=control:"))
+            rewrite_uris(line, rules, body_);
+        else
+            replace_ip4(line, rules.proxy_ip, body_);
+    }
+}
+
+void RtspRewriter::rewrite_response(const RtspMessage &msg, const Rules &rules, std::string &out)
+{
+    std::string_view head = msg.head();
+    std::string_view body = msg.body();
+
+    bool sdp = !body.empty() && msg.header("Content-Type").find("application/sdp") != std::string_view::npos;
+    if (sdp)
+    {
+        rewrite_sdp(body, rules);
+        body = body_;
+    }
+
+    size_t eol = head.find('\n');
+    out.append(head.substr(0, eol + 1));
+
+    for (size_t i = 0; i < msg.header_count(); ++i)
+    {
+        std::string_view name = msg.header_name(i);
+        std::string_view value = msg.header_value(i);
+        out.append(name);
+        out.append(": ");
+
+        if (RtspMessage::iequals(name, "Transport"))
+            rewrite_transport(value, rules, out);
+        else if (RtspMessage::iequals(name, "Content-Base") || RtspMessage::iequals(name, "Content-Location") ||
+                 RtspMessage::iequals(name, "Location") || RtspMessage::iequals(name, "RTP-Info"))
+            rewrite_uris(value, rules, out);
+        else if (sdp && RtspMessage::iequals(name, "Content-Length"))
+            append_uint(out, static_cast<unsigned>(body.size()));
+        else
+            out.append(value);
+
+        out.append("\r\n");
+    }
+    out.append(msg.unindexed_headers());
+    out.append("\r\n");
+    out.append(body);
+}
@@ -0,0 +1,82 @@
+#include "protocol/ts_coalescer.h"
+#include <cstring>
+
+TsCoalescer::TsCoalescer(BufferPool &pool, uint32_t latency_ms, EmitFn emit)
+    : pool_(pool), latency_(latency_ms), emit_(std::move(emit))
+{
+}
+
+TsCoalescer::~TsCoalescer()
+{
+    pool_.release(std::move(chunk_));
+}
+
+bool TsCoalescer::starts_gop(const uint8_t *ts, size_t len)
+{
+    // Header checks only: the NAL scan of ts::is_sync_point is too costly for every payload.
+    for (size_t i = 0; i + ts::PACKET_SIZE <= len; i += ts::PACKET_SIZE)
+    {
+        const uint8_t *pkt = ts + i;
+        if (ts::pid(pkt) == 0 || (ts::has_adaptation(pkt) && (pkt[5] & 0x40)))
+            return true;
+    }
+    return false;
+}
+
+void TsCoalescer::push(Packet &&pkt)
+{
+    const uint8_t *payload = pkt.data.get() + pkt.offset;
+    size_t len = pkt.length - pkt.offset;
+    ++payloads_;
+
+    // Whatever is held goes first, also ahead of a payload that is passed through.
+    bool passthrough = len * 2 > CHUNK_BYTES;
+    if (chunk_len_ > 0 && (passthrough || chunk_len_ + len > CHUNK_BYTES || starts_gop(payload, len)))
+        flush();
+
+    if (passthrough)
+    {
+        ++chunks_;
+        emit_(std::move(pkt));
+        return;
+    }
+
+    if (!chunk_)
+        chunk_ = pool_.acquire(HEADROOM + CHUNK_BYTES);
+    if (chunk_len_ == 0)
+        started_ = Clock::now();
+
+    memcpy(chunk_.get() + HEADROOM + chunk_len_, payload, len);
+    chunk_len_ += len;
+    pool_.release(std::move(pkt.data));
+
+    // Another payload of the same size would not fit: do not wait for it.
+    if (chunk_len_ + len > CHUNK_BYTES)
+        flush();
+}
+
+void TsCoalescer::flush()
+{
+    if (chunk_len_ == 0)
+        return;
+
+    size_t len = chunk_len_;
+    chunk_len_ = 0;
+    ++chunks_;
+    emit_(Packet{std::move(chunk_), HEADROOM + len, HEADROOM});
+}
+
+void TsCoalescer::flush_expired()
+{
+    if (chunk_len_ > 0 && Clock::now() - started_ >= latency_)
+        flush();
+}
+
+int TsCoalescer::next_deadline_ms() const
+{
+    if (chunk_len_ == 0)
+        return -1;
+
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(started_ + latency_ - Clock::now()).count();
+    return remaining > 0 ? static_cast<int>(remaining) : 0;
+}
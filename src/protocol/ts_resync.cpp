@@ -0,0 +1,62 @@
+#include "protocol/ts_resync.h"
+#include "protocol/ts_utils.h"
+#include "core/logger.h"
+#include "utils/utils.h"
+
+void TsResync::arm()
+{
+    waiting_ = true;
+    marking_ = 0;
+    seen_.reset();
+    pcr_seen_.reset();
+}
+
+void TsResync::mark()
+{
+    waiting_ = false;
+    marking_ = MARK_WINDOW;
+    seen_.reset();
+    pcr_seen_.reset();
+}
+
+bool TsResync::process(uint8_t *payload, size_t len)
+{
+    if (likely(!active()))
+        return true;
+
+    if (unlikely(len < ts::PACKET_SIZE || payload[0] != 0x47))
+    {
+        // Not TS: nothing to splice, forward as is.
+        waiting_ = false;
+        marking_ = 0;
+        return true;
+    }
+
+    if (waiting_)
+    {
+        if (!ts::find_sync_point(payload, len))
+            return false;
+        waiting_ = false;
+        marking_ = MARK_WINDOW;
+        ++resumes_;
+        Logger::info("[RTP] Upstream resumed on a sync point, flagging TS discontinuity");
+    }
+
+    for (size_t i = 0; i + ts::PACKET_SIZE <= len && marking_ > 0; i += ts::PACKET_SIZE, --marking_)
+    {
+        uint8_t *p = payload + i;
+        uint16_t pid = ts::pid(p);
+        if (pid == ts::NULL_PID)
+            continue;
+
+        uint64_t pcr;
+        bool has_pcr = ts::read_pcr(p, pcr);
+        bool first = !seen_.test(pid);
+        if (first || (has_pcr && !pcr_seen_.test(pid)))
+            ts::set_discontinuity(p);
+        seen_.set(pid);
+        if (has_pcr)
+            pcr_seen_.set(pid);
+    }
+    return true;
+}
@@ -0,0 +1,170 @@
+#include "protocol/websocket.h"
+
+namespace
+{
+    constexpr char HANDSHAKE_GUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+    inline uint32_t rol(uint32_t v, int n) { return (v << n) | (v >> (32 - n)); }
+
+    // SHA-1 of a short message; only the handshake uses it.
+    void sha1(const std::string &msg, uint8_t digest[20])
+    {
+        uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+
+        std::string data = msg;
+        uint64_t bits = static_cast<uint64_t>(msg.size()) * 8;
+        data.push_back(static_cast<char>(0x80));
+        while (data.size() % 64 != 56)
+            data.push_back(0);
+        for (int i = 7; i >= 0; --i)
+            data.push_back(static_cast<char>(bits >> (i * 8)));
+
+        for (size_t block = 0; block < data.size(); block += 64)
+        {
+            const auto *p = reinterpret_cast<const uint8_t *>(data.data() + block);
+            uint32_t w[80];
+            for (int i = 0; i < 16; ++i)
+                w[i] = (p[i * 4] << 24) | (p[i * 4 + 1] << 16) | (p[i * 4 + 2] << 8) | p[i * 4 + 3];
+            for (int i = 16; i < 80; ++i)
+                w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+            uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+            for (int i = 0; i < 80; ++i)
+            {
+                uint32_t f, k;
+                if (i < 20)
+                {
+                    f = (b & c) | (~b & d);
+                    k = 0x5A827999;
+                }
+                else if (i < 40)
+                {
+                    f = b ^ c ^ d;
+                    k = 0x6ED9EBA1;
+                }
+                else if (i < 60)
+                {
+                    f = (b & c) | (b & d) | (c & d);
+                    k = 0x8F1BBCDC;
+                }
+                else
+                {
+                    f = b ^ c ^ d;
+                    k = 0xCA62C1D6;
+                }
+                uint32_t t = rol(a, 5) + f + e + k + w[i];
+                e = d;
+                d = c;
+                c = rol(b, 30);
+                b = a;
+                a = t;
+            }
+            h[0] += a;
+            h[1] += b;
+            h[2] += c;
+            h[3] += d;
+            h[4] += e;
+        }
+
+        for (int i = 0; i < 5; ++i)
+        {
+            digest[i * 4] = static_cast<uint8_t>(h[i] >> 24);
+            digest[i * 4 + 1] = static_cast<uint8_t>(h[i] >> 16);
+            digest[i * 4 + 2] = static_cast<uint8_t>(h[i] >> 8);
+            digest[i * 4 + 3] = static_cast<uint8_t>(h[i]);
+        }
+    }
+
+    std::string base64(const uint8_t *data, size_t len)
+    {
+        static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        std::string out;
+        out.reserve((len + 2) / 3 * 4);
+        for (size_t i = 0; i < len; i += 3)
+        {
+            uint32_t v = data[i] << 16;
+            if (i + 1 < len) v |= data[i + 1] << 8;
+            if (i + 2 < len) v |= data[i + 2];
+            out.push_back(table[(v >> 18) & 0x3F]);
+            out.push_back(table[(v >> 12) & 0x3F]);
+            out.push_back(i + 1 < len ? table[(v >> 6) & 0x3F] : '=');
+            out.push_back(i + 2 < len ? table[v & 0x3F] : '=');
+        }
+        return out;
+    }
+}
+
+std::string ws::accept_key(std::string_view key)
+{
+    uint8_t digest[20];
+    sha1(std::string(key) + HANDSHAKE_GUID, digest);
+    return base64(digest, sizeof(digest));
+}
+
+size_t ws::write_header(uint8_t *out, Opcode opcode, size_t len)
+{
+    out[0] = 0x80 | opcode;
+    if (len < 126)
+    {
+        out[1] = static_cast<uint8_t>(len);
+        return 2;
+    }
+    if (len <= 0xFFFF)
+    {
+        out[1] = 126;
+        out[2] = static_cast<uint8_t>(len >> 8);
+        out[3] = static_cast<uint8_t>(len);
+        return 4;
+    }
+    out[1] = 127;
+    for (int i = 0; i < 8; ++i)
+        out[2 + i] = static_cast<uint8_t>(static_cast<uint64_t>(len) >> ((7 - i) * 8));
+    return 10;
+}
+
+ws::Result ws::read_frame(uint8_t *data, size_t len, size_t max_payload, Frame &frame)
+{
+    if (len < 2)
+        return Result::INCOMPLETE;
+
+    frame.fin = data[0] & 0x80;
+    frame.opcode = static_cast<Opcode>(data[0] & 0x0F);
+    frame.masked = data[1] & 0x80;
+    uint64_t length = data[1] & 0x7F;
+    size_t header = 2;
+    if (length == 126)
+    {
+        if (len < 4)
+            return Result::INCOMPLETE;
+        length = (data[2] << 8) | data[3];
+        header = 4;
+    }
+    else if (length == 127)
+    {
+        if (len < 10)
+            return Result::INCOMPLETE;
+        length = 0;
+        for (int i = 0; i < 8; ++i)
+            length = (length << 8) | data[2 + i];
+        header = 10;
+    }
+    if (length > max_payload)
+        return Result::ERROR;
+
+    const uint8_t *mask = data + header;
+    if (frame.masked)
+        header += 4;
+    if (len < header + length)
+        return Result::INCOMPLETE;
+
+    uint8_t *payload = data + header;
+    if (frame.masked)
+    {
+        for (size_t i = 0; i < length; ++i)
+            payload[i] ^= mask[i & 3];
+    }
+    frame.payload = payload;
+    frame.length = static_cast<size_t>(length);
+    frame.size = header + frame.length;
+    return Result::COMPLETE;
+}
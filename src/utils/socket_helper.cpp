@@ -1,11 +1,13 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <net/if.h>
 #include <netinet/tcp.h>
 #include <sys/socket.h>
 #include <fcntl.h>
 #include <sys/timerfd.h>
 #include <unistd.h>
 #include <string>
+#include <cstring>
 #include <random>
 
 static void optimize_udp_buffer(int fd)
@@ -154,15 +156,134 @@ int bind_udp_socket(int &fd, const uint16_t &port, const std::string &iface = ""
     return 0;
 }
 
+int bind_udp_shared_socket(int &fd, uint16_t port, const std::string &iface)
+{
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    // Lets a restarted worker (or several workers) bind the same fixed port.
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+
+    if ((!iface.empty() && setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, iface.c_str(), iface.length()) < 0) ||
+        bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        fd = -1;
+        return -1;
+    }
+
+    // One socket carries every session's media; give it room for bursts.
+    int buf_size = 8 * 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buf_size, sizeof(buf_size));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buf_size, sizeof(buf_size));
+    return 0;
+}
+
+static void set_inet_storage(sockaddr_storage &storage, uint32_t ip)
+{
+    sockaddr_in sin{};
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = ip;
+    memcpy(&storage, &sin, sizeof(sin));
+}
+
+int join_multicast_socket(int &fd, uint32_t group, uint32_t source, uint16_t port, const std::string &iface)
+{
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = group; // binding the group address filters out other groups on the port
+    addr.sin_port = htons(port);
+
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    // Other receivers of the same group (udpxy, a second worker) may hold the port too.
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    // Only the groups joined on this socket, not those of other sockets on the port.
+    opt = 0;
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_ALL, &opt, sizeof(opt));
+
+    unsigned int ifindex = iface.empty() ? 0 : if_nametoindex(iface.c_str());
+    if ((!iface.empty() && (ifindex == 0 || setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, iface.c_str(), iface.length()) < 0)) ||
+        bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        fd = -1;
+        return -1;
+    }
+
+    int rc;
+    if (source != 0)
+    {
+        group_source_req req{};
+        req.gsr_interface = ifindex;
+        set_inet_storage(req.gsr_group, group);
+        set_inet_storage(req.gsr_source, source);
+        rc = setsockopt(fd, IPPROTO_IP, MCAST_JOIN_SOURCE_GROUP, &req, sizeof(req));
+    }
+    else
+    {
+        group_req req{};
+        req.gr_interface = ifindex;
+        set_inet_storage(req.gr_group, group);
+        rc = setsockopt(fd, IPPROTO_IP, MCAST_JOIN_GROUP, &req, sizeof(req));
+    }
+    if (rc < 0)
+    {
+        close(fd);
+        fd = -1;
+        return -1;
+    }
+
+    // A group serves every viewer of the channel; give it room for bursts.
+    int buf_size = 8 * 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buf_size, sizeof(buf_size));
+    return 0;
+}
+
+int open_multicast_sender(int &fd, const sockaddr_in &group, int ttl, const std::string &iface)
+{
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    ip_mreqn mreq{};
+    mreq.imr_ifindex = iface.empty() ? 0 : static_cast<int>(if_nametoindex(iface.c_str()));
+    if ((!iface.empty() && (mreq.imr_ifindex == 0 ||
+                            setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &mreq, sizeof(mreq)) < 0)) ||
+        setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0 ||
+        connect(fd, (const sockaddr *)&group, sizeof(group)) != 0)
+    {
+        close(fd);
+        fd = -1;
+        return -1;
+    }
+
+    // Receivers on this host (e.g. a local udpxy) see the group as well.
+    int loop = 1;
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+    optimize_udp_buffer(fd);
+    return 0;
+}
+
 #include "core/port_pool.h"
 
-int bind_udp_pair_from_pool(int &rtp_fd, int &rtcp_fd, uint16_t &rtp_port, const std::string &iface)
+int bind_udp_pair_from_pool(int &rtp_fd, int &rtcp_fd, uint16_t &rtp_port, const std::string &iface, int reserve_pairs)
 {
     auto &pool = PortPool::getInstance();
     
     for (int i = 0; i < 10; ++i) // Try up to 10 pairs from pool
     {
-        rtp_port = pool.acquire_pair();
+        rtp_port = pool.acquire_pair(reserve_pairs);
         if (rtp_port == 0) return -1;
 
         if (bind_udp_socket(rtp_fd, rtp_port, iface) == 0)
@@ -180,6 +301,29 @@ int bind_udp_pair_from_pool(int &rtp_fd, int &rtcp_fd, uint16_t &rtp_port, const
         {
             pool.mark_occupied(rtp_port);
         }
+        // The occupied pair stays quarantined; any further reserved pairs go back.
+        pool.release_pair(rtp_port, reserve_pairs);
     }
+    rtp_port = 0;
     return -1;
-}
\ No newline at end of file
+}
+
+int bind_udp_fec_sockets(int &col_fd, int &row_fd, uint16_t rtp_port, const std::string &iface)
+{
+    // SMPTE 2022-1: column FEC on RTP port + 2, row FEC on RTP port + 4
+    if (bind_udp_socket(col_fd, rtp_port + 2, iface) != 0)
+    {
+        if (col_fd >= 0) close(col_fd);
+        col_fd = -1;
+        return -1;
+    }
+    if (bind_udp_socket(row_fd, rtp_port + 4, iface) != 0)
+    {
+        if (row_fd >= 0) close(row_fd);
+        close(col_fd);
+        row_fd = -1;
+        col_fd = -1;
+        return -1;
+    }
+    return 0;
+}
@@ -2,7 +2,10 @@ class Dashboard {
     constructor() {
         this.statusEndpoint = '/api/status';
         this.logEndpoint = '/api/logs';
+        this.playerScript = 'mpegts.js';
         this.lastLogTimestamp = '';
+        this.player = null;
+        this.playerLoading = null;
 
         // DOM Elements
         this.elements = {
@@ -18,7 +21,11 @@ class Dashboard {
             logDisplay: document.getElementById('log-display'),
             logLevelSelect: document.getElementById('log-level-select'),
             clearLogsBtn: document.getElementById('clear-logs'),
-            serverStatus: document.getElementById('server-status')
+            serverStatus: document.getElementById('server-status'),
+            previewArea: document.getElementById('preview-area'),
+            previewTitle: document.getElementById('preview-title'),
+            previewVideo: document.getElementById('preview-video'),
+            closePreviewBtn: document.getElementById('close-preview')
         };
 
         this.init();
@@ -37,6 +44,16 @@ class Dashboard {
         if (this.elements.logLevelSelect) {
             this.elements.logLevelSelect.onchange = () => this.changeLogLevel();
         }
+        if (this.elements.closePreviewBtn) {
+            this.elements.closePreviewBtn.onclick = () => this.closePreview();
+        }
+        if (this.elements.sessionsBody) {
+            // Rows are rebuilt every second, so clicks are caught on the table body.
+            this.elements.sessionsBody.onclick = (e) => {
+                const btn = e.target.closest('.preview-btn');
+                if (btn) this.openPreview(btn.dataset.url);
+            };
+        }
         
         // Refresh loops
         this.refresh();
@@ -99,7 +116,10 @@ class Dashboard {
             
             const durationSeconds = parseInt(client.proxy);
             const durationDisplay = isNaN(durationSeconds) ? '--' : this.formatDuration(durationSeconds);
-            const type = client.type === 'mitm' ? 'MITM' : 'HTTP';
+            const type = client.type === 'mitm' ? 'MITM' : (client.type === 'websocket' ? 'WS' : 'HTTP');
+            const preview = client.url
+                ? `<button class="preview-btn" data-url="${this.escapeAttr(client.url)}">Preview</button>`
+                : '';
             
             const upBps = (client.upstream_bandwidth || 0) / 1000000;
             const downBps = (client.downstream_bandwidth || 0) / 1000000;
@@ -113,11 +133,70 @@ class Dashboard {
                     <td style="color:#34d399; font-family:'JetBrains Mono'">${downBps.toFixed(2)} Mbps</td>
                     <td><span class="tag ${tagClass}">${client.transport || 'UDP'}</span></td>
                     <td>${durationDisplay}</td>
+                    <td>${preview}</td>
                 </tr>
             `;
         }).join('');
     }
 
+    // Plays a session's stream in the dashboard: the same URL over WebSocket,
+    // fed to mpegts.js, which is only loaded the first time.
+    async openPreview(url) {
+        this.closePreview();
+        this.elements.previewArea.hidden = false;
+        this.elements.previewTitle.innerText = url;
+
+        try {
+            await this.loadPlayer();
+        } catch (e) {
+            this.elements.previewTitle.innerText = 'Player could not be loaded (webui/mpegts.js missing)';
+            return;
+        }
+        if (!mpegts.getFeatureList().mseLivePlayback) {
+            this.elements.previewTitle.innerText = 'Live playback is not supported by this browser';
+            return;
+        }
+
+        const token = new URLSearchParams(window.location.search).get('token');
+        let wsUrl = (window.location.protocol === 'https:' ? 'wss://' : 'ws://') + window.location.host + url;
+        if (token) wsUrl += (url.includes('?') ? '&' : '?') + `token=${encodeURIComponent(token)}`;
+
+        this.player = mpegts.createPlayer({ type: 'mpegts', isLive: true, url: wsUrl },
+                                          { enableStashBuffer: false, liveBufferLatencyChasing: true });
+        this.player.attachMediaElement(this.elements.previewVideo);
+        this.player.load();
+        this.player.play();
+    }
+
+    closePreview() {
+        if (this.player) {
+            this.player.pause();
+            this.player.unload();
+            this.player.detachMediaElement();
+            this.player.destroy();
+            this.player = null;
+        }
+        this.elements.previewArea.hidden = true;
+    }
+
+    loadPlayer() {
+        if (window.mpegts) return Promise.resolve();
+        if (!this.playerLoading) {
+            this.playerLoading = new Promise((resolve, reject) => {
+                const script = document.createElement('script');
+                script.src = this.playerScript;
+                script.onload = resolve;
+                script.onerror = () => {
+                    this.playerLoading = null;
+                    script.remove();
+                    reject(new Error('load failed'));
+                };
+                document.head.appendChild(script);
+            });
+        }
+        return this.playerLoading;
+    }
+
     async fetchLogs() {
         try {
             const urlParams = new URLSearchParams(window.location.search);
@@ -160,6 +239,10 @@ class Dashboard {
         this.elements.logDisplay.scrollTop = this.elements.logDisplay.scrollHeight;
     }
 
+    escapeAttr(value) {
+        return String(value).replace(/&/g, '&amp;').replace(/"/g, '&quot;').replace(/</g, '&lt;');
+    }
+
     formatBytes(bytes) {
         if (bytes === 0) return '0 B';
         const k = 1024;